@@ -0,0 +1,708 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "csv.h"
+#include "csv-handler.h"
+#include "csvh-line-helper.h"
+
+// Benchmarks for the hot paths, instead of just printing things out for a
+// person to look at like the tests do.  Run it with `make bench`, which builds
+// everything optimized (and without the sanitizers, which would swamp the
+// numbers).
+//
+// For each function, it reports nanoseconds per record, bytes of input per
+// CPU cycle, and allocations per record.  Allocations get counted by having
+// the linker send every malloc, calloc, realloc and strdup through the
+// wrappers below (see BENCH_WRAP in the makefile), so it's only the ones made
+// by this code, not by libc for itself.  Cycles are the time stamp counter's,
+// which ticks at a fixed rate, not the CPU's current clock.
+//
+// The first run saves its figures as the baseline.  After that, a figure more
+// than the threshold percent worse than the baseline's fails the run.  Times
+// are the best of several runs, since anything else going on only ever makes
+// them slower.
+//
+// Every run happens in a child process, since csv-handler can only be opened
+// once per process.
+//
+// After that, it compares the parser and counter against the ones for input
+// without quoting (-q none), on the same records.  That's just reported, not
+// compared against the baseline.
+
+/**
+ * Records to generate, and how many times to run each benchmark.
+ */
+#define RECORD_COUNT 200000
+#define REPEATS 5
+
+/**
+ * Number of benchmarks.
+ */
+#define BENCH_COUNT 5
+
+/**
+ * What a run measured, all in total.
+ */
+struct benchRun {
+    double ns;
+    double cycles;
+    double allocs;
+    double records;
+    double bytes;
+};
+
+/**
+ * The figures that get reported and compared.
+ */
+struct benchResult {
+    char name[32];
+    double nsPerRecord;
+    double bytesPerCycle;
+    double allocsPerRecord;
+};
+
+// Forward declarations for helper functions.
+
+void *__real_malloc(size_t size);
+
+void *__real_calloc(size_t count, size_t size);
+
+void *__real_realloc(void *ptr, size_t size);
+
+char *__real_strdup(const char *str);
+
+static char generateInput();
+
+static void startClock(struct benchRun *run);
+
+static void stopClock(struct benchRun *run);
+
+static void benchParse(struct benchRun *run);
+
+static void benchCount(struct benchRun *run);
+
+static void benchShouldSkip(struct benchRun *run);
+
+static void benchReadLine(struct benchRun *run);
+
+static void benchOutputLine(struct benchRun *run);
+
+static void benchQuotingParse(struct benchRun *run);
+
+static void benchQuotingCount(struct benchRun *run);
+
+static char reportQuoting();
+
+static char runBest(void (*bench)(struct benchRun *), struct benchRun *best);
+
+static void toResult(const char *name, struct benchRun *run, struct benchResult *result);
+
+static char readBaseline(const char *path, struct benchResult *results);
+
+static char writeBaseline(const char *path, struct benchResult *results);
+
+static char isWorse(double now, double then, double threshold, char higherIsBetter);
+
+// END forward declarations.
+
+/**
+ * Allocations made since the count was last reset.
+ */
+static unsigned long long allocCount = 0;
+
+/**
+ * The generated records, one string each, their lengths, and all of them
+ * together as a file (for csv-handler, which reads files).
+ */
+static char **lines = NULL;
+static size_t *lineLens = NULL;
+static size_t inputBytes = 0;
+static char inputPath[] = "/tmp/csv-bench-XXXXXX";
+
+/**
+ * The parser and counter to run on the records, for comparing with and
+ * without quoting.
+ */
+static csv_parse_fn quotingParser = parse_csv_len;
+static csv_count_fn quotingCounter = count_fields_len;
+
+/**
+ * Clock readings at the start of a run.
+ */
+static struct timespec startTime;
+static unsigned long long startCycles = 0;
+static unsigned long long startAllocs = 0;
+
+void *__wrap_malloc(size_t size)
+{
+    allocCount++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    allocCount++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    allocCount++;
+    return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *str)
+{
+    allocCount++;
+    return __real_strdup(str);
+}
+
+/**
+ * Usage: csv-bench <baseline file> [threshold percent] [update]
+ */
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        printf("Usage: %s <baseline file> [threshold percent] [update]\n", argv[0]);
+        return 1;
+    }
+    const char *baselinePath = argv[1];
+    double threshold = (argc > 2) ? atof(argv[2]) : 10;
+    char update = argc > 3 && strcmp(argv[3], "update") == 0;
+
+    if (generateInput()) {
+        printf("Error: Couldn't generate input.\n");
+        return 1;
+    }
+
+    const char *names[BENCH_COUNT] = {
+        "parse_csv",
+        "count_fields",
+        "should_skip",
+        "read_next_line",
+        "output_line",
+    };
+    void (*benches[BENCH_COUNT])(struct benchRun *) = {
+        benchParse,
+        benchCount,
+        benchShouldSkip,
+        benchReadLine,
+        benchOutputLine,
+    };
+
+    struct benchResult results[BENCH_COUNT];
+    struct benchRun readRun = {0};
+    char failed = 0;
+
+    for (int i = 0; i < BENCH_COUNT && !failed; i++) {
+        struct benchRun run;
+        if (runBest(benches[i], &run)) {
+            printf("Error: %s didn't run.\n", names[i]);
+            failed = 1;
+            break;
+        }
+
+        if (benches[i] == benchReadLine) {
+            readRun = run;
+        } else if (benches[i] == benchOutputLine) {
+            // That run read the lines too, so take that part back out.
+            run.ns -= readRun.ns;
+            run.cycles -= readRun.cycles;
+            run.allocs -= readRun.allocs;
+        }
+
+        toResult(names[i], &run, results + i);
+    }
+
+    unlink(inputPath);
+
+    if (failed) {
+        return 1;
+    }
+
+    struct benchResult baseline[BENCH_COUNT];
+    char haveBaseline = !update && readBaseline(baselinePath, baseline) == 0;
+    char regressed = 0;
+
+    printf("%-16s %14s %14s %16s\n", "", "ns/record", "bytes/cycle", "allocs/record");
+    for (int i = 0; i < BENCH_COUNT; i++) {
+        printf(
+            "%-16s %14.2f %14.3f %16.2f",
+            results[i].name,
+            results[i].nsPerRecord,
+            results[i].bytesPerCycle,
+            results[i].allocsPerRecord
+        );
+
+        if (haveBaseline) {
+            char worse = isWorse(results[i].nsPerRecord, baseline[i].nsPerRecord, threshold, 0)
+                || isWorse(results[i].bytesPerCycle, baseline[i].bytesPerCycle, threshold, 1)
+                || isWorse(results[i].allocsPerRecord, baseline[i].allocsPerRecord, threshold, 0);
+            printf(
+                "   (was %.2f, %.3f, %.2f)%s",
+                baseline[i].nsPerRecord,
+                baseline[i].bytesPerCycle,
+                baseline[i].allocsPerRecord,
+                worse ? "  REGRESSED" : ""
+            );
+            regressed = regressed || worse;
+        }
+        printf("\n");
+    }
+
+    if (reportQuoting()) {
+        printf("Error: Couldn't compare quoting.\n");
+        return 1;
+    }
+
+    if (!haveBaseline) {
+        if (writeBaseline(baselinePath, results)) {
+            printf("Error: Couldn't save the baseline to %s.\n", baselinePath);
+            return 1;
+        }
+        printf("Saved as the baseline in %s.\n", baselinePath);
+        return 0;
+    }
+
+    if (regressed) {
+        printf("More than %.0f%% worse than the baseline.\n", threshold);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Make up the records: a mix of short and long fields, numbers, a quoted one
+ * with a delimiter in it, and a status column to filter on, which is about
+ * what real exports look like.
+ */
+static char generateInput()
+{
+    static const char *statuses[] = {"ACTIVE", "CLOSED", "PENDING", "INACTIVE"};
+
+    lines = malloc(sizeof(char *) * RECORD_COUNT);
+    lineLens = malloc(sizeof(size_t) * RECORD_COUNT);
+    if (lines == NULL || lineLens == NULL) {
+        return 1;
+    }
+
+    int fd = mkstemp(inputPath);
+    FILE *file = (fd == -1) ? NULL : fdopen(fd, "w");
+    if (file == NULL) {
+        return 1;
+    }
+
+    fprintf(file, "id,name,amount,status,note\n");
+
+    char buff[256];
+    unsigned int seed = 42;
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        seed = seed * 1103515245 + 12345;
+        int len = snprintf(
+            buff,
+            sizeof(buff),
+            "%d,\"Name %u, Jr.\",%u.%02u,%s,%.*s",
+            i,
+            seed % 10000,
+            seed % 100000,
+            seed % 100,
+            statuses[(seed >> 8) % 4],
+            (int) (seed >> 16) % 40,
+            "some free text that goes on for a while"
+        );
+        if ((lines[i] = malloc(sizeof(char) * (len + 1))) == NULL) {
+            fclose(file);
+            return 1;
+        }
+        memcpy(lines[i], buff, len + 1);
+        lineLens[i] = len;
+        fprintf(file, "%s\n", buff);
+        inputBytes += len + 1;
+    }
+
+    return fclose(file) != 0;
+}
+
+/**
+ * Start timing (and counting allocations for) a run.
+ *
+ * @param   run
+ */
+static void startClock(struct benchRun *run)
+{
+    memset(run, 0, sizeof(*run));
+    startAllocs = allocCount;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+#if defined(__x86_64__) || defined(__i386__)
+    startCycles = __rdtsc();
+#endif
+}
+
+/**
+ * Stop timing a run, and fill in what it measured (except the records and
+ * bytes, which are up to the benchmark).
+ *
+ * @param   run
+ */
+static void stopClock(struct benchRun *run)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned long long endCycles = __rdtsc();
+#endif
+    struct timespec endTime;
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+
+    run->ns = (endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec);
+#if defined(__x86_64__) || defined(__i386__)
+    run->cycles = endCycles - startCycles;
+#else
+    // No cycle counter to go by, so assume a 1 GHz clock.
+    run->cycles = run->ns;
+#endif
+    run->allocs = allocCount - startAllocs;
+}
+
+/**
+ * parse_csv (and freeing what it returns) on every record.
+ *
+ * @param   run
+ */
+static void benchParse(struct benchRun *run)
+{
+    startClock(run);
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        free_csv_line(parse_csv(lines[i], ','));
+    }
+    stopClock(run);
+
+    run->records = RECORD_COUNT;
+    run->bytes = inputBytes;
+}
+
+/**
+ * count_fields on every record.
+ *
+ * @param   run
+ */
+static void benchCount(struct benchRun *run)
+{
+    // Added up, so the calls can't get optimized out.
+    volatile int total = 0;
+
+    startClock(run);
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        total += count_fields(lines[i], ',');
+    }
+    stopClock(run);
+
+    run->records = RECORD_COUNT;
+    run->bytes = inputBytes;
+}
+
+/**
+ * csvh_line_helper_should_skip on every record, restricted to one value of
+ * the status column (i.e., `-r e status ACTIVE`).
+ *
+ * @param   run
+ */
+static void benchShouldSkip(struct benchRun *run)
+{
+    char equals[] = "ACTIVE";
+    csvh_line_helper_init_equals(3, equals);
+
+    volatile int skipped = 0;
+
+    startClock(run);
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        skipped += csvh_line_helper_should_skip(lines[i], lineLens[i]) == CSVH_LINE_HELPER__SKIP;
+    }
+    stopClock(run);
+
+    csvh_line_helper_close();
+
+    run->records = RECORD_COUNT;
+    run->bytes = inputBytes;
+}
+
+/**
+ * csv_handler_read_next_line on every record of the file, after the headers.
+ *
+ * @param   run
+ */
+static void benchReadLine(struct benchRun *run)
+{
+    char *paths[] = {inputPath};
+    csv_handler_set_files(paths, 1);
+    csv_handler_read_next_line();
+    csv_handler_set_headers_from_line();
+
+    int count = 0;
+
+    startClock(run);
+    while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+        count++;
+    }
+    stopClock(run);
+
+    csv_handler_close();
+
+    run->records = count;
+    run->bytes = inputBytes;
+}
+
+/**
+ * Same as benchReadLine, plus csv_handler_output_line on every record.
+ *
+ * @param   run
+ */
+static void benchOutputLine(struct benchRun *run)
+{
+    char *paths[] = {inputPath};
+    csv_handler_set_files(paths, 1);
+    csv_handler_read_next_line();
+    csv_handler_set_headers_from_line();
+
+    char *outputLine = NULL;
+    int count = 0;
+
+    startClock(run);
+    while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+        csv_handler_output_line(&outputLine);
+        count++;
+    }
+    stopClock(run);
+
+    free(outputLine);
+    csv_handler_close();
+
+    run->records = count;
+    run->bytes = inputBytes;
+}
+
+/**
+ * quotingParser (and freeing what it returns) on every record.
+ *
+ * @param   run
+ */
+static void benchQuotingParse(struct benchRun *run)
+{
+    startClock(run);
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        free_csv_line(quotingParser(lines[i], lineLens[i], ',', NULL));
+    }
+    stopClock(run);
+
+    run->records = RECORD_COUNT;
+    run->bytes = inputBytes;
+}
+
+/**
+ * quotingCounter on every record.
+ *
+ * @param   run
+ */
+static void benchQuotingCount(struct benchRun *run)
+{
+    volatile int total = 0;
+
+    startClock(run);
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        total += quotingCounter(lines[i], lineLens[i], ',');
+    }
+    stopClock(run);
+
+    run->records = RECORD_COUNT;
+    run->bytes = inputBytes;
+}
+
+/**
+ * Time parsing and counting with quoting and without, and print how much
+ * faster without is.  (Without quoting, the quoted value just gets split in
+ * two, which is about the same amount of work.)
+ */
+static char reportQuoting()
+{
+    // With and without, for parsing and then counting.
+    struct benchRun runs[4];
+
+    for (int k = 0; k < 2; k++) {
+        quotingParser = csv_parser_for(k == 0);
+        quotingCounter = csv_counter_for(k == 0);
+        if (runBest(benchQuotingParse, runs + k) || runBest(benchQuotingCount, runs + 2 + k)) {
+            return 1;
+        }
+    }
+
+    printf(
+        "\n%-16s %14s %14s %8s %14s %14s %8s\n",
+        "",
+        "parse",
+        "parse -q none",
+        "gain",
+        "count",
+        "count -q none",
+        "gain"
+    );
+    printf(
+        "%-16s %14.2f %14.2f %7.1f%% %14.2f %14.2f %7.1f%%\n",
+        "ns/record",
+        runs[0].ns / RECORD_COUNT,
+        runs[1].ns / RECORD_COUNT,
+        (runs[0].ns - runs[1].ns) * 100 / runs[0].ns,
+        runs[2].ns / RECORD_COUNT,
+        runs[3].ns / RECORD_COUNT,
+        (runs[2].ns - runs[3].ns) * 100 / runs[2].ns
+    );
+
+    return 0;
+}
+
+/**
+ * Run a benchmark REPEATS times, each in its own process, and keep the
+ * fastest run.  Returns nonzero if a run didn't report back.
+ *
+ * @param   bench
+ * @param   best
+ */
+static char runBest(void (*bench)(struct benchRun *), struct benchRun *best)
+{
+    for (int i = 0; i < REPEATS; i++) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            return 1;
+        }
+
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == -1) {
+            return 1;
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            struct benchRun run;
+            bench(&run);
+            char ok = write(fds[1], &run, sizeof(run)) == sizeof(run);
+            _exit(ok ? 0 : 1);
+        }
+
+        close(fds[1]);
+        struct benchRun run;
+        ssize_t got = read(fds[0], &run, sizeof(run));
+        close(fds[0]);
+        waitpid(pid, NULL, 0);
+
+        if (got != sizeof(run)) {
+            return 1;
+        }
+        if (i == 0 || run.ns < best->ns) {
+            *best = run;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Work out the reported figures from a run.
+ *
+ * @param   name
+ * @param   run
+ * @param   result
+ */
+static void toResult(const char *name, struct benchRun *run, struct benchResult *result)
+{
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->nsPerRecord = run->ns / run->records;
+    result->bytesPerCycle = (run->cycles > 0) ? run->bytes / run->cycles : 0;
+    result->allocsPerRecord = run->allocs / run->records;
+}
+
+/**
+ * Read the baseline, which is one line per benchmark, in the same order:
+ * name, ns/record, bytes/cycle, allocs/record.  Returns nonzero if there
+ * isn't one (or it's for a different set of benchmarks).
+ *
+ * @param   path
+ * @param   results
+ */
+static char readBaseline(const char *path, struct benchResult *results)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return 1;
+    }
+
+    int i = 0;
+    for (; i < BENCH_COUNT; i++) {
+        if (fscanf(
+            file,
+            "%31s %lf %lf %lf",
+            results[i].name,
+            &results[i].nsPerRecord,
+            &results[i].bytesPerCycle,
+            &results[i].allocsPerRecord
+        ) != 4) {
+            break;
+        }
+    }
+    fclose(file);
+
+    return i != BENCH_COUNT;
+}
+
+/**
+ * Save the results as the baseline.
+ *
+ * @param   path
+ * @param   results
+ */
+static char writeBaseline(const char *path, struct benchResult *results)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return 1;
+    }
+
+    for (int i = 0; i < BENCH_COUNT; i++) {
+        fprintf(
+            file,
+            "%s %f %f %f\n",
+            results[i].name,
+            results[i].nsPerRecord,
+            results[i].bytesPerCycle,
+            results[i].allocsPerRecord
+        );
+    }
+
+    return fclose(file) != 0;
+}
+
+/**
+ * Determine if a figure is more than threshold percent worse than it was.
+ *
+ * @param   now
+ * @param   then
+ * @param   threshold
+ * @param   higherIsBetter
+ */
+static char isWorse(double now, double then, double threshold, char higherIsBetter)
+{
+    if (higherIsBetter) {
+        return now < then * (1 - threshold / 100);
+    }
+
+    // Anything is worse than none at all.
+    return (then == 0) ? now > 0 : now > then * (1 + threshold / 100);
+}
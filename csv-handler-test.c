@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "csv-handler.h"
 
@@ -44,6 +45,7 @@ int main()
 
     //csv_handler_restrict_by_ranges("3", "10-17,23");
     //csv_handler_restrict_by_equals("3", "7,15");
+    //csv_handler_set_sort("Range:n:desc", 64); // Tiny budget, so it spills.
 
     while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
         csv_handler_output_line_number(&outputLine);
@@ -80,6 +82,7 @@ int main()
     //csv_handler_read_next_line();
     //csv_handler_set_headers_from_line(); // Needed for vertical output.
     //csv_handler_set_selected_fields("B,C");
+    ////csv_handler_set_column_window("B-C"); // Same thing, without parsing the rest.
     //csv_handler_restrict_by_lines("1-2,4");
 
     //while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
@@ -92,6 +95,7 @@ int main()
     // Print headers test.
     //csv_handler_read_next_line();
     //csv_handler_set_headers_from_line();
+    //printf("duplicate header: %s\n", csv_handler_duplicate_header()); // NULL if none.
     //while (csv_handler_output_headers(&outputLine) == CSV_HANDLER__OK) {
     //    printf("%s\n", outputLine);
     //}
@@ -110,6 +114,171 @@ int main()
     //    printf("%s\n", outputLine);
     //}
 
+    // Print raw lines by copying ranges.  (Needs stdin to be a file, not a
+    // pipe.)
+    //csv_handler_read_next_line();
+    //csv_handler_set_headers_from_line();
+    //csv_handler_restrict_by_lines("2-3,5");
+    //printf("can copy ranges: should be 1: %d\n", csv_handler_can_copy_ranges());
+    //csv_handler_raw_line(&outputLine);
+    //printf("%s\n", outputLine);
+    //fflush(stdout);
+    //csv_handler_raw_copy_ranges(1);
+
+    // Read through the binary cache.  (Needs stdin to be a file.)  Run it
+    // twice: the first time builds the .csvb file next to the input, and the
+    // second time should print the same thing straight from it.
+    //csv_handler_set_cache();
+    //csv_handler_read_next_line();
+    //csv_handler_set_headers_from_line();
+    //csv_handler_set_selected_fields("HeadA,Range");
+    //csv_handler_restrict_by_equals("HeadB", "meh");
+    //while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+    //    csv_handler_output_line(&outputLine);
+    //    printf("%s\n", outputLine);
+    //}
+
+    // Group by a column, counting and adding up another.  Should print the
+    // same thing no matter how many threads.
+    //csv_handler_set_threads(4);
+    //csv_handler_read_next_line();
+    //csv_handler_set_headers_from_line();
+    //csv_handler_restrict_by_equals("HeadB", "meh");
+    //csv_handler_group_by("HeadA", "Range", 256 * 1024 * 1024);
+    //csv_handler_output_line(&outputLine);
+    //printf("%s\n", outputLine);
+    //while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+    //    csv_handler_output_line(&outputLine);
+    //    printf("%s\n", outputLine);
+    //}
+
+    // Most common values of a column, in a fixed amount of memory.  (Swap in
+    // csv_handler_distinct("HeadA") for the distinct count.)
+    //csv_handler_read_next_line();
+    //csv_handler_set_headers_from_line();
+    //csv_handler_top_k("HeadA", 3);
+    //csv_handler_output_line(&outputLine);
+    //printf("%s\n", outputLine);
+    //while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+    //    csv_handler_output_line(&outputLine);
+    //    printf("%s\n", outputLine);
+    //}
+
+    // Profile every column.  Should print the same thing no matter how many
+    // threads.
+    //csv_handler_set_threads(4);
+    //csv_handler_read_next_line();
+    //csv_handler_set_headers_from_line();
+    //csv_handler_profile();
+    //csv_handler_vertical_border_line(&borderLine);
+    //while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+    //    printf("%s\n", borderLine);
+    //    csv_handler_output_vertical_entry(&outputLine);
+    //    printf("%s\n", outputLine);
+    //}
+
+    // Random sample.  Should print the same lines every time, since the seed
+    // is set.
+    //csv_handler_read_next_line();
+    //csv_handler_set_headers_from_line();
+    //csv_handler_sample(3, 42);
+    //csv_handler_output_line(&outputLine);
+    //printf("%s\n", outputLine);
+    //while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+    //    csv_handler_output_line(&outputLine);
+    //    printf("%s\n", outputLine);
+    //}
+
+    // Several files as one.  Doesn't need stdin.  The headers should only
+    // print once, and the line numbers should keep going.
+    //char *files[] = {"a.csv", "b.csv"};
+    //csv_handler_set_files(files, 2);
+    //csv_handler_read_next_line();
+    //csv_handler_set_headers_from_line();
+    //while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+    //    csv_handler_output_line_number(&outputLine);
+    //    printf("%s", outputLine);
+    //    csv_handler_output_line(&outputLine);
+    //    printf("%s\n", outputLine);
+    //}
+
+
+    // Skip lines before the headers.  Pass something with a quoted line
+    // break in the first 2 lines; the headers should still be the third
+    // line.
+    //csv_handler_skip_lines(2);
+    //csv_handler_read_next_line();
+    //csv_handler_set_headers_from_line();
+    //csv_handler_output_line(&outputLine);
+    //printf("%s\n", outputLine);
+
+    // JSON Lines.  Should be one object per line, keyed by the headers.
+    //char *jsonBuff = NULL;
+    //size_t jsonLen = 0;
+    //size_t jsonCap = 0;
+    //csv_handler_read_next_line();
+    //csv_handler_set_headers_from_line();
+    //while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+    //    csv_handler_append_json_line(&jsonBuff, &jsonLen, &jsonCap);
+    //    printf("%s\n", jsonBuff);
+    //    jsonLen = 0;
+    //}
+    //free(jsonBuff);
+
+    // Malformed lines.  Pass something with an unclosed quote partway
+    // through; everything after its line should still print, and the count
+    // should be 1.
+    //long long badOffset;
+    //int badLine;
+    //char *badFile;
+    //csv_handler_set_bad_records(1024, 0);
+    //csv_handler_read_next_line();
+    //csv_handler_set_headers_from_line();
+    //while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+    //    csv_handler_output_line(&outputLine);
+    //    printf("%s\n", outputLine);
+    //}
+    //printf("%d bad\n", csv_handler_bad_record_count());
+    //csv_handler_bad_record(0, &badOffset, &badLine, &badFile);
+    //printf("line %d, byte %lld\n", badLine, badOffset);
+
+    // Raw lines with nulls in them.  Pass something like "x\0y" in a cell;
+    // the length should count the null, and it should still be there.
+    //char *rawBuff = NULL;
+    //size_t rawLen = 0;
+    //size_t rawCap = 0;
+    //csv_handler_read_next_line();
+    //csv_handler_append_raw_line(&rawBuff, &rawLen, &rawCap);
+    //fwrite(rawBuff, 1, rawLen, stdout);
+    //printf("\n%zu bytes\n", rawLen);
+    //free(rawBuff);
+
+    // No quoting.  Pass something with a stray quote in a value, like
+    // 5" screen; it should stay on its line, quote and all, and nothing after
+    // it should get joined up with it.
+    //csv_handler_set_quoting(0);
+    //csv_handler_read_next_line();
+    //csv_handler_set_headers_from_line();
+    //while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+    //    csv_handler_output_line(&outputLine);
+    //    printf("%s\n", outputLine);
+    //}
+
+    // Stdin that's already partway into the file, like after a shell
+    // script's `read -r header`.  Pass a file with a plain first line; the
+    // second line should come out as the headers, whether or not it's mapped
+    // (csv_handler_set_no_mapping() for not).
+    //char skipped;
+    //while (read(0, &skipped, 1) == 1 && skipped != '\n') {
+    //}
+    //csv_handler_read_next_line();
+    //csv_handler_set_headers_from_line();
+    //csv_handler_output_line(&outputLine);
+    //printf("%s\n", outputLine);
+    //while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+    //    csv_handler_output_line(&outputLine);
+    //    printf("%s\n", outputLine);
+    //}
 
     free(outputLine);
     free(borderLine);
@@ -1,9 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "csv.h"
+#include "csvh-cache.h"
+#include "csvh-dict.h"
+#include "csvh-escape.h"
+#include "csvh-files.h"
+#include "csvh-group.h"
 #include "csvh-line-helper.h"
+#include "csvh-parallel.h"
+#include "csvh-profile.h"
+#include "csvh-reader.h"
+#include "csvh-sample.h"
+#include "csvh-scan.h"
+#include "csvh-sketch.h"
+#include "csvh-sort.h"
+#include "csvh-store.h"
+#include "csvh-width.h"
 
 #include "csv-handler.h"
 
@@ -12,26 +27,213 @@
  */
 static char delim = ',';
 
+/**
+ * Quotes can have delimiters and line breaks between them.  On by default.
+ */
+static char quoting = 1;
+
+/**
+ * The parser and field counter, which depend on whether there's quoting.
+ */
+static csv_parse_fn parseFields = parse_csv_len;
+static csv_count_fn countFields = count_fields_len;
+
 /**
  * Current complete line.
  */
 static char *line = NULL;
 
+/**
+ * The bytes of the current line exactly as they were in the input, and their
+ * count.  Usually points into the reader's buffer, so it's only good until
+ * the next read.  Line always has the same bytes (plus a null terminator), so
+ * the count is line's length too, and that's what everything goes by, not
+ * the null terminator, since there can be nulls in the input.
+ */
+static const char *rawRecord = NULL;
+static size_t rawRecordLen = 0;
+
+/**
+ * The reader has been opened on the input.
+ */
+static char readerIsOpen = 0;
+
+/**
+ * Files to read instead of stdin, one after another as if they were one file
+ * (see csvh-files.c).  NULL if reading stdin.
+ */
+static char **inputPaths = NULL;
+static int inputPathCount = 0;
+
+/**
+ * Fd being read, and the name of the file it is (or of the last one that
+ * couldn't be opened), for error messages.  Kept as a copy so that it's still
+ * there after closing.
+ */
+static int inputFd = STDIN_FILENO;
+static char inputName[1024] = "";
+
+/**
+ * With several files, the first one's headers, which every other one has to
+ * match.  NULL if there aren't any headers, or they haven't been read yet.
+ */
+static char *firstHeader = NULL;
+static size_t firstHeaderLen = 0;
+
+/**
+ * Number the lines of each file separately, instead of all the way through.
+ */
+static char linesPerFile = 0;
+
+/**
+ * Lines skipped before the headers.  Each file after the first gets the same
+ * number skipped.
+ */
+static int skippedLines = 0;
+
+/**
+ * Malformed records that got skipped (see csvh_reader_next_record): how many,
+ * and where the first few were.  The file is empty for stdin.  Like
+ * inputName, these are still good after closing, so the error can say where.
+ */
+static int badRecordCount = 0;
+static long long badRecordOffsets[CSV_HANDLER__BAD_RECORDS_KEPT];
+static int badRecordLineNums[CSV_HANDLER__BAD_RECORDS_KEPT];
+static char badRecordFiles[CSV_HANDLER__BAD_RECORDS_KEPT][1024];
+
+/**
+ * Stop at the first malformed record instead of skipping it.
+ */
+static char stopOnBadRecord = 0;
+
+/**
+ * Where the binary cache is at: not wanted, wanted but not opened yet (that
+ * happens on the first read), or open and handing out rows.
+ */
+static char cacheState = 0;
+#define CACHE_STATE__OFF        0
+#define CACHE_STATE__WANTED     1
+#define CACHE_STATE__ON         2
+
+/**
+ * The current line is the cache's current row, so its fields can come from
+ * the cache.  (Not true for made-up headers or sorted lines.)
+ */
+static char lineFromCache = 0;
+
+/**
+ * Line number of the current line.
+ */
+static int curLineNum = 0;
+
+/**
+ * Index of the column to sort by.  -1 if not sorting.
+ */
+static int sortInd = -1;
+
+/**
+ * Where sorting is at.  Either not sorting, waiting to read everything in and
+ * sort it, or handing out sorted lines.
+ */
+static char sortState = 0;
+#define SORT_STATE__NONE        0
+#define SORT_STATE__PENDING     1
+#define SORT_STATE__SERVING     2
+
+/**
+ * Where grouping is at.  Either not grouping, handing out groups (which have
+ * all been added up by the time anything gets handed out), handing out
+ * estimates from csvh-sketch (which is grouping too, just approximately),
+ * handing out column profiles from csvh-profile, or handing out a random
+ * sample of the lines from csvh-sample.
+ */
+static char groupState = 0;
+#define GROUP_STATE__NONE       0
+#define GROUP_STATE__SERVING    1
+#define GROUP_STATE__SKETCH     2
+#define GROUP_STATE__PROFILE    3
+#define GROUP_STATE__SAMPLE     4
+
+/**
+ * Header of the column that distinct values were counted for.  Only set until
+ * its line has been handed out.
+ */
+static char *distinctColumn = NULL;
+
+/**
+ * Indexes of the columns to group by and to add up.  groupSumInd is -1 if
+ * only counting.
+ */
+static int groupKeyInd = -1;
+static int groupSumInd = -1;
+
+/**
+ * Most memory for groups before they get spilled to temp files.
+ */
+static size_t groupMemBudget = 0;
+
+/**
+ * Next column to hand out when profiling, and the headers from before
+ * profiling, to name them by.
+ */
+static int profileCol = 0;
+static char **profileHeaders = NULL;
+
+/**
+ * When going through records in threads, what to hand each one to, how each
+ * thread went, and how many records it went through (skipped or not, for
+ * keeping line numbers right).
+ */
+static char (*recordCallback)(int chunk, char **fields) = NULL;
+static char *recordRcs = NULL;
+static int *recordCounts = NULL;
+
+/**
+ * Most threads to use.  0 means one per processor.
+ */
+static int threadCount = 0;
+
+/**
+ * Most lines to hand out (not counting headers).  -1 means no limit.
+ */
+static int rowLimit = -1;
+
+/**
+ * Lines handed out so far (not counting headers).
+ */
+static int rowCount = 0;
+
 /**
  * Width used to display line numbers.
  */
 static int linePad = 3;
 
 /**
- * Temporary line to hold in memory until called.
+ * Temporary line to hold in memory until called, and its length.
  */
 static char *lineBuff = NULL;
+static size_t lineBuffLen = 0;
 
 /**
  * Headers as array of strings.
  */
 static char **headers = NULL;
 
+/**
+ * Headers by name, so that looking one up doesn't mean going through all of
+ * them (some files have thousands).  The dictionary's code for a name is the
+ * index into headerInds, which has the index of the first header with that
+ * name.
+ */
+static struct csvhDict *headerIndex = NULL;
+static int *headerInds = NULL;
+
+/**
+ * First header name that shows up more than once, or NULL if none do.  Points
+ * into headers.
+ */
+static char *duplicateHeader = NULL;
+
 /**
  * Source file has text headers.  Default to true.
  */
@@ -53,18 +255,41 @@ static int countHeaders = -1;
  */
 static int selectedFieldCount = -1;
 
+/**
+ * "Header: " for each column shown in vertical output, worked out the first
+ * time an entry is, since they're the same for every one.
+ */
+static char **verticalPrefixes = NULL;
+static size_t *verticalPrefixLens = NULL;
+static int verticalPrefixCount = 0;
+
+/**
+ * "\"Header\":" for each column in JSON output, escaped once up front, for
+ * the same reason.
+ */
+static char **jsonKeys = NULL;
+static size_t *jsonKeyLens = NULL;
+static int jsonKeyCount = 0;
+
+/**
+ * First and last columns of the window, if only a window of columns is being
+ * looked at (which also means selectedFields is just those columns in
+ * order).  -1 if not.
+ */
+static int windowFirst = -1;
+static int windowLast = -1;
+
 /**
  * Width of cells to output.
  */
 static int width = 15;
 
 /**
- * Array of array of strings, terminated by a NULL at the end.  Good grief;
- * this will be annoying.  Holds the entirety of the input file except what is
- * filtered out, and except for the headers.  Currently only used for displaying
- * transposed output.
+ * The entirety of the input file except what is filtered out, and except for
+ * the headers, is in csvh-store.  Currently only used for displaying
+ * transposed output.  This says whether it's been loaded.
  */
-static char ***entireInput = NULL;
+static char entireInputLoaded = 0;
 
 /**
  * Array of integers of line numbers from the source file to display.  Only
@@ -75,20 +300,115 @@ static int *lineNums = NULL;
 
 // START forward declarations for static functions.
 
-static char getParsedLine(char ***parsedLine);
+static char readLine();
+
+static char readNextUnsorted();
+
+static char gatherSorted();
+
+static char readNextSorted();
+
+static char sortToHandlerRc(char rc);
+
+static char gatherRecords(char (*onStart)(int chunkCount), char (*onRecord)(int chunk, char **fields));
+
+static char parallelRecord(int chunk, const char *record, size_t recordLen);
 
-static char appendBoxedValue(char **outputLine, char *newValue, char useBrace);
+static char currentLineRecord(char (*onRecord)(int chunk, char **fields));
+
+static char startGroups(int chunkCount);
+
+static char addRecordToGroup(int chunk, char **fields);
+
+static char addToGroup(int table, char *key, char *sumValue);
+
+static char readGroupLine();
+
+static char startProfile(int chunkCount);
+
+static char addRecordToProfile(int chunk, char **fields);
+
+static char readProfileLine();
+
+static char gatherSample();
+
+static char readSampleLine();
+
+static char gatherSketch(char *header, int k);
+
+static char readSketchLine();
+
+static char setSummaryHeaders(const char **names);
+
+static char setLineFromValues(char **values);
+
+static char groupToHandlerRc(char rc);
+
+static char *getField(char **parsedLine, int ind);
+
+static char openReader();
+
+static char openNextFile();
+
+static char nextFile();
+
+static char sameAsFirstHeader(const char *record, size_t recordLen);
+
+static char severalFiles();
+
+static char openCache();
+
+static char readCachedLine();
+
+static char shouldSkip();
+
+static void getRecordSpan(long long *offset, long long *end, char *terminated);
+
+static char recordEndsInCrlf();
+
+static char getCachedParsedLine(char ***parsedLine, size_t **lens);
+
+static char readerToHandlerRc(char rc);
+
+static char noteBadRecord();
+
+static char getParsedLine(char ***parsedLine, size_t **lens);
+
+static char appendBoxedValue(
+    char **outputLine,
+    size_t *len,
+    size_t *cap,
+    const char *newValue,
+    size_t valueLen,
+    char useBrace
+);
 
 static int getSelectedFieldCount();
 
 static char *getHeaderFromPosition(int pos);
 
-static char unparseValue(char **value);
-
-static char copyArrayOfStrings(char ***destArray, char ***srcArray, int *specInds);
+static size_t unparseValue(const char *value, size_t valueLen, char *out);
 
 static int getHeaderIndexFromString(char *critHeader);
 
+static char buildVerticalPrefixes();
+
+static void freeVerticalPrefixes();
+
+static char buildJsonKeys();
+
+static void freeJsonKeys();
+
+static char reserveOutput(char **buff, size_t *len, size_t *cap, size_t needed);
+
+static int getColumnFromString(char *column, int headerCount);
+
+static char **parseWindow(const char *record, size_t len, size_t **lens);
+
+static char indexHeaders();
+
+static void freeHeaderIndex();
+
 static char setHeadersAsNumbers();
 
 static int countDigits(int num);
@@ -113,832 +433,3156 @@ void csv_handler_set_has_headers(char hasHeadersIn)
 void csv_handler_set_delim(char delimIn)
 {
     delim = delimIn;
+    csvh_line_helper_set_delim(delimIn);
 }
 
 /**
- * Skip next line before even reading it.
+ * Turn quoting on or off.  With it off, a record is just a line, every
+ * delimiter splits, and quotes are just part of the value.  That's for feeds
+ * that never quote anything (i.e., a lot of TSV), where a stray quote would
+ * otherwise run on to the end of the file.  Values get written back out the
+ * same way, unquoted.  Must be called before reading anything.
+ *
+ * @param   quotingIn
  */
-char csv_handler_skip_next_line()
+char csv_handler_set_quoting(char quotingIn)
 {
-    int buffsize = 255;
-    char buff[buffsize];
-    while (1) {
-        if (fgets(buff, buffsize, stdin) == NULL) {
-            // This will happen *after* the final line has already been read.
-            return CSV_HANDLER__DONE;
-        }
-
-        if (buff[strlen(buff) - 1] == '\n') {
-            // Reached EOL.
-            break;
-        }
+    if (readerIsOpen) {
+        return CSV_HANDLER__ALREADY_SET;
     }
 
+    quoting = quotingIn;
+    parseFields = csv_parser_for(quoting);
+    countFields = csv_counter_for(quoting);
+    csvh_reader_set_quoting(quoting);
+    csvh_parallel_set_quoting(quoting);
+    csvh_line_helper_set_quoting(quoting);
+
     return CSV_HANDLER__OK;
 }
 
 /**
- * Read next line into memory.
+ * Read the passed files, one after another, instead of stdin.  Paths can be
+ * patterns, like "day-*.csv".  If there's more than one file, every file's
+ * headers have to match the first one's, and they only get output once.  Files
+ * come in the order passed.  Must be called before reading anything.
+ *
+ * @param   paths
+ * @param   count
  */
-char csv_handler_read_next_line()
+char csv_handler_set_files(char **paths, int count)
 {
-    if (line != NULL) {
-        free(line);
-        line = NULL;
+    if (readerIsOpen) {
+        return CSV_HANDLER__ALREADY_SET;
+    }
+    if (count < 1) {
+        return CSV_HANDLER__INVALID_INPUT;
     }
 
-    if (lineBuff != NULL) {
-        // Have a line in memory being held, so just switch around the pointers.
-        line = lineBuff;
-        lineBuff = NULL;
-    } else {
-        // Might be good to abstract this to a different function?
-        line = malloc(sizeof(char));
-
-        if (line == NULL) {
-            return CSV_HANDLER__OUT_OF_MEMORY;
-        }
-
-        line[0] = '\0'; // Empty string for now because we don't know how long it
-        // will be.
-
-        int buffsize = 255;
-        char buff[buffsize];
-        while (1) {
-            if (fgets(buff, buffsize, stdin) == NULL) {
-                // Note that this should happen *after* the final line has already
-                // been read into memory.
-                return CSV_HANDLER__DONE;
-            }
-
-            line = realloc(
-                line,
-                sizeof(char) * (strlen(line) + strlen(buff) + 1) // +1 for null terminator
-            );
-
-            if (line == NULL) {
-                return CSV_HANDLER__OUT_OF_MEMORY;
-            }
+    inputPaths = paths;
+    inputPathCount = count;
 
-            strcat(line, buff);
+    return CSV_HANDLER__OK;
+}
 
-            size_t lst = strlen(line) - 1;
-            if ((countHeaders = count_fields(line, delim)) != -1) {
-                // If count_fields is -1, then that means the line is not parseable
-                // as a CSV line, which probably means that the file has a field
-                // with a line break in it, meaning we have to include both of the
-                // *file*'s lines as part of the same logical CSV line.  Example:
+/**
+ * Number the lines of each input file separately, starting from 1, instead of
+ * all the way through.  Line restrictions then pick out lines from each file.
+ */
+void csv_handler_set_lines_per_file()
+{
+    linesPerFile = 1;
+}
 
-                // field one,field two,"field with
-                // line break", field four
+/**
+ * Get the name of the file being read, or of the one that couldn't be.  Empty
+ * if reading stdin.  Still good after closing.
+ */
+char *csv_handler_current_file()
+{
+    return inputName;
+}
 
-                // From the CSV perspective, this is one line, but if we don't check
-                // that the line we just found is parseable when we reach the first
-                // newline, we'll get an unparseable string and csv.c will return
-                // null.
+/**
+ * Skip next line before even reading it.
+ */
+char csv_handler_skip_next_line()
+{
+    return csv_handler_skip_lines(1);
+}
 
-                if (line[lst] == '\n') {
-                    line[lst] = '\0'; // Removing newline, but not reallocing.
+/**
+ * Skip the next count lines before even reading them.  These are whole
+ * records, so a quoted line break doesn't throw off the count.
+ *
+ * @param   count
+ */
+char csv_handler_skip_lines(int count)
+{
+    char rc;
+    if ((rc = openReader()) != CSV_HANDLER__OK) {
+        return rc;
+    }
 
-                    if (line[lst - 1] == '\r') {
-                        // Because DOS line endings.
-                        line[lst - 1] = '\0'; // Remove nonsense, but not reallocing.
-                    }
-                    // Technically, this assumes that the line is longer than 2 characters.  Oh, well.
+    skippedLines += count;
 
-                    break;
+    int skipped;
+    return readerToHandlerRc(csvh_reader_skip_records(count, &skipped));
+}
 
-                    // I know this nested-nested if is bad, but I don't have
-                    // time to do it properly right now.
-                }
+/**
+ * Read next line into memory.
+ */
+char csv_handler_read_next_line()
+{
+    char rc;
 
-            }
+    if (headers != NULL) {
+        // Only count lines after the headers.
+        if (rowLimit != -1 && rowCount >= rowLimit) {
+            // Done without even looking at the rest of the input.
+            return CSV_HANDLER__DONE;
         }
+        rowCount++;
     }
 
-    if (!hasHeaders) {
-        // Take the line that was just found and stash it away, because we're
-        // going to print out the numerical headers first.
-        lineBuff = line;
-        char rc;
-        if ((rc = setHeadersAsNumbers()) != CSV_HANDLER__OK) {
-            return rc;
+    if (sortState == SORT_STATE__NONE) {
+        if ((rc = readNextUnsorted()) == CSV_HANDLER__OK) {
+            curLineNum = csvh_line_helper_get_line_num();
         }
-        hasHeaders = 1; // Now have headers.  (Basically just don't want to come
-        // back here.)
+        return rc;
     }
 
-    // Determine if should skip, stop, print, or what-have-you.
-    switch (csvh_line_helper_should_skip(line)) {
-        case CSVH_LINE_HELPER__SKIP:
-            return csv_handler_read_next_line();
-        case CSVH_LINE_HELPER__DONE:
-            return CSV_HANDLER__DONE;
-        case CSVH_LINE_HELPER__OK:
-            return CSV_HANDLER__OK;
-        case CSVH_LINE_HELPER__INVALID_INPUT:
-            return CSV_HANDLER__INVALID_INPUT;
+    if (sortState == SORT_STATE__PENDING) {
+        if ((rc = gatherSorted()) != CSV_HANDLER__OK) {
+            return rc;
+        }
+        sortState = SORT_STATE__SERVING;
     }
 
-    return CSV_HANDLER__UNKNOWN_ERROR;
+    return readNextSorted();
 }
 
 /**
- * Set the headers from the line in memory.
+ * Follow the input as it grows, like "tail -f".  Must be called before reading
+ * anything.  The input has to be a file for this to do anything.
  */
-char csv_handler_set_headers_from_line()
+char csv_handler_set_follow()
 {
-    if (line == NULL) {
-        return CSV_HANDLER__LINE_IS_NULL;
-    }
-    if (headers != NULL) {
+    if (readerIsOpen) {
         return CSV_HANDLER__ALREADY_SET;
     }
 
-    headers = parse_csv(line, delim);
-    // Not using getParsedLine because don't want to filter anything out for
-    // headers.
-
-    if (headers == NULL) {
-        return CSV_HANDLER__OUT_OF_MEMORY;
+    if (csvh_reader_set_follow(1) != CSVH_READER__OK) {
+        return CSV_HANDLER__INVALID_INPUT;
     }
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Pass on lines restrictions to csvh-line-helper.
- *
- * @param   lines
+ * Don't map input files into memory; read them ahead in big pieces instead
+ * (see csvh-reader.c).  For network filesystems that do badly with mappings.
+ * Anything that only works on mapped input (i.e., splitting it up between
+ * threads) falls back to going one line at a time.  Must be called before
+ * reading anything.
  */
-char csv_handler_restrict_by_lines(char *lines)
+char csv_handler_set_no_mapping()
 {
-    return csvh_line_helper_init_lines(lines);
+    if (readerIsOpen) {
+        return CSV_HANDLER__ALREADY_SET;
+    }
+
+    csvh_reader_set_mapping(0);
+
+    return CSV_HANDLER__OK;
 }
 
 /**
- * Pass on ranges restrictions to csvh-line-helper.
+ * Set the longest a record can be, in bytes.  Past that, or if its quotes
+ * never close, it's malformed, and gets skipped (or stops everything, if
+ * stop is set).  Either way, it never takes more than that much memory or
+ * time to find out.  Must be called before reading anything.
  *
- * @param   critHeader
- * @param   ranges
+ * @param   maxSize     0 for the default (64 MB).
+ * @param   stop
  */
-char csv_handler_restrict_by_ranges(char *critHeader, char *ranges)
+char csv_handler_set_bad_records(size_t maxSize, char stop)
 {
-    int critInd = getHeaderIndexFromString(critHeader);
-
-    if (critInd == -1) {
-        return CSV_HANDLER__HEADER_NOT_FOUND;
-    }
-
-    char rc = csvh_line_helper_init_ranges(critInd, ranges);
-
-    if (rc == CSVH_LINE_HELPER__INVALID_INPUT) {
-        return CSV_HANDLER__INVALID_INPUT;
+    if (readerIsOpen) {
+        return CSV_HANDLER__ALREADY_SET;
     }
 
-    if (rc != CSVH_LINE_HELPER__OK) {
-        return CSV_HANDLER__UNKNOWN_ERROR;
-    }
+    csvh_reader_set_max_record(maxSize);
+    stopOnBadRecord = stop;
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Pass on equals restrictions to csvh-line-helper.
+ * Get how many malformed records have been skipped so far.
+ */
+int csv_handler_bad_record_count()
+{
+    return badRecordCount;
+}
+
+/**
+ * Get where a malformed record was: its offset in the file, the line number
+ * it would have had, and the file (NULL for stdin).  Only the first
+ * CSV_HANDLER__BAD_RECORDS_KEPT are kept; DONE past that.  Still good after
+ * closing.
  *
- * @param   critHeader
- * @param   equals
+ * @param   ind
+ * @param   offset
+ * @param   lineNum
+ * @param   file
  */
-char csv_handler_restrict_by_equals(char *critHeader, char *equals)
+char csv_handler_bad_record(int ind, long long *offset, int *lineNum, char **file)
 {
-    int critInd = getHeaderIndexFromString(critHeader);
+    if (ind < 0 || ind >= badRecordCount || ind >= CSV_HANDLER__BAD_RECORDS_KEPT) {
+        return CSV_HANDLER__DONE;
+    }
 
-    if (critInd == -1) {
-        return CSV_HANDLER__HEADER_NOT_FOUND;
+    *offset = badRecordOffsets[ind];
+    *lineNum = badRecordLineNums[ind];
+    *file = (badRecordFiles[ind][0] == '\0') ? NULL : badRecordFiles[ind];
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Use a binary cache of the input, kept next to it as the same file name
+ * with ".csvb" on the end.  If there's a good one, lines come out of it
+ * already split into fields, so nothing gets parsed.  If not, it gets made
+ * first.  Must be called before reading anything.  Does nothing if the input
+ * isn't a file, or the cache can't be written.
+ */
+char csv_handler_set_cache()
+{
+    if (readerIsOpen) {
+        return CSV_HANDLER__ALREADY_SET;
     }
 
-    char rc = csvh_line_helper_init_equals(critInd, equals);
+    cacheState = CACHE_STATE__WANTED;
 
-    if (rc == CSVH_LINE_HELPER__INVALID_INPUT) {
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Set the most lines to output.  Once that many have been read, reading stops
+ * and nothing else in the input gets looked at.
+ *
+ * @param   limit
+ */
+void csv_handler_set_limit(int limit)
+{
+    rowLimit = limit;
+}
+
+/**
+ * Jump ahead to the last n lines of the input.  Must be called after the
+ * headers are read.  Restrictions apply to those lines as usual, and line
+ * numbers count from the first of them.
+ *
+ * If the input is a file, this only reads the end of it.  n can't be
+ * negative.
+ *
+ * @param   n
+ */
+char csv_handler_set_tail(int n)
+{
+    if (headers == NULL) {
+        return CSV_HANDLER__HEADERS_NOT_SET;
+    }
+    if (n < 0) {
         return CSV_HANDLER__INVALID_INPUT;
     }
+    if (groupState != GROUP_STATE__NONE) {
+        // Groups aren't lines from the input, so there's no end of the input
+        // to jump to.
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+    if (severalFiles()) {
+        // The end of the last file isn't the tail if the last file's short.
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+
+    int found = 0;
+    char rc;
+    if (cacheState == CACHE_STATE__ON) {
+        csvh_cache_seek_tail(n, &found);
+    } else if ((rc = csvh_reader_seek_tail(n, &found)) != CSVH_READER__OK) {
+        return readerToHandlerRc(rc);
+    }
+
+    // The reader may have had to read through everything to get here, so the
+    // bytes of the current line might not be in its buffer anymore.  Line
+    // has the same bytes.  Same goes for the cache, which has moved on from
+    // its row.
+    rawRecord = line;
+    lineFromCache = 0;
+
+    if (lineBuff != NULL && found >= n) {
+        // With no headers, the first line has already been read in and is
+        // being held on to.  If there's enough lines after it, it's not part
+        // of the tail.
+        free(lineBuff);
+        lineBuff = NULL;
+    }
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Get a single header to print out (to loop through so can get all headers).
+ * Set the column to sort by, and how.  The spec is the header, optionally
+ * followed by ":n" (sort as numbers) or ":s" (sort as strings, the default),
+ * and optionally ":desc" (descending).  Lines are sorted after restrictions
+ * are applied.  Any other ":" suffix is an invalid sort type, unless it's
+ * part of the header.
  *
- * @param   outputLine
+ * Anything over the memory budget gets sorted in pieces that are spilled to
+ * temp files and then merged.  If the input is a file, only the sort keys and
+ * where the lines are in the file are kept, not the lines themselves.
+ *
+ * @param   spec
+ * @param   memBudget   In bytes.
  */
-char csv_handler_output_headers(char **outputLine)
+char csv_handler_set_sort(char *spec, size_t memBudget)
 {
-    static int ind = -1;
+    if (headers == NULL) {
+        return CSV_HANDLER__HEADERS_NOT_SET;
+    }
+    if (sortState != SORT_STATE__NONE) {
+        return CSV_HANDLER__ALREADY_SET;
+    }
 
-    if (*outputLine != NULL) {
-        free(*outputLine);
-        *outputLine = NULL;
+    char *critHeader = strdup(spec);
+    if (critHeader == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
-    ind++;
+    char numeric = 0;
+    char descending = 0;
+    char *suffix;
+
+    // Peel suffixes off of the end, so that headers with colons in them still
+    // work as long as they don't end in one of these.
+    while ((suffix = strrchr(critHeader, ':')) != NULL) {
+        if (strcmp(suffix, ":n") == 0) {
+            numeric = 1;
+        } else if (strcmp(suffix, ":s") == 0) {
+            numeric = 0;
+        } else if (strcmp(suffix, ":desc") == 0) {
+            descending = 1;
+        } else if (strcmp(suffix, ":asc") == 0) {
+            descending = 0;
+        } else {
+            break;
+        }
+        *suffix = '\0';
+    }
 
-    if (headers[ind] == NULL) {
-        return CSV_HANDLER__DONE;
+    sortInd = getHeaderIndexFromString(critHeader);
+    free(critHeader);
+
+    if (sortInd == -1 && suffix != NULL) {
+        // It stopped at a suffix it didn't know, and that's not part of a
+        // header either, so it's a sort type with a typo in it (like
+        // "State:q"), not a header that doesn't exist.
+        return CSV_HANDLER__INVALID_SORT_TYPE;
+    }
+    if (sortInd == -1) {
+        return CSV_HANDLER__HEADER_NOT_FOUND;
     }
 
-    *outputLine = malloc(sizeof(char) * (strlen(headers[ind]) + 1));
-    strcpy(*outputLine, headers[ind]);
+    csvh_sort_init(numeric, descending, memBudget);
+    sortState = SORT_STATE__PENDING;
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Get the line in CSV format.
+ * Set the most threads to use for anything that can be split up (i.e.,
+ * grouping).  Zero or less means one per processor.
  *
- * @param   wholeLine   Pointer to string.
+ * @param   count
  */
-char csv_handler_raw_line(char **wholeLine)
+void csv_handler_set_threads(int count)
 {
-    if (line == NULL) {
-        return CSV_HANDLER__LINE_IS_NULL;
+    threadCount = (count < 0) ? 0 : count;
+}
+
+/**
+ * Add up the lines that aren't skipped by the value in the key column, and
+ * from then on hand out one line per value instead: the value, how many lines
+ * had it, and (if sumHeader isn't NULL) the total of sumHeader over those
+ * lines.  Values that aren't numbers count as zero.  Groups come out sorted
+ * by value, unless there were so many that they had to be spilled to temp
+ * files, in which case they're only sorted within each batch.
+ *
+ * Must be called after the headers are read and the restrictions are set.
+ * The headers change to the value header, "count" and "sum", so picking
+ * fields and sorting have to come after this.
+ *
+ * If the input is a mapped file and the restrictions don't go by line
+ * numbers, the input gets split up between threads, each with its own groups,
+ * and they're put together at the end.
+ *
+ * @param   keyHeader
+ * @param   sumHeader
+ * @param   memBudget   In bytes.
+ */
+char csv_handler_group_by(char *keyHeader, char *sumHeader, size_t memBudget)
+{
+    if (headers == NULL) {
+        return CSV_HANDLER__HEADERS_NOT_SET;
+    }
+    if (groupState != GROUP_STATE__NONE || sortState != SORT_STATE__NONE || selectedFields != NULL) {
+        return CSV_HANDLER__ALREADY_SET;
+    }
+    if (csvh_reader_is_following()) {
+        // Would never be done adding up.
+        return CSV_HANDLER__INVALID_INPUT;
     }
 
-    if (*wholeLine != NULL) {
-        free(*wholeLine);
-        *wholeLine = NULL;
+    if ((groupKeyInd = getHeaderIndexFromString(keyHeader)) == -1) {
+        return CSV_HANDLER__HEADER_NOT_FOUND;
+    }
+    if (sumHeader != NULL && (groupSumInd = getHeaderIndexFromString(sumHeader)) == -1) {
+        return CSV_HANDLER__HEADER_NOT_FOUND;
     }
 
-    char **parsedLine = NULL;
-    getParsedLine(&parsedLine);
+    groupMemBudget = memBudget;
 
-    *wholeLine = malloc(sizeof(char));
+    char rc;
+    if ((rc = gatherRecords(startGroups, addRecordToGroup)) != CSV_HANDLER__OK) {
+        return rc;
+    }
 
-    if (*wholeLine == NULL) {
-        return CSV_HANDLER__OUT_OF_MEMORY;
+    if ((rc = groupToHandlerRc(csvh_group_finish())) != CSV_HANDLER__OK) {
+        return rc;
     }
 
-    strcpy(*wholeLine, "");
+    const char *names[4] = {headers[groupKeyInd], "count", NULL, NULL};
+    if (groupSumInd != -1) {
+        names[2] = "sum";
+    }
 
-    char rc = 0;
+    if ((rc = setSummaryHeaders(names)) != CSV_HANDLER__OK) {
+        return rc;
+    }
 
-    char delimStr[] = " ";
-    delimStr[0] = delim;
-    // This is an annoying way of concatenating a single char.
+    groupState = GROUP_STATE__SERVING;
 
-    for (int i = 0; parsedLine[i] != NULL; i++) {
-        if ((rc = unparseValue(&(parsedLine[i]))) != CSV_HANDLER__OK) {
-            return rc;
-        }
-        *wholeLine = realloc(
-            *wholeLine,
-            sizeof(char) * (strlen(*wholeLine) + strlen(parsedLine[i]) + 2)
-        );
-        if (*wholeLine == NULL) {
-            return CSV_HANDLER__OUT_OF_MEMORY;
-        }
-        strcat(*wholeLine, parsedLine[i]);
-        strcat(*wholeLine, delimStr);
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Estimate how many different values there are in a column, and from then on
+ * hand out a single line with that instead: the column's header and the
+ * estimate.  Uses a fixed amount of memory no matter how big the input is
+ * (see csvh-sketch.c), and is usually within a percent or two.
+ *
+ * Must be called after the headers are read and the restrictions are set.
+ * The headers change to "column" and "distinct".
+ *
+ * @param   header
+ */
+char csv_handler_distinct(char *header)
+{
+    char rc;
+    if ((rc = gatherSketch(header, 0)) != CSV_HANDLER__OK) {
+        return rc;
     }
 
-    (*wholeLine)[strlen(*wholeLine) - 1] = '\0';  // Don't resize.
-    free_csv_line(parsedLine);
+    if ((distinctColumn = strdup(header)) == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    const char *names[3] = {"column", "distinct", NULL};
+    if ((rc = setSummaryHeaders(names)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    groupState = GROUP_STATE__SKETCH;
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Get line to print out to stdout.
+ * Find the k most common values in a column (approximately), and from then
+ * on hand out one line for each instead, most common first: the value, how
+ * many times it showed up, and the error.  The real count is somewhere
+ * between count - error and count, and the error is usually zero for values
+ * that really are near the top.  Uses a fixed amount of memory no matter how
+ * big the input is (see csvh-sketch.c).
  *
- * @param   outputLine
+ * Must be called after the headers are read and the restrictions are set.
+ * The headers change to the column's header, "count" and "error".
+ *
+ * @param   header
+ * @param   k
  */
-char csv_handler_output_line(char **outputLine)
+char csv_handler_top_k(char *header, int k)
 {
-    if (*outputLine != NULL) {
-        free(*outputLine);
-        *outputLine = NULL;
+    if (k < 1) {
+        return CSV_HANDLER__INVALID_INPUT;
     }
 
-    if (line == NULL) {
-        return CSV_HANDLER__LINE_IS_NULL;
+    char rc;
+    if ((rc = gatherSketch(header, k)) != CSV_HANDLER__OK) {
+        return rc;
     }
-    char **parsedLine = NULL;
-    getParsedLine(&parsedLine);
 
-    *outputLine = malloc(sizeof(char) * 2);
+    const char *names[4] = {header, "count", "error", NULL};
+    if ((rc = setSummaryHeaders(names)) != CSV_HANDLER__OK) {
+        return rc;
+    }
 
-    if (*outputLine == NULL) {
+    groupState = GROUP_STATE__SKETCH;
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Go through every line that isn't skipped, and from then on hand out one
+ * line per column instead, describing what's in it: the column's header, the
+ * type its values look like (int, decimal, date, text, or empty), how many
+ * are empty, the shortest and longest lengths, the smallest and biggest
+ * numbers (for number columns), and whether every value is different.  See
+ * csvh-profile.c.
+ *
+ * Must be called after the headers are read and the restrictions are set.
+ * The headers change to "column", "type", "empty", "min length",
+ * "max length", "min", "max" and "unique".
+ *
+ * Like grouping, if the input is a mapped file and the restrictions don't go
+ * by line numbers, it's split up between threads.
+ */
+char csv_handler_profile()
+{
+    if (headers == NULL) {
+        return CSV_HANDLER__HEADERS_NOT_SET;
+    }
+    if (groupState != GROUP_STATE__NONE || sortState != SORT_STATE__NONE || selectedFields != NULL) {
+        return CSV_HANDLER__ALREADY_SET;
+    }
+    if (csvh_reader_is_following()) {
+        // Would never be done.
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+
+    char rc;
+    if ((rc = gatherRecords(startProfile, addRecordToProfile)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    if (csvh_profile_finish() != CSVH_PROFILE__OK) {
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
-    (*outputLine)[0] = '|'; // Opening brace.
-    (*outputLine)[1] = '\0';
+    // Hold on to the old headers, since they're what the lines are about.
+    int count = 0;
+    for (; headers[count] != NULL; count++) {}
 
-    // Add content.
-    char rc = 0;
-    for (int i = 0; parsedLine[i] != NULL; i++) {
-        if ((rc = appendBoxedValue(outputLine, parsedLine[i], 1)) != CSV_HANDLER__OK) {
-            return rc;
+    if ((profileHeaders = calloc(count + 1, sizeof(char *))) == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+    for (int i = 0; i < count; i++) {
+        if ((profileHeaders[i] = strdup(headers[i])) == NULL) {
+            return CSV_HANDLER__OUT_OF_MEMORY;
         }
     }
 
-    free_csv_line(parsedLine);
+    const char *names[CSVH_PROFILE__FIELD_COUNT + 2] = {
+        "column", "type", "empty", "min length", "max length", "min", "max", "unique", NULL
+    };
+    if ((rc = setSummaryHeaders(names)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    profileCol = 0;
+    groupState = GROUP_STATE__PROFILE;
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Get the line number as string.
+ * Pick n of the lines that aren't skipped at random, and from then on hand out
+ * only those, in the order they were in.  The headers stay the same, but the
+ * line numbers start over from 1, same as for the tail.
  *
- * @param outputString
+ * If the input is a mapped file with no restrictions, it jumps to random
+ * spots in the file instead of reading all of it, so it's done in about the
+ * time it takes to read n lines.  Otherwise, it reads through everything once
+ * and keeps n lines as it goes.  See csvh-sample.c.
+ *
+ * Must be called after the headers are read and the restrictions are set.
+ *
+ * @param   n
+ * @param   seed    For the random numbers, so that a sample can be gotten
+ *                  again.  0 to use a different one every time.
  */
-char csv_handler_output_line_number(char **outputString)
+char csv_handler_sample(int n, unsigned long long seed)
 {
-    if (*outputString != NULL) {
-        free(*outputString);
-        *outputString = NULL;
+    if (headers == NULL) {
+        return CSV_HANDLER__HEADERS_NOT_SET;
+    }
+    if (n < 0) {
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+    if (groupState != GROUP_STATE__NONE || sortState != SORT_STATE__NONE) {
+        return CSV_HANDLER__ALREADY_SET;
+    }
+    if (csvh_reader_is_following()) {
+        // Would never be done picking.
+        return CSV_HANDLER__INVALID_INPUT;
     }
 
-    int num = csvh_line_helper_get_line_num();
+    if (csvh_sample_init(n, seed) != CSVH_SAMPLE__OK) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
 
-    int numLen = countDigits(num);
-    int sizeDum = (numLen > linePad) ? numLen : linePad;
-    *outputString = malloc(sizeof(char) * (sizeDum + 1));
-    if (*outputString == NULL) {
+    // Reading through the lines replaces the line in memory, which is still
+    // the headers, so hang on to it.
+    size_t headerLineLen = rawRecordLen;
+    char *headerLine = malloc(sizeof(char) * (headerLineLen + 1));
+    if (headerLine == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+    memcpy(headerLine, line, headerLineLen + 1);
+
+    char rc;
+    if ((rc = gatherSample()) != CSV_HANDLER__OK) {
+        free(headerLine);
+        return rc;
+    }
+
+    csvh_sample_finish();
+
+    free(line);
+    line = headerLine;
+    rawRecord = line;
+    rawRecordLen = headerLineLen;
+    countHeaders = countFields(line, rawRecordLen, delim);
+    lineFromCache = 0;
+
+    // The picks have already been through the restrictions.
+    csvh_line_helper_reset();
+    groupState = GROUP_STATE__SAMPLE;
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Set the headers from the line in memory.
+ */
+char csv_handler_set_headers_from_line()
+{
+    if (line == NULL) {
+        return CSV_HANDLER__LINE_IS_NULL;
+    }
+    if (headers != NULL) {
+        return CSV_HANDLER__ALREADY_SET;
+    }
+
+    headers = parseFields(line, rawRecordLen, delim, NULL);
+    // Not using getParsedLine because don't want to filter anything out for
+    // headers.
+
+    if (headers == NULL) {
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
-    if (numLen < linePad) {
-        sprintf(*outputString, "% 3d", num);
-    } else {
-        sprintf(*outputString, "%d", num);
+    return indexHeaders();
+}
+
+/**
+ * Get the first header name that shows up more than once, or NULL if there
+ * aren't any.  Looking up a name like that always gets the first one.
+ */
+char *csv_handler_duplicate_header()
+{
+    return duplicateHeader;
+}
+
+/**
+ * Pass on lines restrictions to csvh-line-helper.
+ *
+ * @param   lines
+ */
+char csv_handler_restrict_by_lines(char *lines)
+{
+    return csvh_line_helper_init_lines(lines);
+}
+
+/**
+ * Pass on ranges restrictions to csvh-line-helper.
+ *
+ * @param   critHeader
+ * @param   ranges
+ */
+char csv_handler_restrict_by_ranges(char *critHeader, char *ranges)
+{
+    int critInd = getHeaderIndexFromString(critHeader);
+
+    if (critInd == -1) {
+        return CSV_HANDLER__HEADER_NOT_FOUND;
+    }
+
+    char rc = csvh_line_helper_init_ranges(critInd, ranges);
+
+    if (rc == CSVH_LINE_HELPER__INVALID_INPUT) {
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+
+    if (rc != CSVH_LINE_HELPER__OK) {
+        return CSV_HANDLER__UNKNOWN_ERROR;
+    }
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Pass on equals restrictions to csvh-line-helper.
+ *
+ * @param   critHeader
+ * @param   equals
+ */
+char csv_handler_restrict_by_equals(char *critHeader, char *equals)
+{
+    int critInd = getHeaderIndexFromString(critHeader);
+
+    if (critInd == -1) {
+        return CSV_HANDLER__HEADER_NOT_FOUND;
+    }
+
+    char rc = csvh_line_helper_init_equals(critInd, equals);
+
+    if (rc == CSVH_LINE_HELPER__INVALID_INPUT) {
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Pass on contains restriction to csvh-line-helper.
+ *
+ * @param   critHeader
+ * @param   substring
+ */
+char csv_handler_restrict_by_contains(char *critHeader, char *substring)
+{
+    int critInd = getHeaderIndexFromString(critHeader);
+
+    if (critInd == -1) {
+        return CSV_HANDLER__HEADER_NOT_FOUND;
+    }
+
+    char rc = csvh_line_helper_init_contains(critInd, substring);
+
+    if (rc != CSVH_LINE_HELPER__OK) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Pass on regex restriction to csvh-line-helper.
+ *
+ * @param   critHeader
+ * @param   pattern
+ */
+char csv_handler_restrict_by_regex(char *critHeader, char *pattern)
+{
+    int critInd = getHeaderIndexFromString(critHeader);
+
+    if (critInd == -1) {
+        return CSV_HANDLER__HEADER_NOT_FOUND;
+    }
+
+    char rc = csvh_line_helper_init_regex(critInd, pattern);
+
+    if (rc == CSVH_LINE_HELPER__INVALID_INPUT) {
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+
+    if (rc == CSVH_LINE_HELPER__UNSUPPORTED) {
+        return CSV_HANDLER__UNSUPPORTED;
+    }
+
+    if (rc != CSVH_LINE_HELPER__OK) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get a single header to print out (to loop through so can get all headers).
+ *
+ * @param   outputLine
+ */
+char csv_handler_output_headers(char **outputLine)
+{
+    static int ind = -1;
+
+    if (*outputLine != NULL) {
+        free(*outputLine);
+        *outputLine = NULL;
+    }
+
+    ind++;
+
+    if (headers[ind] == NULL) {
+        return CSV_HANDLER__DONE;
+    }
+
+    *outputLine = malloc(sizeof(char) * (strlen(headers[ind]) + 1));
+    strcpy(*outputLine, headers[ind]);
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get the line in CSV format.  If there can be nulls in the input, use
+ * csv_handler_append_raw_line instead, which says how long it is.
+ *
+ * @param   wholeLine   Pointer to string.
+ */
+char csv_handler_raw_line(char **wholeLine)
+{
+    if (*wholeLine != NULL) {
+        free(*wholeLine);
+        *wholeLine = NULL;
+    }
+
+    size_t len = 0;
+    size_t cap = 0;
+
+    return csv_handler_append_raw_line(wholeLine, &len, &cap);
+}
+
+/**
+ * Same as csv_handler_raw_line, except it's added onto the end of a buffer
+ * that the caller holds on to, like csv_handler_append_vertical_entry, and
+ * the length says where it ends, even if there are nulls in it.
+ *
+ * @param   buff
+ * @param   len     What's in buff already.  Gets updated.
+ * @param   cap     Size of buff.  Gets updated.
+ */
+char csv_handler_append_raw_line(char **buff, size_t *len, size_t *cap)
+{
+    if (line == NULL) {
+        return CSV_HANDLER__LINE_IS_NULL;
+    }
+
+    char rc;
+
+    if (selectedFields == NULL) {
+        // Without picking fields, the output is exactly what was read in.
+        if ((rc = reserveOutput(buff, len, cap, rawRecordLen + 1)) != CSV_HANDLER__OK) {
+            return rc;
+        }
+        memcpy(*buff + *len, rawRecord, rawRecordLen);
+        *len += rawRecordLen;
+        (*buff)[*len] = '\0';
+
+        return CSV_HANDLER__OK;
+    }
+
+    char **parsedLine = NULL;
+    size_t *lens = NULL;
+    if ((rc = getParsedLine(&parsedLine, &lens)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    // Size it up first (quoting included), so it's written straight in.
+    size_t needed = 1; // Null terminator.
+    for (int i = 0; parsedLine[i] != NULL; i++) {
+        needed += unparseValue(parsedLine[i], lens[i], NULL) + 1;
+    }
+
+    if ((rc = reserveOutput(buff, len, cap, needed)) != CSV_HANDLER__OK) {
+        free_csv_line(parsedLine);
+        free(lens);
+        return rc;
+    }
+
+    char *out = *buff + *len;
+    for (int i = 0; parsedLine[i] != NULL; i++) {
+        if (i != 0) {
+            *out++ = delim;
+        }
+        out += unparseValue(parsedLine[i], lens[i], out);
+    }
+    *out = '\0';
+    *len = out - *buff;
+
+    free_csv_line(parsedLine);
+    free(lens);
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get the line exactly as it was in the input, without copying it.  Only
+ * available if not selecting fields, since otherwise the output isn't the
+ * same as the input.  Good until the next read.
+ *
+ * @param   record
+ * @param   recordLen
+ */
+char csv_handler_raw_record(const char **record, size_t *recordLen)
+{
+    if (line == NULL) {
+        return CSV_HANDLER__LINE_IS_NULL;
+    }
+
+    if (selectedFields != NULL) {
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+
+    *record = rawRecord;
+    *recordLen = rawRecordLen;
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Determine if raw output can skip the parser and go straight from the input
+ * (i.e., no fields are selected).
+ */
+char csv_handler_can_pass_through()
+{
+    return selectedFields == NULL;
+}
+
+/**
+ * Determine if raw output can be copied as whole byte ranges of the input
+ * file.  That's when it can pass through, the only restrictions are by line,
+ * and the input is a regular file.  Also not when the current line (i.e., the
+ * headers) ends in \r\n, since every line gets written with just \n, and
+ * copying a range per line would be slower than going through stdio.
+ */
+char csv_handler_can_copy_ranges()
+{
+    return csv_handler_can_pass_through()
+        && !recordEndsInCrlf()
+        && sortState == SORT_STATE__NONE
+        && groupState == GROUP_STATE__NONE
+        && csvh_line_helper_is_line_only()
+        && csvh_reader_is_file()
+        && !severalFiles() // Ranges are only good within one file.
+        && !csvh_reader_is_following(); // Ranges would never end.
+}
+
+/**
+ * Read all remaining lines and write them out raw, copying each run of lines
+ * that are next to each other in the input as a single range.  Only use if
+ * csv_handler_can_copy_ranges() is true.  Anything already printed to the
+ * output fd through stdio needs to be flushed first.
+ *
+ * @param   outFd
+ */
+char csv_handler_raw_copy_ranges(int outFd)
+{
+    char haveRange = 0;
+    long long rangeStart = 0;
+    long long rangeEnd = 0;
+    char terminated = 1;
+    char rc;
+
+    while (1) {
+        rc = csv_handler_read_next_line();
+
+        long long recordOffset = 0;
+        long long recordEnd = 0;
+        char recordTerminated = 1;
+        if (rc == CSV_HANDLER__OK) {
+            getRecordSpan(&recordOffset, &recordEnd, &recordTerminated);
+        }
+
+        if (haveRange && (rc != CSV_HANDLER__OK || recordOffset != rangeEnd)) {
+            // Range is done, so send it out.
+            if (csvh_reader_copy_range(rangeStart, rangeEnd - rangeStart, outFd) != CSVH_READER__OK) {
+                return CSV_HANDLER__UNKNOWN_ERROR;
+            }
+            if (!terminated && write(outFd, "\n", 1) != 1) {
+                // Last line of the file has no line break, but every line of
+                // output should.
+                return CSV_HANDLER__UNKNOWN_ERROR;
+            }
+            haveRange = 0;
+        }
+
+        if (rc != CSV_HANDLER__OK) {
+            break;
+        }
+
+        if (!haveRange) {
+            haveRange = 1;
+            rangeStart = recordOffset;
+        }
+        rangeEnd = recordEnd;
+        terminated = recordTerminated;
+        if (recordEndsInCrlf()) {
+            // Every other way of printing raw lines leaves the \r off, so
+            // this does too, which means the range can't go past it.
+            rangeEnd -= 2;
+            terminated = 0;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * Get line to print out to stdout.
+ *
+ * @param   outputLine
+ */
+char csv_handler_output_line(char **outputLine)
+{
+    if (*outputLine != NULL) {
+        free(*outputLine);
+        *outputLine = NULL;
+    }
+
+    if (line == NULL) {
+        return CSV_HANDLER__LINE_IS_NULL;
+    }
+
+    char rc;
+    char **parsedLine = NULL;
+    size_t *lens = NULL;
+    if ((rc = getParsedLine(&parsedLine, &lens)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    size_t len = 0;
+    size_t cap = 0;
+    if ((rc = reserveOutput(outputLine, &len, &cap, 2)) != CSV_HANDLER__OK) {
+        free_csv_line(parsedLine);
+        free(lens);
+        return rc;
+    }
+
+    (*outputLine)[len++] = '|'; // Opening brace.
+    (*outputLine)[len] = '\0';
+
+    // Add content.
+    for (int i = 0; rc == CSV_HANDLER__OK && parsedLine[i] != NULL; i++) {
+        rc = appendBoxedValue(outputLine, &len, &cap, parsedLine[i], lens[i], 1);
+    }
+
+    free_csv_line(parsedLine);
+    free(lens);
+
+    return rc;
+}
+
+/**
+ * Get the line number as string.
+ *
+ * @param outputString
+ */
+char csv_handler_output_line_number(char **outputString)
+{
+    if (*outputString != NULL) {
+        free(*outputString);
+        *outputString = NULL;
+    }
+
+    int num = curLineNum;
+
+    int numLen = countDigits(num);
+    int sizeDum = (numLen > linePad) ? numLen : linePad;
+    *outputString = malloc(sizeof(char) * (sizeDum + 1));
+    if (*outputString == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    if (numLen < linePad) {
+        sprintf(*outputString, "% 3d", num);
+    } else {
+        sprintf(*outputString, "%d", num);
+    }
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get the blank padding for lines without numbers (like borders).
+ *
+ * @param   outputString
+ */
+char csv_handler_output_line_padding(char **outputString)
+{
+    if (*outputString != NULL) {
+        free(*outputString);
+        *outputString = NULL;
+    }
+
+    *outputString = malloc(sizeof(char) * linePad + 1);
+    if (*outputString == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+    for (int i = 0; i < linePad; i++) {
+        (*outputString)[i] = ' ';
+    }
+    (*outputString)[linePad] = '\0';
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get border to print out.
+ *
+ * @param   outputLine
+ */
+char csv_handler_border_line(char **outputLine)
+{
+    if (countHeaders == -1) {
+        return CSV_HANDLER__LINE_IS_NULL; // Not sure what else to call this.
+    }
+
+    if (*outputLine != NULL) {
+        free(*outputLine);
+        *outputLine = NULL;
+    }
+
+    int lineLen = (width + 1) * getSelectedFieldCount() + 1;
+    // I almost wanted to name this "linLen" because then it would be pronounced
+    // "len-len" and that would be funny.
+    // (width + 1) is the width of every field plus its left brace.
+    // + 2 is one for rightmost brace.
+    // Null terminator is *not* included here, because want to match what the
+    // result of strlen would be.
+
+    *outputLine = malloc(sizeof(char) * (lineLen + 1));
+
+    if (*outputLine == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    (*outputLine)[0] = '+';
+
+    for (int i = 1; i < lineLen - 1; i++) {
+        (*outputLine)[i] = '-';
+    }
+    (*outputLine)[lineLen - 1] = '+';
+    (*outputLine)[lineLen] = '\0';
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get *vertical* entry to print to stdout.
+ *
+ * This is not a single line, so behavior is inconsistent.  It's the entirety of
+ * an entry, line breaks and all.
+ *
+ * @param   outputEntry
+ */
+char csv_handler_output_vertical_entry(char **outputEntry)
+{
+    if (*outputEntry != NULL) {
+        free(*outputEntry);
+        *outputEntry = NULL;
+    }
+
+    size_t len = 0;
+    size_t cap = 0;
+
+    return csv_handler_append_vertical_entry(outputEntry, &len, &cap);
+}
+
+/**
+ * Same as csv_handler_output_vertical_entry, except it's added onto the end of
+ * a buffer that the caller holds on to, so that the same one can be used over
+ * and over (and written out in batches).  The buffer only gets realloc'd if
+ * the entry doesn't fit, and it's always null-terminated.
+ *
+ * @param   buff
+ * @param   len     What's in buff already.  Gets updated.
+ * @param   cap     Size of buff.  Gets updated.
+ */
+char csv_handler_append_vertical_entry(char **buff, size_t *len, size_t *cap)
+{
+    if (line == NULL) {
+        return CSV_HANDLER__LINE_IS_NULL;
+    }
+
+    if (headers == NULL) {
+        return CSV_HANDLER__HEADERS_NOT_SET;
+    }
+
+    char rc;
+    if (verticalPrefixes == NULL && (rc = buildVerticalPrefixes()) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    char **parsedLine = NULL;
+    size_t *lens = NULL;
+    if ((rc = getParsedLine(&parsedLine, &lens)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    // Size it up first, so it's copied straight in without going back over
+    // anything.
+    size_t needed = 1; // Null terminator.
+    int count = 0;
+    for (; count < verticalPrefixCount && parsedLine[count] != NULL; count++) {
+        needed += verticalPrefixLens[count] + lens[count] + (count == 0 ? 0 : 1);
+    }
+
+    if ((rc = reserveOutput(buff, len, cap, needed)) != CSV_HANDLER__OK) {
+        free_csv_line(parsedLine);
+        free(lens);
+        return rc;
+    }
+
+    char *out = *buff + *len;
+    for (int i = 0; i < count; i++) {
+        if (i != 0) {
+            *out++ = '\n';
+        }
+        memcpy(out, verticalPrefixes[i], verticalPrefixLens[i]);
+        out += verticalPrefixLens[i];
+
+        memcpy(out, parsedLine[i], lens[i]);
+        out += lens[i];
+    }
+    *out = '\0';
+    *len = out - *buff;
+
+    free_csv_line(parsedLine);
+    free(lens);
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Add the line onto the end of a buffer as a JSON object, keyed by the
+ * headers, for JSON Lines output.  Every value is a string, since there's no
+ * telling what's a number in a CSV.  Works like
+ * csv_handler_append_vertical_entry otherwise (no line break at the end
+ * either).
+ *
+ * @param   buff
+ * @param   len     What's in buff already.  Gets updated.
+ * @param   cap     Size of buff.  Gets updated.
+ */
+char csv_handler_append_json_line(char **buff, size_t *len, size_t *cap)
+{
+    if (line == NULL) {
+        return CSV_HANDLER__LINE_IS_NULL;
+    }
+
+    if (headers == NULL) {
+        return CSV_HANDLER__HEADERS_NOT_SET;
+    }
+
+    char rc;
+    if (jsonKeys == NULL && (rc = buildJsonKeys()) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    char **parsedLine = NULL;
+    size_t *lens = NULL;
+    if ((rc = getParsedLine(&parsedLine, &lens)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    // Enough for every byte to need escaping, so nothing has to be checked
+    // while writing.
+    size_t needed = 3; // Braces and null terminator.
+    int count = 0;
+    for (; count < jsonKeyCount && parsedLine[count] != NULL; count++) {
+        needed += jsonKeyLens[count] + lens[count] * CSVH_ESCAPE__JSON_MAX_GROWTH + 3;
+    }
+
+    if ((rc = reserveOutput(buff, len, cap, needed)) != CSV_HANDLER__OK) {
+        free_csv_line(parsedLine);
+        free(lens);
+        return rc;
+    }
+
+    char *out = *buff + *len;
+    *out++ = '{';
+    for (int i = 0; i < count; i++) {
+        if (i != 0) {
+            *out++ = ',';
+        }
+        memcpy(out, jsonKeys[i], jsonKeyLens[i]);
+        out += jsonKeyLens[i];
+
+        *out++ = '"';
+        out += csvh_escape_json(parsedLine[i], lens[i], out);
+        *out++ = '"';
+    }
+    *out++ = '}';
+    *out = '\0';
+    *len = out - *buff;
+
+    free_csv_line(parsedLine);
+    free(lens);
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Add the line onto the end of a buffer as TSV.  Works like
+ * csv_handler_append_vertical_entry otherwise (no line break at the end
+ * either).
+ *
+ * @param   buff
+ * @param   len     What's in buff already.  Gets updated.
+ * @param   cap     Size of buff.  Gets updated.
+ */
+char csv_handler_append_tsv_line(char **buff, size_t *len, size_t *cap)
+{
+    if (line == NULL) {
+        return CSV_HANDLER__LINE_IS_NULL;
+    }
+
+    char rc;
+    char **parsedLine = NULL;
+    size_t *lens = NULL;
+    if ((rc = getParsedLine(&parsedLine, &lens)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    size_t needed = 1; // Null terminator.
+    for (int i = 0; parsedLine[i] != NULL; i++) {
+        needed += lens[i] * CSVH_ESCAPE__TSV_MAX_GROWTH + 1;
+    }
+
+    if ((rc = reserveOutput(buff, len, cap, needed)) != CSV_HANDLER__OK) {
+        free_csv_line(parsedLine);
+        free(lens);
+        return rc;
+    }
+
+    char *out = *buff + *len;
+    for (int i = 0; parsedLine[i] != NULL; i++) {
+        if (i != 0) {
+            *out++ = '\t';
+        }
+        out += csvh_escape_tsv(parsedLine[i], lens[i], out);
+    }
+    *out = '\0';
+    *len = out - *buff;
+
+    free_csv_line(parsedLine);
+    free(lens);
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get border line for vertical entry.
+ *
+ * @param   outputLine
+ */
+char csv_handler_vertical_border_line(char **outputLine)
+{
+    if (*outputLine != NULL) {
+        free(*outputLine);
+        *outputLine = NULL;
+    }
+
+    *outputLine = malloc(sizeof(char) * width + 1); // Re-use width, so can
+    // change it if want to.
+
+    if (*outputLine == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; i < width; i++) {
+        (*outputLine)[i] = '*';
+    }
+
+    (*outputLine)[width] = '\0';
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Read the entirety of the file (that's desired) into memory so that can output
+ * it as transposed.
+ *
+ * @param   fields      Passed fields, if any.
+ */
+char csv_handler_initialize_transpose()
+{
+    if (entireInputLoaded) {
+        return CSV_HANDLER__ALREADY_SET;
+    }
+
+    char **parsedLine = NULL;
+    size_t *lens = NULL;
+
+    // Create lineNums array.  Use zero as terminator.
+    lineNums = malloc(sizeof(int));
+    lineNums[0] = 0;
+    int lineNumsCount = 1;
+
+    while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+        // Add to the store.  Columns that are mostly the same few values get
+        // kept as small codes instead of copies of the strings.
+        getParsedLine(&parsedLine, &lens);
+        if (parsedLine == NULL) {
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        }
+
+        if (csvh_store_add_row(parsedLine, lens) != CSVH_STORE__OK) {
+            free_csv_line(parsedLine);
+            free(lens);
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        }
+
+        free_csv_line(parsedLine);
+        free(lens);
+
+        // Append lineNums array.
+        lineNums = realloc(lineNums, sizeof(int) * ++lineNumsCount);
+
+        if (lineNums == NULL) {
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        }
+
+        lineNums[lineNumsCount - 2] = curLineNum;
+        lineNums[lineNumsCount - 1] = 0;
+    }
+
+    entireInputLoaded = 1;
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get transposed line to print to stdout.
+ *
+ * @param   outputLine
+ */
+char csv_handler_transposed_line(char **outputLine)
+{
+    // This one's very different.  Everything is already stored in memory in
+    // csvh-store, so go down the line from there.
+
+    static int ind = 0;
+
+    if (*outputLine != NULL) {
+        free(*outputLine);
+        *outputLine = NULL;
+    }
+
+    if (!entireInputLoaded) {
+        return CSV_HANDLER__LINE_IS_NULL;
+    }
+
+    if (csvh_store_get(0, ind, NULL) == NULL) {
+        return CSV_HANDLER__DONE;
+    }
+
+    int headerInd = (selectedFields == NULL) ? ind : selectedFields[ind];
+
+    if (headers[headerInd] == NULL) {
+        // If reach end of HEADERS, then force stop.  This unfortunately happens
+        // with files that have trailing commas at the end of the line.  That
+        // means that the file is malformed, but it happens so often that I
+        // don't want to just return an error code.
+        return CSV_HANDLER__DONE;
+    }
+
+    // If header is too wide to fit in the box with its [], cut it down so that
+    // the ] still fits.
+    int headerCols;
+    size_t headerLen = csvh_width_fit(
+        headers[headerInd],
+        strlen(headers[headerInd]),
+        width - 2,
+        &headerCols
+    );
+
+    char *headerDum = malloc(sizeof(char) * (headerLen + 3));
+    // Start with opening [, header, ], and null term.
+    if (headerDum == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+    headerDum[0] = '[';
+    memcpy(headerDum + 1, headers[headerInd], headerLen);
+    headerDum[headerLen + 1] = ']';
+    headerDum[headerLen + 2] = '\0';
+
+    // Every row goes on this one line, so keep track of where it ends instead
+    // of going back over it for every one.
+    size_t len = 0;
+    size_t cap = 0;
+    char rc = reserveOutput(outputLine, &len, &cap, 1);
+    if (rc != CSV_HANDLER__OK) {
+        free(headerDum);
+        return rc;
+    }
+    (*outputLine)[0] = '\0'; // Starting with empty string.
+
+    rc = appendBoxedValue(outputLine, &len, &cap, headerDum, headerLen + 2, 1);
+    free(headerDum);
+    if (rc != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    const char *value;
+    size_t valueLen;
+    for (int i = 0; i < csvh_store_row_count(); i++) {
+        if ((value = csvh_store_get(i, ind, &valueLen)) == NULL) {
+            // Short line.
+            value = "";
+            valueLen = 0;
+        }
+        if ((rc = appendBoxedValue(outputLine, &len, &cap, value, valueLen, 1)) != CSV_HANDLER__OK) {
+            return rc;
+        }
+    }
+
+    ind++;
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+   Get transposed line of line numbers to stdout.
+ */
+char csv_handler_transposed_number_line(char **outputLine)
+{
+    // Similar to csv_handler_transposed_line, but just using lineNums.
+
+    if (*outputLine != NULL) {
+        free (*outputLine);
+        *outputLine = NULL;
+    }
+
+    if (lineNums == NULL) {
+        return CSV_HANDLER__LINE_IS_NULL;
+    }
+
+    size_t len = 0;
+    size_t cap = 0;
+    char rc;
+    if ((rc = reserveOutput(outputLine, &len, &cap, 1)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    // First part is just empty space and sadness.
+    (*outputLine)[0] = '\0';
+    if ((rc = appendBoxedValue(outputLine, &len, &cap, "", 0, 0)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    int i = 0;
+    char *numStrDum;
+    int numStrLen;
+
+    while (lineNums[i] != 0) {
+        numStrLen = countDigits(lineNums[i]);
+        numStrDum = malloc(sizeof(char) * (numStrLen + 1));
+        if (numStrDum == NULL) {
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        }
+        sprintf(numStrDum, "%d", lineNums[i]);
+
+        if ((rc = appendBoxedValue(outputLine, &len, &cap, numStrDum, numStrLen, 0)) != CSV_HANDLER__OK) {
+            return rc;
+        }
+        free(numStrDum);
+        i++;
+    }
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get transposed border line to print to stdout.
+ *
+ * @param   outputLine
+ */
+char csv_handler_transposed_border_line(char **outputLine)
+{
+    if (*outputLine != NULL) {
+        free(*outputLine);
+        *outputLine = NULL;
+    }
+
+    if (!entireInputLoaded) {
+        return CSV_HANDLER__LINE_IS_NULL;
+    }
+
+    int len = csvh_store_row_count();
+    len++; // One more for headers.
+
+    len = (len * (width + 1));
+    // len is number of elements in first row, so multiply it by field width
+    // (plus one for |).
+
+    *outputLine = malloc(sizeof(char *) * (len + 1));
+
+    if (*outputLine == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; i < len - 1; i++) {
+        (*outputLine)[i] = '-';
+    }
+
+    (*outputLine)[len - 1] = '+';
+    (*outputLine)[len] = '\0';
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Change the width.
+ *
+ * @param   newWidth
+ */
+void csv_handler_set_width(int newWidth)
+{
+    width = newWidth;
+}
+
+/**
+ * Only look at a window of columns, from one column to another (inclusive),
+ * like "12-40" or "Start Time-End Time".  Columns can be given by header or
+ * by position (starting from 1), and either end can be left off to go all the
+ * way to that end.  A single column works too.
+ *
+ * This is like selecting every column in the window, except that lines only
+ * get parsed as far as the end of the window, and everything before it gets
+ * skipped over without being copied or unquoted, which is what makes it
+ * usable on lines with tens of thousands of values.
+ *
+ * @param   range
+ */
+char csv_handler_set_column_window(char *range)
+{
+    if (headers == NULL) {
+        return CSV_HANDLER__HEADERS_NOT_SET;
+    }
+    if (selectedFields != NULL) {
+        return CSV_HANDLER__ALREADY_SET;
+    }
+
+    int headerCount = 0;
+    for (; headers[headerCount] != NULL; headerCount++) {}
+
+    int first = getColumnFromString(range, headerCount);
+    int last = first;
+
+    // Headers can have dashes in them, so try every dash until both sides
+    // make sense.
+    for (char *dash = strchr(range, '-'); first == -1 && dash != NULL; dash = strchr(dash + 1, '-')) {
+        *dash = '\0';
+        first = (range[0] == '\0') ? 0 : getColumnFromString(range, headerCount);
+        last = (dash[1] == '\0') ? headerCount - 1 : getColumnFromString(dash + 1, headerCount);
+        *dash = '-';
+
+        if (last == -1) {
+            first = -1;
+        }
+    }
+
+    if (first == -1) {
+        return CSV_HANDLER__HEADER_NOT_FOUND;
+    }
+    if (last < first) {
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+
+    selectedFieldCount = last - first + 1;
+    selectedFields = malloc(sizeof(int) * (selectedFieldCount + 1));
+    if (selectedFields == NULL) {
+        selectedFieldCount = -1;
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; i < selectedFieldCount; i++) {
+        selectedFields[i] = first + i;
+    }
+    selectedFields[selectedFieldCount] = -1;
+
+    windowFirst = first;
+    windowLast = last;
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Set the selected fields.  (String input will be same as CSV format.)
+ *
+ * @param   fields
+ */
+char csv_handler_set_selected_fields(char *fields)
+{
+    if (headers == NULL) {
+        return CSV_HANDLER__HEADERS_NOT_SET;
+    }
+    if (selectedFields != NULL) {
+        return CSV_HANDLER__ALREADY_SET;
+    }
+    if (fields[0] == '\0') {
+        // Empty string, so do nothing.
+        return CSV_HANDLER__OK;
+    }
+
+    selectedFieldCount = count_fields(fields, ','); // Always use comma for this.
+    selectedFields = malloc(sizeof(int) * (getSelectedFieldCount() + 1));
+    char **fieldArr = parse_csv(fields, ','); // Always comma for this.
+
+    if (fieldArr == NULL) {
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+
+    for (int i = 0; fieldArr[i] != NULL; i++) {
+        selectedFields[i] = getHeaderIndexFromString(fieldArr[i]);
+        if (selectedFields[i] == -1) {
+            // Nothing was found, so return rc.
+            free_csv_line(fieldArr);
+            return CSV_HANDLER__HEADER_NOT_FOUND;
+        }
+    }
+
+    selectedFields[getSelectedFieldCount()] = -1;
+
+    free_csv_line(fieldArr);
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Close out everything.
+ */
+char csv_handler_close()
+{
+    if (headers != NULL) {
+        free_csv_line(headers);
+        headers = NULL;
+    }
+    freeHeaderIndex();
+    freeVerticalPrefixes();
+    freeJsonKeys();
+    csvh_store_close();
+    entireInputLoaded = 0;
+
+    free(line);
+    line = NULL;
+    free(selectedFields);
+    selectedFields = NULL;
+    windowFirst = -1;
+    windowLast = -1;
+    csvh_line_helper_close();
+    csvh_sort_close();
+    csvh_group_close();
+    csvh_sketch_close();
+    free(distinctColumn);
+    distinctColumn = NULL;
+    csvh_profile_close();
+    csvh_sample_close();
+    if (profileHeaders != NULL) {
+        free_csv_line(profileHeaders);
+        profileHeaders = NULL;
+    }
+    csvh_cache_close();
+    csvh_reader_close();
+    if (inputFd != STDIN_FILENO) {
+        close(inputFd);
+        inputFd = STDIN_FILENO;
+    }
+    csvh_files_close();
+    free(firstHeader);
+    firstHeader = NULL;
+
+    return CSV_HANDLER__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Read the next line from the input into memory, regardless of whether it
+ * gets skipped.
+ */
+static char readLine()
+{
+    if (line != NULL) {
+        free(line);
+        line = NULL;
+    }
+
+    if (lineBuff != NULL) {
+        // Have a line in memory being held, so just switch around the pointers.
+        // If it came from the cache, the cache hasn't moved on since.
+        line = lineBuff;
+        lineBuff = NULL;
+        rawRecord = line;
+        rawRecordLen = lineBuffLen;
+        countHeaders = countFields(line, rawRecordLen, delim);
+        lineFromCache = (cacheState == CACHE_STATE__ON);
+        return CSV_HANDLER__OK;
+    }
+
+    if (groupState == GROUP_STATE__SERVING) {
+        return readGroupLine();
+    }
+    if (groupState == GROUP_STATE__SKETCH) {
+        return readSketchLine();
+    }
+    if (groupState == GROUP_STATE__PROFILE) {
+        return readProfileLine();
+    }
+    if (groupState == GROUP_STATE__SAMPLE) {
+        return readSampleLine();
+    }
+
+    char rc;
+    if ((rc = openReader()) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    if (cacheState == CACHE_STATE__WANTED && (rc = openCache()) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    if (cacheState == CACHE_STATE__ON) {
+        return readCachedLine();
+    }
+
+    while (
+        (rc = csvh_reader_next_record(&rawRecord, &rawRecordLen)) == CSVH_READER__DONE
+        || rc == CSVH_READER__BAD_RECORD
+    ) {
+        char nextRc;
+        if (rc == CSVH_READER__BAD_RECORD) {
+            // The reader's already past it.
+            if ((nextRc = noteBadRecord()) != CSV_HANDLER__OK) {
+                return nextRc;
+            }
+            continue;
+        }
+
+        // Note that this should happen *after* the final line has already
+        // been read into memory.  If there's another file, keep going in it.
+        if ((nextRc = nextFile()) != CSV_HANDLER__OK) {
+            return nextRc;
+        }
+    }
+    if (rc != CSVH_READER__OK) {
+        return readerToHandlerRc(rc);
+    }
+
+    line = malloc(sizeof(char) * (rawRecordLen + 1));
+    if (line == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+    memcpy(line, rawRecord, rawRecordLen);
+    line[rawRecordLen] = '\0';
+
+    if (headers == NULL && hasHeaders && firstHeader == NULL && severalFiles()) {
+        // This is the headers, so the rest of the files need to match it.
+        if ((firstHeader = malloc(sizeof(char) * (rawRecordLen + 1))) == NULL) {
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        }
+        memcpy(firstHeader, line, rawRecordLen + 1);
+        firstHeaderLen = rawRecordLen;
+    }
+
+    countHeaders = countFields(line, rawRecordLen, delim);
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Read next line that isn't skipped into memory, straight from the input.
+ */
+static char readNextUnsorted()
+{
+    char rc;
+
+    while (1) {
+        if ((rc = readLine()) != CSV_HANDLER__OK) {
+            return rc;
+        }
+
+        if (!hasHeaders) {
+            // Take the line that was just found and stash it away, because
+            // we're going to print out the numerical headers first.
+            lineBuff = line;
+            lineBuffLen = rawRecordLen;
+            if ((rc = setHeadersAsNumbers()) != CSV_HANDLER__OK) {
+                return rc;
+            }
+            hasHeaders = 1; // Now have headers.  (Basically just don't want
+            // to come back here.)
+        }
+
+        // Determine if should skip, stop, print, or what-have-you.
+        switch (shouldSkip()) {
+            case CSVH_LINE_HELPER__SKIP:
+                continue;
+            case CSVH_LINE_HELPER__DONE:
+                if (linesPerFile && (rc = nextFile()) == CSV_HANDLER__OK) {
+                    // Only done with this file.
+                    continue;
+                }
+                return (rc == CSV_HANDLER__OK) ? CSV_HANDLER__DONE : rc;
+            case CSVH_LINE_HELPER__OK:
+                return CSV_HANDLER__OK;
+            case CSVH_LINE_HELPER__INVALID_INPUT:
+                return CSV_HANDLER__INVALID_INPUT;
+        }
+
+        return CSV_HANDLER__UNKNOWN_ERROR;
+    }
+}
+
+
+/**
+ * Read in every line that isn't skipped and hand it off to be sorted.
+ */
+static char gatherSorted()
+{
+    char rc;
+    char **parsedLine = NULL;
+
+    size_t *lens = NULL;
+
+    while ((rc = readNextUnsorted()) == CSV_HANDLER__OK) {
+        char *key = NULL;
+        size_t keyLen = 0;
+
+        if (lineFromCache) {
+            // Already split up, so no parsing.
+            key = csvh_cache_field(sortInd, &keyLen);
+        } else {
+            if ((parsedLine = parseFields(line, rawRecordLen, delim, &lens)) == NULL) {
+                return CSV_HANDLER__OUT_OF_MEMORY;
+            }
+            for (int i = 0; parsedLine[i] != NULL; i++) {
+                if (i == sortInd) {
+                    key = parsedLine[i];
+                    keyLen = lens[i];
+                    break;
+                }
+            }
+        }
+
+        if (key == NULL) {
+            key = "";
+            keyLen = 0;
+        }
+
+        long long offset;
+        long long end;
+        char terminated;
+        getRecordSpan(&offset, &end, &terminated);
+
+        // If the whole input is mapped, where the line is in it is enough to
+        // get it back later.  (Groups aren't in the input, though, and with
+        // several files, the file it's in will be closed by then.)
+        rc = csvh_sort_add(
+            key,
+            keyLen,
+            csvh_line_helper_get_line_num(),
+            (csvh_reader_is_mapped() && groupState == GROUP_STATE__NONE && !severalFiles())
+                ? NULL
+                : rawRecord,
+            rawRecordLen,
+            offset
+        );
+
+        if (parsedLine != NULL) {
+            free_csv_line(parsedLine);
+            parsedLine = NULL;
+            free(lens);
+            lens = NULL;
+        }
+
+        if (rc != CSVH_SORT__OK) {
+            return sortToHandlerRc(rc);
+        }
+    }
+
+    if (rc != CSV_HANDLER__DONE) {
+        return rc;
+    }
+
+    return sortToHandlerRc(csvh_sort_finish());
+}
+
+/**
+ * Hand every line that isn't skipped to onRecord, as a parsed line, after
+ * telling onStart how many chunks there will be.  If the input is a mapped
+ * file and the restrictions don't go by line numbers, the rest of the input
+ * gets split up between threads (see csvh-parallel.c), and onRecord gets
+ * called from all of them at once, each with its own chunk number, so it
+ * can't touch anything that isn't the chunk's own.  Otherwise, it's one line
+ * at a time in this thread, all as chunk 0.
+ *
+ * @param   onStart
+ * @param   onRecord
+ */
+static char gatherRecords(char (*onStart)(int chunkCount), char (*onRecord)(int chunk, char **fields))
+{
+    const char *data;
+    size_t len;
+    long long restStart = csvh_reader_position();
+    char rc;
+
+    if (
+        !csvh_reader_is_mapped()
+        || cacheState == CACHE_STATE__ON // Already split up, so faster as-is.
+        || csvh_line_helper_uses_line_nums()
+        || csvh_reader_take_rest(&data, &len) != CSVH_READER__OK
+    ) {
+        if ((rc = onStart(1)) != CSV_HANDLER__OK) {
+            return rc;
+        }
+
+        while ((rc = readNextUnsorted()) == CSV_HANDLER__OK) {
+            if ((rc = currentLineRecord(onRecord)) != CSV_HANDLER__OK) {
+                return rc;
+            }
+        }
+
+        return (rc == CSV_HANDLER__DONE) ? CSV_HANDLER__OK : rc;
+    }
+
+    int threads = (threadCount > 0) ? threadCount : csvh_parallel_default_threads();
+    int chunkCount = csvh_parallel_chunk_count(len, threads);
+    if (severalFiles()) {
+        // The files after this one could be any size.
+        chunkCount = csvh_parallel_chunk_count((size_t) -1, threads);
+    }
+
+    if ((rc = onStart(chunkCount)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    if (lineBuff != NULL) {
+        // With no headers, the first line was already read in and is being
+        // held on to.
+        if ((rc = readNextUnsorted()) == CSV_HANDLER__OK) {
+            rc = currentLineRecord(onRecord);
+        }
+        if (rc != CSV_HANDLER__OK && rc != CSV_HANDLER__DONE) {
+            return rc;
+        }
+    }
+
+    recordCallback = onRecord;
+    recordRcs = calloc(chunkCount, sizeof(char));
+    recordCounts = calloc(chunkCount, sizeof(int));
+
+    if (recordRcs != NULL && recordCounts != NULL) {
+        // One file at a time, each split up between the threads.  Chunk
+        // numbers get reused from file to file, which is fine, since whatever
+        // gets built up for a chunk only gets put together at the end.
+        while (1) {
+            int fileChunks = csvh_parallel_chunk_count(len, threads);
+            if (fileChunks > chunkCount) {
+                fileChunks = chunkCount;
+            }
+
+            rc = csvh_parallel_for_records(data, len, fileChunks, parallelRecord);
+            if (rc == CSVH_PARALLEL__UNBALANCED) {
+                // A stray quote somewhere, which only the reader knows what
+                // to do with, so give it back and go one line at a time.
+                // Nothing got handed out yet, so nothing gets done twice.
+                csvh_reader_rewind(restStart);
+                while ((rc = readNextUnsorted()) == CSV_HANDLER__OK) {
+                    if ((rc = currentLineRecord(recordCallback)) != CSV_HANDLER__OK) {
+                        break;
+                    }
+                }
+                break;
+            }
+            rc = (rc == CSVH_PARALLEL__OUT_OF_MEMORY) ? CSV_HANDLER__OUT_OF_MEMORY : CSV_HANDLER__OK;
+
+            for (int i = 0; i < fileChunks; i++) {
+                csvh_line_helper_count_lines(recordCounts[i]);
+                recordCounts[i] = 0;
+            }
+
+            // What went wrong in the threads comes first, since it's the
+            // reason they stopped.
+            for (int i = 0; i < fileChunks; i++) {
+                if (recordRcs[i] != CSV_HANDLER__OK) {
+                    rc = recordRcs[i];
+                    break;
+                }
+            }
+
+            if (rc != CSV_HANDLER__OK || (rc = nextFile()) != CSV_HANDLER__OK) {
+                break;
+            }
+
+            restStart = csvh_reader_position();
+            if (csvh_reader_take_rest(&data, &len) != CSVH_READER__OK) {
+                // Can't be split up (i.e., it's empty), so the rest go
+                // through here, one line at a time.
+                while ((rc = readNextUnsorted()) == CSV_HANDLER__OK) {
+                    if ((rc = currentLineRecord(recordCallback)) != CSV_HANDLER__OK) {
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+
+        if (rc == CSV_HANDLER__DONE) {
+            // Out of files.
+            rc = CSV_HANDLER__OK;
+        }
+    } else {
+        rc = CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    free(recordRcs);
+    recordRcs = NULL;
+    free(recordCounts);
+    recordCounts = NULL;
+    recordCallback = NULL;
+
+    return rc;
+}
+
+/**
+ * Parse a single record and hand it to recordCallback, if it isn't skipped.
+ * This is the callback for csvh_parallel_for_records, so it runs in the
+ * chunk's own thread, and can't touch anything that isn't the chunk's own.
+ *
+ * @param   chunk
+ * @param   record
+ * @param   recordLen
+ */
+static char parallelRecord(int chunk, const char *record, size_t recordLen)
+{
+    recordCounts[chunk]++;
+
+    if (!csvh_line_helper_passes_prefilter(record, recordLen)) {
+        return CSVH_PARALLEL__OK;
+    }
+
+    // Parsed right where it is, since the parser goes by length.  Lengths
+    // only matter if there's a null somewhere.
+    size_t *lens = NULL;
+    char **parsedLine = parseFields(
+        record,
+        recordLen,
+        delim,
+        (memchr(record, '\0', recordLen) == NULL) ? NULL : &lens
+    );
+    if (parsedLine == NULL) {
+        // Unparseable, so skipped, same as it would be otherwise.
+        return CSVH_PARALLEL__OK;
+    }
+
+    int critInd = csvh_line_helper_get_crit_ind();
+    char *critValue = (critInd == -1) ? NULL : getField(parsedLine, critInd);
+    size_t critLen = 0;
+    if (critValue != NULL) {
+        critLen = (lens == NULL) ? strlen(critValue) : lens[critInd];
+    }
+    char rc = CSV_HANDLER__OK;
+
+    if (
+        critInd == -1
+        || csvh_line_helper_value_matches(critValue, critLen) == CSVH_LINE_HELPER__OK
+    ) {
+        rc = recordCallback(chunk, parsedLine);
+    }
+
+    free_csv_line(parsedLine);
+    free(lens);
+
+    if (rc != CSV_HANDLER__OK) {
+        // Stop this chunk.  What went wrong gets sorted out after all the
+        // threads are done.
+        recordRcs[chunk] = rc;
+        return rc;
+    }
+
+    return CSVH_PARALLEL__OK;
+}
+
+/**
+ * Hand the current line to onRecord as chunk 0, from this thread.
+ *
+ * @param   onRecord
+ */
+static char currentLineRecord(char (*onRecord)(int chunk, char **fields))
+{
+    char rc;
+
+    if (lineFromCache) {
+        // Already split up, so no parsing.  The fields belong to the cache,
+        // so only the array gets freed.
+        char **fields = malloc(sizeof(char *) * (countHeaders + 1));
+        if (fields == NULL) {
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        }
+        for (int i = 0; i < countHeaders; i++) {
+            fields[i] = csvh_cache_field(i, NULL);
+            if (fields[i] == NULL) {
+                fields[i] = "";
+            }
+        }
+        fields[countHeaders] = NULL;
+
+        rc = onRecord(0, fields);
+
+        free(fields);
+        return rc;
+    }
+
+    char **parsedLine = parseFields(line, rawRecordLen, delim, NULL);
+    if (parsedLine == NULL) {
+        // Can't tell what's in it, so leave it out.
+        return CSV_HANDLER__OK;
+    }
+
+    rc = onRecord(0, parsedLine);
+
+    free_csv_line(parsedLine);
+
+    return rc;
+}
+
+/**
+ * Get csvh-group ready for the given number of chunks.  (For gatherRecords.)
+ *
+ * @param   chunkCount
+ */
+static char startGroups(int chunkCount)
+{
+    return groupToHandlerRc(csvh_group_init(chunkCount, groupMemBudget));
+}
+
+/**
+ * Add a parsed line to its group.  (For gatherRecords.)
+ *
+ * @param   chunk
+ * @param   fields
+ */
+static char addRecordToGroup(int chunk, char **fields)
+{
+    return groupToHandlerRc(addToGroup(chunk, getField(fields, groupKeyInd), getField(fields, groupSumInd)));
+}
+
+/**
+ * Add to a group.  Returns a csvh-group return code.  Lines missing the key
+ * column go in the group for the empty string.
+ *
+ * @param   table       The thread's own group table.
+ * @param   key         NULL if the line doesn't have the column.
+ * @param   sumValue    NULL if not adding up or the line doesn't have it.
+ */
+static char addToGroup(int table, char *key, char *sumValue)
+{
+    if (key == NULL) {
+        key = "";
+    }
+
+    double value = 0;
+    char hasValue = 0;
+
+    if (sumValue != NULL) {
+        char *eptr;
+        value = strtod(sumValue, &eptr);
+        hasValue = (eptr != sumValue);
+    }
+
+    return csvh_group_add(table, key, strlen(key), value, hasValue);
+}
+
+/**
+ * Read the next group into memory, as a line like any other.
+ */
+static char readGroupLine()
+{
+    const char *key;
+    long long count;
+    double sum;
+    char rc;
+
+    if ((rc = csvh_group_next(&key, &count, &sum)) != CSVH_GROUP__OK) {
+        return groupToHandlerRc(rc);
+    }
+
+    char countStr[32];
+    char sumStr[32];
+    snprintf(countStr, sizeof(countStr), "%lld", count);
+    snprintf(sumStr, sizeof(sumStr), "%.15g", sum);
+
+    char *values[4] = {NULL, NULL, NULL, NULL};
+    values[0] = strdup(key);
+    values[1] = strdup(countStr);
+    values[2] = (groupSumInd == -1) ? NULL : strdup(sumStr);
+
+    if (values[0] == NULL || values[1] == NULL || (groupSumInd != -1 && values[2] == NULL)) {
+        rc = CSV_HANDLER__OUT_OF_MEMORY;
+    } else {
+        rc = setLineFromValues(values);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        free(values[i]);
+    }
+
+    return rc;
+}
+
+/**
+ * Get csvh-profile ready for the given number of chunks.  (For
+ * gatherRecords.)
+ *
+ * @param   chunkCount
+ */
+static char startProfile(int chunkCount)
+{
+    return (csvh_profile_init(chunkCount) == CSVH_PROFILE__OK) ? CSV_HANDLER__OK : CSV_HANDLER__OUT_OF_MEMORY;
+}
+
+/**
+ * Add a parsed line to the column profiles.  (For gatherRecords.)
+ *
+ * @param   chunk
+ * @param   fields
+ */
+static char addRecordToProfile(int chunk, char **fields)
+{
+    return (csvh_profile_add_row(chunk, fields) == CSVH_PROFILE__OK) ? CSV_HANDLER__OK : CSV_HANDLER__OUT_OF_MEMORY;
+}
+
+/**
+ * Read the next column's profile into memory, as a line like any other.
+ */
+static char readProfileLine()
+{
+    char *values[CSVH_PROFILE__FIELD_COUNT + 2];
+    char rc;
+
+    if ((rc = csvh_profile_describe(profileCol, values + 1)) != CSVH_PROFILE__OK) {
+        return (rc == CSVH_PROFILE__DONE) ? CSV_HANDLER__DONE : CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    // Columns past the end of the headers (from lines longer than the first)
+    // go by number.
+    char *header = NULL;
+    for (int i = 0; profileHeaders[i] != NULL; i++) {
+        if (i == profileCol) {
+            header = profileHeaders[i];
+            break;
+        }
+    }
+
+    char numStr[32];
+    if (header == NULL) {
+        snprintf(numStr, sizeof(numStr), "%d", profileCol + 1);
+        header = numStr;
+    }
+
+    values[0] = strdup(header);
+    values[CSVH_PROFILE__FIELD_COUNT + 1] = NULL;
+
+    rc = (values[0] == NULL) ? CSV_HANDLER__OUT_OF_MEMORY : setLineFromValues(values);
+
+    for (int i = 0; i < CSVH_PROFILE__FIELD_COUNT + 1; i++) {
+        free(values[i]);
+    }
+
+    profileCol++;
+
+    return rc;
+}
+
+/**
+ * Pick the sample, either by jumping around the mapped file or by going
+ * through every line that isn't skipped.
+ */
+static char gatherSample()
+{
+    const char *data;
+    size_t len;
+    char rc;
+
+    long long pos = csvh_reader_position();
+
+    if (
+        lineBuff == NULL // Otherwise the first line would never get a chance.
+        && cacheState != CACHE_STATE__ON
+        && csvh_line_helper_get_crit_ind() == -1
+        && !csvh_line_helper_uses_line_nums()
+        && !severalFiles() // Picks need to be spread over all of them.
+        && csvh_reader_take_rest(&data, &len) == CSVH_READER__OK
+    ) {
+        if ((rc = csvh_sample_seek(data, len, delim, quoting)) != CSVH_SAMPLE__TOO_SMALL) {
+            return (rc == CSVH_SAMPLE__OK) ? CSV_HANDLER__OK : CSV_HANDLER__OUT_OF_MEMORY;
+        }
+        // Not enough lines to be worth it, so go back and read through them.
+        if (csvh_reader_rewind(pos) != CSVH_READER__OK) {
+            return CSV_HANDLER__UNKNOWN_ERROR;
+        }
+    }
+
+    while ((rc = readNextUnsorted()) == CSV_HANDLER__OK) {
+        // Line instead of rawRecord, since the reader might have moved on.
+        if (csvh_sample_add(line, strlen(line)) != CSVH_SAMPLE__OK) {
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        }
+    }
+
+    return (rc == CSV_HANDLER__DONE) ? CSV_HANDLER__OK : rc;
+}
+
+/**
+ * Read the next picked line into memory.
+ */
+static char readSampleLine()
+{
+    const char *record;
+    size_t recordLen;
+
+    if (csvh_sample_next(&record, &recordLen) != CSVH_SAMPLE__OK) {
+        return CSV_HANDLER__DONE;
+    }
+
+    line = malloc(sizeof(char) * (recordLen + 1));
+    if (line == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+    memcpy(line, record, recordLen);
+    line[recordLen] = '\0';
+
+    rawRecord = record;
+    rawRecordLen = recordLen;
+    countHeaders = countFields(line, rawRecordLen, delim);
+    lineFromCache = 0;
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Count every value in a column, of the lines that aren't skipped, for either
+ * distinct values (k is 0) or the k most common values.
+ *
+ * @param   header
+ * @param   k
+ */
+static char gatherSketch(char *header, int k)
+{
+    if (headers == NULL) {
+        return CSV_HANDLER__HEADERS_NOT_SET;
+    }
+    if (groupState != GROUP_STATE__NONE || sortState != SORT_STATE__NONE || selectedFields != NULL) {
+        return CSV_HANDLER__ALREADY_SET;
+    }
+    if (csvh_reader_is_following()) {
+        // Would never be done counting.
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+
+    int ind = getHeaderIndexFromString(header);
+    if (ind == -1) {
+        return CSV_HANDLER__HEADER_NOT_FOUND;
+    }
+
+    char rc = (k == 0) ? csvh_sketch_init_distinct() : csvh_sketch_init_top_k(k);
+    if (rc != CSVH_SKETCH__OK) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    while ((rc = readNextUnsorted()) == CSV_HANDLER__OK) {
+        char **parsedLine = NULL;
+        size_t *lens = NULL;
+        char *value;
+        size_t valueLen = 0;
+
+        if (lineFromCache) {
+            // Already split up, so no parsing.
+            value = csvh_cache_field(ind, &valueLen);
+        } else {
+            if ((parsedLine = parseFields(line, rawRecordLen, delim, &lens)) == NULL) {
+                // Unparseable, so leave it out.
+                continue;
+            }
+            if ((value = getField(parsedLine, ind)) != NULL) {
+                valueLen = lens[ind];
+            }
+        }
+
+        if (value == NULL) {
+            // Same as grouping: missing counts as empty.
+            value = "";
+            valueLen = 0;
+        }
+
+        rc = csvh_sketch_add(value, valueLen);
+
+        if (parsedLine != NULL) {
+            free_csv_line(parsedLine);
+            free(lens);
+        }
+
+        if (rc != CSVH_SKETCH__OK) {
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        }
+    }
+
+    if (rc != CSV_HANDLER__DONE) {
+        return rc;
+    }
+
+    if (csvh_sketch_finish() != CSVH_SKETCH__OK) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Get the blank padding for lines without numbers (like borders).
- *
- * @param   outputString
+ * Read the next estimate from csvh-sketch into memory, as a line like any
+ * other.
  */
-char csv_handler_output_line_padding(char **outputString)
+static char readSketchLine()
 {
-    if (*outputString != NULL) {
-        free(*outputString);
-        *outputString = NULL;
+    char countStr[32];
+    char errorStr[32];
+    char *values[4] = {NULL, NULL, NULL, NULL};
+    char rc;
+
+    if (distinctColumn != NULL) {
+        snprintf(countStr, sizeof(countStr), "%lld", csvh_sketch_distinct_estimate());
+        values[0] = distinctColumn;
+        distinctColumn = NULL;
+        values[1] = strdup(countStr);
+    } else {
+        const char *value;
+        long long count;
+        long long error;
+
+        if ((rc = csvh_sketch_next(&value, &count, &error)) != CSVH_SKETCH__OK) {
+            return (rc == CSVH_SKETCH__DONE) ? CSV_HANDLER__DONE : CSV_HANDLER__UNKNOWN_ERROR;
+        }
+
+        snprintf(countStr, sizeof(countStr), "%lld", count);
+        snprintf(errorStr, sizeof(errorStr), "%lld", error);
+        values[0] = strdup(value);
+        values[1] = strdup(countStr);
+        if ((values[2] = strdup(errorStr)) == NULL) {
+            free(values[0]);
+            values[0] = NULL; // So it gets caught below.
+        }
     }
 
-    *outputString = malloc(sizeof(char) * linePad + 1);
-    if (*outputString == NULL) {
-        return CSV_HANDLER__OUT_OF_MEMORY;
+    if (values[0] == NULL || values[1] == NULL) {
+        rc = CSV_HANDLER__OUT_OF_MEMORY;
+    } else {
+        rc = setLineFromValues(values);
     }
-    for (int i = 0; i < linePad; i++) {
-        (*outputString)[i] = ' ';
+
+    for (int i = 0; i < 3; i++) {
+        free(values[i]);
     }
-    (*outputString)[linePad] = '\0';
 
-    return CSV_HANDLER__OK;
+    return rc;
 }
 
 /**
- * Get border to print out.
+ * Replace the headers with new ones, for when the lines being handed out
+ * aren't the ones from the input anymore (grouping and the like), and make
+ * them the current line, same as the real headers would be.  Also drops the
+ * restrictions, since they've already been applied.
  *
- * @param   outputLine
+ * @param   names   NULL-terminated.
  */
-char csv_handler_border_line(char **outputLine)
+static char setSummaryHeaders(const char **names)
 {
-    if (countHeaders == -1) {
-        return CSV_HANDLER__LINE_IS_NULL; // Not sure what else to call this.
+    int count = 0;
+    for (; names[count] != NULL; count++) {}
+
+    // Two copies: one for the headers, and one for the line, which gets
+    // quoted.
+    char **newHeaders = calloc(count + 1, sizeof(char *));
+    char **values = calloc(count + 1, sizeof(char *));
+    char rc = (newHeaders == NULL || values == NULL) ? CSV_HANDLER__OUT_OF_MEMORY : CSV_HANDLER__OK;
+
+    for (int i = 0; rc == CSV_HANDLER__OK && i < count; i++) {
+        newHeaders[i] = strdup(names[i]);
+        values[i] = strdup(names[i]);
+        if (newHeaders[i] == NULL || values[i] == NULL) {
+            rc = CSV_HANDLER__OUT_OF_MEMORY;
+        }
     }
 
-    if (*outputLine != NULL) {
-        free(*outputLine);
-        *outputLine = NULL;
+    if (rc != CSV_HANDLER__OK) {
+        // Not free_csv_line, since there might be a NULL before the end.
+        for (int i = 0; newHeaders != NULL && values != NULL && i < count; i++) {
+            free(newHeaders[i]);
+            free(values[i]);
+        }
+        free(newHeaders);
+        free(values);
+        return rc;
     }
 
-    int lineLen = (width + 1) * getSelectedFieldCount() + 1;
-    // I almost wanted to name this "linLen" because then it would be pronounced
-    // "len-len" and that would be funny.
-    // (width + 1) is the width of every field plus its left brace.
-    // + 2 is one for rightmost brace.
-    // Null terminator is *not* included here, because want to match what the
-    // result of strlen would be.
-
-    *outputLine = malloc(sizeof(char) * (lineLen + 1));
+    // From here on, none of the lines get skipped.
+    csvh_line_helper_reset();
 
-    if (*outputLine == NULL) {
-        return CSV_HANDLER__OUT_OF_MEMORY;
+    free_csv_line(headers);
+    headers = newHeaders;
+    if ((rc = indexHeaders()) != CSV_HANDLER__OK) {
+        free_csv_line(values);
+        return rc;
     }
 
-    (*outputLine)[0] = '+';
-
-    for (int i = 1; i < lineLen - 1; i++) {
-        (*outputLine)[i] = '-';
-    }
-    (*outputLine)[lineLen - 1] = '+';
-    (*outputLine)[lineLen] = '\0';
+    rc = setLineFromValues(values);
+    free_csv_line(values);
 
-    return CSV_HANDLER__OK;
+    return rc;
 }
 
 /**
- * Get *vertical* entry to print to stdout.
- *
- * This is not a single line, so behavior is inconsistent.  It's the entirety of
- * an entry, line breaks and all.
+ * Set the current line from a NULL-terminated array of values, which get
+ * quoted as needed.
  *
- * @param   outputEntry
+ * @param   values
  */
-char csv_handler_output_vertical_entry(char **outputEntry)
+static char setLineFromValues(char **values)
 {
-    if (*outputEntry != NULL) {
-        free(*outputEntry);
-        *outputEntry = NULL;
-    }
+    size_t len = 0;
 
-    if (line == NULL) {
-        return CSV_HANDLER__LINE_IS_NULL;
+    for (int i = 0; values[i] != NULL; i++) {
+        len += unparseValue(values[i], strlen(values[i]), NULL) + 1;
     }
 
-    if (headers == NULL) {
-        return CSV_HANDLER__HEADERS_NOT_SET;
+    free(line);
+    line = malloc(sizeof(char) * (len + 1));
+    if (line == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
-    char **parsedLine = NULL;
-    getParsedLine(&parsedLine);
-
-    *outputEntry = malloc(sizeof(char));
-    (*outputEntry)[0] = '\0';
-
-    for (int i = 0; parsedLine[i] != NULL && headers[i] != NULL; i++) {
-        *outputEntry = realloc(
-            *outputEntry,
-            strlen(*outputEntry)
-            + strlen(parsedLine[i])
-            + strlen(headers[i])
-            + (i == 0 ? 3 : 4)
-        );
-        // +1 for null term, +1 for line break, +2 for ": "
-        if (i != 0) {
-            strcat(*outputEntry, "\n");
+    size_t used = 0;
+    for (int i = 0; values[i] != NULL; i++) {
+        if (i > 0) {
+            line[used++] = delim;
         }
-        strcat(*outputEntry, getHeaderFromPosition(i));
-        strcat(*outputEntry, ": ");
-        strcat(*outputEntry, parsedLine[i]);
+        used += unparseValue(values[i], strlen(values[i]), line + used);
     }
+    line[used] = '\0';
 
-    free_csv_line(parsedLine);
+    rawRecord = line;
+    rawRecordLen = used;
+    countHeaders = countFields(line, rawRecordLen, delim);
+    lineFromCache = 0;
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Get border line for vertical entry.
- *
- * @param   outputLine
+ * Read next line in sorted order into memory.
  */
-char csv_handler_vertical_border_line(char **outputLine)
+static char readNextSorted()
 {
-    if (*outputLine != NULL) {
-        free(*outputLine);
-        *outputLine = NULL;
-    }
+    const char *record;
+    size_t recordLen;
+    long long offset;
+    char rc;
 
-    *outputLine = malloc(sizeof(char) * width + 1); // Re-use width, so can
-    // change it if want to.
+    if ((rc = csvh_sort_next(&record, &recordLen, &offset, &curLineNum)) != CSVH_SORT__OK) {
+        return sortToHandlerRc(rc);
+    }
 
-    if (*outputLine == NULL) {
-        return CSV_HANDLER__OUT_OF_MEMORY;
+    if (record == NULL && csvh_reader_view(offset, recordLen, &record) != CSVH_READER__OK) {
+        return CSV_HANDLER__UNKNOWN_ERROR;
     }
 
-    for (int i = 0; i < width; i++) {
-        (*outputLine)[i] = '*';
+    free(line);
+    line = malloc(sizeof(char) * (recordLen + 1));
+    if (line == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
     }
+    memcpy(line, record, recordLen);
+    line[recordLen] = '\0';
 
-    (*outputLine)[width] = '\0';
+    rawRecord = record;
+    rawRecordLen = recordLen;
+    countHeaders = countFields(line, rawRecordLen, delim);
+    lineFromCache = 0;
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Read the entirety of the file (that's desired) into memory so that can output
- * it as transposed.
- *
- * @param   fields      Passed fields, if any.
+ * Open the reader on stdin, or the first file if there are files, if it isn't
+ * already.
  */
-char csv_handler_initialize_transpose()
+static char openReader()
 {
-    if (entireInput != NULL) {
-        return CSV_HANDLER__ALREADY_SET;
+    if (readerIsOpen) {
+        return CSV_HANDLER__OK;
     }
 
-    char **parsedLine = NULL;
-    int arrLen = 0;
-    char rc = 0;
-
-    // Create lineNums array.  Use zero as terminator.
-    lineNums = malloc(sizeof(int));
-    lineNums[0] = 0;
-    int lineNumsCount = 1;
-
-    while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
-        // Append entireInput array.
-        getParsedLine(&parsedLine);
-        arrLen++;
-        entireInput = realloc(entireInput, sizeof(char ***) * arrLen);
-        entireInput[arrLen - 1] = NULL;
+    char rc;
 
-        if (entireInput == NULL) {
+    if (inputPaths != NULL) {
+        if (csvh_files_open(inputPaths, inputPathCount) != CSVH_FILES__OK) {
             return CSV_HANDLER__OUT_OF_MEMORY;
         }
-
-        if ((rc = copyArrayOfStrings(&(entireInput[arrLen - 1]), &parsedLine, NULL))) {
-            return rc;
+        if ((rc = openNextFile()) != CSV_HANDLER__OK) {
+            // Not even one file is the same as an empty one.
+            return (rc == CSV_HANDLER__DONE) ? CSV_HANDLER__FILE_NOT_FOUND : rc;
         }
+        readerIsOpen = 1;
+        return CSV_HANDLER__OK;
+    }
 
-        free_csv_line(parsedLine);
+    if ((rc = csvh_reader_open(STDIN_FILENO)) != CSVH_READER__OK) {
+        return readerToHandlerRc(rc);
+    }
+    readerIsOpen = 1;
 
-        // Append lineNums array.
-        lineNums = realloc(lineNums, sizeof(int) * ++lineNumsCount);
+    return CSV_HANDLER__OK;
+}
 
-        if (lineNums == NULL) {
-            return CSV_HANDLER__OUT_OF_MEMORY;
-        }
+/**
+ * Open the reader on the next of the files.
+ */
+static char openNextFile()
+{
+    const char *path;
+    char rc = csvh_files_next(&inputFd, &path);
 
-        lineNums[lineNumsCount - 2] = csvh_line_helper_get_line_num();
-        lineNums[lineNumsCount - 1] = 0;
+    if (rc == CSVH_FILES__DONE) {
+        inputFd = STDIN_FILENO;
+        return CSV_HANDLER__DONE;
     }
 
-    entireInput = realloc(entireInput, sizeof(char ***) * (arrLen + 1));
+    snprintf(inputName, sizeof(inputName), "%s", path);
 
-    if (entireInput == NULL) {
-        return CSV_HANDLER__OUT_OF_MEMORY;
+    if (rc != CSVH_FILES__OK) {
+        inputFd = STDIN_FILENO;
+        return CSV_HANDLER__FILE_NOT_FOUND;
     }
 
-    entireInput[arrLen] = NULL;
-
-    return CSV_HANDLER__OK;
+    return readerToHandlerRc(csvh_reader_open(inputFd));
 }
 
 /**
- * Get transposed line to print to stdout.
- *
- * @param   outputLine
+ * Go on to the next file, if there are files.  Its headers get checked
+ * against the first file's and then skipped, so the next record is the first
+ * line after them.  DONE if that was the last file (or it's stdin).
  */
-char csv_handler_transposed_line(char **outputLine)
+static char nextFile()
 {
-    // This one's very different.  Everything is already stored in memory in
-    // entireInput, so go down the line from there.
+    if (inputPaths == NULL || csvh_files_remaining() == 0) {
+        // Leave the last one open, since things like views still need it.
+        return CSV_HANDLER__DONE;
+    }
 
-    static int ind = 0;
+    csvh_reader_close();
+    close(inputFd);
 
-    if (*outputLine != NULL) {
-        free(*outputLine);
-        *outputLine = NULL;
+    char rc;
+    if ((rc = openNextFile()) != CSV_HANDLER__OK) {
+        return rc;
     }
 
-    if (entireInput == NULL) {
-        return CSV_HANDLER__LINE_IS_NULL;
-    }
+    int skipped;
+    csvh_reader_skip_records(skippedLines, &skipped);
 
-    if (entireInput[0][ind] == NULL) {
-        return CSV_HANDLER__DONE;
+    if (linesPerFile) {
+        csvh_line_helper_restart_lines();
     }
 
-    int headerInd = (selectedFields == NULL) ? ind : selectedFields[ind];
-
-    if (headers[headerInd] == NULL) {
-        // If reach end of HEADERS, then force stop.  This unfortunately happens
-        // with files that have trailing commas at the end of the line.  That
-        // means that the file is malformed, but it happens so often that I
-        // don't want to just return an error code.
-        return CSV_HANDLER__DONE;
+    if (firstHeader == NULL) {
+        // No headers (or the first files were empty, in which case this
+        // file's first line is the headers).
+        return CSV_HANDLER__OK;
     }
 
-    char *headerDum = malloc(sizeof(char) * (strlen(headers[headerInd]) + 3));
-    // Start with opening [, header, ], and null term.
-    // This technically wastes memory because if it's a long header, only part
-    // of what's allocated here will actually be used.  But, the code's slightly
-    // easier this way.
-    strcpy(headerDum, "[");
-    strcat(headerDum, headers[headerInd]);
-    strcat(headerDum, "]");
-
-    *outputLine = malloc(sizeof(char));
-    if (*outputLine == NULL) {
-        return CSV_HANDLER__OUT_OF_MEMORY;
+    const char *record;
+    size_t recordLen;
+    if ((rc = csvh_reader_next_record(&record, &recordLen)) == CSVH_READER__DONE) {
+        // Empty file, so nothing to mismatch.
+        return CSV_HANDLER__OK;
+    }
+    if (rc == CSVH_READER__BAD_RECORD) {
+        // Can't tell if the headers match if they can't even be read.
+        noteBadRecord();
+        return CSV_HANDLER__BAD_RECORD;
+    }
+    if (rc != CSVH_READER__OK) {
+        return readerToHandlerRc(rc);
     }
-    (*outputLine)[0] = '\0'; // Starting with empty string.
 
-    char rc = 0;
+    return sameAsFirstHeader(record, recordLen) ? CSV_HANDLER__OK : CSV_HANDLER__HEADER_MISMATCH;
+}
 
-    if ((rc = appendBoxedValue(outputLine, headerDum, 1)) != CSV_HANDLER__OK) {
-        return rc;
+/**
+ * Determine if a record has the same headers as the first file.  They don't
+ * have to be byte-for-byte the same, just have the same values (i.e., one
+ * might quote everything).
+ *
+ * @param   record
+ * @param   recordLen
+ */
+static char sameAsFirstHeader(const char *record, size_t recordLen)
+{
+    if (recordLen == firstHeaderLen && memcmp(record, firstHeader, recordLen) == 0) {
+        return 1;
     }
-    free(headerDum);
 
-    if ((*outputLine)[width - 1] != ' ') {
-        // If header is too wide to fix in box, set its last character to ].
-        (*outputLine)[width - 1] = ']';
+    char **these = parseFields(record, recordLen, delim, NULL);
+    char **first = parseFields(firstHeader, firstHeaderLen, delim, NULL);
+    char same = (these != NULL && first != NULL);
+
+    for (int i = 0; same && (these[i] != NULL || first[i] != NULL); i++) {
+        same = these[i] != NULL && first[i] != NULL && strcmp(these[i], first[i]) == 0;
     }
 
-    for (int i = 0; entireInput[i] != NULL; i++) {
-        if ((rc = appendBoxedValue(outputLine, entireInput[i][ind], 1)) != CSV_HANDLER__OK) {
-            return rc;
-        }
+    if (these != NULL) {
+        free_csv_line(these);
+    }
+    if (first != NULL) {
+        free_csv_line(first);
     }
 
-    ind++;
+    return same;
+}
 
-    return CSV_HANDLER__OK;
+/**
+ * Determine if the input is more than one file.
+ */
+static char severalFiles()
+{
+    return csvh_files_count() > 1;
 }
 
 /**
-   Get transposed line of line numbers to stdout.
+ * Open the binary cache, and build it first if there isn't a good one.  The
+ * reader has to be open already, and at the first line.  If there's any
+ * problem with the cache, just go on without it.
  */
-char csv_handler_transposed_number_line(char **outputLine)
+static char openCache()
 {
-    // Similar to csv_handler_transposed_line, but just using lineNums.
+    cacheState = CACHE_STATE__OFF; // Unless everything works out.
 
-    if (*outputLine != NULL) {
-        free (*outputLine);
-        *outputLine = NULL;
+    if (!csvh_reader_is_mapped() || severalFiles()) {
+        // Building it needs two passes, so only files that are mapped.  And
+        // there's only one cache, so only one file.
+        return CSV_HANDLER__OK;
     }
 
-    if (lineNums == NULL) {
-        return CSV_HANDLER__LINE_IS_NULL;
+    long long start = csvh_reader_position();
+    char rc = csvh_cache_open(inputFd, start, delim, quoting);
+
+    if (rc == CSVH_CACHE__MISS) {
+        // Both passes go over the same records.
+        const char *record;
+        size_t recordLen;
+        char readerRc = CSVH_READER__OK;
+
+        for (int pass = 0; pass < 2 && rc != CSVH_CACHE__IO_ERROR; pass++) {
+            csvh_reader_rewind(start);
+            rc = CSVH_CACHE__OK;
+            while (
+                rc == CSVH_CACHE__OK
+                && (readerRc = csvh_reader_next_record(&record, &recordLen)) == CSVH_READER__OK
+            ) {
+                rc = csvh_cache_add(
+                    record,
+                    recordLen,
+                    csvh_reader_record_offset(),
+                    csvh_reader_record_end()
+                );
+            }
+            if (rc == CSVH_CACHE__OK && readerRc != CSVH_READER__DONE) {
+                // A malformed line (or a read error) would leave the cache
+                // ending there, so give up on it, and let reading it normally
+                // deal with that line the usual way.
+                rc = CSVH_CACHE__UNAVAILABLE;
+            }
+            if (rc == CSVH_CACHE__OK) {
+                rc = csvh_cache_end_pass();
+            }
+            if (rc != CSVH_CACHE__OK) {
+                break;
+            }
+        }
+
+        csvh_reader_rewind(start);
     }
 
-    *outputLine = malloc(sizeof(char));
-    if (*outputLine == NULL) {
+    if (rc == CSVH_CACHE__OUT_OF_MEMORY) {
+        csvh_cache_close();
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
-    // First part is just empty space and sadness.
-    char rc;
-    (*outputLine)[0] = '\0';
-    if ((rc = appendBoxedValue(outputLine, "", 0)) != CSV_HANDLER__OK) {
-        return rc;
+    if (rc != CSVH_CACHE__OK) {
+        // Can't cache this, so just read it normally.
+        csvh_cache_close();
+        return CSV_HANDLER__OK;
     }
 
-    int i = 0;
-    char *numStrDum;
-    int numStrLen;
-
-    while (lineNums[i] != 0) {
-        numStrLen = countDigits(lineNums[i]);
-        numStrDum = malloc(sizeof(char) * (numStrLen + 1));
-        if (numStrDum == NULL) {
-            return CSV_HANDLER__OUT_OF_MEMORY;
-        }
-        sprintf(numStrDum, "%d", lineNums[i]);
-
-        if ((rc = appendBoxedValue(outputLine, numStrDum, 0)) != CSV_HANDLER__OK) {
-            return rc;
-        }
-        free(numStrDum);
-        i++;
-    }
+    cacheState = CACHE_STATE__ON;
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Get transposed border line to print to stdout.
- *
- * @param   outputLine
+ * Read the next line from the cache.  The line itself still gets copied out
+ * of the input, since raw output and the line restrictions want it, but it
+ * never gets parsed.
  */
-char csv_handler_transposed_border_line(char **outputLine)
+static char readCachedLine()
 {
-    if (*outputLine != NULL) {
-        free(*outputLine);
-        *outputLine = NULL;
+    char rc;
+    if ((rc = csvh_cache_next_row()) != CSVH_CACHE__OK) {
+        return (rc == CSVH_CACHE__DONE) ? CSV_HANDLER__DONE : CSV_HANDLER__UNKNOWN_ERROR;
     }
 
-    if (entireInput == NULL) {
-        return CSV_HANDLER__LINE_IS_NULL;
+    long long offset;
+    long long end;
+    csvh_cache_row(&offset, &rawRecordLen, &end);
+    if (csvh_reader_view(offset, rawRecordLen, &rawRecord) != CSVH_READER__OK) {
+        return CSV_HANDLER__UNKNOWN_ERROR;
     }
 
-    int len = 0;
-
-    // Count up the number of fields in the array.
-    for (;entireInput[++len] != NULL;){};
-    len++; // One more for headers.
-
-    len = (len * (width + 1));
-    // len is number of elements in first row, so multiply it by field width
-    // (plus one for |).
-
-    *outputLine = malloc(sizeof(char *) * (len + 1));
-
-    if (*outputLine == NULL) {
+    line = malloc(sizeof(char) * (rawRecordLen + 1));
+    if (line == NULL) {
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
+    memcpy(line, rawRecord, rawRecordLen);
+    line[rawRecordLen] = '\0';
 
-    for (int i = 0; i < len - 1; i++) {
-        (*outputLine)[i] = '-';
+    countHeaders = csvh_cache_field_count();
+    lineFromCache = 1;
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Ask csvh-line-helper if the current line should be skipped.  If the line
+ * came from the cache, it only needs the one value that it's checking.
+ */
+static char shouldSkip()
+{
+    if (!lineFromCache) {
+        return csvh_line_helper_should_skip(line, rawRecordLen);
     }
 
-    (*outputLine)[len - 1] = '+';
-    (*outputLine)[len] = '\0';
+    int critInd = csvh_line_helper_get_crit_ind();
+    size_t critLen = 0;
+    char *critValue = (critInd == -1) ? NULL : csvh_cache_field(critInd, &critLen);
 
-    return CSV_HANDLER__OK;
+    return csvh_line_helper_should_skip_value(critValue, critLen);
 }
 
 /**
- * Change the width.
+ * Get where the current line is in the input: its start, just past its line
+ * break, and whether it has a line break.
  *
- * @param   newWidth
+ * @param   offset
+ * @param   end
+ * @param   terminated
  */
-void csv_handler_set_width(int newWidth)
+static void getRecordSpan(long long *offset, long long *end, char *terminated)
 {
-    width = newWidth;
+    if (!lineFromCache) {
+        *offset = csvh_reader_record_offset();
+        *end = csvh_reader_record_end();
+        *terminated = csvh_reader_record_terminated();
+        return;
+    }
+
+    size_t len;
+    csvh_cache_row(offset, &len, end);
+    *terminated = (*end > *offset + (long long) len);
 }
 
 /**
- * Set the selected fields.  (String input will be same as CSV format.)
+ * Determine if the current line ended in \r\n in the input.  The \r isn't
+ * part of rawRecord, so the span of the input it came from is 2 bytes longer
+ * than it.
+ */
+static char recordEndsInCrlf()
+{
+    long long offset;
+    long long end;
+    char terminated;
+    getRecordSpan(&offset, &end, &terminated);
+
+    return terminated && end - offset == (long long) rawRecordLen + 2;
+}
+
+/**
+ * Same as getParsedLine, but for a line from the cache.  Only the selected
+ * fields get looked at.
  *
- * @param   fields
+ * @param   parsedLine
+ * @param   lens
  */
-char csv_handler_set_selected_fields(char *fields)
+static char getCachedParsedLine(char ***parsedLine, size_t **lens)
 {
-    if (headers == NULL) {
-        return CSV_HANDLER__HEADERS_NOT_SET;
-    }
-    if (selectedFields != NULL) {
-        return CSV_HANDLER__ALREADY_SET;
-    }
-    if (fields[0] == '\0') {
-        // Empty string, so do nothing.
-        return CSV_HANDLER__OK;
+    int count = getSelectedFieldCount();
+    if (count < 0) {
+        // Couldn't be parsed.
+        count = 0;
     }
 
-    selectedFieldCount = count_fields(fields, ','); // Always use comma for this.
-    selectedFields = malloc(sizeof(int) * (getSelectedFieldCount() + 1));
-    char **fieldArr = parse_csv(fields, ','); // Always comma for this.
-
-    if (fieldArr == NULL) {
-        return CSV_HANDLER__INVALID_INPUT;
+    *parsedLine = calloc(count + 1, sizeof(char *));
+    if (*parsedLine == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+    if (lens != NULL && (*lens = malloc(sizeof(size_t) * (count + 1))) == NULL) {
+        free(*parsedLine);
+        *parsedLine = NULL;
+        return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
-    for (int i = 0; fieldArr[i] != NULL; i++) {
-        selectedFields[i] = -1;
-        for (int j = 0; headers[j] != NULL; j++) {
-            if (strcmp(fieldArr[i], headers[j]) == 0) {
-                selectedFields[i] = j;
+    for (int i = 0; i < count; i++) {
+        size_t fieldLen = 0;
+        char *field = csvh_cache_field((selectedFields == NULL) ? i : selectedFields[i], &fieldLen);
+        if (field == NULL) {
+            field = "";
+            fieldLen = 0;
+        }
+        if (((*parsedLine)[i] = malloc(sizeof(char) * (fieldLen + 1))) == NULL) {
+            free_csv_line(*parsedLine);
+            *parsedLine = NULL;
+            if (lens != NULL) {
+                free(*lens);
+                *lens = NULL;
             }
+            return CSV_HANDLER__OUT_OF_MEMORY;
         }
-        if (selectedFields[i] == -1) {
-            // Nothing was found, so return rc.
-            free_csv_line(fieldArr);
-            return CSV_HANDLER__HEADER_NOT_FOUND;
+        memcpy((*parsedLine)[i], field, fieldLen + 1);
+        if (lens != NULL) {
+            (*lens)[i] = fieldLen;
         }
     }
 
-    selectedFields[getSelectedFieldCount()] = -1;
-
-    free_csv_line(fieldArr);
+    if (lens != NULL) {
+        (*lens)[count] = 0;
+    }
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Close out everything.
+ * Translate a return code from csvh-reader to one from this module.
+ *
+ * @param   rc
  */
-char csv_handler_close()
+static char readerToHandlerRc(char rc)
 {
-    if (headers != NULL) {
-        free_csv_line(headers);
+    switch (rc) {
+        case CSVH_READER__OK:
+            return CSV_HANDLER__OK;
+        case CSVH_READER__DONE:
+            return CSV_HANDLER__DONE;
+        case CSVH_READER__OUT_OF_MEMORY:
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        case CSVH_READER__BAD_RECORD:
+            return CSV_HANDLER__BAD_RECORD;
     }
-    if (entireInput != NULL) {
-        for (int i = 0; entireInput[i] != NULL; i++) {
-            free_csv_line(entireInput[i]);
-            entireInput[i] = NULL;
-        }
-        free(entireInput);
+
+    return CSV_HANDLER__UNKNOWN_ERROR;
+}
+
+/**
+ * Keep track of a malformed record the reader just skipped.  Returns
+ * BAD_RECORD if that means stopping.
+ */
+static char noteBadRecord()
+{
+    if (badRecordCount < CSV_HANDLER__BAD_RECORDS_KEPT) {
+        int ind = badRecordCount;
+        badRecordOffsets[ind] = csvh_reader_bad_record_offset();
+        // It never got a number, so it's the one the next line would get.
+        badRecordLineNums[ind] = csvh_line_helper_get_line_num() + (headers != NULL);
+        snprintf(badRecordFiles[ind], sizeof(badRecordFiles[ind]), "%s", inputName);
     }
+    badRecordCount++;
 
-    free(line);
-    line = NULL;
-    free(selectedFields);
-    selectedFields = NULL;
-    csvh_line_helper_close();
+    return stopOnBadRecord ? CSV_HANDLER__BAD_RECORD : CSV_HANDLER__OK;
+}
 
-    return CSV_HANDLER__OK;
+/**
+ * Translate a return code from csvh-sort to one from this module.
+ *
+ * @param   rc
+ */
+static char sortToHandlerRc(char rc)
+{
+    switch (rc) {
+        case CSVH_SORT__OK:
+            return CSV_HANDLER__OK;
+        case CSVH_SORT__DONE:
+            return CSV_HANDLER__DONE;
+        case CSVH_SORT__OUT_OF_MEMORY:
+            return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    return CSV_HANDLER__UNKNOWN_ERROR;
 }
 
+/**
+ * Translate a return code from csvh-group to one from this module.
+ *
+ * @param   rc
+ */
+static char groupToHandlerRc(char rc)
+{
+    switch (rc) {
+        case CSVH_GROUP__OK:
+            return CSV_HANDLER__OK;
+        case CSVH_GROUP__DONE:
+            return CSV_HANDLER__DONE;
+        case CSVH_GROUP__OUT_OF_MEMORY:
+            return CSV_HANDLER__OUT_OF_MEMORY;
+    }
 
-// Static functions below this line.
+    return CSV_HANDLER__UNKNOWN_ERROR;
+}
 
 /**
- * Set passed pointer to array of strings to parsed CSV from line.
+ * Set passed pointer to array of strings to parsed CSV from line.  If lens
+ * isn't NULL, it gets set to the length of each one (which is what to go by,
+ * since there can be nulls in them), and needs to be freed along with them.
  *
  * @param   parsedLine
+ * @param   lens
  */
-static char getParsedLine(char ***parsedLine)
+static char getParsedLine(char ***parsedLine, size_t **lens)
 {
+    if (lineFromCache) {
+        return getCachedParsedLine(parsedLine, lens);
+    }
+
+    if (windowFirst != -1) {
+        *parsedLine = parseWindow(line, rawRecordLen, lens);
+        return (*parsedLine == NULL) ? CSV_HANDLER__OUT_OF_MEMORY : CSV_HANDLER__OK;
+    }
+
     if (selectedFields == NULL) {
-        *parsedLine = parse_csv(line, delim);
+        *parsedLine = parseFields(line, rawRecordLen, delim, lens);
         if (*parsedLine == NULL) {
             // Is this right?  I think it could mean it's unparseable.
             return CSV_HANDLER__OUT_OF_MEMORY;
@@ -947,65 +3591,116 @@ static char getParsedLine(char ***parsedLine)
         return CSV_HANDLER__OK;
     }
 
-    char **dumParsed = parse_csv(line, delim);
-
-    *parsedLine = malloc(sizeof(char **) * (getSelectedFieldCount() + 1));
-    if (*parsedLine == NULL) {
+    size_t *dumLens = NULL;
+    char **dumParsed = parseFields(line, rawRecordLen, delim, &dumLens);
+    int count = getSelectedFieldCount();
+
+    *parsedLine = calloc(count + 1, sizeof(char *));
+    if (*parsedLine == NULL || (lens != NULL && (*lens = malloc(sizeof(size_t) * (count + 1))) == NULL)) {
+        free(*parsedLine);
+        *parsedLine = NULL;
+        if (dumParsed != NULL) {
+            free_csv_line(dumParsed);
+            free(dumLens);
+        }
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
+    char rc = CSV_HANDLER__OK;
+
     for (int i = 0, j = 0; (j = selectedFields[i]) != -1; i++) {
-        (*parsedLine)[i] = malloc(sizeof(char *) * (strlen(dumParsed[j]) + 1));
-        strcpy((*parsedLine)[i], dumParsed[j]);
+        // Lines that are too short (or unparseable) get empty values, same as
+        // with a window.
+        char *value = (dumParsed == NULL) ? NULL : getField(dumParsed, j);
+        size_t valueLen = (value == NULL) ? 0 : dumLens[j];
+        if (value == NULL) {
+            value = "";
+        }
+        if (((*parsedLine)[i] = malloc(sizeof(char) * (valueLen + 1))) == NULL) {
+            rc = CSV_HANDLER__OUT_OF_MEMORY;
+            break;
+        }
+        memcpy((*parsedLine)[i], value, valueLen + 1);
+        if (lens != NULL) {
+            (*lens)[i] = valueLen;
+        }
+    }
+
+    if (dumParsed != NULL) {
+        free_csv_line(dumParsed);
+        free(dumLens);
     }
 
-    (*parsedLine)[getSelectedFieldCount()] = NULL;
+    if (rc != CSV_HANDLER__OK) {
+        free_csv_line(*parsedLine);
+        *parsedLine = NULL;
+        if (lens != NULL) {
+            free(*lens);
+            *lens = NULL;
+        }
+        return rc;
+    }
 
-    free_csv_line(dumParsed);
+    if (lens != NULL) {
+        (*lens)[count] = 0;
+    }
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Append string with new boxed value for printing to output.
+ * Append string with new boxed value for printing to output.  The line's
+ * length and size get passed along (like csv_handler_append_vertical_entry),
+ * so that a line with a lot of boxes on it (i.e., transposed) doesn't get
+ * gone back over for every one.
  *
  * @param   outputLine
+ * @param   len         What's in outputLine already.  Gets updated.
+ * @param   cap         Size of outputLine.  Gets updated.
  * @param   newValue
+ * @param   valueLen
  * @param   useBrace
  */
-static char appendBoxedValue(char **outputLine, char *newValue, char useBrace)
-{
-    int initialLen = strlen(*outputLine);
-    *outputLine = realloc(*outputLine, sizeof(char) * (initialLen + 2 + width));
-    // +2 is one for '|' and one for null terminator.
-
-    if (*outputLine == NULL) {
-        return CSV_HANDLER__OUT_OF_MEMORY;
-    }
-
+static char appendBoxedValue(
+    char **outputLine,
+    size_t *len,
+    size_t *cap,
+    const char *newValue,
+    size_t valueLen,
+    char useBrace
+) {
     // Only want to concat part of the string, so need to do some funky stuff.
+    // The box is width columns, not bytes, so that non-ASCII text lines up
+    // (see csvh-width.c).
+
+    int contentCols;
+    size_t contentLength = csvh_width_fit(newValue, valueLen, width, &contentCols);
+    int fillerLength = width - contentCols; // Will be zero if content is larger than width.
+    size_t boxLength = contentLength + fillerLength;
 
-    int contentLength = strlen(newValue);
-    if (contentLength > width) {
-        contentLength = width;
+    char rc;
+    if ((rc = reserveOutput(outputLine, len, cap, boxLength + 2)) != CSV_HANDLER__OK) {
+        // +2 is one for '|' and one for null terminator.
+        return rc;
     }
-    int fillerLength = width - contentLength; // Will be zero if content is larger than width.
 
-    for (int j = 0; j < contentLength; j++) {
-        if (newValue[j] == '\n') {
-            // Don't display newline.  It's confusing in this context.
-            (*outputLine)[initialLen + j] = ' ';
+    char *out = *outputLine + *len;
+    // Note that this starts on the null terminator, so overwriting it.
+
+    for (size_t j = 0; j < contentLength; j++) {
+        if (newValue[j] == '\n' || newValue[j] == '\0') {
+            // Don't display newline.  It's confusing in this context.  Nulls
+            // don't show up at all, which would make the box come up short.
+            out[j] = ' ';
         } else {
-            (*outputLine)[initialLen + j] = newValue[j];
+            out[j] = newValue[j];
         }
-        // Note that this starts with j = 0, so overwriting the null terminator.
-    }
-    for (int j = 0; j < fillerLength; j++) {
-        (*outputLine)[initialLen + contentLength + j] = ' ';
     }
+    memset(out + contentLength, ' ', fillerLength);
 
-    (*outputLine)[initialLen + width] = useBrace ? '|' : ' '; // Next brace.
-    (*outputLine)[initialLen + width + 1] = '\0'; // Putting back in the null terminator.
+    out[boxLength] = useBrace ? '|' : ' '; // Next brace.
+    out[boxLength + 1] = '\0'; // Putting back in the null terminator.
+    *len += boxLength + 1;
 
     return CSV_HANDLER__OK;
 }
@@ -1034,112 +3729,365 @@ static char *getHeaderFromPosition(int pos)
 
 /**
  * "Unparse" a specific value (i.e., cell), by surrounding with double-quotes if
- * necessary and doubling double-quotes if necessary.
+ * necessary and doubling double-quotes if necessary (unless quoting's off, in
+ * which case it's just copied).  It gets written to out
+ * (without a null terminator), and the length of what got written is
+ * returned.  Pass NULL for out to just get the length, for sizing things
+ * first.
  *
  * @param   value
+ * @param   valueLen
+ * @param   out
  */
-static char unparseValue(char **value)
+static size_t unparseValue(const char *value, size_t valueLen, char *out)
 {
     char dontParse = 1;
-    char doubleQuotes = 0;
-    for (long int i = 0; (*value)[i]; i++) {
-        if ((*value)[i] == delim || (*value)[i] == '\n') {
+    size_t doubleQuotes = 0;
+    for (size_t i = 0; quoting && i < valueLen; i++) {
+        if (value[i] == delim || value[i] == '\n') {
             dontParse = 0;
-        } else if ((*value)[i] == '"') {
+        } else if (value[i] == '"') {
             dontParse = 0;
             doubleQuotes++;
         }
     }
 
     if (dontParse) {
-        return CSV_HANDLER__OK;
+        if (out != NULL) {
+            memcpy(out, value, valueLen);
+        }
+        return valueLen;
     }
 
-    char *newValue = malloc(sizeof(char) * (strlen(*value) + doubleQuotes + 3));
-    // +1 for null term, +2 for opening and closing double quotes.
-    strcpy(newValue, "\"");
+    if (out != NULL) {
+        size_t j = 0;
+        out[j++] = '"';
+        for (size_t i = 0; i < valueLen; i++) {
+            out[j++] = value[i];
+            if (value[i] == '"') {
+                out[j++] = '"';
+            }
+        }
+        out[j++] = '"';
+    }
+
+    // +2 for opening and closing double quotes.
+    return valueLen + doubleQuotes + 2;
+}
+
+/**
+ * Get a field from a parsed line, or NULL if the line doesn't have it (or ind
+ * is -1).
+ *
+ * @param   parsedLine
+ * @param   ind
+ */
+static char *getField(char **parsedLine, int ind)
+{
+    if (ind < 0) {
+        return NULL;
+    }
 
-    for (long int i = 0, j = 1; (*value)[i] != '\0'; i++) {
-        newValue[j] = (*value)[i];
-        if (newValue[j] == '"') {
-            newValue[++j] = '"';
+    for (int i = 0; i < ind; i++) {
+        if (parsedLine[i] == NULL) {
+            return NULL;
         }
-        j++;
     }
 
-    newValue[strlen(*value) + doubleQuotes + 1] = '\0';
-    strcat(newValue, "\"");
+    return parsedLine[ind];
+}
+
+/**
+ * Get index of header from matching string.
+ *
+ * Return -1 in case of no match.
+ *
+ * @param   critHeader
+ */
+static int getHeaderIndexFromString(char *critHeader)
+{
+    int code = csvh_dict_find(headerIndex, critHeader, strlen(critHeader));
 
-    free(*value);
-    *value = newValue;
+    if (code == -1) {
+        // Not found.
+        return -1;
+    }
 
-    return CSV_HANDLER__OK;
+    return headerInds[code];
 }
 
 /**
- * Copy an array of strings into first passed variable, where source array of
- * strings is terminated by a NULL pointer.
+ * Get the index of a column from its header or its position (starting from
+ * 1), in that order.  Return -1 if it's neither.
  *
- * @param   destArray
- * @param   srcArray
- * @param   specInds
- *  "Specify indices" array.  If null, then use all from source array.
+ * @param   column
+ * @param   headerCount
  */
-static char copyArrayOfStrings(char ***destArray, char ***srcArray, int *specInds)
+static int getColumnFromString(char *column, int headerCount)
 {
-    if (*destArray != NULL) {
-        return CSV_HANDLER__ALREADY_SET;
+    int ind = getHeaderIndexFromString(column);
+    if (ind != -1) {
+        return ind;
     }
 
-    *destArray = malloc(sizeof(char **) * (getSelectedFieldCount() + 1));
-    // Don't bother to get the count of the source array, at least not right
-    // now.  Anything other than output width is not *currently* a use case.
-    // Don't set this size to module-wide variable to reuse because it's
-    // *hypothetically* possible that it can change if one line has more fields
-    // than another.  (That would break RFC 4180, but, need to be prepared for
-    // that.)  So, we need to calculate it every time.
+    char *eptr;
+    long pos = strtol(column, &eptr, 10);
+    if (column[0] == '\0' || *eptr != '\0' || pos < 1 || pos > headerCount) {
+        return -1;
+    }
 
-    if (*destArray == NULL) {
-        return CSV_HANDLER__OUT_OF_MEMORY;
+    return pos - 1;
+}
+
+/**
+ * Parse only the window of columns out of a record.  The columns before it
+ * get skipped by csvh-scan, and nothing after it gets looked at.  Lines that
+ * are too short get empty values, so there's always one value for every
+ * column in the window.  lens works the same as for getParsedLine.
+ *
+ * @param   record
+ * @param   len
+ * @param   lens
+ */
+static char **parseWindow(const char *record, size_t len, size_t **lens)
+{
+    int count = windowLast - windowFirst + 1;
+
+    char **parsedLine = calloc(count + 1, sizeof(char *));
+    if (parsedLine == NULL) {
+        return NULL;
+    }
+    if (lens != NULL && (*lens = calloc(count + 1, sizeof(size_t))) == NULL) {
+        free(parsedLine);
+        return NULL;
+    }
+
+    const char *start = quoting
+        ? csvh_scan_skip_unquoted(record, len, delim, '"', windowFirst)
+        : csvh_scan_skip(record, len, delim, windowFirst);
+    char **windowParsed = NULL;
+    size_t *windowLens = NULL;
+
+    if (start != NULL) {
+        // End is just past the delimiter after the window, if there is one.
+        const char *end = quoting
+            ? csvh_scan_skip_unquoted(start, record + len - start, delim, '"', count)
+            : csvh_scan_skip(start, record + len - start, delim, count);
+        size_t windowLen = (end == NULL) ? (size_t) (record + len - start) : (size_t) (end - 1 - start);
+
+        // NULL here means it's unparseable, which just leaves it all empty.
+        windowParsed = parseFields(start, windowLen, delim, &windowLens);
     }
 
     int i = 0;
-    char *srcEl = NULL;
+    for (; windowParsed != NULL && windowParsed[i] != NULL && i < count; i++) {
+        parsedLine[i] = windowParsed[i];
+        if (lens != NULL) {
+            (*lens)[i] = windowLens[i];
+        }
+    }
+    free(windowParsed); // The values are parsedLine's now.
+    free(windowLens);
+
+    for (; i < count; i++) {
+        if ((parsedLine[i] = strdup("")) == NULL) {
+            free_csv_line(parsedLine);
+            if (lens != NULL) {
+                free(*lens);
+                *lens = NULL;
+            }
+            return NULL;
+        }
+    }
+
+    return parsedLine;
+}
 
-    for (;(srcEl = (specInds == NULL) ? (*srcArray)[i] : (*srcArray)[specInds[i]]); i++) {
-        // Expand this out to help understand it better.
-        (*destArray)[i] = malloc(sizeof(char) * (strlen(srcEl) + 1));
+/**
+ * Work out the "Header: " that goes in front of each value in vertical
+ * output.
+ */
+static char buildVerticalPrefixes()
+{
+    int count = selectedFieldCount;
+    if (count == -1) {
+        // Not every line has the same number of values, so go by the
+        // headers.
+        for (count = 0; headers[count] != NULL; count++) {}
+    }
+
+    verticalPrefixes = calloc(count + 1, sizeof(char *));
+    verticalPrefixLens = malloc(sizeof(size_t) * (count + 1));
+    if (verticalPrefixes == NULL || verticalPrefixLens == NULL) {
+        freeVerticalPrefixes();
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+    verticalPrefixCount = count;
+
+    for (int i = 0; i < count; i++) {
+        char *header = getHeaderFromPosition(i);
+        size_t headerLen = strlen(header);
 
-        if ((*destArray)[i] == NULL) {
+        if ((verticalPrefixes[i] = malloc(sizeof(char) * (headerLen + 3))) == NULL) {
+            freeVerticalPrefixes();
             return CSV_HANDLER__OUT_OF_MEMORY;
         }
+        memcpy(verticalPrefixes[i], header, headerLen);
+        memcpy(verticalPrefixes[i] + headerLen, ": ", 3);
+        verticalPrefixLens[i] = headerLen + 2;
+    }
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Free the vertical output prefixes.
+ */
+static void freeVerticalPrefixes()
+{
+    if (verticalPrefixes != NULL) {
+        free_csv_line(verticalPrefixes); // NULL-terminated, thanks to calloc.
+        verticalPrefixes = NULL;
+    }
+    free(verticalPrefixLens);
+    verticalPrefixLens = NULL;
+    verticalPrefixCount = 0;
+}
+
+/**
+ * Build the JSON keys from the headers shown, quoted and escaped, with the
+ * colon after them.
+ */
+static char buildJsonKeys()
+{
+    int count = selectedFieldCount;
+    if (count == -1) {
+        for (count = 0; headers[count] != NULL; count++) {}
+    }
 
-        strcpy((*destArray)[i], srcEl);
+    jsonKeys = calloc(count + 1, sizeof(char *));
+    jsonKeyLens = malloc(sizeof(size_t) * (count + 1));
+    if (jsonKeys == NULL || jsonKeyLens == NULL) {
+        freeJsonKeys();
+        return CSV_HANDLER__OUT_OF_MEMORY;
     }
+    jsonKeyCount = count;
 
-    (*destArray)[i] = NULL;
+    for (int i = 0; i < count; i++) {
+        char *header = getHeaderFromPosition(i);
+        size_t headerLen = strlen(header);
+
+        jsonKeys[i] = malloc(sizeof(char) * (headerLen * CSVH_ESCAPE__JSON_MAX_GROWTH + 4));
+        if (jsonKeys[i] == NULL) {
+            freeJsonKeys();
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        }
+        char *out = jsonKeys[i];
+        *out++ = '"';
+        out += csvh_escape_json(header, headerLen, out);
+        *out++ = '"';
+        *out++ = ':';
+        *out = '\0';
+        jsonKeyLens[i] = out - jsonKeys[i];
+    }
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Get index of header from matching string.
- *
- * Return -1 in case of no match.
+ * Free the JSON keys.
+ */
+static void freeJsonKeys()
+{
+    if (jsonKeys != NULL) {
+        free_csv_line(jsonKeys); // NULL-terminated, thanks to calloc.
+        jsonKeys = NULL;
+    }
+    free(jsonKeyLens);
+    jsonKeyLens = NULL;
+    jsonKeyCount = 0;
+}
+
+/**
+ * Make sure a caller's output buffer has room for needed more bytes after
+ * what's in it, growing it (at least double, so it doesn't happen often) if
+ * it doesn't.
  *
- * @param   critHeader
+ * @param   buff
+ * @param   len
+ * @param   cap
+ * @param   needed
  */
-static int getHeaderIndexFromString(char *critHeader)
+static char reserveOutput(char **buff, size_t *len, size_t *cap, size_t needed)
 {
-    int critInd = -1;
-    for (;headers[++critInd] != NULL && strcmp(critHeader, headers[critInd]) != 0;) {}
+    if (*len + needed <= *cap) {
+        return CSV_HANDLER__OK;
+    }
 
-    if (headers[critInd] == NULL) {
-        // Not found.
-        return -1;
+    size_t newCap = (*cap * 2 > *len + needed) ? *cap * 2 : *len + needed;
+    char *newBuff = realloc(*buff, sizeof(char) * newCap);
+    if (newBuff == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+    *buff = newBuff;
+    *cap = newCap;
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Build headerIndex from the headers, replacing whatever was there, and look
+ * for duplicates while at it.
+ */
+static char indexHeaders()
+{
+    freeHeaderIndex();
+
+    int count = 0;
+    for (; headers[count] != NULL; count++) {}
+
+    headerIndex = csvh_dict_new();
+    headerInds = malloc(sizeof(int) * (count + 1));
+    if (headerIndex == NULL || headerInds == NULL) {
+        freeHeaderIndex();
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int before = csvh_dict_count(headerIndex);
+        int code = csvh_dict_intern(headerIndex, headers[i], strlen(headers[i]));
+
+        if (code == -1) {
+            freeHeaderIndex();
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        }
+
+        if (code < before) {
+            // Already have one by this name, which wins.
+            if (duplicateHeader == NULL) {
+                duplicateHeader = headers[i];
+            }
+            continue;
+        }
+
+        headerInds[code] = i;
     }
 
-    return critInd;
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Free headerIndex and everything that goes with it.
+ */
+static void freeHeaderIndex()
+{
+    if (headerIndex != NULL) {
+        csvh_dict_free(headerIndex);
+        headerIndex = NULL;
+    }
+    free(headerInds);
+    headerInds = NULL;
+    duplicateHeader = NULL;
 }
 
 /**
@@ -1158,41 +4106,37 @@ static char setHeadersAsNumbers()
         return CSV_HANDLER__ALREADY_SET;
     }
 
-    int lineLen = 0;
-    char **parsedLine = parse_csv(lineBuff, delim);
     // Not using getParsedLine because dont' want to filter anything out right
-    // now.
-    for (;parsedLine[++lineLen] != NULL;) {}
-    free_csv_line(parsedLine);
+    // now.  Only the count matters.
+    int fieldCount = countFields(lineBuff, lineBuffLen, delim);
+    if (fieldCount < 1) {
+        // Unparseable, so there's at least the one.
+        fieldCount = 1;
+    }
 
-    char *headerLine = malloc(sizeof(char));
-    headerLine[0] = '\0';
-    int newDigitLen;
-    char *newDigitStrDum;
+    // Size it up first, so each number gets written right where it goes.
+    size_t headerLen = 0;
+    for (int i = 1; i < fieldCount + 1; i++) {
+        headerLen += countDigits(i) + 1;
+    }
 
-    char delimStr[2];
-    delimStr[0] = delim;
-    delimStr[1] = '\0';
+    char *headerLine = malloc(sizeof(char) * (headerLen + 1));
+    if (headerLine == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
 
-    for (int i = 1; i < lineLen + 1; i++) {
-        newDigitLen = countDigits(i);
-        newDigitStrDum = malloc(sizeof(char) * (newDigitLen + 1));
-        if (newDigitStrDum == NULL) {
-            return CSV_HANDLER__OUT_OF_MEMORY;
-        }
-        headerLine = realloc(headerLine, strlen(headerLine) + newDigitLen + 2);
-        if (headerLine == NULL) {
-            return CSV_HANDLER__OUT_OF_MEMORY;
-        }
-        sprintf(newDigitStrDum, "%d", i);
-        strcat(headerLine, newDigitStrDum);
-        strcat(headerLine, delimStr);
-        free(newDigitStrDum);
+    size_t used = 0;
+    for (int i = 1; i < fieldCount + 1; i++) {
+        used += sprintf(headerLine + used, "%d", i);
+        headerLine[used++] = delim;
     }
 
-    headerLine[strlen(headerLine) - 1] = '\0'; // Remove last comma.
+    headerLine[--used] = '\0'; // Remove last comma.
 
     line = headerLine;
+    rawRecord = line;
+    rawRecordLen = used;
+    lineFromCache = 0;
     headerLine = NULL;
 
     return CSV_HANDLER__OK;
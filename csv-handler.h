@@ -1,6 +1,8 @@
 #ifndef csvhandler_h
 #define csvhandler_h
 
+#include <stddef.h>
+
 // Constants
 
 #define CSV_HANDLER__OK                 0
@@ -13,28 +15,90 @@
 #define CSV_HANDLER__INVALID_INPUT      7
 #define CSV_HANDLER__HEADER_NOT_FOUND   8
 #define CSV_HANDLER__UNKNOWN_ERROR      9
+#define CSV_HANDLER__HEADER_MISMATCH    10
+#define CSV_HANDLER__BAD_RECORD         11
+#define CSV_HANDLER__UNSUPPORTED        12
+#define CSV_HANDLER__INVALID_SORT_TYPE  13
+
+#define CSV_HANDLER__BAD_RECORDS_KEPT   10
 
 // Functions for typical output and vertical output.
 void csv_handler_set_has_headers(char hasHeadersIn);
 
 void csv_handler_set_delim(char delimIn);
 
+char csv_handler_set_quoting(char quotingIn);
+
+char csv_handler_set_files(char **paths, int count);
+
+void csv_handler_set_lines_per_file();
+
+char *csv_handler_current_file();
+
 char csv_handler_skip_next_line();
 
+char csv_handler_skip_lines(int count);
+
 char csv_handler_read_next_line();
 
+char csv_handler_set_sort(char *spec, size_t memBudget);
+
+void csv_handler_set_threads(int count);
+
+char csv_handler_group_by(char *keyHeader, char *sumHeader, size_t memBudget);
+
+char csv_handler_distinct(char *header);
+
+char csv_handler_top_k(char *header, int k);
+
+char csv_handler_profile();
+
+char csv_handler_sample(int n, unsigned long long seed);
+
+char csv_handler_set_follow();
+
+char csv_handler_set_cache();
+
+char csv_handler_set_no_mapping();
+
+char csv_handler_set_bad_records(size_t maxSize, char stop);
+
+int csv_handler_bad_record_count();
+
+char csv_handler_bad_record(int ind, long long *offset, int *lineNum, char **file);
+
+void csv_handler_set_limit(int limit);
+
+char csv_handler_set_tail(int n);
+
 char csv_handler_set_headers_from_line();
 
+char *csv_handler_duplicate_header();
+
 char csv_handler_restrict_by_lines(char *lines);
 
 char csv_handler_restrict_by_ranges(char *critHeader, char *ranges);
 
 char csv_handler_restrict_by_equals(char *critHeader, char *equals);
 
+char csv_handler_restrict_by_contains(char *critHeader, char *substring);
+
+char csv_handler_restrict_by_regex(char *critHeader, char *pattern);
+
 char csv_handler_output_headers(char **outputLine);
 
 char csv_handler_raw_line(char **wholeLine);
 
+char csv_handler_append_raw_line(char **buff, size_t *len, size_t *cap);
+
+char csv_handler_raw_record(const char **record, size_t *recordLen);
+
+char csv_handler_can_pass_through();
+
+char csv_handler_can_copy_ranges();
+
+char csv_handler_raw_copy_ranges(int outFd);
+
 char csv_handler_output_line(char **outputLine);
 
 char csv_handler_output_line_number(char **outputString);
@@ -45,6 +109,12 @@ char csv_handler_border_line(char **outputLine);
 
 char csv_handler_output_vertical_entry(char **outputEntry);
 
+char csv_handler_append_vertical_entry(char **buff, size_t *len, size_t *cap);
+
+char csv_handler_append_json_line(char **buff, size_t *len, size_t *cap);
+
+char csv_handler_append_tsv_line(char **buff, size_t *len, size_t *cap);
+
 char csv_handler_vertical_border_line(char **outputLine);
 
 // Functions for transposed output.
@@ -62,6 +132,8 @@ void csv_handler_set_width(int newWidth);
 
 char csv_handler_set_selected_fields(char *fields);
 
+char csv_handler_set_column_window(char *range);
+
 char csv_handler_close();
 
 #endif
@@ -0,0 +1,431 @@
+#include <malloc.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "csv-handler.h"
+
+// Memory tests: every output mode and every kind of restriction gets run on
+// generated files of a few different sizes, and the most heap that was in use
+// at once gets recorded for each.  Run it with `make memtest` (Linux only,
+// since it goes by glibc's malloc_usable_size).
+//
+// Most modes stream, and those should use the same memory no matter how many
+// rows there are.  The ones that can't stream (transposing and sorting, which
+// need every row before they can output the first) are allowed a fixed number
+// of bytes for each cell added instead.  (Per cell added, not per cell,
+// because on small files, the buffers everything starts out with are most of
+// it.)  Going over either fails the run.
+//
+// It's the heap that gets counted, not RSS, because input files get mapped,
+// and a mapped file shows up in RSS as it's read even though none of it is
+// being held on to.  Heap use gets counted by having the linker send every
+// malloc, calloc, realloc, strdup and free through the wrappers below (see
+// MEMTEST_WRAP in the makefile).
+//
+// Every run happens in a child process, since csv-handler can only be opened
+// once per process (and so nothing from one run is still around for the
+// next).
+
+/**
+ * Sizes of the generated files, in rows.  The columns are always the same.
+ */
+#define SIZE_COUNT 3
+static const int rowCounts[SIZE_COUNT] = {5000, 20000, 80000};
+#define COL_COUNT 5
+
+/**
+ * How much more the biggest file can use than the smallest one in a mode
+ * that streams: a quarter more, plus a little for things like a buffer
+ * happening to double on one and not the other.
+ */
+#define STREAMING_GROWTH 1.25
+#define STREAMING_SLACK 65536
+
+/**
+ * Kinds of output.
+ */
+#define OUTPUT__NORMAL      0
+#define OUTPUT__VERTICAL    1
+#define OUTPUT__RAW         2
+#define OUTPUT__JSON        3
+#define OUTPUT__TSV         4
+#define OUTPUT__TRANSPOSED  5
+
+/**
+ * One thing to check: how to set up csv-handler, how to output, and either
+ * that it streams (budget of 0) or how many bytes it can use for each cell
+ * added.
+ */
+struct memCase {
+    const char *name;
+    char output;
+    char restrictType;  // Same letters as -r, or 0 for none.
+    char *restrictHeader;
+    char *restrictValue;
+    char *sortSpec;
+    char *groupHeader;
+    int tail;
+    double bytesPerCell;
+};
+
+static struct memCase cases[] = {
+    {"normal",          OUTPUT__NORMAL,     0,   NULL,     NULL,                 NULL,     NULL,     0,   0},
+    {"vertical",        OUTPUT__VERTICAL,   0,   NULL,     NULL,                 NULL,     NULL,     0,   0},
+    {"raw",             OUTPUT__RAW,        0,   NULL,     NULL,                 NULL,     NULL,     0,   0},
+    {"json",            OUTPUT__JSON,       0,   NULL,     NULL,                 NULL,     NULL,     0,   0},
+    {"tsv",             OUTPUT__TSV,        0,   NULL,     NULL,                 NULL,     NULL,     0,   0},
+    {"restrict lines",  OUTPUT__NORMAL,     'l', NULL,     "2-100,1000-",        NULL,     NULL,     0,   0},
+    {"restrict ranges", OUTPUT__NORMAL,     'r', "amount", "100-500",            NULL,     NULL,     0,   0},
+    {"restrict equals", OUTPUT__NORMAL,     'e', "status", "ACTIVE,CLOSED",      NULL,     NULL,     0,   0},
+    {"restrict contains", OUTPUT__NORMAL,   'c', "note",   "goes on",            NULL,     NULL,     0,   0},
+    {"restrict regex",  OUTPUT__NORMAL,     'x', "status", "^(ACTIVE|PENDING)$", NULL,     NULL,     0,   0},
+    {"tail",            OUTPUT__NORMAL,     0,   NULL,     NULL,                 NULL,     NULL,     100, 0},
+    {"group",           OUTPUT__NORMAL,     0,   NULL,     NULL,                 NULL,     "status", 0,   0},
+    {"transposed",      OUTPUT__TRANSPOSED, 0,   NULL,     NULL,                 NULL,     NULL,     0,   32},
+    {"sort",            OUTPUT__NORMAL,     0,   NULL,     NULL,                 "amount", NULL,     0,   32},
+};
+
+#define CASE_COUNT (int) (sizeof(cases) / sizeof(cases[0]))
+
+// Forward declarations for helper functions.
+
+void *__real_malloc(size_t size);
+
+void *__real_calloc(size_t count, size_t size);
+
+void *__real_realloc(void *ptr, size_t size);
+
+char *__real_strdup(const char *str);
+
+void __real_free(void *ptr);
+
+static void countAlloc(void *ptr);
+
+static char generateFile(int rows, char *path);
+
+static char runCase(struct memCase *memCase, char *path);
+
+static char measureCase(struct memCase *memCase, char *path, size_t *peak);
+
+// END forward declarations.
+
+/**
+ * Heap in use right now, and the most there's been.
+ */
+static size_t liveBytes = 0;
+static size_t peakBytes = 0;
+
+void *__wrap_malloc(size_t size)
+{
+    void *ptr = __real_malloc(size);
+    countAlloc(ptr);
+    return ptr;
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    void *ptr = __real_calloc(count, size);
+    countAlloc(ptr);
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    size_t oldSize = (ptr == NULL) ? 0 : malloc_usable_size(ptr);
+    void *newPtr = __real_realloc(ptr, size);
+    if (newPtr != NULL) {
+        liveBytes -= oldSize;
+        countAlloc(newPtr);
+    }
+    return newPtr;
+}
+
+char *__wrap_strdup(const char *str)
+{
+    char *ptr = __real_strdup(str);
+    countAlloc(ptr);
+    return ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+    if (ptr != NULL) {
+        size_t size = malloc_usable_size(ptr);
+        // Something libc allocated for itself could get freed here without
+        // ever having been counted.
+        liveBytes = (size > liveBytes) ? 0 : liveBytes - size;
+    }
+    __real_free(ptr);
+}
+
+int main()
+{
+    char paths[SIZE_COUNT][32];
+    for (int i = 0; i < SIZE_COUNT; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/tmp/csv-memory-XXXXXX");
+        if (generateFile(rowCounts[i], paths[i])) {
+            printf("Error: Couldn't generate input.\n");
+            return 1;
+        }
+    }
+
+    char failed = 0;
+
+    printf("%-18s", "");
+    for (int i = 0; i < SIZE_COUNT; i++) {
+        printf(" %9d rows", rowCounts[i]);
+    }
+    printf("   limit\n");
+
+    for (int c = 0; c < CASE_COUNT; c++) {
+        size_t peaks[SIZE_COUNT];
+        char ran = 1;
+
+        printf("%-18s", cases[c].name);
+        for (int i = 0; i < SIZE_COUNT && ran; i++) {
+            if (measureCase(cases + c, paths[i], peaks + i)) {
+                ran = 0;
+                break;
+            }
+            printf(" %14zu", peaks[i]);
+        }
+
+        if (!ran) {
+            printf("   FAILED TO RUN\n");
+            failed = 1;
+            continue;
+        }
+
+        char over = 0;
+        if (cases[c].bytesPerCell == 0) {
+            size_t limit = peaks[0] * STREAMING_GROWTH + STREAMING_SLACK;
+            over = peaks[SIZE_COUNT - 1] > limit;
+            printf("   %zu (streams)", limit);
+        } else {
+            // Every size has to be under, not just the biggest.
+            for (int i = 1; i < SIZE_COUNT; i++) {
+                double added = (double) (rowCounts[i] - rowCounts[0]) * COL_COUNT;
+                over = over || (double) peaks[i] - peaks[0] > cases[c].bytesPerCell * added;
+            }
+            printf("   %.0f bytes/cell added", cases[c].bytesPerCell);
+        }
+        printf("%s\n", over ? "  OVER" : "");
+        failed = failed || over;
+    }
+
+    for (int i = 0; i < SIZE_COUNT; i++) {
+        unlink(paths[i]);
+    }
+
+    if (failed) {
+        printf("Memory use is over the limit.\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Add a new allocation to what's in use.
+ *
+ * @param   ptr
+ */
+static void countAlloc(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    liveBytes += malloc_usable_size(ptr);
+    if (liveBytes > peakBytes) {
+        peakBytes = liveBytes;
+    }
+}
+
+/**
+ * Write a file with headers and the passed number of rows.  Every row is
+ * about the same length, so the only thing that changes between sizes is how
+ * many there are.
+ *
+ * @param   rows
+ * @param   path    A mkstemp template, which gets filled in.
+ */
+static char generateFile(int rows, char *path)
+{
+    static const char *statuses[] = {"ACTIVE", "CLOSED", "PENDING", "INACTIVE"};
+
+    int fd = mkstemp(path);
+    FILE *file = (fd == -1) ? NULL : fdopen(fd, "w");
+    if (file == NULL) {
+        return 1;
+    }
+
+    fprintf(file, "id,name,amount,status,note\n");
+
+    unsigned int seed = 7;
+    for (int i = 0; i < rows; i++) {
+        seed = seed * 1103515245 + 12345;
+        fprintf(
+            file,
+            "%08d,\"Name %04u, Jr.\",%03u.%02u,%s,some text that goes on\n",
+            i,
+            seed % 10000,
+            (seed >> 4) % 1000,
+            seed % 100,
+            statuses[(seed >> 8) % 4]
+        );
+    }
+
+    return fclose(file) != 0;
+}
+
+/**
+ * Set up csv-handler the way csview would for a case, and go through all of
+ * the output without printing it.  Runs in the child.
+ *
+ * @param   memCase
+ * @param   path
+ */
+static char runCase(struct memCase *memCase, char *path)
+{
+    char rc;
+    char *paths[] = {path};
+
+    // The counting isn't thread-safe, and the point is how much gets kept,
+    // not how it's split up.
+    csv_handler_set_threads(1);
+
+    if ((rc = csv_handler_set_files(paths, 1)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+    if ((rc = csv_handler_read_next_line()) != CSV_HANDLER__OK) {
+        return rc;
+    }
+    if ((rc = csv_handler_set_headers_from_line()) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    switch (memCase->restrictType) {
+        case 'l':
+            rc = csv_handler_restrict_by_lines(memCase->restrictValue);
+            break;
+        case 'r':
+            rc = csv_handler_restrict_by_ranges(memCase->restrictHeader, memCase->restrictValue);
+            break;
+        case 'e':
+            rc = csv_handler_restrict_by_equals(memCase->restrictHeader, memCase->restrictValue);
+            break;
+        case 'c':
+            rc = csv_handler_restrict_by_contains(memCase->restrictHeader, memCase->restrictValue);
+            break;
+        case 'x':
+            rc = csv_handler_restrict_by_regex(memCase->restrictHeader, memCase->restrictValue);
+            break;
+    }
+    if (rc != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    if (memCase->groupHeader != NULL
+        && (rc = csv_handler_group_by(memCase->groupHeader, "amount", 256 * 1024 * 1024)) != CSV_HANDLER__OK
+    ) {
+        return rc;
+    }
+    if (memCase->tail > 0 && (rc = csv_handler_set_tail(memCase->tail)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+    if (memCase->sortSpec != NULL
+        && (rc = csv_handler_set_sort(memCase->sortSpec, 256 * 1024 * 1024)) != CSV_HANDLER__OK
+    ) {
+        return rc;
+    }
+
+    char *outputLine = NULL;
+    char *lineNum = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+
+    if (memCase->output == OUTPUT__TRANSPOSED) {
+        if ((rc = csv_handler_initialize_transpose()) == CSV_HANDLER__OK) {
+            while ((rc = csv_handler_transposed_line(&outputLine)) == CSV_HANDLER__OK) {}
+        }
+    } else {
+        while ((rc = csv_handler_read_next_line()) == CSV_HANDLER__OK) {
+            // Output gets thrown out right away, like it would be once it's
+            // written.
+            len = 0;
+            switch (memCase->output) {
+                case OUTPUT__NORMAL:
+                    if ((rc = csv_handler_output_line_number(&lineNum)) == CSV_HANDLER__OK) {
+                        rc = csv_handler_output_line(&outputLine);
+                    }
+                    break;
+                case OUTPUT__VERTICAL:
+                    rc = csv_handler_append_vertical_entry(&outputLine, &len, &cap);
+                    break;
+                case OUTPUT__RAW:
+                    rc = csv_handler_raw_line(&outputLine);
+                    break;
+                case OUTPUT__JSON:
+                    rc = csv_handler_append_json_line(&outputLine, &len, &cap);
+                    break;
+                case OUTPUT__TSV:
+                    rc = csv_handler_append_tsv_line(&outputLine, &len, &cap);
+                    break;
+            }
+            if (rc != CSV_HANDLER__OK) {
+                break;
+            }
+        }
+    }
+
+    free(outputLine);
+    free(lineNum);
+    csv_handler_close();
+
+    return (rc == CSV_HANDLER__DONE) ? CSV_HANDLER__OK : rc;
+}
+
+/**
+ * Run a case in a child process and get the most heap it had in use at
+ * once.  Returns nonzero if it didn't run all the way through.
+ *
+ * @param   memCase
+ * @param   path
+ * @param   peak
+ */
+static char measureCase(struct memCase *memCase, char *path, size_t *peak)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return 1;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        return 1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        liveBytes = 0;
+        peakBytes = 0;
+        char ok = runCase(memCase, path) == CSV_HANDLER__OK
+            && write(fds[1], &peakBytes, sizeof(peakBytes)) == sizeof(peakBytes);
+        _exit(ok ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t got = read(fds[0], peak, sizeof(*peak));
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+
+    return got != sizeof(*peak) || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
@@ -2,8 +2,12 @@
 #include <string.h>
 #include <stdio.h>
 
+#include "csv.h"
+
 // Note: This has been modified from the original source to fit our needs by
-// adding an delimiter option.
+// adding an delimiter option, and versions that go by length instead of a
+// null terminator.  There are also versions for input without any quoting,
+// which split at every delimiter.
 
 void free_csv_line( char **parsed ) {
     char **ptr;
@@ -16,25 +20,24 @@ void free_csv_line( char **parsed ) {
 }
 
 int count_fields( const char *line, char del) {
-    const char *ptr;
-    int cnt, fQuote;
+    return count_fields_len( line, strlen(line), del );
+}
 
-    for ( cnt = 1, fQuote = 0, ptr = line; *ptr; ptr++ ) {
-        if ( fQuote ) {
-            if ( *ptr == '\"' ) {
-                fQuote = 0;
-            }
-            continue;
-        }
+/*
+ *  Same as count_fields, but for exactly len bytes, which don't need a null
+ *  terminator (and can have nulls in them).
+ */
+int count_fields_len( const char *line, size_t len, char del ) {
+    size_t i;
+    int cnt, fQuote;
 
-        if ( *ptr == '\"' ) {
-            fQuote = 1;
-            continue;
-        } else if ( *ptr == del ) {
+    for ( cnt = 1, fQuote = 0, i = 0; i < len; i++ ) {
+        if ( line[i] == '\"' ) {
+            // A doubled-up quote inside quotes closes and reopens them, which
+            // comes out the same.
+            fQuote = !fQuote;
+        } else if ( !fQuote && line[i] == del ) {
             cnt++;
-            continue;
-        } else {
-            continue;
         }
     }
 
@@ -51,11 +54,22 @@ int count_fields( const char *line, char del) {
  *  array of strings, one for every cell in the row.
  */
 char **parse_csv( const char *line, char del ) {
-    char **buf, **bptr, *tmp, *tptr;
-    const char *ptr;
-    int fieldcnt, fQuote, fEnd;
+    return parse_csv_len( line, strlen(line), del, NULL );
+}
 
-    fieldcnt = count_fields( line, del );
+/*
+ *  Same as parse_csv, but for exactly len bytes, which don't need a null
+ *  terminator.  Nulls in the line are kept, so if lens isn't NULL, it gets
+ *  set to a malloc'd array with the length of each cell (every cell still
+ *  gets a null terminator after it, too).
+ */
+char **parse_csv_len( const char *line, size_t len, char del, size_t **lens ) {
+    char **buf;
+    char *tmp, *tptr;
+    size_t i;
+    int fieldcnt, fQuote, field;
+
+    fieldcnt = count_fields_len( line, len, del );
 
     if ( fieldcnt == -1 ) {
         return NULL;
@@ -67,76 +81,192 @@ char **parse_csv( const char *line, char del ) {
         return NULL;
     }
 
-    tmp = malloc( strlen(line) + 1 );
+    if ( lens ) {
+        *lens = malloc( sizeof(size_t) * (fieldcnt+1) );
+        if ( !*lens ) {
+            free( buf );
+            return NULL;
+        }
+    }
+
+    // No cell can be longer than the line, so this is enough for any of them.
+    tmp = malloc( len + 1 );
 
     if ( !tmp ) {
         free( buf );
+        if ( lens ) {
+            free( *lens );
+            *lens = NULL;
+        }
         return NULL;
     }
 
-    bptr = buf;
-
-    for ( ptr = line, fQuote = 0, *tmp = '\0', tptr = tmp, fEnd = 0; ; ptr++ ) {
+    for ( i = 0, fQuote = 0, field = 0, tptr = tmp; ; i++ ) {
         if ( fQuote ) {
-            if ( !*ptr ) {
-                break;
-            }
-
-            if ( *ptr == '\"' ) {
-                if ( ptr[1] == '\"' ) {
+            if ( line[i] == '\"' ) {
+                if ( i + 1 < len && line[i + 1] == '\"' ) {
                     *tptr++ = '\"';
-                    ptr++;
+                    i++;
                     continue;
                 }
                 fQuote = 0;
             }
             else {
-                *tptr++ = *ptr;
+                *tptr++ = line[i];
             }
 
             continue;
         }
 
-        if ( *ptr == '\"' ) {
+        if ( i < len && line[i] == '\"' ) {
             fQuote = 1;
-            continue;
-        } else if ( *ptr == '\0' || *ptr == del ) {
-            if ( *ptr == '\0' ) {
-                fEnd = 1;
-            }
+        } else if ( i == len || line[i] == del ) {
+            size_t cellLen = tptr - tmp;
 
-            *tptr = '\0';
-            *bptr = strdup( tmp );
+            buf[field] = malloc( cellLen + 1 );
 
-            if ( !*bptr ) {
-                for ( bptr--; bptr >= buf; bptr-- ) {
-                    free( *bptr );
+            if ( !buf[field] ) {
+                while ( field-- > 0 ) {
+                    free( buf[field] );
                 }
                 free( buf );
                 free( tmp );
+                if ( lens ) {
+                    free( *lens );
+                    *lens = NULL;
+                }
 
                 return NULL;
             }
 
-            bptr++;
+            memcpy( buf[field], tmp, cellLen );
+            buf[field][cellLen] = '\0';
+            if ( lens ) {
+                (*lens)[field] = cellLen;
+            }
+
+            field++;
             tptr = tmp;
 
-            if ( fEnd ) {
+            if ( i == len ) {
                 break;
-            } else {
-                continue;
             }
         } else {
-            *tptr++ = *ptr;
-            continue;
+            *tptr++ = line[i];
+        }
+    }
+
+    buf[field] = NULL;
+    if ( lens ) {
+        (*lens)[field] = 0;
+    }
+    free( tmp );
+    return buf;
+}
+
+/*
+ *  Same as count_fields_len, but for input without any quoting: every
+ *  delimiter splits, and a quote is just another byte.  So it's never
+ *  unparseable, and memchr can do the looking.
+ */
+int count_fields_len_unquoted( const char *line, size_t len, char del ) {
+    const char *ptr, *end;
+    int cnt;
+
+    for ( cnt = 1, ptr = line, end = line + len; ( ptr = memchr( ptr, del, end - ptr ) ) != NULL; ptr++ ) {
+        cnt++;
+    }
+
+    return cnt;
+}
+
+/*
+ *  Same as parse_csv_len, but for input without any quoting, the same as
+ *  count_fields_len_unquoted.  Nothing needs unescaping, so each cell gets
+ *  copied straight out of the line.
+ */
+char **parse_csv_len_unquoted( const char *line, size_t len, char del, size_t **lens ) {
+    char **buf;
+    const char *ptr, *end, *next;
+    int fieldcnt, field;
+
+    fieldcnt = count_fields_len_unquoted( line, len, del );
+
+    buf = malloc( sizeof(char*) * (fieldcnt+1) );
+
+    if ( !buf ) {
+        return NULL;
+    }
+
+    if ( lens ) {
+        *lens = malloc( sizeof(size_t) * (fieldcnt+1) );
+        if ( !*lens ) {
+            free( buf );
+            return NULL;
         }
+    }
+
+    for ( field = 0, ptr = line, end = line + len; field < fieldcnt; field++ ) {
+        size_t cellLen;
 
-        if ( fEnd ) {
-            break;
+        next = memchr( ptr, del, end - ptr );
+        if ( !next ) {
+            next = end;
+        }
+        cellLen = next - ptr;
+
+        buf[field] = malloc( cellLen + 1 );
+
+        if ( !buf[field] ) {
+            while ( field-- > 0 ) {
+                free( buf[field] );
+            }
+            free( buf );
+            if ( lens ) {
+                free( *lens );
+                *lens = NULL;
+            }
+
+            return NULL;
+        }
+
+        memcpy( buf[field], ptr, cellLen );
+        buf[field][cellLen] = '\0';
+        if ( lens ) {
+            (*lens)[field] = cellLen;
+        }
+
+        if ( next < end ) {
+            ptr = next + 1;
         }
     }
 
-    *bptr = NULL;
-    free( tmp );
+    buf[field] = NULL;
+    if ( lens ) {
+        (*lens)[field] = 0;
+    }
     return buf;
 }
+
+/*
+ *  Get the parse_csv_len to use for whether the input has quoting.  It's
+ *  meant to be looked up once, when that's set.
+ */
+csv_parse_fn csv_parser_for( char quoted ) {
+    if ( !quoted ) {
+        return parse_csv_len_unquoted;
+    }
+
+    return parse_csv_len;
+}
+
+/*
+ *  Same as csv_parser_for, but for count_fields_len.
+ */
+csv_count_fn csv_counter_for( char quoted ) {
+    if ( !quoted ) {
+        return count_fields_len_unquoted;
+    }
+
+    return count_fields_len;
+}
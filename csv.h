@@ -1,8 +1,19 @@
 #ifndef CSV_DOT_H_INCLUDE_GUARD
 #define CSV_DOT_H_INCLUDE_GUARD
 
+#include <stddef.h>
+
+typedef char **(*csv_parse_fn)( const char *line, size_t len, char del, size_t **lens );
+typedef int (*csv_count_fn)( const char *line, size_t len, char del );
+
 char **parse_csv( const char *line, char del );
 void free_csv_line( char **parsed );
 int count_fields(const char *line, char del);
+char **parse_csv_len( const char *line, size_t len, char del, size_t **lens );
+int count_fields_len( const char *line, size_t len, char del );
+char **parse_csv_len_unquoted( const char *line, size_t len, char del, size_t **lens );
+int count_fields_len_unquoted( const char *line, size_t len, char del );
+csv_parse_fn csv_parser_for( char quoted );
+csv_count_fn csv_counter_for( char quoted );
 
 #endif
@@ -0,0 +1,485 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define CSVH_AIO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#include "csvh-aio.h"
+
+// This is a helper module for csvh-reader.c.
+
+// Reads a file ahead of whoever's using it, for when it can't (or shouldn't)
+// be mapped.  There's a ring of big buffers, and all of them but the one
+// being looked at have a read in flight, so that by the time one buffer's
+// been gone through, the next one's usually already full.  The reads go
+// through io_uring, straight to the kernel's syscalls (there's no liburing
+// here), so nothing blocks except waiting on a buffer that isn't done yet.
+//
+// Buffers are handed out in file order and stay good until the next call to
+// csvh_aio_next, which is when the one before gets sent off for more.
+//
+// If io_uring isn't there (old kernel, not Linux, or blocked, like in some
+// containers), opening says so, and csvh-reader just reads normally.  If it
+// stops working partway through, the reads left get done here with pread,
+// once the ones already sent off are out of the kernel's hands.
+
+/**
+ * Number of buffers, and the size of each.
+ */
+#define BUFFER_COUNT 4
+#define BUFFER_SIZE 1048576
+
+// Forward declarations for static functions.
+
+static char submitRead(int ind);
+
+static char waitForRead(int ind);
+
+static char readSync(int ind);
+
+#ifdef CSVH_AIO_URING
+static char waitForCompletion();
+
+static char drainRing();
+
+static char abandonRing();
+
+static char setUpRing();
+
+static void tearDownRing();
+#endif
+
+// END forward declarations.
+
+/**
+ * The file, and the offset in it of the next read to send off.
+ */
+static int aioFd = -1;
+static long long nextOffset = 0;
+
+/**
+ * The buffers, the offset each one was read from, how much of each got
+ * filled (-1 if its read isn't done yet, and -2 if it needs to be done over
+ * with pread), and the next one to hand out.
+ * handedOut is the one that was handed out last (-1 if none), which gets sent
+ * back off on the next call.
+ */
+static char *buffers[BUFFER_COUNT];
+static long long offsets[BUFFER_COUNT];
+static long long filled[BUFFER_COUNT];
+static int nextInd = 0;
+static int handedOut = -1;
+
+/**
+ * Got to the end of the file, so there's no point sending off any more reads.
+ */
+static char reachedEnd = 0;
+
+/**
+ * io_uring is being used (as opposed to plain pread, after it stopped
+ * working).
+ */
+static char useRing = 0;
+
+#ifdef CSVH_AIO_URING
+/**
+ * The ring, and the parts of it that get mapped in from the kernel.
+ */
+static int ringFd = -1;
+static void *sqMap = NULL;
+static size_t sqMapLen = 0;
+static void *cqMap = NULL;
+static size_t cqMapLen = 0;
+static struct io_uring_sqe *sqes = NULL;
+static size_t sqesLen = 0;
+static unsigned *sqTail = NULL;
+static unsigned *sqMask = NULL;
+static unsigned *sqArray = NULL;
+static unsigned *cqHead = NULL;
+static unsigned *cqTail = NULL;
+static unsigned *cqMask = NULL;
+static struct io_uring_cqe *cqes = NULL;
+#endif
+
+/**
+ * Start reading the file from the passed offset.  Returns UNAVAILABLE if
+ * io_uring can't be used, in which case there's nothing to close.
+ *
+ * @param   fd
+ * @param   offset
+ */
+char csvh_aio_open(int fd, long long offset)
+{
+#ifdef CSVH_AIO_URING
+    if (setUpRing() != CSVH_AIO__OK) {
+        return CSVH_AIO__UNAVAILABLE;
+    }
+
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        filled[i] = 0;
+        if ((buffers[i] = malloc(sizeof(char) * BUFFER_SIZE)) == NULL) {
+            csvh_aio_close();
+            return CSVH_AIO__OUT_OF_MEMORY;
+        }
+    }
+
+    aioFd = fd;
+    nextOffset = offset;
+    nextInd = 0;
+    handedOut = -1;
+    reachedEnd = 0;
+    useRing = 1;
+
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        if (submitRead(i) != CSVH_AIO__OK) {
+            csvh_aio_close();
+            return CSVH_AIO__IO_ERROR;
+        }
+    }
+
+    return CSVH_AIO__OK;
+#else
+    return CSVH_AIO__UNAVAILABLE;
+#endif
+}
+
+/**
+ * Get the next buffer of the file, and the offset in the file it starts at.
+ * A length of 0 means the end of the file.
+ *
+ * @param   buff
+ * @param   len
+ * @param   offset
+ */
+char csvh_aio_next(const char **buff, size_t *len, long long *offset)
+{
+    char rc;
+
+    if (handedOut != -1 && !reachedEnd) {
+        // Done with that one, so it can go get more.
+        if ((rc = submitRead(handedOut)) != CSVH_AIO__OK) {
+            return rc;
+        }
+    }
+
+    int ind = nextInd;
+    if ((rc = waitForRead(ind)) != CSVH_AIO__OK) {
+        return rc;
+    }
+
+    if (filled[ind] > 0 && filled[ind] < BUFFER_SIZE) {
+        // Short read, which is usually the end of the file, but not always
+        // on network filesystems.  Either way, make sure.
+        if ((rc = readSync(ind)) != CSVH_AIO__OK) {
+            return rc;
+        }
+    }
+
+    if (filled[ind] < BUFFER_SIZE) {
+        // Everything after this would just be past the end.
+        reachedEnd = 1;
+    }
+
+    *buff = buffers[ind];
+    *len = filled[ind];
+    *offset = offsets[ind];
+
+    handedOut = ind;
+    nextInd = (ind + 1) % BUFFER_COUNT;
+
+    return CSVH_AIO__OK;
+}
+
+/**
+ * Close out everything.  Waits for any reads still in flight, since the
+ * kernel is still writing into their buffers.
+ */
+char csvh_aio_close()
+{
+#ifdef CSVH_AIO_URING
+    abandonRing();
+    tearDownRing();
+#endif
+
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        free(buffers[i]);
+        buffers[i] = NULL;
+    }
+
+    aioFd = -1;
+    useRing = 0;
+    handedOut = -1;
+
+    return CSVH_AIO__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Send off a read into a buffer, for the next part of the file.
+ *
+ * @param   ind
+ */
+static char submitRead(int ind)
+{
+    offsets[ind] = nextOffset;
+    nextOffset += BUFFER_SIZE;
+    filled[ind] = -1;
+
+#ifdef CSVH_AIO_URING
+    if (useRing) {
+        unsigned tail = *sqTail;
+        unsigned slot = tail & *sqMask;
+        struct io_uring_sqe *sqe = sqes + slot;
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = aioFd;
+        sqe->addr = (unsigned long) buffers[ind];
+        sqe->len = BUFFER_SIZE;
+        sqe->off = offsets[ind];
+        sqe->user_data = ind;
+        sqArray[slot] = slot;
+
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        long res;
+        while ((res = syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, NULL, 0)) < 0 && errno == EINTR) {}
+        if (res == 1) {
+            return CSVH_AIO__OK;
+        }
+
+        // Couldn't send it off.  Take it back out and do it the slow way,
+        // along with everything after it.
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+        filled[ind] = -2;
+        return abandonRing();
+    }
+#endif
+
+    // Not reading ahead anymore, so it gets read when it's waited for.
+    return CSVH_AIO__OK;
+}
+
+/**
+ * Wait for a buffer's read to be done.
+ *
+ * @param   ind
+ */
+static char waitForRead(int ind)
+{
+#ifdef CSVH_AIO_URING
+    char rc;
+    while (useRing && filled[ind] == -1) {
+        if (waitForCompletion() != CSVH_AIO__OK && (rc = abandonRing()) != CSVH_AIO__OK) {
+            return rc;
+        }
+    }
+#endif
+
+    if (filled[ind] < 0) {
+        filled[ind] = 0;
+        return readSync(ind);
+    }
+
+    return CSVH_AIO__OK;
+}
+
+/**
+ * Fill whatever's left of a buffer with plain reads, until it's full or the
+ * file ends.
+ *
+ * @param   ind
+ */
+static char readSync(int ind)
+{
+    while (filled[ind] < BUFFER_SIZE) {
+        ssize_t res = pread(
+            aioFd,
+            buffers[ind] + filled[ind],
+            BUFFER_SIZE - filled[ind],
+            offsets[ind] + filled[ind]
+        );
+        if (res < 0) {
+            return CSVH_AIO__IO_ERROR;
+        }
+        if (res == 0) {
+            break;
+        }
+        filled[ind] += res;
+    }
+
+    return CSVH_AIO__OK;
+}
+
+#ifdef CSVH_AIO_URING
+/**
+ * Take one read off the completion queue, waiting for one if none are done
+ * yet.  Returns IO_ERROR if the waiting itself doesn't work.
+ */
+static char waitForCompletion()
+{
+    unsigned head = *cqHead;
+
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        // Getting interrupted by a signal (like Ctrl-Z and then fg) doesn't
+        // mean anything's wrong, so just wait again.
+        while (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+            if (errno != EINTR) {
+                return CSVH_AIO__IO_ERROR;
+            }
+        }
+        return CSVH_AIO__OK;
+    }
+
+    struct io_uring_cqe *cqe = cqes + (head & *cqMask);
+    int done = cqe->user_data;
+    // A failed read (i.e., the kernel doesn't know IORING_OP_READ) gets done
+    // over with pread.
+    filled[done] = (cqe->res < 0) ? -2 : cqe->res;
+
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+    return CSVH_AIO__OK;
+}
+
+/**
+ * Wait for every read that's still in flight.
+ */
+static char drainRing()
+{
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        while (filled[i] == -1) {
+            if (waitForCompletion() != CSVH_AIO__OK) {
+                return CSVH_AIO__IO_ERROR;
+            }
+        }
+    }
+
+    return CSVH_AIO__OK;
+}
+
+/**
+ * Stop using the ring, and do every read from here on with pread.  The reads
+ * still in flight have to be done first, since the kernel's writing into
+ * their buffers.  If they can't even be waited for, those buffers get left
+ * to the kernel for good (i.e., leaked) and swapped out for new ones, which
+ * is better than it writing into memory that's been handed out again.
+ */
+static char abandonRing()
+{
+    char rc = CSVH_AIO__OK;
+
+    if (!useRing) {
+        return rc;
+    }
+    useRing = 0;
+
+    if (drainRing() == CSVH_AIO__OK) {
+        return rc;
+    }
+
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        if (filled[i] == -1) {
+            if ((buffers[i] = malloc(sizeof(char) * BUFFER_SIZE)) == NULL) {
+                rc = CSVH_AIO__OUT_OF_MEMORY;
+            }
+            filled[i] = -2;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * Set up the ring and map in its queues.
+ */
+static char setUpRing()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ringFd = syscall(__NR_io_uring_setup, BUFFER_COUNT, &params);
+    if (ringFd < 0) {
+        ringFd = -1;
+        return CSVH_AIO__UNAVAILABLE;
+    }
+
+    sqMapLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqMapLen = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        // Both queues are in one mapping.
+        if (cqMapLen > sqMapLen) {
+            sqMapLen = cqMapLen;
+        }
+    }
+
+    sqMap = mmap(NULL, sqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqMap == MAP_FAILED) {
+        sqMap = NULL;
+        tearDownRing();
+        return CSVH_AIO__UNAVAILABLE;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cqMap = sqMap;
+    } else {
+        cqMap = mmap(NULL, cqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqMap == MAP_FAILED) {
+            cqMap = NULL;
+            tearDownRing();
+            return CSVH_AIO__UNAVAILABLE;
+        }
+    }
+
+    sqesLen = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = mmap(NULL, sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        sqes = NULL;
+        tearDownRing();
+        return CSVH_AIO__UNAVAILABLE;
+    }
+
+    sqTail = (unsigned *) ((char *) sqMap + params.sq_off.tail);
+    sqMask = (unsigned *) ((char *) sqMap + params.sq_off.ring_mask);
+    sqArray = (unsigned *) ((char *) sqMap + params.sq_off.array);
+    cqHead = (unsigned *) ((char *) cqMap + params.cq_off.head);
+    cqTail = (unsigned *) ((char *) cqMap + params.cq_off.tail);
+    cqMask = (unsigned *) ((char *) cqMap + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) ((char *) cqMap + params.cq_off.cqes);
+
+    return CSVH_AIO__OK;
+}
+
+/**
+ * Unmap the ring's queues and close it.
+ */
+static void tearDownRing()
+{
+    if (sqes != NULL) {
+        munmap(sqes, sqesLen);
+        sqes = NULL;
+    }
+    if (cqMap != NULL && cqMap != sqMap) {
+        munmap(cqMap, cqMapLen);
+    }
+    cqMap = NULL;
+    if (sqMap != NULL) {
+        munmap(sqMap, sqMapLen);
+        sqMap = NULL;
+    }
+    if (ringFd != -1) {
+        close(ringFd);
+        ringFd = -1;
+    }
+}
+#endif
@@ -0,0 +1,19 @@
+#ifndef csvh_aio_h
+#define csvh_aio_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_AIO__OK                    0
+#define CSVH_AIO__UNAVAILABLE           1
+#define CSVH_AIO__OUT_OF_MEMORY         2
+#define CSVH_AIO__IO_ERROR              3
+
+char csvh_aio_open(int fd, long long offset);
+
+char csvh_aio_next(const char **buff, size_t *len, long long *offset);
+
+char csvh_aio_close();
+
+#endif
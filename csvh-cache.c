@@ -0,0 +1,759 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "csv.h"
+
+#include "csvh-cache.h"
+
+// This is a helper module for csv-handler.c.
+
+// Keeps a binary, column-by-column copy of an input file next to it (the
+// file's name with ".csvb" tacked on), so that the next time the same file
+// gets opened, nothing has to be parsed.  Every field is already split out and
+// unescaped, and each column is stored by itself, so looking at one column of
+// a row only touches that column.
+
+// The cache is only good for the exact file it was made from.  It has the
+// file's size, its modification time and a hash of a sample of its bytes, and
+// if any of those don't match (or the delimiter, the quoting, or where reading
+// started), it gets rebuilt.
+
+// Building it takes two passes over the records.  The first one just counts,
+// so that the whole cache file can be laid out up front, and the second one
+// fills it in.  It's written under a temp name and renamed when done, so a
+// half-written cache never gets picked up.
+
+// The layout of the file, after the header, is the row table (one cacheRow per
+// row), the column table (one cacheColumn per column), then each column's
+// offsets (one per row, plus one at the end) followed by its field bytes.
+// Every field is followed by a null terminator so it can be handed out
+// straight from the mapping.  Everything's in the machine's byte order, since
+// the cache never leaves the machine.
+
+/**
+ * Identifies the file, and its layout version.  Bump the version if anything
+ * about the layout changes.  (Or if older ones can't be trusted: before 4, a
+ * malformed line would leave the cache cut off there.)
+ */
+#define CACHE_MAGIC     "CSVB"
+#define CACHE_VERSION   4
+
+/**
+ * What gets sampled for the hash: the start and end of the file, and this
+ * many blocks spread out evenly in between.
+ */
+#define HASH_EDGE_SIZE      65536
+#define HASH_SAMPLE_SIZE    4096
+#define HASH_SAMPLE_COUNT   16
+
+/**
+ * Start of the cache file.
+ */
+struct cacheHeader {
+    char magic[4];
+    uint32_t version;
+    // Key.  All of this has to match for the cache to be good.
+    uint64_t srcSize;
+    int64_t srcMtimeSec;
+    int64_t srcMtimeNsec;
+    uint64_t srcHash;
+    int64_t startOffset;
+    uint32_t delim;
+    uint32_t quoted;
+    // Contents.
+    uint32_t colCount;
+    uint64_t rowCount;
+    uint64_t rowsAt;
+    uint64_t colsAt;
+    uint64_t fileSize;
+};
+
+/**
+ * Where a row came from in the source, and how many fields it has (-1 if it
+ * couldn't be parsed).
+ */
+struct cacheRow {
+    int64_t offset;
+    int64_t end; // Just past the line break.
+    uint64_t len; // Not including the line break.
+    int32_t fieldCount;
+    uint32_t padding;
+};
+
+/**
+ * Where a column's offsets and field bytes are in the cache file.
+ */
+struct cacheColumn {
+    uint64_t offsetsAt;
+    uint64_t dataAt;
+};
+
+// Forward declarations for static functions.
+
+static char keyFromSource(int srcFd, struct cacheHeader *key);
+
+static uint64_t hashBytes(uint64_t hash, const char *bytes, size_t len);
+
+static char hashRange(int srcFd, long long offset, size_t len, uint64_t *hash);
+
+static char loadCache(const char *path);
+
+static char growColumns(int newCount);
+
+static char layOut();
+
+static char storeFields(struct cacheRow *row, char **parsedLine, size_t *lens);
+
+static uint64_t alignUp(uint64_t num);
+
+// END forward declarations.
+
+/**
+ * Where things are at: not open, counting (first pass), filling in (second
+ * pass), or handing out rows.
+ */
+static char state = 0;
+#define STATE__CLOSED       0
+#define STATE__COUNTING     1
+#define STATE__FILLING      2
+#define STATE__SERVING      3
+
+/**
+ * Delimiter used to split the records, and the parser for whether there's
+ * quoting.
+ */
+static char delim = ',';
+static csv_parse_fn parseFields = parse_csv_len;
+
+/**
+ * Path of the cache file, and of the temp file it gets built in.
+ */
+static char *cachePath = NULL;
+static char *tempPath = NULL;
+
+/**
+ * The cache file, mapped, and its size.
+ */
+static char *map = NULL;
+static size_t mapLen = 0;
+
+/**
+ * Header, either from the mapping or, while building, the one being built.
+ */
+static struct cacheHeader *header = NULL;
+static struct cacheHeader buildHeader;
+
+/**
+ * Row and column tables, in the mapping.
+ */
+static struct cacheRow *rows = NULL;
+static struct cacheColumn *cols = NULL;
+
+/**
+ * While building, the number of field bytes in each column (including null
+ * terminators), and, on the second pass, how many have been filled in.
+ */
+static uint64_t *colBytes = NULL;
+static uint64_t *colFilled = NULL;
+static int colCap = 0;
+
+/**
+ * While building, rows added so far in this pass.
+ */
+static uint64_t rowsAdded = 0;
+
+/**
+ * Row currently being handed out.  -1 before the first one.
+ */
+static long long curRow = -1;
+
+/**
+ * Open the cache for the file behind the passed fd.  Returns OK if there's a
+ * good cache and it's ready to hand out rows, MISS if it needs to be built
+ * (meaning pass every record to csvh_cache_add, call csvh_cache_end_pass,
+ * then do it again), or UNAVAILABLE if there's no way to cache this input
+ * (like it isn't a file, or there's nowhere to put the cache).
+ *
+ * @param   srcFd
+ * @param   startOffset     Where in the file the first record starts.
+ * @param   delimIn
+ * @param   quoted          Whether the records have quoting.
+ */
+char csvh_cache_open(int srcFd, long long startOffset, char delimIn, char quoted)
+{
+#ifdef _WIN32
+    return CSVH_CACHE__UNAVAILABLE;
+#else
+    delim = delimIn;
+    parseFields = csv_parser_for(quoted);
+
+    // Need the name of the file to know where the cache goes.
+    char fdPath[64];
+    char srcPath[4096];
+    snprintf(fdPath, sizeof(fdPath), "/proc/self/fd/%d", srcFd);
+    ssize_t pathLen = readlink(fdPath, srcPath, sizeof(srcPath) - 1);
+    if (pathLen <= 0 || srcPath[0] != '/') {
+        // Either no /proc, or it's not a file with a name (e.g. it was
+        // deleted).
+        return CSVH_CACHE__UNAVAILABLE;
+    }
+    srcPath[pathLen] = '\0';
+
+    cachePath = malloc(sizeof(char) * (pathLen + 6));
+    tempPath = malloc(sizeof(char) * (pathLen + 32));
+    if (cachePath == NULL || tempPath == NULL) {
+        return CSVH_CACHE__OUT_OF_MEMORY;
+    }
+    sprintf(cachePath, "%s.csvb", srcPath);
+    sprintf(tempPath, "%s.csvb.%ld", srcPath, (long) getpid());
+
+    memset(&buildHeader, 0, sizeof(buildHeader));
+    buildHeader.startOffset = startOffset;
+    buildHeader.delim = (unsigned char) delim;
+    buildHeader.quoted = quoted;
+
+    char rc;
+    if ((rc = keyFromSource(srcFd, &buildHeader)) != CSVH_CACHE__OK) {
+        return rc;
+    }
+
+    if (loadCache(cachePath) == CSVH_CACHE__OK) {
+        state = STATE__SERVING;
+        return CSVH_CACHE__OK;
+    }
+
+    state = STATE__COUNTING;
+    rowsAdded = 0;
+
+    return CSVH_CACHE__MISS;
+#endif
+}
+
+/**
+ * Add the next record while building the cache.  Pass the same records, in
+ * the same order, on both passes.
+ *
+ * @param   record
+ * @param   recordLen
+ * @param   offset      Where the record starts in the file.
+ * @param   end         Where the next record starts in the file.
+ */
+char csvh_cache_add(const char *record, size_t recordLen, long long offset, long long end)
+{
+    if (state != STATE__COUNTING && state != STATE__FILLING) {
+        return CSVH_CACHE__IO_ERROR;
+    }
+
+    size_t *lens = NULL;
+    char **parsedLine = parseFields(record, recordLen, delim, &lens);
+
+    int fieldCount = 0;
+    if (parsedLine != NULL) {
+        for (; parsedLine[fieldCount] != NULL; fieldCount++) {}
+    }
+
+    char rc = CSVH_CACHE__OK;
+
+    if (state == STATE__COUNTING) {
+        if (fieldCount > (int) buildHeader.colCount) {
+            rc = growColumns(fieldCount);
+        }
+        for (int i = 0; rc == CSVH_CACHE__OK && i < fieldCount; i++) {
+            colBytes[i] += lens[i] + 1;
+        }
+    } else if (rowsAdded >= header->rowCount) {
+        // Something changed between passes.
+        rc = CSVH_CACHE__IO_ERROR;
+    } else {
+        struct cacheRow *row = rows + rowsAdded;
+        row->offset = offset;
+        row->end = end;
+        row->len = recordLen;
+        row->fieldCount = (parsedLine == NULL) ? -1 : fieldCount;
+        rc = storeFields(row, parsedLine, lens);
+    }
+
+    if (parsedLine != NULL) {
+        free_csv_line(parsedLine);
+        free(lens);
+    }
+
+    rowsAdded++;
+
+    return rc;
+}
+
+/**
+ * End a pass of building the cache.  After the first one, the cache file gets
+ * laid out and it's ready for the second.  After the second one, the cache is
+ * done, saved, and ready to hand out rows.
+ */
+char csvh_cache_end_pass()
+{
+#ifdef _WIN32
+    return CSVH_CACHE__UNAVAILABLE;
+#else
+    if (state == STATE__COUNTING) {
+        buildHeader.rowCount = rowsAdded;
+        rowsAdded = 0;
+        state = STATE__FILLING;
+        return layOut();
+    }
+
+    if (state != STATE__FILLING || rowsAdded != header->rowCount) {
+        return CSVH_CACHE__IO_ERROR;
+    }
+
+    // Make the offsets for each column end at the end of its bytes.
+    for (uint32_t i = 0; i < header->colCount; i++) {
+        ((uint64_t *) (map + cols[i].offsetsAt))[header->rowCount] = colFilled[i];
+    }
+
+    // Only mark it as a cache file at the very end, so that if anything goes
+    // wrong before here, it won't be taken as good.
+    memcpy(header->magic, CACHE_MAGIC, 4);
+
+    if (msync(map, mapLen, MS_SYNC) != 0 || rename(tempPath, cachePath) != 0) {
+        return CSVH_CACHE__IO_ERROR;
+    }
+    free(tempPath);
+    tempPath = NULL;
+
+    free(colBytes);
+    free(colFilled);
+    colBytes = NULL;
+    colFilled = NULL;
+    colCap = 0;
+
+    state = STATE__SERVING;
+    curRow = -1;
+
+    return CSVH_CACHE__OK;
+#endif
+}
+
+/**
+ * Move on to the next row.
+ */
+char csvh_cache_next_row()
+{
+    if (state != STATE__SERVING) {
+        return CSVH_CACHE__IO_ERROR;
+    }
+
+    if (curRow + 1 >= (long long) header->rowCount) {
+        return CSVH_CACHE__DONE;
+    }
+
+    curRow++;
+
+    return CSVH_CACHE__OK;
+}
+
+/**
+ * Move ahead to the last n rows, and set found to the number of rows left
+ * after the current one (which is less than n if there aren't that many).
+ *
+ * @param   n
+ * @param   found
+ */
+char csvh_cache_seek_tail(int n, int *found)
+{
+    if (state != STATE__SERVING) {
+        return CSVH_CACHE__IO_ERROR;
+    }
+
+    long long left = (long long) header->rowCount - (curRow + 1);
+    *found = (left < n) ? left : n;
+    curRow = header->rowCount - *found - 1;
+
+    return CSVH_CACHE__OK;
+}
+
+/**
+ * Get where the current row is in the source file.
+ *
+ * @param   offset
+ * @param   len     Not including the line break.
+ * @param   end     Just past the line break.
+ */
+void csvh_cache_row(long long *offset, size_t *len, long long *end)
+{
+    *offset = rows[curRow].offset;
+    *len = rows[curRow].len;
+    *end = rows[curRow].end;
+}
+
+/**
+ * Get the number of fields in the current row.  Returns -1 if it couldn't be
+ * parsed, the same as count_fields.
+ */
+int csvh_cache_field_count()
+{
+    return rows[curRow].fieldCount;
+}
+
+/**
+ * Get a field of the current row, already unescaped, and its length, if len
+ * isn't NULL.  (It's null-terminated too, but can have nulls in it.)  Returns
+ * NULL if the row doesn't have that many fields.  Good until the cache is
+ * closed, and must not be changed.
+ *
+ * @param   col
+ * @param   len
+ */
+char *csvh_cache_field(int col, size_t *len)
+{
+    if (col < 0 || col >= rows[curRow].fieldCount) {
+        return NULL;
+    }
+
+    uint64_t *offsets = (uint64_t *) (map + cols[col].offsetsAt);
+
+    if (len != NULL) {
+        // The next one starts just past this one's null terminator.
+        *len = offsets[curRow + 1] - offsets[curRow] - 1;
+    }
+
+    return map + cols[col].dataAt + offsets[curRow];
+}
+
+/**
+ * Close out everything.  If the cache was in the middle of being built, it's
+ * thrown away.
+ */
+char csvh_cache_close()
+{
+#ifndef _WIN32
+    if (map != NULL) {
+        munmap(map, mapLen);
+    }
+#endif
+    map = NULL;
+    mapLen = 0;
+    header = NULL;
+    rows = NULL;
+    cols = NULL;
+
+    if (tempPath != NULL) {
+        unlink(tempPath);
+        free(tempPath);
+        tempPath = NULL;
+    }
+    free(cachePath);
+    cachePath = NULL;
+
+    free(colBytes);
+    free(colFilled);
+    colBytes = NULL;
+    colFilled = NULL;
+    colCap = 0;
+
+    state = STATE__CLOSED;
+    curRow = -1;
+
+    return CSVH_CACHE__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Fill in the parts of the key that come from the source file itself.
+ *
+ * @param   srcFd
+ * @param   key
+ */
+static char keyFromSource(int srcFd, struct cacheHeader *key)
+{
+    struct stat st;
+    if (fstat(srcFd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return CSVH_CACHE__UNAVAILABLE;
+    }
+
+    key->srcSize = st.st_size;
+    key->srcMtimeSec = st.st_mtim.tv_sec;
+    key->srcMtimeNsec = st.st_mtim.tv_nsec;
+
+    // Hashing the whole thing would take as long as parsing it, which would
+    // defeat the purpose.  The modification time catches almost everything,
+    // and this catches the rest as long as the change isn't somewhere in the
+    // middle that doesn't get sampled.
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a offset basis.
+    long long size = st.st_size;
+    char rc;
+
+    if (size <= 2 * HASH_EDGE_SIZE + HASH_SAMPLE_COUNT * HASH_SAMPLE_SIZE) {
+        rc = hashRange(srcFd, 0, size, &hash);
+    } else {
+        rc = hashRange(srcFd, 0, HASH_EDGE_SIZE, &hash);
+
+        long long step = (size - 2 * HASH_EDGE_SIZE) / (HASH_SAMPLE_COUNT + 1);
+        for (int i = 1; rc == CSVH_CACHE__OK && i <= HASH_SAMPLE_COUNT; i++) {
+            rc = hashRange(srcFd, HASH_EDGE_SIZE + i * step, HASH_SAMPLE_SIZE, &hash);
+        }
+
+        if (rc == CSVH_CACHE__OK) {
+            rc = hashRange(srcFd, size - HASH_EDGE_SIZE, HASH_EDGE_SIZE, &hash);
+        }
+    }
+
+    key->srcHash = hash;
+
+    return rc;
+}
+
+/**
+ * Add bytes to an FNV-1a hash.
+ *
+ * @param   hash
+ * @param   bytes
+ * @param   len
+ */
+static uint64_t hashBytes(uint64_t hash, const char *bytes, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) bytes[i];
+        hash *= 1099511628211ULL; // FNV prime.
+    }
+
+    return hash;
+}
+
+/**
+ * Add a range of the source file to a hash.
+ *
+ * @param   srcFd
+ * @param   offset
+ * @param   len
+ * @param   hash
+ */
+static char hashRange(int srcFd, long long offset, size_t len, uint64_t *hash)
+{
+    char buff[HASH_SAMPLE_SIZE];
+
+    while (len > 0) {
+        size_t want = (len < sizeof(buff)) ? len : sizeof(buff);
+        ssize_t got = pread(srcFd, buff, want, offset);
+        if (got <= 0) {
+            return CSVH_CACHE__IO_ERROR;
+        }
+        *hash = hashBytes(*hash, buff, got);
+        offset += got;
+        len -= got;
+    }
+
+    return CSVH_CACHE__OK;
+}
+
+/**
+ * Map an existing cache file and check that it's good for the source.
+ *
+ * @param   path
+ */
+static char loadCache(const char *path)
+{
+#ifdef _WIN32
+    return CSVH_CACHE__UNAVAILABLE;
+#else
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return CSVH_CACHE__MISS;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(struct cacheHeader)) {
+        close(fd);
+        return CSVH_CACHE__MISS;
+    }
+
+    void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // The mapping stays good without it.
+    if (mapped == MAP_FAILED) {
+        return CSVH_CACHE__MISS;
+    }
+
+    struct cacheHeader *found = mapped;
+
+    // Everything has to match, and the tables have to actually fit in the
+    // file, in case it got cut off.
+    if (
+        memcmp(found->magic, CACHE_MAGIC, 4) != 0
+        || found->version != CACHE_VERSION
+        || found->srcSize != buildHeader.srcSize
+        || found->srcMtimeSec != buildHeader.srcMtimeSec
+        || found->srcMtimeNsec != buildHeader.srcMtimeNsec
+        || found->srcHash != buildHeader.srcHash
+        || found->startOffset != buildHeader.startOffset
+        || found->delim != buildHeader.delim
+        || found->quoted != buildHeader.quoted
+        || found->fileSize != (uint64_t) st.st_size
+        || found->rowsAt + found->rowCount * sizeof(struct cacheRow) > found->colsAt
+        || found->colsAt + found->colCount * sizeof(struct cacheColumn) > found->fileSize
+    ) {
+        munmap(mapped, st.st_size);
+        return CSVH_CACHE__MISS;
+    }
+
+    map = mapped;
+    mapLen = st.st_size;
+    header = found;
+    rows = (struct cacheRow *) (map + header->rowsAt);
+    cols = (struct cacheColumn *) (map + header->colsAt);
+    curRow = -1;
+
+    for (uint32_t i = 0; i < header->colCount; i++) {
+        if (
+            cols[i].offsetsAt + (header->rowCount + 1) * sizeof(uint64_t) > cols[i].dataAt
+            || cols[i].dataAt > header->fileSize
+        ) {
+            munmap(map, mapLen);
+            map = NULL;
+            return CSVH_CACHE__MISS;
+        }
+    }
+
+    return CSVH_CACHE__OK;
+#endif
+}
+
+/**
+ * Make room for more columns while counting.
+ *
+ * @param   newCount
+ */
+static char growColumns(int newCount)
+{
+    if (newCount > colCap) {
+        int newCap = (colCap == 0) ? 64 : colCap;
+        for (; newCap < newCount; newCap *= 2) {}
+
+        uint64_t *newBytes = realloc(colBytes, sizeof(uint64_t) * newCap);
+        if (newBytes == NULL) {
+            return CSVH_CACHE__OUT_OF_MEMORY;
+        }
+        memset(newBytes + colCap, 0, sizeof(uint64_t) * (newCap - colCap));
+        colBytes = newBytes;
+        colCap = newCap;
+    }
+
+    buildHeader.colCount = newCount;
+
+    return CSVH_CACHE__OK;
+}
+
+/**
+ * Create the temp file at its full size, map it, and fill in the header and
+ * column table, now that the counts are known.
+ */
+static char layOut()
+{
+#ifdef _WIN32
+    return CSVH_CACHE__UNAVAILABLE;
+#else
+    uint64_t rowCount = buildHeader.rowCount;
+    uint32_t colCount = buildHeader.colCount;
+
+    buildHeader.version = CACHE_VERSION;
+    buildHeader.rowsAt = alignUp(sizeof(struct cacheHeader));
+    buildHeader.colsAt = alignUp(buildHeader.rowsAt + rowCount * sizeof(struct cacheRow));
+
+    uint64_t at = alignUp(buildHeader.colsAt + colCount * sizeof(struct cacheColumn));
+
+    struct cacheColumn *layout = malloc(sizeof(struct cacheColumn) * (colCount + 1));
+    colFilled = calloc(colCount + 1, sizeof(uint64_t));
+    if (layout == NULL || colFilled == NULL) {
+        free(layout);
+        return CSVH_CACHE__OUT_OF_MEMORY;
+    }
+
+    for (uint32_t i = 0; i < colCount; i++) {
+        layout[i].offsetsAt = at;
+        layout[i].dataAt = at + (rowCount + 1) * sizeof(uint64_t);
+        at = alignUp(layout[i].dataAt + colBytes[i]);
+    }
+    buildHeader.fileSize = at;
+
+    int fd = open(tempPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        free(layout);
+        free(tempPath);
+        tempPath = NULL; // Nothing to clean up.
+        return CSVH_CACHE__UNAVAILABLE;
+    }
+
+    void *mapped = MAP_FAILED;
+    if (ftruncate(fd, at) == 0) {
+        mapped = mmap(NULL, at, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        free(layout);
+        return CSVH_CACHE__IO_ERROR;
+    }
+
+    map = mapped;
+    mapLen = at;
+    header = (struct cacheHeader *) map;
+    memcpy(header, &buildHeader, sizeof(buildHeader));
+    memset(header->magic, 0, 4); // Not good until it's done.
+    rows = (struct cacheRow *) (map + header->rowsAt);
+    cols = (struct cacheColumn *) (map + header->colsAt);
+    memcpy(cols, layout, sizeof(struct cacheColumn) * colCount);
+    free(layout);
+
+    return CSVH_CACHE__OK;
+#endif
+}
+
+/**
+ * Copy the fields of a row into their columns on the second pass.  Columns
+ * that the row doesn't have get an empty stretch, so every column has an
+ * offset for every row.
+ *
+ * @param   row
+ * @param   parsedLine  NULL if the row couldn't be parsed.
+ * @param   lens        Length of each field.
+ */
+static char storeFields(struct cacheRow *row, char **parsedLine, size_t *lens)
+{
+    int fieldCount = (row->fieldCount > 0) ? row->fieldCount : 0;
+
+    for (uint32_t i = 0; i < header->colCount; i++) {
+        ((uint64_t *) (map + cols[i].offsetsAt))[rowsAdded] = colFilled[i];
+
+        if ((int) i >= fieldCount) {
+            continue;
+        }
+
+        size_t len = lens[i] + 1; // Null terminator and all.
+        if (colFilled[i] + len > colBytes[i]) {
+            // Something changed between passes.
+            return CSVH_CACHE__IO_ERROR;
+        }
+        memcpy(map + cols[i].dataAt + colFilled[i], parsedLine[i], len);
+        colFilled[i] += len;
+    }
+
+    return CSVH_CACHE__OK;
+}
+
+/**
+ * Round up to a multiple of 8, to keep everything in the cache file aligned.
+ *
+ * @param   num
+ */
+static uint64_t alignUp(uint64_t num)
+{
+    return (num + 7) & ~((uint64_t) 7);
+}
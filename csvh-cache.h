@@ -0,0 +1,33 @@
+#ifndef csvh_cache_h
+#define csvh_cache_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_CACHE__OK                  0
+#define CSVH_CACHE__DONE                1
+#define CSVH_CACHE__OUT_OF_MEMORY       2
+#define CSVH_CACHE__IO_ERROR            3
+#define CSVH_CACHE__MISS                4
+#define CSVH_CACHE__UNAVAILABLE         5
+
+char csvh_cache_open(int srcFd, long long startOffset, char delimIn, char quoted);
+
+char csvh_cache_add(const char *record, size_t recordLen, long long offset, long long end);
+
+char csvh_cache_end_pass();
+
+char csvh_cache_next_row();
+
+char csvh_cache_seek_tail(int n, int *found);
+
+void csvh_cache_row(long long *offset, size_t *len, long long *end);
+
+int csvh_cache_field_count();
+
+char *csvh_cache_field(int col, size_t *len);
+
+char csvh_cache_close();
+
+#endif
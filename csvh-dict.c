@@ -0,0 +1,354 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "csvh-dict.h"
+
+// This is a helper module for csv-handler.c (and csvh-line-helper.c).
+
+// A dictionary of strings, for columns that only have a handful of different
+// values (statuses, currencies, state codes, etc.).  Each different value gets
+// stored once and given a code, counting up from zero, so a column of them can
+// be kept as codes instead of strings, and two values are the same if their
+// codes are.  Values go by length, so they can have nulls in them.
+
+// Unlike the other helper modules, there can be more than one of these at a
+// time (one per column), so everything's kept in a struct that gets passed
+// around.
+
+/**
+ * Size of the first block of memory holding the strings, and the most any
+ * block grows to.  Each block is twice the size of the one before, so a
+ * dictionary with only a few values (like one per column of a wide file)
+ * doesn't take up a whole big block.  Anything that doesn't fit in the next
+ * block gets its own.
+ */
+#define ARENA_FIRST_BLOCK_SIZE 256
+#define ARENA_BLOCK_SIZE 65536
+
+/**
+ * Starting number of slots in the hash table, and of values.  Kept small for
+ * the same reason as the arena.  The number of slots is always a power of
+ * two.
+ */
+#define START_SLOTS 16
+#define START_VALUES 4
+
+/**
+ * Don't decide whether a column is low-cardinality until it's had this many
+ * values.  Until then, everything counts as low-cardinality.
+ */
+#define MIN_SEEN_TO_JUDGE 1024
+
+struct csvhDict {
+    // Code to string, and its length.
+    char **values;
+    size_t *lens;
+    int count;
+    int cap;
+    // Hash table of codes, with -1 as empty, and the hash of each code's
+    // string so the table can grow without rehashing the strings.
+    int *slots;
+    int slotCount;
+    uint64_t *hashes;
+    // Strings.
+    char **blocks;
+    int blockCount;
+    size_t blockUsed;
+    size_t blockSize; // Of the one being filled.
+};
+
+// Forward declarations for static functions.
+
+static uint64_t hashString(const char *value, size_t len);
+
+static int findSlot(struct csvhDict *dict, const char *value, size_t len, uint64_t hash);
+
+static char growSlots(struct csvhDict *dict);
+
+static char *arenaCopy(struct csvhDict *dict, const char *value, size_t len);
+
+// END forward declarations.
+
+/**
+ * Make a new, empty dictionary.  Returns NULL if out of memory.
+ */
+struct csvhDict *csvh_dict_new()
+{
+    struct csvhDict *dict = calloc(1, sizeof(struct csvhDict));
+    if (dict == NULL) {
+        return NULL;
+    }
+
+    dict->slotCount = START_SLOTS;
+    dict->slots = malloc(sizeof(int) * dict->slotCount);
+    if (dict->slots == NULL) {
+        free(dict);
+        return NULL;
+    }
+    memset(dict->slots, -1, sizeof(int) * dict->slotCount);
+
+    return dict;
+}
+
+/**
+ * Get the code for a value, adding it if it's not there yet.  Returns -1 if
+ * out of memory.
+ *
+ * @param   dict
+ * @param   value
+ * @param   len
+ */
+int csvh_dict_intern(struct csvhDict *dict, const char *value, size_t len)
+{
+    uint64_t hash = hashString(value, len);
+    int slot = findSlot(dict, value, len, hash);
+
+    if (dict->slots[slot] != -1) {
+        return dict->slots[slot];
+    }
+
+    if (dict->count == dict->cap) {
+        int newCap = (dict->cap == 0) ? START_VALUES : dict->cap * 2;
+        char **newValues = realloc(dict->values, sizeof(char *) * newCap);
+        if (newValues == NULL) {
+            return -1;
+        }
+        dict->values = newValues;
+        size_t *newLens = realloc(dict->lens, sizeof(size_t) * newCap);
+        if (newLens == NULL) {
+            return -1;
+        }
+        dict->lens = newLens;
+        uint64_t *newHashes = realloc(dict->hashes, sizeof(uint64_t) * newCap);
+        if (newHashes == NULL) {
+            return -1;
+        }
+        dict->hashes = newHashes;
+        dict->cap = newCap;
+    }
+
+    char *copy = arenaCopy(dict, value, len);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    int code = dict->count++;
+    dict->values[code] = copy;
+    dict->lens[code] = len;
+    dict->hashes[code] = hash;
+    dict->slots[slot] = code;
+
+    // Keep it at most half full, so lookups stay short.
+    if (dict->count * 2 > dict->slotCount && !growSlots(dict)) {
+        return -1;
+    }
+
+    return code;
+}
+
+/**
+ * Get the code for a value without adding it.  Returns -1 if it's not there.
+ *
+ * @param   dict
+ * @param   value
+ * @param   len
+ */
+int csvh_dict_find(struct csvhDict *dict, const char *value, size_t len)
+{
+    return dict->slots[findSlot(dict, value, len, hashString(value, len))];
+}
+
+/**
+ * Get the string for a code, and its length, if len isn't NULL.  (It's
+ * null-terminated too, but can have nulls in it.)
+ *
+ * @param   dict
+ * @param   code
+ * @param   len
+ */
+const char *csvh_dict_value(struct csvhDict *dict, int code, size_t *len)
+{
+    if (len != NULL) {
+        *len = dict->lens[code];
+    }
+
+    return dict->values[code];
+}
+
+/**
+ * Get the number of different values.
+ *
+ * @param   dict
+ */
+int csvh_dict_count(struct csvhDict *dict)
+{
+    return dict->count;
+}
+
+/**
+ * Decide whether a column is still worth keeping as codes, given how many
+ * values it's had (including repeats).  It is if, on average, each different
+ * value shows up at least twice.  Anything less and the dictionary is just
+ * overhead.
+ *
+ * @param   dict
+ * @param   seen
+ */
+char csvh_dict_is_low_cardinality(struct csvhDict *dict, long long seen)
+{
+    return seen < MIN_SEEN_TO_JUDGE || (long long) dict->count * 2 <= seen;
+}
+
+/**
+ * Free everything.
+ *
+ * @param   dict
+ */
+void csvh_dict_free(struct csvhDict *dict)
+{
+    if (dict == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < dict->blockCount; i++) {
+        free(dict->blocks[i]);
+    }
+    free(dict->blocks);
+    free(dict->values);
+    free(dict->lens);
+    free(dict->hashes);
+    free(dict->slots);
+    free(dict);
+}
+
+
+// Static functions below this line.
+
+/**
+ * FNV-1a hash of a string.
+ *
+ * @param   value
+ * @param   len
+ */
+static uint64_t hashString(const char *value, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) value[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * Find the slot that either has the value's code, or is empty and is where it
+ * would go.
+ *
+ * @param   dict
+ * @param   value
+ * @param   len
+ * @param   hash
+ */
+static int findSlot(struct csvhDict *dict, const char *value, size_t len, uint64_t hash)
+{
+    int mask = dict->slotCount - 1;
+    int slot = hash & mask;
+
+    while (dict->slots[slot] != -1) {
+        int code = dict->slots[slot];
+        if (
+            dict->hashes[code] == hash
+            && dict->lens[code] == len
+            && memcmp(dict->values[code], value, len) == 0
+        ) {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+/**
+ * Double the size of the hash table.  Returns 0 if out of memory.
+ *
+ * @param   dict
+ */
+static char growSlots(struct csvhDict *dict)
+{
+    int newCount = dict->slotCount * 2;
+    int *newSlots = malloc(sizeof(int) * newCount);
+    if (newSlots == NULL) {
+        return 0;
+    }
+    memset(newSlots, -1, sizeof(int) * newCount);
+
+    for (int code = 0; code < dict->count; code++) {
+        int slot = dict->hashes[code] & (newCount - 1);
+        while (newSlots[slot] != -1) {
+            slot = (slot + 1) & (newCount - 1);
+        }
+        newSlots[slot] = code;
+    }
+
+    free(dict->slots);
+    dict->slots = newSlots;
+    dict->slotCount = newCount;
+
+    return 1;
+}
+
+/**
+ * Copy a string into the arena, with a null terminator after it.
+ *
+ * @param   dict
+ * @param   value
+ * @param   len
+ */
+static char *arenaCopy(struct csvhDict *dict, const char *value, size_t len)
+{
+    size_t need = len + 1;
+    char *dest;
+
+    if (dict->blockCount == 0 || dict->blockUsed + need > dict->blockSize) {
+        char **newBlocks = realloc(dict->blocks, sizeof(char *) * (dict->blockCount + 1));
+        if (newBlocks == NULL) {
+            return NULL;
+        }
+        dict->blocks = newBlocks;
+
+        size_t nextSize = ARENA_FIRST_BLOCK_SIZE;
+        if (dict->blockCount > 0) {
+            nextSize = (dict->blockSize * 2 > ARENA_BLOCK_SIZE) ? ARENA_BLOCK_SIZE : dict->blockSize * 2;
+        }
+        size_t blockSize = (need > nextSize) ? need : nextSize;
+        if ((dict->blocks[dict->blockCount] = malloc(blockSize)) == NULL) {
+            return NULL;
+        }
+
+        if (need > nextSize && dict->blockCount > 0) {
+            // Big one gets its own block, but keep filling the one before it.
+            char *dum = dict->blocks[dict->blockCount];
+            dict->blocks[dict->blockCount] = dict->blocks[dict->blockCount - 1];
+            dict->blocks[dict->blockCount - 1] = dum;
+            dict->blockCount++;
+            memcpy(dum, value, len);
+            dum[len] = '\0';
+            return dum;
+        }
+
+        dict->blockCount++;
+        dict->blockUsed = 0;
+        dict->blockSize = blockSize;
+    }
+
+    dest = dict->blocks[dict->blockCount - 1] + dict->blockUsed;
+    memcpy(dest, value, len);
+    dest[len] = '\0';
+    dict->blockUsed += need;
+
+    return dest;
+}
@@ -0,0 +1,22 @@
+#ifndef csvh_dict_h
+#define csvh_dict_h
+
+#include <stddef.h>
+
+struct csvhDict;
+
+struct csvhDict *csvh_dict_new();
+
+int csvh_dict_intern(struct csvhDict *dict, const char *value, size_t len);
+
+int csvh_dict_find(struct csvhDict *dict, const char *value, size_t len);
+
+const char *csvh_dict_value(struct csvhDict *dict, int code, size_t *len);
+
+int csvh_dict_count(struct csvhDict *dict);
+
+char csvh_dict_is_low_cardinality(struct csvhDict *dict, long long seen);
+
+void csvh_dict_free(struct csvhDict *dict);
+
+#endif
@@ -0,0 +1,118 @@
+#include <string.h>
+
+#include "csvh-escape.h"
+#include "csvh-scan.h"
+
+// This is a helper module for csv-handler.c.
+
+// Escapes values for JSON strings and TSV fields.  Almost everything in real
+// data doesn't need escaping at all, so the work is finding the next byte that
+// does (which csvh-scan does 16 bytes at a time) and copying everything before
+// it in one go.  Only the bytes that need it get looked at one at a time.
+//
+// The caller makes sure there's room: a value never takes up more than the
+// MAX_GROWTH constants times its length once it's escaped.
+
+/**
+ * Hex digits, for \u escapes.
+ */
+static const char hexDigits[] = "0123456789abcdef";
+
+/**
+ * Write a value into out as the inside of a JSON string (i.e., without the
+ * quotes around it), and return how much got written.  Bytes that aren't
+ * ASCII are left alone, so UTF-8 stays UTF-8.
+ *
+ * @param   value
+ * @param   len
+ * @param   out
+ */
+size_t csvh_escape_json(const char *value, size_t len, char *out)
+{
+    char *start = out;
+    size_t i = 0;
+
+    while (i < len) {
+        size_t plain = csvh_scan_plain_prefix(value + i, len - i, "\"\\", 2, 1);
+        memcpy(out, value + i, plain);
+        out += plain;
+        i += plain;
+
+        if (i == len) {
+            break;
+        }
+
+        unsigned char c = value[i++];
+        *out++ = '\\';
+        switch (c) {
+            case '"':
+            case '\\':
+                *out++ = c;
+                break;
+            case '\n':
+                *out++ = 'n';
+                break;
+            case '\r':
+                *out++ = 'r';
+                break;
+            case '\t':
+                *out++ = 't';
+                break;
+            default:
+                *out++ = 'u';
+                *out++ = '0';
+                *out++ = '0';
+                *out++ = hexDigits[c >> 4];
+                *out++ = hexDigits[c & 0xf];
+                break;
+        }
+    }
+
+    return out - start;
+}
+
+/**
+ * Write a value into out as a TSV field, and return how much got written.
+ * Tabs and line breaks can't be in a field, so they get written the way most
+ * things that read TSV expect (\t, \n and \r), and backslashes get doubled so
+ * that those can be told apart from the real thing.
+ *
+ * @param   value
+ * @param   len
+ * @param   out
+ */
+size_t csvh_escape_tsv(const char *value, size_t len, char *out)
+{
+    char *start = out;
+    size_t i = 0;
+
+    while (i < len) {
+        size_t plain = csvh_scan_plain_prefix(value + i, len - i, "\t\n\r\\", 4, 0);
+        memcpy(out, value + i, plain);
+        out += plain;
+        i += plain;
+
+        if (i == len) {
+            break;
+        }
+
+        char c = value[i++];
+        *out++ = '\\';
+        switch (c) {
+            case '\t':
+                *out++ = 't';
+                break;
+            case '\n':
+                *out++ = 'n';
+                break;
+            case '\r':
+                *out++ = 'r';
+                break;
+            default:
+                *out++ = c;
+                break;
+        }
+    }
+
+    return out - start;
+}
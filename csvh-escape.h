@@ -0,0 +1,18 @@
+#ifndef csvh_escape_h
+#define csvh_escape_h
+
+#include <stddef.h>
+
+// Escaping values for output formats other than CSV.
+
+/**
+ * Most bytes a value can take up once escaped, per byte of the value.
+ */
+#define CSVH_ESCAPE__JSON_MAX_GROWTH    6
+#define CSVH_ESCAPE__TSV_MAX_GROWTH     2
+
+size_t csvh_escape_json(const char *value, size_t len, char *out);
+
+size_t csvh_escape_tsv(const char *value, size_t len, char *out);
+
+#endif
@@ -0,0 +1,217 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <glob.h>
+#endif
+
+#include "csvh-files.h"
+
+// This is a helper module for csv-handler.c.
+
+// Keeps track of the input files when there's more than one of them (i.e.,
+// daily partitions with the same headers), and hands them out one at a time
+// to be read.  They get parsed one after another, since the reader and
+// everything after it keep one set of state.  The one thing that does happen
+// at the same time is the disk: whenever a file gets handed out, the one after
+// it gets opened and the kernel gets told it'll be needed, so it can start
+// reading it in while this one's being parsed.
+
+/**
+ * How much of the next file to ask for ahead of time.  Past this, the reader's
+ * own read-ahead keeps up fine, and asking for all of a huge file would just
+ * push other things out of the page cache.
+ */
+#define AHEAD_SIZE 67108864
+
+// Forward declarations for static functions.
+
+static char addPath(char *path);
+
+static int openAhead(int ind);
+
+// END forward declarations.
+
+/**
+ * The files, with any patterns in them already expanded, and how many.
+ */
+static char **paths = NULL;
+static int fileCount = 0;
+static int pathCap = 0;
+
+/**
+ * How many have been handed out.
+ */
+static int takenCount = 0;
+
+/**
+ * The file after the last one handed out, already opened to read ahead, or -1
+ * if it isn't (it couldn't be, or isn't a regular file).
+ */
+static int aheadFd = -1;
+
+/**
+ * Get ready to hand out the passed files.  Any path with a wildcard in it that
+ * the shell didn't already expand (i.e., it was in quotes) gets expanded here,
+ * in sorted order.  A path that doesn't exist isn't an error until it's its
+ * turn.
+ *
+ * @param   pathsIn
+ * @param   count
+ */
+char csvh_files_open(char **pathsIn, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (addPath(pathsIn[i]) != CSVH_FILES__OK) {
+            return CSVH_FILES__OUT_OF_MEMORY;
+        }
+    }
+
+    takenCount = 0;
+    aheadFd = -1;
+
+    return CSVH_FILES__OK;
+}
+
+/**
+ * Get the number of files, after expanding any patterns.
+ */
+int csvh_files_count()
+{
+    return fileCount;
+}
+
+/**
+ * Get the number of files that haven't been handed out yet.
+ */
+int csvh_files_remaining()
+{
+    return fileCount - takenCount;
+}
+
+/**
+ * Get the next file to read.  The fd is the caller's to close.  If the file
+ * couldn't be opened, path still says which one it was.
+ *
+ * @param   fd
+ * @param   path
+ */
+char csvh_files_next(int *fd, const char **path)
+{
+    if (takenCount >= fileCount) {
+        return CSVH_FILES__DONE;
+    }
+
+    int ind = takenCount++;
+
+    *path = paths[ind];
+    *fd = (aheadFd != -1) ? aheadFd : open(paths[ind], O_RDONLY);
+
+    aheadFd = (takenCount < fileCount) ? openAhead(takenCount) : -1;
+
+    return (*fd == -1) ? CSVH_FILES__NOT_FOUND : CSVH_FILES__OK;
+}
+
+/**
+ * Close out everything, including the file that was opened ahead, if it never
+ * got handed out.
+ */
+char csvh_files_close()
+{
+    if (aheadFd != -1) {
+        close(aheadFd);
+        aheadFd = -1;
+    }
+
+    for (int i = 0; i < fileCount; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    paths = NULL;
+    fileCount = 0;
+    pathCap = 0;
+    takenCount = 0;
+
+    return CSVH_FILES__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Add a path to the list of files, or everything it matches if it's a
+ * pattern that matches anything.
+ *
+ * @param   path
+ */
+static char addPath(char *path)
+{
+    char **matches = &path;
+    size_t matchCount = 1;
+
+#ifndef _WIN32
+    glob_t found;
+    char globbed = strpbrk(path, "*?[") != NULL && glob(path, 0, NULL, &found) == 0;
+    if (globbed) {
+        matches = found.gl_pathv;
+        matchCount = found.gl_pathc;
+    }
+#endif
+
+    char rc = CSVH_FILES__OK;
+
+    for (size_t i = 0; i < matchCount; i++) {
+        if (fileCount == pathCap) {
+            int newCap = (pathCap == 0) ? 16 : pathCap * 2;
+            char **newPaths = realloc(paths, sizeof(char *) * newCap);
+            if (newPaths == NULL) {
+                rc = CSVH_FILES__OUT_OF_MEMORY;
+                break;
+            }
+            paths = newPaths;
+            pathCap = newCap;
+        }
+        if ((paths[fileCount] = strdup(matches[i])) == NULL) {
+            rc = CSVH_FILES__OUT_OF_MEMORY;
+            break;
+        }
+        fileCount++;
+    }
+
+#ifndef _WIN32
+    if (globbed) {
+        globfree(&found);
+    }
+#endif
+
+    return rc;
+}
+
+/**
+ * Open a file and have the kernel start reading it in.  Returns the fd, or -1
+ * if it couldn't be opened or isn't a regular file.  (Opening a pipe could
+ * hang until something writes to it, and reading it ahead would use it up, so
+ * those just get opened when it's their turn.)
+ *
+ * @param   ind
+ */
+static int openAhead(int ind)
+{
+    struct stat st;
+    if (stat(paths[ind], &st) != 0 || !S_ISREG(st.st_mode)) {
+        return -1;
+    }
+
+    int fd = open(paths[ind], O_RDONLY);
+
+#ifdef POSIX_FADV_WILLNEED
+    if (fd != -1) {
+        posix_fadvise(fd, 0, AHEAD_SIZE, POSIX_FADV_WILLNEED);
+    }
+#endif
+
+    return fd;
+}
@@ -0,0 +1,21 @@
+#ifndef csvh_files_h
+#define csvh_files_h
+
+// Constants
+
+#define CSVH_FILES__OK                  0
+#define CSVH_FILES__DONE                1
+#define CSVH_FILES__OUT_OF_MEMORY       2
+#define CSVH_FILES__NOT_FOUND           3
+
+char csvh_files_open(char **paths, int count);
+
+int csvh_files_count();
+
+int csvh_files_remaining();
+
+char csvh_files_next(int *fd, const char **path);
+
+char csvh_files_close();
+
+#endif
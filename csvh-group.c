@@ -0,0 +1,618 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "csvh-group.h"
+
+// This is a helper module for csv-handler.c.
+
+// Counts up rows by the value of a key column, and optionally adds up a
+// number for each.  There's a separate hash table for each thread adding to
+// it (so no locking), and they get merged together at the end.
+
+// If the tables get too big, they get spilled to temp files, split up by
+// hash into partitions.  At the end, every partition gets read back in and
+// added up by itself, so at most one partition's worth is ever in memory.
+// Groups come out sorted by key within each partition (so fully sorted, if
+// nothing was spilled).
+
+/**
+ * Number of partitions to split spilled groups into.  Has to be a power of
+ * two.
+ */
+#define SPILL_PARTITIONS 64
+
+/**
+ * Size of each block of memory holding keys.  Anything bigger gets its own
+ * block.
+ */
+#define ARENA_BLOCK_SIZE 1048576
+
+/**
+ * Starting number of slots in each hash table.  Always a power of two.
+ */
+#define START_SLOTS 1024
+
+/**
+ * A single group.  An empty slot has a NULL key.
+ */
+struct groupEntry {
+    uint64_t hash;
+    char *key; // Null-terminated, but keyLen is what counts.
+    size_t keyLen;
+    long long count;
+    double sum;
+    double sumError; // What's been lost to rounding (see addToSum).
+};
+
+/**
+ * A hash table of groups, with its own memory for keys.
+ */
+struct groupTable {
+    struct groupEntry *slots;
+    size_t slotCount;
+    size_t used;
+    char **blocks;
+    int blockCount;
+    size_t blockUsed;
+    size_t memUsed;
+    FILE **spills; // One per partition.  NULL if never spilled.
+};
+
+// Forward declarations for static functions.
+
+static char tableInit(struct groupTable *table);
+
+static void tableFree(struct groupTable *table);
+
+static char tableAdd(struct groupTable *table, const char *key, size_t keyLen, uint64_t hash, long long count, double sum, double sumError);
+
+static char tableGrow(struct groupTable *table);
+
+static char *tableCopyKey(struct groupTable *table, const char *key, size_t keyLen);
+
+static char spillTable(struct groupTable *table);
+
+static char loadPartition(int partition);
+
+static char prepareServing();
+
+static int compareServed(const void *a, const void *b);
+
+static void addToSum(struct groupEntry *entry, double value);
+
+static uint64_t hashKey(const char *key, size_t keyLen);
+
+// END forward declarations.
+
+/**
+ * Tables, one per thread.
+ */
+static struct groupTable *tables = NULL;
+static int tableCount = 0;
+
+/**
+ * Most memory for each table before it gets spilled.
+ */
+static size_t memBudget = 0;
+
+/**
+ * Something was spilled, so groups get served one partition at a time.
+ */
+static char spilled = 0;
+
+/**
+ * Partition currently being served, if spilled.
+ */
+static int partition = 0;
+
+/**
+ * Groups being served, sorted, and the next one to hand out.
+ */
+static struct groupEntry **served = NULL;
+static size_t servedCount = 0;
+static size_t servedInd = 0;
+
+/**
+ * Initialize.
+ *
+ * @param   tableCountIn    Number of threads that will be adding.
+ * @param   memBudgetIn     In bytes, for all of them together.
+ */
+char csvh_group_init(int tableCountIn, size_t memBudgetIn)
+{
+    tableCount = (tableCountIn < 1) ? 1 : tableCountIn;
+    memBudget = memBudgetIn / tableCount;
+
+    tables = calloc(tableCount, sizeof(struct groupTable));
+    if (tables == NULL) {
+        return CSVH_GROUP__OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; i < tableCount; i++) {
+        if (tableInit(tables + i) != CSVH_GROUP__OK) {
+            return CSVH_GROUP__OUT_OF_MEMORY;
+        }
+    }
+
+    return CSVH_GROUP__OK;
+}
+
+/**
+ * Add a row to a group.  Each thread has to stick to its own table.
+ *
+ * @param   table
+ * @param   key
+ * @param   keyLen
+ * @param   value       Number to add to the group's sum.
+ * @param   hasValue    Whether there's a number at all.
+ */
+char csvh_group_add(int table, const char *key, size_t keyLen, double value, char hasValue)
+{
+    struct groupTable *t = tables + table;
+    char rc;
+
+    if ((rc = tableAdd(t, key, keyLen, hashKey(key, keyLen), 1, hasValue ? value : 0, 0)) != CSVH_GROUP__OK) {
+        return rc;
+    }
+
+    if (t->memUsed > memBudget) {
+        return spillTable(t);
+    }
+
+    return CSVH_GROUP__OK;
+}
+
+/**
+ * Done adding.  Put the tables together and get ready to hand out groups.
+ */
+char csvh_group_finish()
+{
+    char rc;
+
+    for (int i = 0; i < tableCount; i++) {
+        if (tables[i].spills != NULL) {
+            spilled = 1;
+        }
+    }
+
+    if (spilled) {
+        // Once anything's spilled, everything has to be, so that each
+        // partition can be added up by itself.
+        for (int i = 0; i < tableCount; i++) {
+            if ((rc = spillTable(tables + i)) != CSVH_GROUP__OK) {
+                return rc;
+            }
+        }
+        partition = 0;
+        return loadPartition(0);
+    }
+
+    for (int i = 1; i < tableCount; i++) {
+        struct groupTable *src = tables + i;
+        for (size_t j = 0; j < src->slotCount; j++) {
+            struct groupEntry *e = src->slots + j;
+            if (e->key == NULL) {
+                continue;
+            }
+            if ((rc = tableAdd(tables, e->key, e->keyLen, e->hash, e->count, e->sum, e->sumError)) != CSVH_GROUP__OK) {
+                return rc;
+            }
+        }
+        tableFree(src);
+    }
+
+    return prepareServing();
+}
+
+/**
+ * Get the next group.  The key is good until the next call.
+ *
+ * @param   key
+ * @param   count
+ * @param   sum
+ */
+char csvh_group_next(const char **key, long long *count, double *sum)
+{
+    char rc;
+
+    while (servedInd >= servedCount) {
+        if (!spilled || partition >= SPILL_PARTITIONS - 1) {
+            return CSVH_GROUP__DONE;
+        }
+        if ((rc = loadPartition(++partition)) != CSVH_GROUP__OK) {
+            return rc;
+        }
+    }
+
+    struct groupEntry *e = served[servedInd++];
+    *key = e->key;
+    *count = e->count;
+    *sum = e->sum + e->sumError;
+
+    return CSVH_GROUP__OK;
+}
+
+/**
+ * Close out everything.
+ */
+char csvh_group_close()
+{
+    for (int i = 0; i < tableCount; i++) {
+        tableFree(tables + i);
+        if (tables[i].spills != NULL) {
+            for (int j = 0; j < SPILL_PARTITIONS; j++) {
+                if (tables[i].spills[j] != NULL) {
+                    fclose(tables[i].spills[j]);
+                }
+            }
+            free(tables[i].spills);
+        }
+    }
+    free(tables);
+    tables = NULL;
+    tableCount = 0;
+
+    free(served);
+    served = NULL;
+    servedCount = 0;
+    servedInd = 0;
+    spilled = 0;
+
+    return CSVH_GROUP__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Set up an empty table.
+ *
+ * @param   table
+ */
+static char tableInit(struct groupTable *table)
+{
+    table->slotCount = START_SLOTS;
+    table->slots = calloc(table->slotCount, sizeof(struct groupEntry));
+    if (table->slots == NULL) {
+        return CSVH_GROUP__OUT_OF_MEMORY;
+    }
+    table->used = 0;
+    table->blocks = NULL;
+    table->blockCount = 0;
+    table->blockUsed = 0;
+    table->memUsed = table->slotCount * sizeof(struct groupEntry);
+
+    return CSVH_GROUP__OK;
+}
+
+/**
+ * Free a table's slots and keys (but not its spill files).
+ *
+ * @param   table
+ */
+static void tableFree(struct groupTable *table)
+{
+    free(table->slots);
+    table->slots = NULL;
+    table->slotCount = 0;
+    table->used = 0;
+
+    for (int i = 0; i < table->blockCount; i++) {
+        free(table->blocks[i]);
+    }
+    free(table->blocks);
+    table->blocks = NULL;
+    table->blockCount = 0;
+    table->blockUsed = 0;
+    table->memUsed = 0;
+}
+
+/**
+ * Add to a group in a table, making the group if it's not there yet.
+ *
+ * @param   table
+ * @param   key
+ * @param   keyLen
+ * @param   hash
+ * @param   count
+ * @param   sum
+ * @param   sumError
+ */
+static char tableAdd(struct groupTable *table, const char *key, size_t keyLen, uint64_t hash, long long count, double sum, double sumError)
+{
+    size_t mask = table->slotCount - 1;
+    size_t slot = hash & mask;
+    struct groupEntry *e;
+
+    while ((e = table->slots + slot)->key != NULL) {
+        if (e->hash == hash && e->keyLen == keyLen && memcmp(e->key, key, keyLen) == 0) {
+            e->count += count;
+            addToSum(e, sum);
+            addToSum(e, sumError);
+            return CSVH_GROUP__OK;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if ((e->key = tableCopyKey(table, key, keyLen)) == NULL) {
+        return CSVH_GROUP__OUT_OF_MEMORY;
+    }
+    e->hash = hash;
+    e->keyLen = keyLen;
+    e->count = count;
+    e->sum = sum;
+    e->sumError = sumError;
+    table->used++;
+
+    // Keep it at most half full, so lookups stay short.
+    if (table->used * 2 > table->slotCount) {
+        return tableGrow(table);
+    }
+
+    return CSVH_GROUP__OK;
+}
+
+/**
+ * Double the number of slots in a table.
+ *
+ * @param   table
+ */
+static char tableGrow(struct groupTable *table)
+{
+    size_t newCount = table->slotCount * 2;
+    struct groupEntry *newSlots = calloc(newCount, sizeof(struct groupEntry));
+    if (newSlots == NULL) {
+        return CSVH_GROUP__OUT_OF_MEMORY;
+    }
+
+    for (size_t i = 0; i < table->slotCount; i++) {
+        if (table->slots[i].key == NULL) {
+            continue;
+        }
+        size_t slot = table->slots[i].hash & (newCount - 1);
+        while (newSlots[slot].key != NULL) {
+            slot = (slot + 1) & (newCount - 1);
+        }
+        newSlots[slot] = table->slots[i];
+    }
+
+    table->memUsed += (newCount - table->slotCount) * sizeof(struct groupEntry);
+    free(table->slots);
+    table->slots = newSlots;
+    table->slotCount = newCount;
+
+    return CSVH_GROUP__OK;
+}
+
+/**
+ * Copy a key into a table's memory, with a null terminator.
+ *
+ * @param   table
+ * @param   key
+ * @param   keyLen
+ */
+static char *tableCopyKey(struct groupTable *table, const char *key, size_t keyLen)
+{
+    size_t need = keyLen + 1;
+
+    if (table->blockCount == 0 || table->blockUsed + need > ARENA_BLOCK_SIZE) {
+        char **newBlocks = realloc(table->blocks, sizeof(char *) * (table->blockCount + 1));
+        if (newBlocks == NULL) {
+            return NULL;
+        }
+        table->blocks = newBlocks;
+
+        size_t blockSize = (need > ARENA_BLOCK_SIZE) ? need : ARENA_BLOCK_SIZE;
+        if ((table->blocks[table->blockCount++] = malloc(blockSize)) == NULL) {
+            table->blockCount--;
+            return NULL;
+        }
+        table->blockUsed = 0;
+    }
+
+    char *dest = table->blocks[table->blockCount - 1] + table->blockUsed;
+    memcpy(dest, key, keyLen);
+    dest[keyLen] = '\0';
+    table->blockUsed += need;
+    table->memUsed += need; // Not counting the rest of the block, or else a
+    // small budget would mean spilling after every key.
+
+    return dest;
+}
+
+/**
+ * Write every group in a table out to its partition's temp file, and empty
+ * the table.
+ *
+ * @param   table
+ */
+static char spillTable(struct groupTable *table)
+{
+    if (table->spills == NULL) {
+        table->spills = calloc(SPILL_PARTITIONS, sizeof(FILE *));
+        if (table->spills == NULL) {
+            return CSVH_GROUP__OUT_OF_MEMORY;
+        }
+        for (int i = 0; i < SPILL_PARTITIONS; i++) {
+            if ((table->spills[i] = tmpfile()) == NULL) {
+                return CSVH_GROUP__IO_ERROR;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < table->slotCount; i++) {
+        struct groupEntry *e = table->slots + i;
+        if (e->key == NULL) {
+            continue;
+        }
+
+        // Top bits pick the partition, since the bottom ones pick the slot.
+        FILE *file = table->spills[e->hash >> 58];
+        if (
+            fwrite(&e->keyLen, sizeof(size_t), 1, file) != 1
+            || fwrite(e->key, sizeof(char), e->keyLen, file) != e->keyLen
+            || fwrite(&e->count, sizeof(long long), 1, file) != 1
+            || fwrite(&e->sum, sizeof(double), 1, file) != 1
+            || fwrite(&e->sumError, sizeof(double), 1, file) != 1
+        ) {
+            return CSVH_GROUP__IO_ERROR;
+        }
+    }
+
+    tableFree(table);
+
+    return tableInit(table);
+}
+
+/**
+ * Read a partition back in from every table's temp files, add it all up in
+ * the first table, and get ready to hand it out.
+ *
+ * @param   part
+ */
+static char loadPartition(int part)
+{
+    char rc;
+    char *key = NULL;
+    size_t keyCap = 0;
+
+    tableFree(tables);
+    if ((rc = tableInit(tables)) != CSVH_GROUP__OK) {
+        return rc;
+    }
+
+    for (int i = 0; i < tableCount; i++) {
+        FILE *file = tables[i].spills[part];
+        rewind(file);
+
+        size_t keyLen;
+        long long count;
+        double sum;
+        double sumError;
+
+        while (fread(&keyLen, sizeof(size_t), 1, file) == 1) {
+            if (keyLen + 1 > keyCap) {
+                keyCap = keyLen + 1;
+                char *newKey = realloc(key, keyCap);
+                if (newKey == NULL) {
+                    free(key);
+                    return CSVH_GROUP__OUT_OF_MEMORY;
+                }
+                key = newKey;
+            }
+            if (
+                fread(key, sizeof(char), keyLen, file) != keyLen
+                || fread(&count, sizeof(long long), 1, file) != 1
+                || fread(&sum, sizeof(double), 1, file) != 1
+                || fread(&sumError, sizeof(double), 1, file) != 1
+            ) {
+                free(key);
+                return CSVH_GROUP__IO_ERROR;
+            }
+            if ((rc = tableAdd(tables, key, keyLen, hashKey(key, keyLen), count, sum, sumError)) != CSVH_GROUP__OK) {
+                free(key);
+                return rc;
+            }
+        }
+
+        // Done with it, so don't hang on to the disk space.
+        fclose(file);
+        tables[i].spills[part] = NULL;
+    }
+
+    free(key);
+
+    return prepareServing();
+}
+
+/**
+ * Sort the groups in the first table so they can be handed out.
+ */
+static char prepareServing()
+{
+    free(served);
+    served = malloc(sizeof(struct groupEntry *) * (tables->used + 1));
+    if (served == NULL) {
+        return CSVH_GROUP__OUT_OF_MEMORY;
+    }
+
+    servedCount = 0;
+    servedInd = 0;
+    for (size_t i = 0; i < tables->slotCount; i++) {
+        if (tables->slots[i].key != NULL) {
+            served[servedCount++] = tables->slots + i;
+        }
+    }
+
+    qsort(served, servedCount, sizeof(struct groupEntry *), compareServed);
+
+    return CSVH_GROUP__OK;
+}
+
+/**
+ * Compare groups by key, for qsort.
+ *
+ * @param   a
+ * @param   b
+ */
+static int compareServed(const void *a, const void *b)
+{
+    const struct groupEntry *ea = *(struct groupEntry * const *) a;
+    const struct groupEntry *eb = *(struct groupEntry * const *) b;
+    size_t len = (ea->keyLen < eb->keyLen) ? ea->keyLen : eb->keyLen;
+    int cmp = memcmp(ea->key, eb->key, len);
+
+    if (cmp != 0) {
+        return cmp;
+    }
+
+    return (ea->keyLen > eb->keyLen) - (ea->keyLen < eb->keyLen);
+}
+
+/**
+ * Add to a group's sum, keeping track of what gets lost to rounding
+ * (Neumaier's version of Kahan summation).  Otherwise the last few digits
+ * depend on what order things got added in, which depends on how the input
+ * was split up between threads.
+ *
+ * @param   entry
+ * @param   value
+ */
+static void addToSum(struct groupEntry *entry, double value)
+{
+    double total = entry->sum + value;
+
+    if (fabs(entry->sum) >= fabs(value)) {
+        entry->sumError += (entry->sum - total) + value;
+    } else {
+        entry->sumError += (value - total) + entry->sum;
+    }
+
+    entry->sum = total;
+}
+
+/**
+ * FNV-1a hash of a key, with the bits mixed up some more at the end so the
+ * top ones (which pick the partition) are as good as the bottom ones.
+ *
+ * @param   key
+ * @param   keyLen
+ */
+static uint64_t hashKey(const char *key, size_t keyLen)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < keyLen; i++) {
+        hash ^= (unsigned char) key[i];
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
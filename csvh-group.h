@@ -0,0 +1,23 @@
+#ifndef csvh_group_h
+#define csvh_group_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_GROUP__OK                  0
+#define CSVH_GROUP__DONE                1
+#define CSVH_GROUP__OUT_OF_MEMORY       2
+#define CSVH_GROUP__IO_ERROR            3
+
+char csvh_group_init(int tableCountIn, size_t memBudgetIn);
+
+char csvh_group_add(int table, const char *key, size_t keyLen, double value, char hasValue);
+
+char csvh_group_finish();
+
+char csvh_group_next(const char **key, long long *count, double *sum);
+
+char csvh_group_close();
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "csvh-line-helper.h"
 
@@ -11,37 +12,72 @@ int main()
     //int line = 0; // zero is header in this case.
 
     //for (int i = 1; i < 21; i++) {
-    //    printf("line: %d, res: %d\n", line++, csvh_line_helper_should_skip(""));
+    //    printf("line: %d, res: %d\n", line++, csvh_line_helper_should_skip("", strlen("")));
     //}
 
     // Ranges.
     //csvh_line_helper_init_ranges(2, "5-7,11.1-12.8, 15");
 
-    //printf("header, always print: should be 0: %d\n", csvh_line_helper_should_skip("blah"));
-    //printf("integer range 1: should be 1: %d\n", csvh_line_helper_should_skip("a,b,1"));
-    //printf("double range 2: should be 1: %d\n", csvh_line_helper_should_skip("a,b,4.9"));
-    //printf("integer range 3: should be 0: %d\n", csvh_line_helper_should_skip("a,b,5"));
-    //printf("double range 4: should be 0: %d\n", csvh_line_helper_should_skip("a,b,5.1"));
-    //printf("double range 5: should be 0: %d\n", csvh_line_helper_should_skip("a,b,6.999"));
-    //printf("integer range 6: should be 0: %d\n", csvh_line_helper_should_skip("a,b,7"));
-    //printf("double range 7: should be 1: %d\n", csvh_line_helper_should_skip("a,b,7.0001"));
-    //printf("integer range 8: should be 1: %d\n", csvh_line_helper_should_skip("a,b,8"));
-    //printf("double range 9: should be 1: %d\n", csvh_line_helper_should_skip("a,b,11"));
-    //printf("double range 10: should be 0: %d\n", csvh_line_helper_should_skip("a,b,11.1"));
-    //printf("double range 11: should be 0: %d\n", csvh_line_helper_should_skip("a,b,12"));
-    //printf("double range 12: should be 1: %d\n", csvh_line_helper_should_skip("a,b,13"));
-    //printf("integer range 13: should be 1: %d\n", csvh_line_helper_should_skip("a,b,14"));
-    //printf("integer range 14: should be 1: %d\n", csvh_line_helper_should_skip("a,b,16"));
-    //printf("integer range 15: should be 0: %d\n", csvh_line_helper_should_skip("a,b,15"));
-    //printf("integer range 15: should be 0, but might not be: %d\n", csvh_line_helper_should_skip("a,b,15.0"));
+    //printf("header, always print: should be 0: %d\n", csvh_line_helper_should_skip("blah", strlen("blah")));
+    //printf("integer range 1: should be 1: %d\n", csvh_line_helper_should_skip("a,b,1", strlen("a,b,1")));
+    //printf("double range 2: should be 1: %d\n", csvh_line_helper_should_skip("a,b,4.9", strlen("a,b,4.9")));
+    //printf("integer range 3: should be 0: %d\n", csvh_line_helper_should_skip("a,b,5", strlen("a,b,5")));
+    //printf("double range 4: should be 0: %d\n", csvh_line_helper_should_skip("a,b,5.1", strlen("a,b,5.1")));
+    //printf("double range 5: should be 0: %d\n", csvh_line_helper_should_skip("a,b,6.999", strlen("a,b,6.999")));
+    //printf("integer range 6: should be 0: %d\n", csvh_line_helper_should_skip("a,b,7", strlen("a,b,7")));
+    //printf("double range 7: should be 1: %d\n", csvh_line_helper_should_skip("a,b,7.0001", strlen("a,b,7.0001")));
+    //printf("integer range 8: should be 1: %d\n", csvh_line_helper_should_skip("a,b,8", strlen("a,b,8")));
+    //printf("double range 9: should be 1: %d\n", csvh_line_helper_should_skip("a,b,11", strlen("a,b,11")));
+    //printf("double range 10: should be 0: %d\n", csvh_line_helper_should_skip("a,b,11.1", strlen("a,b,11.1")));
+    //printf("double range 11: should be 0: %d\n", csvh_line_helper_should_skip("a,b,12", strlen("a,b,12")));
+    //printf("double range 12: should be 1: %d\n", csvh_line_helper_should_skip("a,b,13", strlen("a,b,13")));
+    //printf("integer range 13: should be 1: %d\n", csvh_line_helper_should_skip("a,b,14", strlen("a,b,14")));
+    //printf("integer range 14: should be 1: %d\n", csvh_line_helper_should_skip("a,b,16", strlen("a,b,16")));
+    //printf("integer range 15: should be 0: %d\n", csvh_line_helper_should_skip("a,b,15", strlen("a,b,15")));
+    //printf("integer range 15: should be 0, but might not be: %d\n", csvh_line_helper_should_skip("a,b,15.0", strlen("a,b,15.0")));
 
     // Equals
     csvh_line_helper_init_equals(2,"blah,blas");
 
-    printf("header, always print: should be 0: %d\n", csvh_line_helper_should_skip("blah"));
-    printf("value 1: should be 1: %d\n", csvh_line_helper_should_skip("someval,someval,someval"));
-    printf("value 2: should be 1: %d\n", csvh_line_helper_should_skip("blah,someval,someval"));
-    printf("value 3: should be 1: %d\n", csvh_line_helper_should_skip("someval,blah,someval"));
-    printf("value 4: should be 0: %d\n", csvh_line_helper_should_skip("someval,someval,blah"));
-    printf("value 5: should be 0: %d\n", csvh_line_helper_should_skip("someval,someval,blas"));
+    printf("header, always print: should be 0: %d\n", csvh_line_helper_should_skip("blah", strlen("blah")));
+    printf("value 1: should be 1: %d\n", csvh_line_helper_should_skip("someval,someval,someval", strlen("someval,someval,someval")));
+    printf("value 2: should be 1: %d\n", csvh_line_helper_should_skip("blah,someval,someval", strlen("blah,someval,someval")));
+    printf("value 3: should be 1: %d\n", csvh_line_helper_should_skip("someval,blah,someval", strlen("someval,blah,someval")));
+    printf("value 4: should be 0: %d\n", csvh_line_helper_should_skip("someval,someval,blah", strlen("someval,someval,blah")));
+    printf("value 5: should be 0: %d\n", csvh_line_helper_should_skip("someval,someval,blas", strlen("someval,someval,blas")));
+
+    // Contains
+    //csvh_line_helper_init_contains(1, "ah \"q");
+
+    //printf("header, always print: should be 0: %d\n", csvh_line_helper_should_skip("blah", strlen("blah")));
+    //printf("value 1: should be 1: %d\n", csvh_line_helper_should_skip("blah,someval,someval", strlen("blah,someval,someval")));
+    //printf("value 2: should be 1: %d\n", csvh_line_helper_should_skip("someval,blah q,someval", strlen("someval,blah q,someval")));
+    //printf("value 3: should be 0: %d\n", csvh_line_helper_should_skip("someval,\"blah \"\"q\",someval", strlen("someval,\"blah \"\"q\",someval")));
+    //printf("value 4: should be 1: %d\n", csvh_line_helper_should_skip("someval", strlen("someval")));
+
+    // Regex
+    //csvh_line_helper_init_regex(0, "^bl(a|e)h?x*yz[0-9]+$");
+
+    //printf("header, always print: should be 0: %d\n", csvh_line_helper_should_skip("blah", strlen("blah")));
+    //printf("value 1: should be 1: %d\n", csvh_line_helper_should_skip("blah,someval", strlen("blah,someval")));
+    //printf("value 2: should be 0: %d\n", csvh_line_helper_should_skip("blayz12,someval", strlen("blayz12,someval")));
+    //printf("value 3: should be 0: %d\n", csvh_line_helper_should_skip("blehxxyz9,someval", strlen("blehxxyz9,someval")));
+    //printf("value 4: should be 1: %d\n", csvh_line_helper_should_skip("someval,blayz12", strlen("someval,blayz12")));
+
+    // Regex with a class in brackets.  The ] in [:alpha:] doesn't end the
+    // brackets, so nothing after it is needed for a match.  (Same thing
+    // for [[=a=]] and [[.-.]].)
+    //csvh_line_helper_init_regex(0, "[[:alpha:]]x");
+
+    //printf("header, always print: should be 0: %d\n", csvh_line_helper_should_skip("blah", strlen("blah")));
+    //printf("value 1: should be 0: %d\n", csvh_line_helper_should_skip("ax,1", strlen("ax,1")));
+    //printf("value 2: should be 1: %d\n", csvh_line_helper_should_skip("]x,2", strlen("]x,2")));
+    //printf("value 3: should be 1: %d\n", csvh_line_helper_should_skip("9x,3", strlen("9x,3")));
+
+    //csvh_line_helper_init_regex(0, "[[:alpha:]]");
+
+    //printf("header, always print: should be 0: %d\n", csvh_line_helper_should_skip("blah", strlen("blah")));
+    //printf("value 1: should be 0: %d\n", csvh_line_helper_should_skip("ax,1", strlen("ax,1")));
+    //printf("value 2: should be 0: %d\n", csvh_line_helper_should_skip("]x,2", strlen("]x,2")));
+    //printf("value 3: should be 1: %d\n", csvh_line_helper_should_skip("9],3", strlen("9],3")));
 }
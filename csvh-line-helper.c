@@ -3,7 +3,13 @@
 #include <stdio.h>
 #include <ctype.h>
 
+#ifndef _WIN32
+#include <regex.h>
+#endif
+
 #include "csv.h"
+#include "csvh-dict.h"
+#include "csvh-scan.h"
 
 #include "csvh-line-helper.h"
 
@@ -29,16 +35,50 @@
 #define COND_TYPE__RANGE        3
 // Value equals
 #define COND_TYPE__EQUALS       4
+// Value contains substring
+#define COND_TYPE__CONTAINS     5
+// Value matches regular expression
+#define COND_TYPE__REGEX        6
 
 // END output condition types.
 
+// Internal return code for condBeforeValue, meaning the line's value has to
+// be looked at to decide.  (Past the ones in the header, rather than
+// negative, since char might be unsigned.)
+#define NEEDS_VALUE             (CSVH_LINE_HELPER__UNSUPPORTED + 1)
+
+// What critVerdicts has for a code that hasn't been checked yet.
+#define NOT_CHECKED             (CSVH_LINE_HELPER__UNSUPPORTED + 2)
+
 // Forward declarations for static functions.
 
 static char condLine();
 
-static char condRange(char **parsedLine);
+static char condBeforeValue();
+
+static char condValue(char *val, size_t valLen);
+
+static char condValueUncached(char *val, size_t valLen);
+
+static void initCritDict();
+
+static void freeCritDict();
+
+static char condRange(char *val);
+
+static char condEquals(char *val, size_t valLen);
+
+static char condContains(char *val, size_t valLen);
+
+static char condRegex(char *val, size_t valLen);
 
-static char condEquals(char **parsedLine);
+static char *getCritValue(char **parsedLine, size_t *lens, size_t *valLen);
+
+static void setPrefilter(char *literal, size_t literalLen);
+
+#ifndef _WIN32
+static size_t regexRequiredLiteral(char *pattern, char *literal);
+#endif
 
 static char strIsInt(char *inputStr);
 
@@ -88,12 +128,95 @@ static int condType = COND_TYPE__NONE;
  */
 static int lineNum = 0;
 
+/**
+ * For line conditions, the bounds of the one being used, and where it is in
+ * conds.  With lines, the conditions just get gone through in order, since
+ * line numbers only go up.  A lower bound of 0 means time for the next one.
+ */
+static int lineLower = 0;
+static int lineUpper = 0;
+static int lineCondInd = -1;
+
 /**
  * Yes if file has a header, no if either it doesn't have one or it's
  * already been passed.
  */
 static char hasHeader = 1;
 
+/**
+ * Delimiter used to parse lines for the value conditions, whether there's
+ * quoting, and the parser for that.
+ */
+static char delim = ',';
+static char quoting = 1;
+static csv_parse_fn parseFields = parse_csv_len;
+
+#ifndef _WIN32
+/**
+ * Compiled regular expression for regex conditions.
+ */
+static regex_t condRegexCompiled;
+#endif
+
+/**
+ * Literal that every matching line must contain somewhere in its raw bytes.
+ * Checked before the line gets parsed so that lines that can't possibly match
+ * never get tokenized.  NULL if there's no such literal.
+ */
+static char *prefilter = NULL;
+
+/**
+ * Length of prefilter.
+ */
+static size_t prefilterLen = 0;
+
+/**
+ * Dictionary of the values seen in the critical column (see csvh-dict.c).
+ * Columns that get restricted on are usually ones with only a few different
+ * values (statuses and the like), so each different value only has to be
+ * checked once.  For equals conditions, the values to match are put in first,
+ * so a value matches if its code is one of theirs.  NULL if the column turns
+ * out to have too many different values for this to help.
+ */
+static struct csvhDict *critDict = NULL;
+
+/**
+ * Number of values looked up in critDict, including repeats.
+ */
+static long long critSeen = 0;
+
+/**
+ * For equals conditions, codes below this are the values to match.
+ */
+static int condCodeCount = 0;
+
+/**
+ * Result of checking each code in critDict, or NOT_CHECKED.
+ */
+static char *critVerdicts = NULL;
+static int critVerdictCap = 0;
+
+/**
+ * Set the delimiter used for parsing lines.
+ *
+ * @param   delimIn
+ */
+void csvh_line_helper_set_delim(char delimIn)
+{
+    delim = delimIn;
+}
+
+/**
+ * Turn quoting on or off for parsing lines.
+ *
+ * @param   quotingIn
+ */
+void csvh_line_helper_set_quoting(char quotingIn)
+{
+    quoting = quotingIn;
+    parseFields = csv_parser_for(quoting);
+}
+
 /**
  * Initialize with line ranges restrictions.
  *
@@ -129,6 +252,8 @@ char csvh_line_helper_init_ranges(int critIndInput, char *ranges)
         return CSVH_LINE_HELPER__INVALID_INPUT;
     }
 
+    initCritDict();
+
     return CSVH_LINE_HELPER__OK;
 }
 
@@ -152,9 +277,92 @@ char csvh_line_helper_init_equals(int critIndInput, char *equals)
         return CSVH_LINE_HELPER__INVALID_INPUT;
     }
 
+    initCritDict();
+    if (critDict != NULL) {
+        for (int i = 0; conds[i] != NULL; i++) {
+            if (csvh_dict_intern(critDict, conds[i], strlen(conds[i])) == -1) {
+                freeCritDict();
+                break;
+            }
+        }
+    }
+    if (critDict != NULL) {
+        condCodeCount = csvh_dict_count(critDict);
+    }
+
+    return CSVH_LINE_HELPER__OK;
+}
+
+/**
+ * Initialize with value contains restriction.
+ *
+ * "substring" is taken as-is (no splitting on commas), and matches if the
+ * value contains it anywhere.
+ *
+ * @param   critIndInput
+ * @param   substring
+ */
+char csvh_line_helper_init_contains(int critIndInput, char *substring)
+{
+    condType = COND_TYPE__CONTAINS;
+
+    critInd = critIndInput;
+
+    conds = malloc(sizeof(char *) * 2);
+    if (conds == NULL) {
+        return CSVH_LINE_HELPER__INTERNAL_ERROR;
+    }
+    conds[0] = strdup(substring);
+    conds[1] = NULL;
+    if (conds[0] == NULL) {
+        return CSVH_LINE_HELPER__INTERNAL_ERROR;
+    }
+
+    setPrefilter(conds[0], strlen(conds[0]));
+
+    initCritDict();
+
     return CSVH_LINE_HELPER__OK;
 }
 
+/**
+ * Initialize with value regex restriction.
+ *
+ * "pattern" is a POSIX extended regular expression.  Matches if it matches
+ * anywhere in the value (so anchor it with ^ and $ to match the whole thing).
+ * There's no POSIX regex on Windows, so there it's UNSUPPORTED.
+ *
+ * @param   critIndInput
+ * @param   pattern
+ */
+char csvh_line_helper_init_regex(int critIndInput, char *pattern)
+{
+#ifdef _WIN32
+    (void) critIndInput;
+    (void) pattern;
+    return CSVH_LINE_HELPER__UNSUPPORTED;
+#else
+    if (regcomp(&condRegexCompiled, pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+        return CSVH_LINE_HELPER__INVALID_INPUT;
+    }
+
+    condType = COND_TYPE__REGEX;
+
+    critInd = critIndInput;
+
+    char *literal = malloc(sizeof(char) * (strlen(pattern) + 1));
+    if (literal == NULL) {
+        return CSVH_LINE_HELPER__INTERNAL_ERROR;
+    }
+    setPrefilter(literal, regexRequiredLiteral(pattern, literal));
+    free(literal);
+
+    initCritDict();
+
+    return CSVH_LINE_HELPER__OK;
+#endif
+}
+
 /**
  * Get the current line number.
  */
@@ -163,6 +371,18 @@ int csvh_line_helper_get_line_num()
     return lineNum;
 }
 
+/**
+ * Count lines that got gone through somewhere else (i.e., split up between
+ * threads), so the ones after them get the right numbers.  Only for when
+ * nothing goes by line number, since none of them got checked.
+ *
+ * @param   count
+ */
+void csvh_line_helper_count_lines(int count)
+{
+    lineNum += count;
+}
+
 /**
  * Determine if should skip the current line.  Returns "OK" (don't skip),
  * "Skip" (skip) and "Done" (nothing left to print), according to constants
@@ -173,8 +393,201 @@ int csvh_line_helper_get_line_num()
  * case the condition depends on a column that's not in the output.
  *
  * @param   unparsedLine
+ * @param   lineLen
+ */
+char csvh_line_helper_should_skip(const char *unparsedLine, size_t lineLen)
+{
+    char res;
+    if ((res = condBeforeValue()) != NEEDS_VALUE) {
+        // Don't waste time parsing lines for these.
+        return res;
+    }
+
+    // Before parsing, throw out anything that can't possibly match.  This is
+    // where most of the time goes for contains and regex conditions on big
+    // files, since usually almost nothing matches.
+    if (!csvh_line_helper_passes_prefilter(unparsedLine, lineLen)) {
+        return CSVH_LINE_HELPER__SKIP;
+    }
+
+    // Now parse the line, because it'll be used in the other condition checks.
+    // Values can have nulls in them, so then their lengths come along too.
+    // (Almost no lines do, and it's one less malloc when they don't.)
+    size_t *lens = NULL;
+    char **parsedLine = parseFields(
+        unparsedLine,
+        lineLen,
+        delim,
+        (memchr(unparsedLine, '\0', lineLen) == NULL) ? NULL : &lens
+    );
+    if (parsedLine == NULL) {
+        return CSVH_LINE_HELPER__SKIP;
+    }
+
+    size_t valLen = 0;
+    char *val = getCritValue(parsedLine, lens, &valLen);
+    res = condValue(val, valLen);
+
+    free_csv_line(parsedLine);
+    parsedLine = NULL;
+    free(lens);
+    return res;
+}
+
+/**
+ * Same as csvh_line_helper_should_skip, but for when the line's already been
+ * split up somewhere else, so all that's needed is the value in the critical
+ * column (see csvh_line_helper_get_crit_ind), and its length.  Pass NULL if
+ * the line doesn't have that column.
+ *
+ * @param   critValue
+ * @param   critLen
+ */
+char csvh_line_helper_should_skip_value(char *critValue, size_t critLen)
+{
+    char res;
+    if ((res = condBeforeValue()) != NEEDS_VALUE) {
+        return res;
+    }
+
+    return condValue(critValue, critLen);
+}
+
+/**
+ * Determine if a raw line could possibly match, before bothering to parse it.
+ * Doesn't count the line or change anything, so it's safe to call from more
+ * than one thread at once.
+ *
+ * @param   unparsedLine
+ * @param   lineLen
  */
-char csvh_line_helper_should_skip(char *unparsedLine)
+char csvh_line_helper_passes_prefilter(const char *unparsedLine, size_t lineLen)
+{
+    return prefilter == NULL
+        || csvh_scan_find(unparsedLine, lineLen, prefilter, prefilterLen) != NULL;
+}
+
+/**
+ * Check the value in the critical column against the value conditions, and
+ * nothing else: no line counting and no dictionary.  Returns OK or SKIP.  Safe
+ * to call from more than one thread at once, which is the point.  Only for
+ * value conditions (see csvh_line_helper_is_line_only).
+ *
+ * @param   critValue
+ * @param   critLen
+ */
+char csvh_line_helper_value_matches(char *critValue, size_t critLen)
+{
+    if (critValue == NULL) {
+        return CSVH_LINE_HELPER__SKIP;
+    }
+
+    return condValueUncached(critValue, critLen);
+}
+
+/**
+ * Get the index of the column that the restrictions look at, or -1 if they
+ * don't look at any.
+ */
+int csvh_line_helper_get_crit_ind()
+{
+    return csvh_line_helper_is_line_only() ? -1 : critInd;
+}
+
+/**
+ * Determine if the restrictions only depend on line numbers (or there aren't
+ * any), meaning a line's content never decides whether it's skipped.
+ */
+char csvh_line_helper_is_line_only()
+{
+    return condType == COND_TYPE__NONE
+        || condType == COND_TYPE__DONE
+        || condType == COND_TYPE__LINE;
+}
+
+/**
+ * Determine if the restrictions depend on line numbers, meaning lines have to
+ * go through in order.
+ */
+char csvh_line_helper_uses_line_nums()
+{
+    return condType == COND_TYPE__LINE || condType == COND_TYPE__DONE;
+}
+
+/**
+ * Drop all restrictions and start counting lines over, for when the lines
+ * being handed out aren't the ones from the input anymore (i.e., grouped).
+ * There's no header coming this time around.
+ */
+char csvh_line_helper_reset()
+{
+    csvh_line_helper_close();
+
+    condType = COND_TYPE__NONE;
+    critInd = -1;
+    lineNum = 0;
+    lineLower = 0;
+    lineUpper = 0;
+    lineCondInd = -1;
+    hasHeader = 0;
+
+    return CSVH_LINE_HELPER__OK;
+}
+
+/**
+ * Start counting lines over, for the next of several input files that get
+ * numbered separately.  Line conditions start over too, so they pick out the
+ * same lines in each file.  (The header was taken care of already.)
+ */
+char csvh_line_helper_restart_lines()
+{
+    lineNum = 0;
+    lineLower = 0;
+    lineUpper = 0;
+    lineCondInd = -1;
+
+    if (condType == COND_TYPE__DONE) {
+        condType = COND_TYPE__LINE;
+    }
+
+    return CSVH_LINE_HELPER__OK;
+}
+
+/**
+ * Close out all open variables, etc.
+ */
+char csvh_line_helper_close()
+{
+    if (conds != NULL) {
+        free_csv_line(conds);
+        conds = NULL;
+    }
+
+#ifndef _WIN32
+    if (condType == COND_TYPE__REGEX) {
+        regfree(&condRegexCompiled);
+        condType = COND_TYPE__NONE;
+    }
+#endif
+
+    free(prefilter);
+    prefilter = NULL;
+    prefilterLen = 0;
+
+    freeCritDict();
+
+    return CSVH_LINE_HELPER__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Do everything for deciding whether to skip a line that doesn't need the
+ * line's contents: the header, the line count, and line conditions.  Returns
+ * NEEDS_VALUE if that's not enough to decide.
+ */
+static char condBeforeValue()
 {
     if (hasHeader) {
         // Always want to get the header.
@@ -187,7 +600,6 @@ char csvh_line_helper_should_skip(char *unparsedLine)
 
     lineNum++;
 
-    // Don't waste time parsing lines for these.
     switch (condType) {
         case COND_TYPE__NONE:
             return CSVH_LINE_HELPER__OK;
@@ -197,81 +609,120 @@ char csvh_line_helper_should_skip(char *unparsedLine)
             return condLine();
     }
 
-    // Now parse the line, because it'll be used in the other condition checks.
-    char **parsedLine = parse_csv(unparsedLine, ',');
-    char res = CSVH_LINE_HELPER__INTERNAL_ERROR;
-    // If return this, it means that there's some kind of foreign condition
-    // type that's defined but never used.
+    return NEEDS_VALUE;
+}
 
-    switch (condType) {
-        case COND_TYPE__RANGE:
-            res = condRange(parsedLine);
-            break;
-        case COND_TYPE__EQUALS:
-            res = condEquals(parsedLine);
-            break;
+/**
+ * Check the value in the critical column against the value conditions.  A
+ * NULL value (line too short to have one) never matches.  Each different
+ * value only actually gets checked once, as long as there aren't too many.
+ *
+ * @param   val
+ * @param   valLen
+ */
+static char condValue(char *val, size_t valLen)
+{
+    if (val == NULL) {
+        return CSVH_LINE_HELPER__SKIP;
     }
 
-    free_csv_line(parsedLine);
-    parsedLine = NULL;
-    return res;
+    if (critDict == NULL) {
+        return condValueUncached(val, valLen);
+    }
+
+    critSeen++;
+    int code = csvh_dict_intern(critDict, val, valLen);
+    if (code == -1 || !csvh_dict_is_low_cardinality(critDict, critSeen)) {
+        // Either out of memory or too many different values, so stop using
+        // the dictionary from here on.
+        freeCritDict();
+        return condValueUncached(val, valLen);
+    }
+
+    if (condType == COND_TYPE__EQUALS) {
+        return (code < condCodeCount) ? CSVH_LINE_HELPER__OK : CSVH_LINE_HELPER__SKIP;
+    }
+
+    if (code >= critVerdictCap) {
+        int newCap = (critVerdictCap == 0) ? 256 : critVerdictCap * 2;
+        for (; newCap <= code; newCap *= 2) {}
+        char *newVerdicts = realloc(critVerdicts, sizeof(char) * newCap);
+        if (newVerdicts == NULL) {
+            freeCritDict();
+            return condValueUncached(val, valLen);
+        }
+        memset(newVerdicts + critVerdictCap, NOT_CHECKED, newCap - critVerdictCap);
+        critVerdicts = newVerdicts;
+        critVerdictCap = newCap;
+    }
+
+    if (critVerdicts[code] == NOT_CHECKED) {
+        critVerdicts[code] = condValueUncached(val, valLen);
+    }
+
+    return critVerdicts[code];
 }
 
 /**
- * Close out all open variables, etc.
+ * Check the value in the critical column against the value conditions,
+ * without looking it up in critDict.
+ *
+ * @param   val
+ * @param   valLen
  */
-char csvh_line_helper_close()
+static char condValueUncached(char *val, size_t valLen)
 {
-    if (conds != NULL) {
-        free_csv_line(conds);
-        conds = NULL;
+    switch (condType) {
+        case COND_TYPE__RANGE:
+            // Numbers stop at the first thing that isn't part of one anyway,
+            // so the length doesn't matter.
+            return condRange(val);
+        case COND_TYPE__EQUALS:
+            return condEquals(val, valLen);
+        case COND_TYPE__CONTAINS:
+            return condContains(val, valLen);
+        case COND_TYPE__REGEX:
+            return condRegex(val, valLen);
     }
 
-    return CSVH_LINE_HELPER__OK;
+    // If return this, it means that there's some kind of foreign condition
+    // type that's defined but never used.
+    return CSVH_LINE_HELPER__INTERNAL_ERROR;
 }
 
-
-// Static functions below this line.
-
 /**
  * Handle line conditions.
  */
 static char condLine()
 {
-    static int lower = 0;
-    static int upper = 0;
-    static int condInd = -1; // The condition of the conds array that we're
-    // currently using.  With lines condition we can just go straight through.
-    // TODO: Figure out what that last sentence mean and better explain it.
-
-    if (lower == 0) {
+    if (lineLower == 0) {
         // This means need to get the next segment.
 
-        condInd++;
+        lineCondInd++;
 
         // Check if we're done with reading the conditions.
-        if (conds[condInd] == NULL) {
+        if (conds[lineCondInd] == NULL) {
             condType = COND_TYPE__DONE;
             return CSVH_LINE_HELPER__DONE;
         }
 
         int bounds[2];
-        condLineBounds(bounds, condInd);
-        lower = bounds[0];
-        upper = bounds[1];
+        condLineBounds(bounds, lineCondInd);
+        lineLower = bounds[0];
+        lineUpper = bounds[1];
 
-        if (lower == 0) {
+        if (lineLower == 0) {
             return CSVH_LINE_HELPER__INVALID_INPUT;
         }
     }
 
-    if (lineNum == upper) {
-        lower = 0;
-        upper = 0;
+    if (lineNum == lineUpper) {
+        lineLower = 0;
+        lineUpper = 0;
         return CSVH_LINE_HELPER__OK;
     }
 
-    return (lineNum < lower) ? CSVH_LINE_HELPER__SKIP : CSVH_LINE_HELPER__OK;
+    return (lineNum < lineLower) ? CSVH_LINE_HELPER__SKIP : CSVH_LINE_HELPER__OK;
 }
 
 /**
@@ -304,6 +755,9 @@ static void condLineBounds(int *bounds, int condInd)
 
     // Check that the strings are integers.
     if (!strIsInt(lowerStr) || !strIsInt(upperStr)) {
+        if (isRange) {
+            conds[condInd][isRange - 1] = '-';
+        }
         bounds[0] = 0;
         bounds[1] = 0;
         return;
@@ -311,6 +765,11 @@ static void condLineBounds(int *bounds, int condInd)
 
     bounds[0] = atoi(lowerStr);
     bounds[1] = atoi(upperStr);
+
+    if (isRange) {
+        // Put it back, in case the lines start over (i.e., the next file).
+        conds[condInd][isRange - 1] = '-';
+    }
 }
 
 /**
@@ -332,14 +791,13 @@ static char strIsInt(char *inputStr)
 /**
  * Handle range conditions.
  *
- * @param   parsedLine
+ * @param   val
  */
-static char condRange(char **parsedLine)
+static char condRange(char *val)
 {
     // Loop through each condition and see if it applies.  Return OK on the
     // *first* one where it's true.
 
-    char *val = parsedLine[critInd];
     char *condDum;
     // Need to make a dummy string because going to mutate it later, and don't
     // want to change the original.
@@ -441,17 +899,17 @@ static char condRangeCompare(char *val, char *range)
  * Handle equals condition.
  *
  *
- * @param   parsedLine
+ * @param   val
+ * @param   valLen
  */
-static char condEquals(char **parsedLine)
+static char condEquals(char *val, size_t valLen)
 {
     // Loop through each condition and see if it applies.  Return OK on the
-    // *first* one where it's true.
-
-    char *val = parsedLine[critInd];
+    // *first* one where it's true.  (By length, since a value with a null in
+    // it would look like whatever's before the null otherwise.)
 
     for (int i = 0; conds[i] != NULL; i++) {
-        if (strcmp(conds[i],val) == 0) {
+        if (strlen(conds[i]) == valLen && memcmp(conds[i], val, valLen) == 0) {
             return CSVH_LINE_HELPER__OK;
         }
     }
@@ -459,6 +917,256 @@ static char condEquals(char **parsedLine)
     return CSVH_LINE_HELPER__SKIP;
 }
 
+/**
+ * Handle contains condition.
+ *
+ * @param   val
+ * @param   valLen
+ */
+static char condContains(char *val, size_t valLen)
+{
+    if (csvh_scan_find(val, valLen, conds[0], strlen(conds[0])) == NULL) {
+        return CSVH_LINE_HELPER__SKIP;
+    }
+
+    return CSVH_LINE_HELPER__OK;
+}
+
+/**
+ * Handle regex condition.  Where there's REG_STARTEND, the whole value gets
+ * looked at, nulls and all.  Otherwise, it stops at the first null.
+ *
+ * @param   val
+ * @param   valLen
+ */
+static char condRegex(char *val, size_t valLen)
+{
+#if defined(_WIN32)
+    // Can't get here, since there's no setting up a regex condition.
+    (void) val;
+    (void) valLen;
+    return CSVH_LINE_HELPER__INTERNAL_ERROR;
+#elif defined(REG_STARTEND)
+    regmatch_t bounds[1];
+    bounds[0].rm_so = 0;
+    bounds[0].rm_eo = valLen;
+    if (regexec(&condRegexCompiled, val, 1, bounds, REG_STARTEND) != 0) {
+        return CSVH_LINE_HELPER__SKIP;
+    }
+#else
+    (void) valLen;
+    if (regexec(&condRegexCompiled, val, 0, NULL, 0) != 0) {
+        return CSVH_LINE_HELPER__SKIP;
+    }
+#endif
+
+    return CSVH_LINE_HELPER__OK;
+}
+
+/**
+ * Start the dictionary of critical column values.  If it can't be made, that
+ * just means checking every value.
+ */
+static void initCritDict()
+{
+    freeCritDict();
+    critDict = csvh_dict_new();
+}
+
+/**
+ * Get rid of the dictionary of critical column values.
+ */
+static void freeCritDict()
+{
+    csvh_dict_free(critDict);
+    critDict = NULL;
+    critSeen = 0;
+    condCodeCount = 0;
+    free(critVerdicts);
+    critVerdicts = NULL;
+    critVerdictCap = 0;
+}
+
+/**
+ * Get the value in the critical column, or NULL if the line is too short to
+ * have one.  Its length goes in valLen, from lens, unless that's NULL (i.e.,
+ * nothing has a null in it).
+ *
+ * @param   parsedLine
+ * @param   lens
+ * @param   valLen
+ */
+static char *getCritValue(char **parsedLine, size_t *lens, size_t *valLen)
+{
+    for (int i = 0; i < critInd; i++) {
+        if (parsedLine[i] == NULL) {
+            return NULL;
+        }
+    }
+
+    if (parsedLine[critInd] == NULL) {
+        return NULL;
+    }
+
+    *valLen = (lens == NULL) ? strlen(parsedLine[critInd]) : lens[critInd];
+
+    return parsedLine[critInd];
+}
+
+/**
+ * Set the prefilter literal.  Quotes get special treatment: a quote in a value
+ * shows up doubled in the raw line, so only the longest stretch of the literal
+ * without any quotes is guaranteed to show up as-is.
+ *
+ * @param   literal
+ * @param   literalLen
+ */
+static void setPrefilter(char *literal, size_t literalLen)
+{
+    free(prefilter);
+    prefilter = NULL;
+    prefilterLen = 0;
+
+    size_t bestStart = 0;
+    size_t bestLen = 0;
+
+    for (size_t start = 0, i = 0; i <= literalLen; i++) {
+        if (i == literalLen || literal[i] == '"') {
+            if (i - start > bestLen) {
+                bestStart = start;
+                bestLen = i - start;
+            }
+            start = i + 1;
+        }
+    }
+
+    if (bestLen == 0) {
+        // Nothing to filter on, so everything has to go through the parser.
+        return;
+    }
+
+    prefilter = malloc(sizeof(char) * bestLen);
+    if (prefilter == NULL) {
+        // Not fatal.  Just means no prefilter.
+        return;
+    }
+
+    memcpy(prefilter, literal + bestStart, bestLen);
+    prefilterLen = bestLen;
+}
+
+#ifndef _WIN32
+/**
+ * Find a literal string that must appear in anything the (extended) regex
+ * matches, and put it in the passed buffer, which must be at least as long as
+ * the pattern.  Returns the length of the literal, which is zero if couldn't
+ * find one.
+ *
+ * This is deliberately conservative.  It only looks at the top level of the
+ * pattern (nothing inside parentheses), gives up completely if there's any
+ * alternation, and drops any character that has a ?, * or {} after it.  It
+ * returns the longest run of plain characters that's left.
+ *
+ * @param   pattern
+ * @param   literal
+ */
+static size_t regexRequiredLiteral(char *pattern, char *literal)
+{
+    size_t bestLen = 0;
+    size_t runLen = 0;
+    int depth = 0; // Parenthesis depth.
+
+    // Current run of plain characters.  The best one so far is kept in
+    // literal.
+    char *run = malloc(sizeof(char) * (strlen(pattern) + 1));
+    if (run == NULL) {
+        return 0;
+    }
+
+    for (size_t i = 0; pattern[i] != '\0'; i++) {
+        char c = pattern[i];
+        char isLiteral = 0;
+
+        if (c == '|') {
+            // Alternation means nothing is required, at least not without a
+            // lot more work than this is worth.
+            free(run);
+            return 0;
+        }
+
+        if (c == '\\' && pattern[i + 1] != '\0') {
+            c = pattern[++i];
+            isLiteral = (strchr(".[]()*+?{}|^$\\", c) != NULL);
+        } else if (c == '[') {
+            // Skip to the end of the bracket expression.  A ] right after the
+            // [ (or [^) is part of the expression, not the end of it, and so
+            // is anything in a class like [:alpha:] (or [=a=] or [.-.]),
+            // which can have a ] of its own.
+            if (pattern[i + 1] == '^') {
+                i++;
+            }
+            if (pattern[i + 1] == ']') {
+                i++;
+            }
+            for (; pattern[i + 1] != '\0' && pattern[i + 1] != ']'; i++) {
+                char open = pattern[i + 2];
+                if (pattern[i + 1] == '[' && (open == ':' || open == '=' || open == '.')) {
+                    const char *close = strchr(pattern + i + 3, open);
+                    for (; close != NULL && close[1] != ']'; close = strchr(close + 1, open)) {}
+                    if (close == NULL) {
+                        // Never closes, so there's no telling what's literal.
+                        free(run);
+                        return 0;
+                    }
+                    // The loop's i++ then moves onto the class's ].
+                    i = close - pattern;
+                }
+            }
+            if (pattern[i + 1] != '\0') {
+                i++;
+            }
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')') {
+            depth--;
+        } else if (c == '*' || c == '?' || c == '{') {
+            // The thing before this is optional, so it can't be part of the
+            // run.
+            if (runLen > 0) {
+                runLen--;
+            }
+            if (c == '{') {
+                for (; pattern[i + 1] != '\0' && pattern[i] != '}'; i++) {}
+            }
+        } else if (c != '+' && c != '.' && c != '^' && c != '$' && c != '"') {
+            // A + means the thing before it is required, but what comes after
+            // isn't necessarily right next to it, so it ends the run.
+            isLiteral = 1;
+        }
+
+        if (isLiteral && depth == 0) {
+            run[runLen++] = c;
+            continue;
+        }
+
+        if (runLen > bestLen) {
+            memcpy(literal, run, runLen);
+            bestLen = runLen;
+        }
+        runLen = 0;
+    }
+
+    if (runLen > bestLen) {
+        memcpy(literal, run, runLen);
+        bestLen = runLen;
+    }
+
+    free(run);
+
+    return bestLen;
+}
+#endif
+
 /**
  * Check if there's a hyphen in a string representing a condition.
  *
@@ -1,6 +1,8 @@
 #ifndef csvh_line_helper_h
 #define csvh_line_helper_h
 
+#include <stddef.h>
+
 // Constants
 
 #define CSVH_LINE_HELPER__OK                0
@@ -9,6 +11,7 @@
 #define CSVH_LINE_HELPER__INVALID_INPUT     3
 #define CSVH_LINE_HELPER__INTERNAL_ERROR    4
 // "Internal error" means it's an error inside of the module itself.
+#define CSVH_LINE_HELPER__UNSUPPORTED       5
 
 char csvh_line_helper_init_lines(char *lines);
 
@@ -16,9 +19,35 @@ char csvh_line_helper_init_ranges(int critIndInput, char *ranges);
 
 char csvh_line_helper_init_equals(int critIndInput, char *equals);
 
+char csvh_line_helper_init_contains(int critIndInput, char *substring);
+
+char csvh_line_helper_init_regex(int critIndInput, char *pattern);
+
+void csvh_line_helper_set_delim(char delimIn);
+
+void csvh_line_helper_set_quoting(char quotingIn);
+
 int csvh_line_helper_get_line_num();
 
-char csvh_line_helper_should_skip(char *unparsedLine);
+void csvh_line_helper_count_lines(int count);
+
+char csvh_line_helper_should_skip(const char *unparsedLine, size_t lineLen);
+
+char csvh_line_helper_should_skip_value(char *critValue, size_t critLen);
+
+char csvh_line_helper_passes_prefilter(const char *unparsedLine, size_t lineLen);
+
+char csvh_line_helper_value_matches(char *critValue, size_t critLen);
+
+int csvh_line_helper_get_crit_ind();
+
+char csvh_line_helper_is_line_only();
+
+char csvh_line_helper_uses_line_nums();
+
+char csvh_line_helper_reset();
+
+char csvh_line_helper_restart_lines();
 
 char csvh_line_helper_close();
 
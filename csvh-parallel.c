@@ -0,0 +1,406 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "csvh-parallel.h"
+
+// This is a helper module for csv-handler.c.
+
+// Splits a chunk of memory (i.e., the mapped input) into pieces, one per
+// thread, and hands every record in each piece to a callback, from that
+// piece's thread.  The callback gets the piece's number, so it can keep
+// whatever it's building separate for each one and put them together at the
+// end.
+
+// The hard part is where to split.  A line break only ends a record if it's
+// not inside quotes, which depends on every quote before it.  So it's two
+// passes: first every thread counts the quotes in its piece, which says
+// whether each piece starts inside quotes, and then each split gets moved up
+// to the first line break after it that really ends a record.  This is the
+// same rule csvh-reader uses, so records come out the same either way.
+//
+// Except when there's a stray quote, which leaves everything after it inside
+// quotes.  csvh-reader gives up on a record like that and starts over at the
+// next line, but that can't be done from here, since whether a piece starts
+// inside quotes is the whole basis for the split.  So if the quotes don't
+// pair up, nothing gets walked, and the caller reads it the slow way instead.
+//
+// Without quoting, none of that's needed: a record is just a line, so there's
+// no first pass, and each split just moves up to the next line break.
+
+/**
+ * Smallest piece worth giving its own thread.
+ */
+#define MIN_CHUNK_SIZE 1048576
+
+/**
+ * Most threads to use, no matter how many processors there are.
+ */
+#define MAX_THREADS 64
+
+/**
+ * A piece of the data.
+ */
+struct chunk {
+    int ind;
+    const char *start;
+    const char *end;
+    size_t quotes;
+    char rc;
+};
+
+// Forward declarations for static functions.
+
+static void *countChunkQuotes(void *arg);
+
+static void *walkChunk(void *arg);
+
+static char runChunks(struct chunk *chunks, int chunkCount, void *(*fn)(void *));
+
+static const char *alignToRecord(const char *from, char inQuote);
+
+static size_t countByte(const char *bytes, size_t len, char c);
+
+// END forward declarations.
+
+/**
+ * The data being walked, and the callback, for the threads to get at.
+ */
+static const char *runData = NULL;
+static const char *runDataEnd = NULL;
+static char (*runOnRecord)(int chunk, const char *record, size_t recordLen) = NULL;
+
+/**
+ * Quotes can have line breaks between them.  On by default.
+ */
+static char quoting = 1;
+
+/**
+ * Turn quoting on or off, the same as csvh_reader_set_quoting.
+ *
+ * @param   quotingIn
+ */
+void csvh_parallel_set_quoting(char quotingIn)
+{
+    quoting = quotingIn;
+}
+
+/**
+ * Get the number of threads to use if not told otherwise, which is the number
+ * of processors.
+ */
+int csvh_parallel_default_threads()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (count < 1) {
+        return 1;
+    }
+
+    return (count > MAX_THREADS) ? MAX_THREADS : count;
+}
+
+/**
+ * Get the number of pieces to split data of the passed length into, given the
+ * most threads to use.  Small data doesn't get split at all.
+ *
+ * @param   len
+ * @param   threadCount
+ */
+int csvh_parallel_chunk_count(size_t len, int threadCount)
+{
+    size_t most = len / MIN_CHUNK_SIZE;
+
+    if (threadCount > MAX_THREADS) {
+        threadCount = MAX_THREADS;
+    }
+    if (most < 1) {
+        return 1;
+    }
+
+    return (most < (size_t) threadCount) ? most : threadCount;
+}
+
+/**
+ * Call onRecord for every record in data, split into chunkCount pieces that
+ * each get their own thread.  Records are the same as csvh-reader would give:
+ * no line break at the end, and no \r before it.  Within a piece, the records
+ * come in order.
+ *
+ * If the callback returns anything but OK, its piece stops, and (after the
+ * rest of the pieces finish) that gets returned.  If there's an odd number of
+ * quotes, this returns UNBALANCED without calling it at all.
+ *
+ * @param   data
+ * @param   len
+ * @param   chunkCount
+ * @param   onRecord
+ */
+char csvh_parallel_for_records(
+    const char *data,
+    size_t len,
+    int chunkCount,
+    char (*onRecord)(int chunk, const char *record, size_t recordLen)
+) {
+    if (chunkCount < 1) {
+        chunkCount = 1;
+    }
+
+    struct chunk *chunks = malloc(sizeof(struct chunk) * chunkCount);
+    if (chunks == NULL) {
+        return CSVH_PARALLEL__OUT_OF_MEMORY;
+    }
+
+    runData = data;
+    runDataEnd = data + len;
+    runOnRecord = onRecord;
+
+    for (int i = 0; i < chunkCount; i++) {
+        chunks[i].ind = i;
+        chunks[i].start = data + len / chunkCount * i;
+        chunks[i].end = (i == chunkCount - 1) ? data + len : data + len / chunkCount * (i + 1);
+        chunks[i].quotes = 0;
+        chunks[i].rc = CSVH_PARALLEL__OK;
+    }
+
+    char rc;
+
+    // First pass, for where the pieces really start, and whether they can be
+    // split up at all.
+    if (quoting && (rc = runChunks(chunks, chunkCount, countChunkQuotes)) != CSVH_PARALLEL__OK) {
+        free(chunks);
+        return rc;
+    }
+
+    size_t quotes = 0;
+    for (int i = 0; i < chunkCount; i++) {
+        quotes += chunks[i].quotes;
+    }
+    if (quotes % 2 != 0) {
+        free(chunks);
+        return CSVH_PARALLEL__UNBALANCED;
+    }
+
+    if (chunkCount > 1) {
+        size_t quotesBefore = chunks[0].quotes;
+        for (int i = 1; i < chunkCount; i++) {
+            const char *start = alignToRecord(chunks[i].start, quotesBefore % 2);
+            quotesBefore += chunks[i].quotes;
+
+            // A record can be long enough to go past a whole piece.
+            if (start < chunks[i - 1].start) {
+                start = chunks[i - 1].start;
+            }
+            chunks[i].start = start;
+            chunks[i - 1].end = start;
+        }
+    }
+
+    rc = runChunks(chunks, chunkCount, walkChunk);
+
+    for (int i = 0; rc == CSVH_PARALLEL__OK && i < chunkCount; i++) {
+        rc = chunks[i].rc;
+    }
+
+    free(chunks);
+
+    return rc;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Count the quotes in a piece.  Runs in its own thread.
+ *
+ * @param   arg     The piece.
+ */
+static void *countChunkQuotes(void *arg)
+{
+    struct chunk *chunk = arg;
+
+    chunk->quotes = countByte(chunk->start, chunk->end - chunk->start, '"');
+
+    return NULL;
+}
+
+/**
+ * Hand every record that starts in a piece to the callback.  The last one can
+ * go past the end of the piece.  Runs in its own thread.
+ *
+ * @param   arg     The piece.
+ */
+static void *walkChunk(void *arg)
+{
+    struct chunk *chunk = arg;
+    const char *pos = chunk->start;
+
+    while (pos < chunk->end) {
+        const char *scan = pos;
+        const char *nl = NULL;
+        char inQuote = 0;
+
+        while (scan < runDataEnd) {
+            nl = memchr(scan, '\n', runDataEnd - scan);
+            const char *stop = (nl == NULL) ? runDataEnd : nl;
+            if (quoting) {
+                inQuote ^= countByte(scan, stop - scan, '"') & 1;
+            }
+            if (nl == NULL) {
+                scan = runDataEnd;
+                break;
+            }
+            scan = nl + 1;
+            if (!inQuote) {
+                break;
+            }
+            nl = NULL;
+        }
+
+        const char *recordEnd;
+        if (nl == NULL) {
+            if (inQuote) {
+                // Unterminated quote at the end, which can't be parsed
+                // anyway.
+                break;
+            }
+            // Last line doesn't have a line break.
+            recordEnd = runDataEnd;
+        } else {
+            recordEnd = nl;
+            if (recordEnd > pos && recordEnd[-1] == '\r') {
+                // Because DOS line endings.
+                recordEnd--;
+            }
+        }
+
+        if ((chunk->rc = runOnRecord(chunk->ind, pos, recordEnd - pos)) != CSVH_PARALLEL__OK) {
+            break;
+        }
+
+        pos = scan;
+    }
+
+    return NULL;
+}
+
+/**
+ * Run a function on every piece, each in its own thread, and wait for all of
+ * them.  The first piece runs in this thread.
+ *
+ * @param   chunks
+ * @param   chunkCount
+ * @param   fn
+ */
+static char runChunks(struct chunk *chunks, int chunkCount, void *(*fn)(void *))
+{
+#ifndef _WIN32
+    pthread_t *threads = malloc(sizeof(pthread_t) * chunkCount);
+    if (threads == NULL) {
+        return CSVH_PARALLEL__OUT_OF_MEMORY;
+    }
+
+    int started = 1;
+    char rc = CSVH_PARALLEL__OK;
+
+    for (; started < chunkCount; started++) {
+        if (pthread_create(threads + started, NULL, fn, chunks + started) != 0) {
+            rc = CSVH_PARALLEL__THREAD_ERROR;
+            break;
+        }
+    }
+
+    fn(chunks);
+
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+
+    if (rc != CSVH_PARALLEL__OK) {
+        // Didn't get through all of them, so do the rest here.
+        for (int i = started; i < chunkCount; i++) {
+            fn(chunks + i);
+        }
+    }
+#else
+    for (int i = 0; i < chunkCount; i++) {
+        fn(chunks + i);
+    }
+#endif
+
+    return CSVH_PARALLEL__OK;
+}
+
+/**
+ * Find where the first record that starts at or after a point really starts,
+ * given whether the point is inside quotes.  That's just past the first line
+ * break that isn't inside quotes.
+ *
+ * @param   from
+ * @param   inQuote
+ */
+static const char *alignToRecord(const char *from, char inQuote)
+{
+    if (from > runData && from[-1] == '\n' && !inQuote) {
+        // Already at the start of one.
+        return from;
+    }
+
+    const char *pos = from;
+
+    while (pos < runDataEnd) {
+        const char *nl = memchr(pos, '\n', runDataEnd - pos);
+        const char *stop = (nl == NULL) ? runDataEnd : nl;
+        if (quoting) {
+            inQuote ^= countByte(pos, stop - pos, '"') & 1;
+        }
+        if (nl == NULL) {
+            return runDataEnd;
+        }
+        pos = nl + 1;
+        if (!inQuote) {
+            return pos;
+        }
+    }
+
+    return runDataEnd;
+}
+
+/**
+ * Count how many times a byte shows up.
+ *
+ * @param   bytes
+ * @param   len
+ * @param   c
+ */
+static size_t countByte(const char *bytes, size_t len, char c)
+{
+    size_t count = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Sixteen at a time: compare, turn the matches into a bitmask, count the
+    // bits.
+    __m128i needle = _mm_set1_epi8(c);
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (bytes + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+    }
+#endif
+
+    for (; i < len; i++) {
+        count += (bytes[i] == c);
+    }
+
+    return count;
+}
@@ -0,0 +1,27 @@
+#ifndef csvh_parallel_h
+#define csvh_parallel_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_PARALLEL__OK               0
+#define CSVH_PARALLEL__OUT_OF_MEMORY    1
+#define CSVH_PARALLEL__THREAD_ERROR     2
+#define CSVH_PARALLEL__UNBALANCED       3
+// Anything else returned by the callback gets passed back as-is.
+
+void csvh_parallel_set_quoting(char quotingIn);
+
+int csvh_parallel_default_threads();
+
+int csvh_parallel_chunk_count(size_t len, int threadCount);
+
+char csvh_parallel_for_records(
+    const char *data,
+    size_t len,
+    int chunkCount,
+    char (*onRecord)(int chunk, const char *record, size_t recordLen)
+);
+
+#endif
@@ -0,0 +1,635 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include "csvh-dict.h"
+
+#include "csvh-profile.h"
+
+// This is a helper module for csv-handler.c.
+
+// Sums up what's in every column: what type the values look like, how many
+// are empty, how long they are, the smallest and biggest numbers, and whether
+// any value shows up twice.  Rows come in from more than one thread at once,
+// so every thread (chunk) has its own stats, and they get put together at the
+// end.
+
+// Types, as bits, so a column's type is every type any of its values had.
+#define TYPE__INT       1
+#define TYPE__DECIMAL   2
+#define TYPE__DATE      4
+#define TYPE__TEXT      8
+
+// Whether a column's values are unique.
+#define UNIQUE__YES     0
+#define UNIQUE__NO      1
+#define UNIQUE__UNKNOWN 2 // Too many values to keep track of.
+
+/**
+ * Most values to keep track of for uniqueness in each column, across all the
+ * threads.  Past this, it's just "unknown".
+ */
+#define UNIQUE_TRACK_LIMIT 1048576
+
+/**
+ * Longest integer that fits in a double exactly.  Anything longer gets
+ * mangled by most spreadsheets (and anything else that reads numbers as
+ * floating point).
+ */
+#define MAX_EXACT_DIGITS 15
+
+/**
+ * Stats for a single column, from a single thread.
+ */
+struct columnStats {
+    long long empty; // Including rows that don't have the column at all.
+    long long filled;
+    size_t minLen; // Of the values that aren't empty.
+    size_t maxLen;
+    char types;
+    int maxDigits; // Of the integers.
+    char *min; // Smallest and biggest numbers, as they were in the input.
+    char *max;
+    char minType;
+    char maxType;
+    struct csvhDict *seen; // Every value, for uniqueness.
+    char unique;
+};
+
+/**
+ * Stats for every column, from a single thread.
+ */
+struct chunkStats {
+    struct columnStats *cols;
+    int colCount;
+    long long rows;
+};
+
+// Forward declarations for static functions.
+
+static char addValue(struct columnStats *col, char *value);
+
+static char growColumns(struct chunkStats *chunk, int newCount);
+
+static char mergeColumn(struct columnStats *dest, struct columnStats *src);
+
+static void freeColumn(struct columnStats *col);
+
+static char classify(const char *value, int *digits);
+
+static char isDate(const char *value);
+
+static int compareNumbers(const char *a, char aType, const char *b, char bType);
+
+static char *typeName(struct columnStats *col);
+
+// END forward declarations.
+
+/**
+ * Stats for each thread.  Once finished, everything's in the first one.
+ */
+static struct chunkStats *chunks = NULL;
+static int chunkCount = 0;
+
+/**
+ * Most values each thread keeps track of for uniqueness, per column.
+ */
+static int trackLimit = UNIQUE_TRACK_LIMIT;
+
+/**
+ * Initialize.
+ *
+ * @param   chunkCountIn    Number of threads that will be adding rows.
+ */
+char csvh_profile_init(int chunkCountIn)
+{
+    chunkCount = (chunkCountIn < 1) ? 1 : chunkCountIn;
+    trackLimit = UNIQUE_TRACK_LIMIT / chunkCount;
+
+    chunks = calloc(chunkCount, sizeof(struct chunkStats));
+    if (chunks == NULL) {
+        return CSVH_PROFILE__OUT_OF_MEMORY;
+    }
+
+    return CSVH_PROFILE__OK;
+}
+
+/**
+ * Add a row, as a NULL-terminated array of values.  Each thread has to stick
+ * to its own chunk.
+ *
+ * @param   chunk
+ * @param   fields
+ */
+char csvh_profile_add_row(int chunk, char **fields)
+{
+    struct chunkStats *stats = chunks + chunk;
+
+    int fieldCount = 0;
+    for (; fields[fieldCount] != NULL; fieldCount++) {}
+
+    if (fieldCount > stats->colCount && growColumns(stats, fieldCount) != CSVH_PROFILE__OK) {
+        return CSVH_PROFILE__OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; i < stats->colCount; i++) {
+        if (i >= fieldCount) {
+            // Row's too short to have it, which is the same as empty.
+            stats->cols[i].empty++;
+        } else if (addValue(stats->cols + i, fields[i]) != CSVH_PROFILE__OK) {
+            return CSVH_PROFILE__OUT_OF_MEMORY;
+        }
+    }
+
+    stats->rows++;
+
+    return CSVH_PROFILE__OK;
+}
+
+/**
+ * Done adding rows.  Put all the threads' stats together.
+ */
+char csvh_profile_finish()
+{
+    struct chunkStats *dest = chunks;
+
+    for (int i = 1; i < chunkCount; i++) {
+        struct chunkStats *src = chunks + i;
+
+        if (src->colCount > dest->colCount && growColumns(dest, src->colCount) != CSVH_PROFILE__OK) {
+            return CSVH_PROFILE__OUT_OF_MEMORY;
+        }
+
+        for (int j = 0; j < dest->colCount; j++) {
+            if (j >= src->colCount) {
+                // None of this chunk's rows had it.
+                dest->cols[j].empty += src->rows;
+                continue;
+            }
+            if (mergeColumn(dest->cols + j, src->cols + j) != CSVH_PROFILE__OK) {
+                return CSVH_PROFILE__OUT_OF_MEMORY;
+            }
+        }
+
+        dest->rows += src->rows;
+    }
+
+    return CSVH_PROFILE__OK;
+}
+
+/**
+ * Get the number of columns (of the longest row).
+ */
+int csvh_profile_column_count()
+{
+    return (chunks == NULL) ? 0 : chunks->colCount;
+}
+
+/**
+ * Describe a column, as CSVH_PROFILE__FIELD_COUNT strings: type, empty count,
+ * shortest and longest lengths, smallest and biggest numbers, and whether
+ * every value is different.  The strings are malloc'd, and it's up to the
+ * caller to free them.
+ *
+ * @param   col
+ * @param   values
+ */
+char csvh_profile_describe(int col, char **values)
+{
+    if (col >= csvh_profile_column_count()) {
+        return CSVH_PROFILE__DONE;
+    }
+
+    struct columnStats *stats = chunks->cols + col;
+    char numeric = !(stats->types & ~(TYPE__INT | TYPE__DECIMAL)) && stats->filled > 0;
+    char buff[32];
+
+    for (int i = 0; i < CSVH_PROFILE__FIELD_COUNT; i++) {
+        values[i] = NULL;
+    }
+
+    values[0] = strdup(typeName(stats));
+
+    snprintf(buff, sizeof(buff), "%lld", stats->empty);
+    values[1] = strdup(buff);
+
+    snprintf(buff, sizeof(buff), "%zu", stats->minLen);
+    values[2] = strdup(buff);
+
+    snprintf(buff, sizeof(buff), "%zu", stats->maxLen);
+    values[3] = strdup(buff);
+
+    values[4] = strdup((numeric && stats->min != NULL) ? stats->min : "");
+    values[5] = strdup((numeric && stats->max != NULL) ? stats->max : "");
+
+    if (stats->filled == 0) {
+        values[6] = strdup("");
+    } else if (stats->unique == UNIQUE__YES) {
+        values[6] = strdup("yes");
+    } else if (stats->unique == UNIQUE__NO) {
+        values[6] = strdup("no");
+    } else {
+        values[6] = strdup("unknown");
+    }
+
+    for (int i = 0; i < CSVH_PROFILE__FIELD_COUNT; i++) {
+        if (values[i] == NULL) {
+            for (int j = 0; j < CSVH_PROFILE__FIELD_COUNT; j++) {
+                free(values[j]);
+                values[j] = NULL;
+            }
+            return CSVH_PROFILE__OUT_OF_MEMORY;
+        }
+    }
+
+    return CSVH_PROFILE__OK;
+}
+
+/**
+ * Close out everything.
+ */
+char csvh_profile_close()
+{
+    for (int i = 0; chunks != NULL && i < chunkCount; i++) {
+        for (int j = 0; j < chunks[i].colCount; j++) {
+            freeColumn(chunks[i].cols + j);
+        }
+        free(chunks[i].cols);
+    }
+    free(chunks);
+    chunks = NULL;
+    chunkCount = 0;
+
+    return CSVH_PROFILE__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Add a single value to a column's stats.
+ *
+ * @param   col
+ * @param   value
+ */
+static char addValue(struct columnStats *col, char *value)
+{
+    size_t len = strlen(value);
+
+    if (len == 0) {
+        col->empty++;
+        return CSVH_PROFILE__OK;
+    }
+
+    if (col->filled == 0 || len < col->minLen) {
+        col->minLen = len;
+    }
+    if (len > col->maxLen) {
+        col->maxLen = len;
+    }
+    col->filled++;
+
+    int digits = 0;
+    char type = classify(value, &digits);
+    col->types |= type;
+
+    if (type == TYPE__INT && digits > col->maxDigits) {
+        col->maxDigits = digits;
+    }
+
+    if (type == TYPE__INT || type == TYPE__DECIMAL) {
+        // Keep the original text, so nothing gets lost to rounding.
+        if (col->min == NULL || compareNumbers(value, type, col->min, col->minType) < 0) {
+            free(col->min);
+            if ((col->min = strdup(value)) == NULL) {
+                return CSVH_PROFILE__OUT_OF_MEMORY;
+            }
+            col->minType = type;
+        }
+        if (col->max == NULL || compareNumbers(value, type, col->max, col->maxType) > 0) {
+            free(col->max);
+            if ((col->max = strdup(value)) == NULL) {
+                return CSVH_PROFILE__OUT_OF_MEMORY;
+            }
+            col->maxType = type;
+        }
+    }
+
+    if (col->unique != UNIQUE__YES) {
+        return CSVH_PROFILE__OK;
+    }
+
+    if (col->seen == NULL && (col->seen = csvh_dict_new()) == NULL) {
+        // Not fatal.  Just can't tell.
+        col->unique = UNIQUE__UNKNOWN;
+        return CSVH_PROFILE__OK;
+    }
+
+    int before = csvh_dict_count(col->seen);
+    int code = csvh_dict_intern(col->seen, value, strlen(value));
+
+    if (code == -1 || before >= trackLimit) {
+        col->unique = UNIQUE__UNKNOWN;
+    } else if (code < before) {
+        // Seen it before.
+        col->unique = UNIQUE__NO;
+    }
+
+    if (col->unique != UNIQUE__YES) {
+        // Done with it either way.
+        csvh_dict_free(col->seen);
+        col->seen = NULL;
+    }
+
+    return CSVH_PROFILE__OK;
+}
+
+/**
+ * Add columns to a chunk, when a row comes along with more fields than any
+ * before it.  Rows before it didn't have them, so they count as empty.
+ *
+ * @param   chunk
+ * @param   newCount
+ */
+static char growColumns(struct chunkStats *chunk, int newCount)
+{
+    struct columnStats *newCols = realloc(chunk->cols, sizeof(struct columnStats) * newCount);
+    if (newCols == NULL) {
+        return CSVH_PROFILE__OUT_OF_MEMORY;
+    }
+    chunk->cols = newCols;
+
+    for (; chunk->colCount < newCount; chunk->colCount++) {
+        struct columnStats *col = chunk->cols + chunk->colCount;
+        memset(col, 0, sizeof(struct columnStats));
+        col->empty = chunk->rows;
+        col->unique = UNIQUE__YES;
+    }
+
+    return CSVH_PROFILE__OK;
+}
+
+/**
+ * Add one thread's stats for a column into another's.  What's left in src
+ * gets freed.
+ *
+ * @param   dest
+ * @param   src
+ */
+static char mergeColumn(struct columnStats *dest, struct columnStats *src)
+{
+    if (src->filled > 0) {
+        if (dest->filled == 0 || src->minLen < dest->minLen) {
+            dest->minLen = src->minLen;
+        }
+        if (src->maxLen > dest->maxLen) {
+            dest->maxLen = src->maxLen;
+        }
+    }
+    dest->empty += src->empty;
+    dest->filled += src->filled;
+    dest->types |= src->types;
+    if (src->maxDigits > dest->maxDigits) {
+        dest->maxDigits = src->maxDigits;
+    }
+
+    if (src->min != NULL && (dest->min == NULL || compareNumbers(src->min, src->minType, dest->min, dest->minType) < 0)) {
+        free(dest->min);
+        dest->min = src->min;
+        dest->minType = src->minType;
+        src->min = NULL;
+    }
+    if (src->max != NULL && (dest->max == NULL || compareNumbers(src->max, src->maxType, dest->max, dest->maxType) > 0)) {
+        free(dest->max);
+        dest->max = src->max;
+        dest->maxType = src->maxType;
+        src->max = NULL;
+    }
+
+    if (dest->unique == UNIQUE__YES && src->unique == UNIQUE__YES && src->seen != NULL) {
+        if (dest->seen == NULL) {
+            dest->seen = src->seen;
+            src->seen = NULL;
+        } else {
+            // Unique in each thread, but maybe not together.
+            int count = csvh_dict_count(src->seen);
+            for (int i = 0; i < count && dest->unique == UNIQUE__YES; i++) {
+                int before = csvh_dict_count(dest->seen);
+                size_t len;
+                const char *value = csvh_dict_value(src->seen, i, &len);
+                int code = csvh_dict_intern(dest->seen, value, len);
+                if (code == -1 || before >= UNIQUE_TRACK_LIMIT) {
+                    dest->unique = UNIQUE__UNKNOWN;
+                } else if (code < before) {
+                    dest->unique = UNIQUE__NO;
+                }
+            }
+        }
+    } else if (dest->unique == UNIQUE__NO || src->unique == UNIQUE__NO) {
+        dest->unique = UNIQUE__NO;
+    } else if (src->unique == UNIQUE__UNKNOWN) {
+        dest->unique = UNIQUE__UNKNOWN;
+    }
+
+    if (dest->unique != UNIQUE__YES) {
+        csvh_dict_free(dest->seen);
+        dest->seen = NULL;
+    }
+
+    freeColumn(src);
+
+    return CSVH_PROFILE__OK;
+}
+
+/**
+ * Free what a column's stats are holding on to.
+ *
+ * @param   col
+ */
+static void freeColumn(struct columnStats *col)
+{
+    free(col->min);
+    col->min = NULL;
+    free(col->max);
+    col->max = NULL;
+    csvh_dict_free(col->seen);
+    col->seen = NULL;
+}
+
+/**
+ * Figure out what type a value looks like.  For integers, also gets the
+ * number of digits.
+ *
+ * @param   value
+ * @param   digits
+ */
+static char classify(const char *value, int *digits)
+{
+    const char *c = value;
+    int intDigits = 0;
+    int fracDigits = 0;
+
+    if (*c == '-' || *c == '+') {
+        c++;
+    }
+    for (; isdigit((unsigned char) *c); c++) {
+        intDigits++;
+    }
+
+    if (*c == '\0' && intDigits > 0) {
+        *digits = intDigits;
+        return TYPE__INT;
+    }
+
+    if (*c == '.') {
+        for (c++; isdigit((unsigned char) *c); c++) {
+            fracDigits++;
+        }
+    }
+
+    if (intDigits + fracDigits > 0 && (*c == 'e' || *c == 'E')) {
+        const char *exp = c + 1;
+        if (*exp == '-' || *exp == '+') {
+            exp++;
+        }
+        if (isdigit((unsigned char) *exp)) {
+            for (c = exp; isdigit((unsigned char) *c); c++) {}
+        }
+    }
+
+    if (*c == '\0' && intDigits + fracDigits > 0) {
+        return TYPE__DECIMAL;
+    }
+
+    return isDate(value) ? TYPE__DATE : TYPE__TEXT;
+}
+
+/**
+ * Determine if a value looks like an ISO 8601 date (YYYY-MM-DD), optionally
+ * with a time after it.
+ *
+ * @param   value
+ */
+static char isDate(const char *value)
+{
+    // Stops at the first thing that doesn't fit, so never reads past the end.
+    for (int i = 0; i < 10; i++) {
+        if ((i == 4 || i == 7) ? value[i] != '-' : !isdigit((unsigned char) value[i])) {
+            return 0;
+        }
+    }
+
+    int month = (value[5] - '0') * 10 + (value[6] - '0');
+    int day = (value[8] - '0') * 10 + (value[9] - '0');
+    if (month < 1 || month > 12 || day < 1 || day > 31) {
+        return 0;
+    }
+
+    if (value[10] == '\0') {
+        return 1;
+    }
+
+    // Time, as at least HH:MM.
+    if (
+        (value[10] != 'T' && value[10] != ' ')
+        || !isdigit((unsigned char) value[11])
+        || !isdigit((unsigned char) value[12])
+        || value[13] != ':'
+        || !isdigit((unsigned char) value[14])
+        || !isdigit((unsigned char) value[15])
+    ) {
+        return 0;
+    }
+
+    // Seconds, fractions, and time zone.
+    for (const char *c = value + 16; *c != '\0'; c++) {
+        if (!isdigit((unsigned char) *c) && strchr(":.+-Z", *c) == NULL) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Compare two numbers.  Integers are compared digit by digit, so that ones
+ * too long for a double still come out right.
+ *
+ * @param   a
+ * @param   aType
+ * @param   b
+ * @param   bType
+ */
+static int compareNumbers(const char *a, char aType, const char *b, char bType)
+{
+    if (aType != TYPE__INT || bType != TYPE__INT) {
+        double aDbl = strtod(a, NULL);
+        double bDbl = strtod(b, NULL);
+        return (aDbl > bDbl) - (aDbl < bDbl);
+    }
+
+    char aNeg = (*a == '-');
+    char bNeg = (*b == '-');
+
+    if (*a == '-' || *a == '+') {
+        a++;
+    }
+    if (*b == '-' || *b == '+') {
+        b++;
+    }
+    for (; *a == '0' && a[1] != '\0'; a++) {}
+    for (; *b == '0' && b[1] != '\0'; b++) {}
+
+    // Negative zero is still zero.
+    if (strcmp(a, "0") == 0) {
+        aNeg = 0;
+    }
+    if (strcmp(b, "0") == 0) {
+        bNeg = 0;
+    }
+
+    if (aNeg != bNeg) {
+        return aNeg ? -1 : 1;
+    }
+
+    size_t aLen = strlen(a);
+    size_t bLen = strlen(b);
+    int cmp = (aLen != bLen) ? ((aLen > bLen) ? 1 : -1) : strcmp(a, b);
+    if (cmp > 0) {
+        cmp = 1;
+    } else if (cmp < 0) {
+        cmp = -1;
+    }
+
+    return aNeg ? -cmp : cmp;
+}
+
+/**
+ * Get the name of a column's type, which is the narrowest one that all of its
+ * values fit.
+ *
+ * @param   col
+ */
+static char *typeName(struct columnStats *col)
+{
+    if (col->types == 0) {
+        return "empty";
+    }
+    if (col->types & TYPE__TEXT) {
+        return "text";
+    }
+    if (col->types & TYPE__DATE) {
+        // Dates mixed with numbers are just text.
+        return (col->types == TYPE__DATE) ? "date" : "text";
+    }
+    if (col->types & TYPE__DECIMAL) {
+        return "decimal";
+    }
+    if (col->maxDigits > MAX_EXACT_DIGITS) {
+        // These are the ones spreadsheets mangle.
+        return "int (too long for floats)";
+    }
+
+    return "int";
+}
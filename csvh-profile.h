@@ -0,0 +1,25 @@
+#ifndef csvh_profile_h
+#define csvh_profile_h
+
+// Constants
+
+#define CSVH_PROFILE__OK                0
+#define CSVH_PROFILE__DONE              1
+#define CSVH_PROFILE__OUT_OF_MEMORY     2
+
+// Number of strings csvh_profile_describe puts out for each column.
+#define CSVH_PROFILE__FIELD_COUNT       7
+
+char csvh_profile_init(int chunkCountIn);
+
+char csvh_profile_add_row(int chunk, char **fields);
+
+char csvh_profile_finish();
+
+int csvh_profile_column_count();
+
+char csvh_profile_describe(int col, char **values);
+
+char csvh_profile_close();
+
+#endif
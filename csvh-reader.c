@@ -0,0 +1,1313 @@
+#define _GNU_SOURCE // For copy_file_range.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/inotify.h>
+#endif
+
+#include "csvh-aio.h"
+#include "csvh-reader.h"
+#include "csvh-scan.h"
+
+// This is a helper module for csv-handler.c.
+
+// It owns the input.  If the input is a regular file, the whole thing gets
+// mapped into memory and records are handed out as pointers straight into the
+// mapping.  If it's a file that doesn't get mapped (i.e., mapping's turned off
+// because the file's on a network filesystem), csvh-aio.c reads it ahead into
+// a ring of buffers, and records are handed out as pointers into those; only
+// a record that runs from one buffer into the next gets copied, into a buffer
+// of its own.  Anything else (pipes, terminals) gets read in big chunks into a
+// buffer, and records are handed out as pointers into that.  Either way, a
+// record is only good until the next call to csvh_reader_next_record.
+
+/**
+ * Size of each read when not mapped.
+ */
+#define READ_CHUNK_SIZE 65536
+
+// Forward declarations for static functions.
+
+static char fillBuffer();
+
+static char fillFromRing();
+
+static long findEndInBlock(const char *block, size_t len, char inQuote);
+
+static char waitForAppend();
+
+static long findRecordEnd();
+
+static char resync();
+
+static void setRecord(const char **record, size_t *recordLen, size_t start, size_t end, char terminated);
+
+static char writeAll(int outFd, const char *buff, size_t len);
+
+static char scanTailBlock(const char *block, size_t len, long long blockOffset, int n, int *found, char *inQuote, long long *start);
+
+static char fillTailRing(int n, int *found);
+
+static char nextTailRecord(const char **record, size_t *recordLen);
+
+// END forward declarations.
+
+/**
+ * Input file descriptor.  -1 if not open.
+ */
+static int inFd = -1;
+
+/**
+ * Input is a regular file.
+ */
+static char isFile = 0;
+
+/**
+ * Data currently available.  Either the mapping of the whole file or the
+ * read buffer.
+ */
+static char *data = NULL;
+
+/**
+ * Data is a mapping (as opposed to a malloc'd buffer).
+ */
+static char isMapped = 0;
+
+/**
+ * Length of valid data.
+ */
+static size_t dataLen = 0;
+
+/**
+ * Allocated size of data, when it's a buffer.
+ */
+static size_t dataCap = 0;
+
+/**
+ * Offset into the input of data[0].
+ */
+static long long dataOffset = 0;
+
+/**
+ * Position in data where the next record starts.
+ */
+static size_t pos = 0;
+
+/**
+ * Reached the end of the input (so data holds everything that's left).
+ */
+static char atEof = 0;
+
+/**
+ * How far past pos has already been scanned for the end of the record, and
+ * whether that point is inside quotes.  Kept so that a record that's split
+ * across reads doesn't get rescanned from the start every time.
+ */
+static size_t scanPos = 0;
+static char scanInQuote = 0;
+
+/**
+ * Offsets in the input of the start and end of the last record, where the end
+ * includes its line break.
+ */
+static long long recordOffset = 0;
+static long long recordEnd = 0;
+
+/**
+ * Last record ended with a line break (as opposed to the end of the input).
+ */
+static char recordTerminated = 0;
+
+/**
+ * Keep waiting for more input at the end of the file instead of stopping.
+ */
+static char follow = 0;
+
+/**
+ * Map regular files into memory.  On by default.
+ */
+static char mapFiles = 1;
+
+/**
+ * Quotes can have line breaks between them.  On by default.  With it off, a
+ * record is just a line.
+ */
+static char quoting = 1;
+
+/**
+ * Longest a record can be before it's given up on, and where the last one
+ * that was started at in the input (-1 if none).
+ */
+static size_t maxRecordSize = CSVH_READER__DEFAULT_MAX_RECORD;
+static long long badRecordOffset = -1;
+
+/**
+ * The file is being read through csvh-aio.c, so data is either one of its
+ * buffers or carry.
+ */
+static char usingAio = 0;
+
+/**
+ * Where a record that runs from one of csvh-aio's buffers into the next gets
+ * put back together, and its size.
+ */
+static char *carry = NULL;
+static size_t carryCap = 0;
+
+/**
+ * When data is carry, the rest of the buffer that carry took the end of the
+ * record from, and the offset in the input of its start.  That's where
+ * reading picks up after carry.  NULL if none.
+ */
+static const char *pending = NULL;
+static size_t pendingLen = 0;
+static long long pendingOffset = 0;
+
+/**
+ * Inotify instance watching the input file, when following.  -1 if not.
+ */
+static int watchFd = -1;
+
+/**
+ * When tailing input that isn't mapped, the last records read, oldest first
+ * starting at tailInd.  tailCount is how many there are.  Only used if
+ * tailRing isn't NULL.
+ */
+static char **tailRing = NULL;
+static size_t *tailLens = NULL;
+static long long *tailOffsets = NULL;
+static long long *tailEnds = NULL;
+static int tailCount = 0;
+static int tailInd = 0;
+
+/**
+ * Follow the input file as it grows, the way "tail -f" does: at the end of
+ * it, wait until more gets added instead of stopping.  Anything at the end
+ * that isn't a complete record yet is held until it is.  Must be called
+ * before opening.
+ *
+ * There's no polling.  It sleeps until inotify says the file changed, and
+ * then only reads what's new.  Stops if the file gets deleted.
+ *
+ * @param   followIn
+ */
+char csvh_reader_set_follow(char followIn)
+{
+#ifdef __linux__
+    follow = followIn;
+    return CSVH_READER__OK;
+#else
+    return followIn ? CSVH_READER__IO_ERROR : CSVH_READER__OK;
+#endif
+}
+
+/**
+ * Turn mapping regular files into memory on or off.  Some network filesystems
+ * do badly with mappings (pages get fetched one at a time, or the process gets
+ * killed if the file changes), so with it off, files get read ahead in big
+ * pieces instead.  Must be called before opening.
+ *
+ * @param   mapFilesIn
+ */
+char csvh_reader_set_mapping(char mapFilesIn)
+{
+    mapFiles = mapFilesIn;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Turn quoting on or off.  With it off, every line break ends a record, and
+ * quotes are just bytes like any other, so a stray one can't make the rest of
+ * the input look like one record.  Must be called before opening.
+ *
+ * @param   quotingIn
+ */
+char csvh_reader_set_quoting(char quotingIn)
+{
+    quoting = quotingIn;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Set the longest a record can be, in bytes.  A record that gets longer than
+ * that (i.e., because of a stray quote, which makes everything after it look
+ * like one big value) doesn't get handed out.  Neither does one that's still
+ * inside quotes at the end of the input.
+ *
+ * @param   maxSize
+ */
+char csvh_reader_set_max_record(size_t maxSize)
+{
+    maxRecordSize = (maxSize > 0) ? maxSize : CSVH_READER__DEFAULT_MAX_RECORD;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Open the reader on the passed file descriptor.
+ *
+ * @param   fd
+ */
+char csvh_reader_open(int fd)
+{
+    inFd = fd;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        isFile = 1;
+#ifdef __linux__
+        if (follow) {
+            // Watching the fd's link in /proc watches whatever file it is.
+            char path[64];
+            snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+            if (
+                (watchFd = inotify_init1(IN_CLOEXEC)) == -1
+                || inotify_add_watch(watchFd, path, IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF) == -1
+            ) {
+                return CSVH_READER__IO_ERROR;
+            }
+        }
+#endif
+        // Whoever handed over the fd may have already read some of it (e.g.,
+        // a shell script that read the first line itself), so start from
+        // wherever it's at, not the top of the file.
+        off_t start = lseek(fd, 0, SEEK_CUR);
+        if (start < 0) {
+            start = 0;
+        }
+#ifndef _WIN32
+        // A mapping wouldn't grow with the file, so don't map if following.
+        if (!follow && st.st_size - start <= 0) {
+            // Can't map nothing.
+            atEof = 1;
+            return CSVH_READER__OK;
+        }
+
+        // The whole file gets mapped (mmap wants a page-aligned offset
+        // anyway), and reading just starts partway in, so offsets into the
+        // mapping stay the same as offsets in the file.
+        void *mapped = (follow || !mapFiles) ? MAP_FAILED : mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+            data = mapped;
+            dataLen = st.st_size;
+            pos = start;
+            scanPos = pos;
+            isMapped = 1;
+            atEof = 1;
+            return CSVH_READER__OK;
+        }
+        // If mapping didn't work, just read it like anything else.
+#endif
+
+        if (!follow) {
+            // Reading it through csvh-aio.c, if it can.  A file that's being
+            // followed doesn't have a fixed end to read ahead to.
+            char rc = csvh_aio_open(fd, start);
+            if (rc == CSVH_AIO__OK) {
+                usingAio = 1;
+                dataOffset = start;
+                return CSVH_READER__OK;
+            }
+            if (rc == CSVH_AIO__OUT_OF_MEMORY) {
+                return CSVH_READER__OUT_OF_MEMORY;
+            }
+#ifdef POSIX_FADV_SEQUENTIAL
+            // Otherwise, at least let the kernel know to read ahead.
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        }
+    }
+
+    dataCap = READ_CHUNK_SIZE;
+    data = malloc(sizeof(char) * dataCap);
+    if (data == NULL) {
+        return CSVH_READER__OUT_OF_MEMORY;
+    }
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Get the next record (i.e., logical CSV line, which may cover several
+ * physical lines if there's a quoted line break in it).  The line break at the
+ * end is not included, nor is the \r of a DOS line ending.
+ *
+ * If the record is malformed (too long, or its quotes never close), this
+ * returns BAD_RECORD instead, having already moved on to the line after the
+ * one it started on, so the next call picks up from there.
+ * csvh_reader_bad_record_offset says where it was.
+ *
+ * @param   record
+ * @param   recordLen
+ */
+char csvh_reader_next_record(const char **record, size_t *recordLen)
+{
+    if (inFd == -1) {
+        return CSVH_READER__NOT_OPEN;
+    }
+
+    if (tailRing != NULL) {
+        return nextTailRecord(record, recordLen);
+    }
+
+    long end;
+    char rc;
+
+    while ((end = findRecordEnd()) == -1) {
+        if (scanPos - pos > maxRecordSize || (atEof && scanInQuote && pos < dataLen)) {
+            return resync();
+        }
+
+        if (atEof) {
+            if (pos == dataLen) {
+                return CSVH_READER__DONE;
+            }
+
+            // Last line doesn't have a line break.
+            setRecord(record, recordLen, pos, dataLen, 0);
+            pos = dataLen;
+            scanPos = pos;
+            return CSVH_READER__OK;
+        }
+
+        if ((rc = fillBuffer()) != CSVH_READER__OK) {
+            return rc;
+        }
+    }
+
+    setRecord(record, recordLen, pos, end, 1);
+    pos = end + 1;
+    scanPos = pos;
+    scanInQuote = 0;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Get the offset in the input of the start of the last record that
+ * csvh_reader_next_record gave up on.  -1 if there hasn't been one.
+ */
+long long csvh_reader_bad_record_offset()
+{
+    return badRecordOffset;
+}
+
+/**
+ * Skip the next n records without handing any of them out, and set skipped to
+ * how many there actually were.  Line breaks inside quotes don't count, the
+ * same as with csvh_reader_next_record, so this never ends up in the middle of
+ * a record.
+ *
+ * Nothing gets split into records or kept around: the buffer just gets
+ * scanned for line breaks that aren't in quotes, 16 bytes at a time, and then
+ * thrown out.  A mapped file is already all in the buffer, so skipping ahead
+ * in it is one scan, without reading anything.
+ *
+ * @param   n
+ * @param   skipped
+ */
+char csvh_reader_skip_records(int n, int *skipped)
+{
+    *skipped = 0;
+
+    if (inFd == -1) {
+        return CSVH_READER__NOT_OPEN;
+    }
+
+    int left = n;
+    // The record being skipped started in a buffer that's been thrown out.
+    char started = 0;
+    char rc;
+
+    while (left > 0) {
+        const char *after = quoting
+            ? csvh_scan_skip_unquoted_from(data + scanPos, dataLen - scanPos, '\n', '"', &left, &scanInQuote)
+            : csvh_scan_skip_from(data + scanPos, dataLen - scanPos, '\n', &left);
+
+        if (after != NULL) {
+            pos = after - data;
+            scanPos = pos;
+            scanInQuote = 0;
+            break;
+        }
+
+        if (atEof) {
+            if ((started || pos < dataLen) && !scanInQuote) {
+                // Last line doesn't have a line break.
+                left--;
+            }
+            pos = dataLen;
+            scanPos = pos;
+            break;
+        }
+
+        // Nothing in the buffer is worth keeping, but whether it ended in
+        // quotes is.
+        started = started || pos < dataLen;
+        pos = dataLen;
+        scanPos = pos;
+        if ((rc = fillBuffer()) != CSVH_READER__OK) {
+            return rc;
+        }
+    }
+
+    *skipped = n - left;
+
+    return (left > 0) ? CSVH_READER__DONE : CSVH_READER__OK;
+}
+
+/**
+ * Move ahead to the last n records of the input, and set found to the number
+ * of records that are left to read after that (which is less than n if there
+ * just aren't that many).
+ *
+ * If the input is a file, this scans backwards from the end of it, so only
+ * the last few records ever get looked at.  Scanning backwards, a line break
+ * ends a record if there's an even number of quotes after it, the same as
+ * going forwards (assuming the file doesn't end inside quotes).
+ *
+ * If it isn't a file, there's no going backwards, so it reads everything and
+ * keeps the last n records around.
+ *
+ * @param   n
+ * @param   found
+ */
+char csvh_reader_seek_tail(int n, int *found)
+{
+    if (inFd == -1) {
+        return CSVH_READER__NOT_OPEN;
+    }
+
+    if (!isFile) {
+        return fillTailRing(n, found);
+    }
+
+    long long lower = dataOffset + pos; // Can't go back before here.
+    long long end;
+    char lastChar = '\0';
+
+    if (isMapped) {
+        end = dataLen;
+        if (end > lower) {
+            lastChar = data[end - 1];
+        }
+    } else {
+        struct stat st;
+        if (fstat(inFd, &st) != 0) {
+            return CSVH_READER__IO_ERROR;
+        }
+        end = st.st_size;
+        if (end > lower && pread(inFd, &lastChar, 1, end - 1) != 1) {
+            return CSVH_READER__IO_ERROR;
+        }
+    }
+
+    if (n > 0 && end > lower && lastChar == '\n') {
+        // That's the end of the last record, not the start of the one after
+        // it.
+        end--;
+    }
+
+    *found = (n > 0 && end > lower) ? 1 : 0; // Whatever's after the last break.
+    long long start = lower;
+    char inQuote = 0;
+
+    if (isMapped) {
+        scanTailBlock(data + lower, end - lower, lower, n, found, &inQuote, &start);
+
+        pos = start;
+        scanPos = pos;
+        scanInQuote = 0;
+
+        return CSVH_READER__OK;
+    }
+
+    // Not mapped, so read it backwards a chunk at a time.
+    char buff[READ_CHUNK_SIZE];
+    for (long long blockEnd = end; blockEnd > lower;) {
+        long long blockStart = (blockEnd - lower > READ_CHUNK_SIZE) ? blockEnd - READ_CHUNK_SIZE : lower;
+
+        if (pread(inFd, buff, blockEnd - blockStart, blockStart) != blockEnd - blockStart) {
+            return CSVH_READER__IO_ERROR;
+        }
+
+        if (scanTailBlock(buff, blockEnd - blockStart, blockStart, n, found, &inQuote, &start)) {
+            break;
+        }
+
+        blockEnd = blockStart;
+    }
+
+    // Throw out whatever's buffered and pick up reading from the start of the
+    // tail.
+    if (usingAio) {
+        csvh_aio_close();
+        data = NULL;
+        pending = NULL;
+        char rc = csvh_aio_open(inFd, start);
+        if (rc != CSVH_AIO__OK) {
+            usingAio = 0;
+            return (rc == CSVH_AIO__OUT_OF_MEMORY) ? CSVH_READER__OUT_OF_MEMORY : CSVH_READER__IO_ERROR;
+        }
+    } else if (lseek(inFd, start, SEEK_SET) == -1) {
+        return CSVH_READER__IO_ERROR;
+    }
+    dataOffset = start;
+    dataLen = 0;
+    pos = 0;
+    scanPos = 0;
+    scanInQuote = 0;
+    atEof = 0;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Get offset in the input of where the next record starts.
+ */
+long long csvh_reader_position()
+{
+    return dataOffset + pos;
+}
+
+/**
+ * Go back (or forward) to the passed offset, so that the next record starts
+ * there.  Only works if mapped, and the offset needs to be the start of a
+ * record.
+ *
+ * @param   offset
+ */
+char csvh_reader_rewind(long long offset)
+{
+    if (!isMapped || offset < 0 || offset > (long long) dataLen) {
+        return CSVH_READER__IO_ERROR;
+    }
+
+    pos = offset;
+    scanPos = pos;
+    scanInQuote = 0;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Hand over everything from the next record to the end of the input in one
+ * piece, for splitting up somewhere else, and act like it's all been read.
+ * Only works if mapped (and not following, since then there's no end).
+ *
+ * @param   view
+ * @param   len
+ */
+char csvh_reader_take_rest(const char **view, size_t *len)
+{
+    if (!isMapped || follow || tailRing != NULL) {
+        return CSVH_READER__IO_ERROR;
+    }
+
+    *view = data + pos;
+    *len = dataLen - pos;
+
+    pos = dataLen;
+    scanPos = pos;
+    scanInQuote = 0;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Get offset in the input of the start of the last record.
+ */
+long long csvh_reader_record_offset()
+{
+    return recordOffset;
+}
+
+/**
+ * Get offset in the input just past the end of the last record, including its
+ * line break.
+ */
+long long csvh_reader_record_end()
+{
+    return recordEnd;
+}
+
+/**
+ * Determine if the last record ended with a line break.
+ */
+char csvh_reader_record_terminated()
+{
+    return recordTerminated;
+}
+
+/**
+ * Determine if the input is a regular file.
+ */
+char csvh_reader_is_file()
+{
+    return isFile;
+}
+
+/**
+ * Determine if the whole input is mapped into memory, meaning any part of it
+ * can be gotten at with csvh_reader_view at any time.
+ */
+char csvh_reader_is_mapped()
+{
+    return isMapped;
+}
+
+/**
+ * Determine if following the input as it grows.
+ */
+char csvh_reader_is_following()
+{
+    return watchFd != -1;
+}
+
+/**
+ * Get a pointer to a range of the input, by offset.  Only works if mapped.
+ *
+ * @param   offset
+ * @param   len
+ * @param   view
+ */
+char csvh_reader_view(long long offset, size_t len, const char **view)
+{
+    if (!isMapped || offset < 0 || offset + len > dataLen) {
+        return CSVH_READER__IO_ERROR;
+    }
+
+    *view = data + offset;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Copy a range of bytes from the input file straight to the output.  Only
+ * makes sense when the input is a regular file.
+ *
+ * Uses copy_file_range, then sendfile, to keep the bytes in the kernel, and
+ * falls back to writing from the mapping (or pread) if neither of those work
+ * for this pair of files.
+ *
+ * @param   start
+ * @param   len
+ * @param   outFd
+ */
+char csvh_reader_copy_range(long long start, long long len, int outFd)
+{
+    if (!isFile) {
+        return CSVH_READER__IO_ERROR;
+    }
+
+    off_t off = start;
+    ssize_t res = 0;
+
+#ifdef __linux__
+    while (len > 0 && (res = copy_file_range(inFd, &off, outFd, NULL, len, 0)) > 0) {
+        len -= res;
+    }
+
+    while (len > 0 && (res = sendfile(outFd, inFd, &off, len)) > 0) {
+        len -= res;
+    }
+#endif
+
+    if (len == 0) {
+        return CSVH_READER__OK;
+    }
+
+    if (isMapped) {
+        return writeAll(outFd, data + off, len);
+    }
+
+    char buff[READ_CHUNK_SIZE];
+    while (len > 0) {
+        res = pread(inFd, buff, (len < READ_CHUNK_SIZE) ? len : READ_CHUNK_SIZE, off);
+        if (res <= 0) {
+            return CSVH_READER__IO_ERROR;
+        }
+        if (writeAll(outFd, buff, res) != CSVH_READER__OK) {
+            return CSVH_READER__IO_ERROR;
+        }
+        off += res;
+        len -= res;
+    }
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Close out everything.
+ */
+char csvh_reader_close()
+{
+    if (tailRing != NULL) {
+        for (int i = 0; i < tailCount; i++) {
+            free(tailRing[i]);
+        }
+        free(tailRing);
+        free(tailLens);
+        free(tailOffsets);
+        free(tailEnds);
+        tailRing = NULL;
+    }
+
+#ifndef _WIN32
+    if (isMapped) {
+        munmap(data, dataLen);
+        data = NULL;
+    }
+#endif
+    if (usingAio) {
+        // Data belongs to csvh-aio or is carry.
+        csvh_aio_close();
+        data = NULL;
+        usingAio = 0;
+    }
+    free(carry);
+    carry = NULL;
+    carryCap = 0;
+    pending = NULL;
+    pendingLen = 0;
+    free(data);
+    data = NULL;
+    dataLen = 0;
+    dataCap = 0;
+    inFd = -1;
+
+    // Back to the way it started, in case it gets opened on something else.
+    isFile = 0;
+    isMapped = 0;
+    dataOffset = 0;
+    pos = 0;
+    atEof = 0;
+    scanPos = 0;
+    scanInQuote = 0;
+    recordOffset = 0;
+    recordEnd = 0;
+    recordTerminated = 0;
+    badRecordOffset = -1;
+    tailCount = 0;
+    tailInd = 0;
+
+    if (watchFd != -1) {
+        close(watchFd);
+        watchFd = -1;
+    }
+
+    return CSVH_READER__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Read more input into the buffer.  Anything before pos is thrown out to make
+ * room, and the buffer grows if what's left is already taking up all of it.
+ */
+static char fillBuffer()
+{
+    if (usingAio) {
+        return fillFromRing();
+    }
+
+    if (pos > 0) {
+        memmove(data, data + pos, dataLen - pos);
+        dataLen -= pos;
+        scanPos -= pos;
+        dataOffset += pos;
+        pos = 0;
+    }
+
+    if (dataCap - dataLen < READ_CHUNK_SIZE) {
+        char *newData = realloc(data, sizeof(char) * (dataCap * 2));
+        if (newData == NULL) {
+            return CSVH_READER__OUT_OF_MEMORY;
+        }
+        data = newData;
+        dataCap *= 2;
+    }
+
+    ssize_t res;
+    char rc;
+
+    while ((res = read(inFd, data + dataLen, dataCap - dataLen)) == 0 && watchFd != -1) {
+        // At the end for now, but more might get added, so wait until it is.
+        if ((rc = waitForAppend()) == CSVH_READER__DONE) {
+            break;
+        } else if (rc != CSVH_READER__OK) {
+            return rc;
+        }
+    }
+
+    if (res < 0) {
+        return CSVH_READER__IO_ERROR;
+    }
+
+    if (res == 0) {
+        atEof = 1;
+    }
+
+    dataLen += res;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Move on to the next of csvh-aio's buffers.  Whatever's left in data from
+ * pos on is the start of a record that didn't end in it (or nothing), and it
+ * needs to stay in front of whatever comes next.
+ *
+ * If there's nothing left, data just becomes the next buffer.  Otherwise,
+ * what's left goes in carry, along with as much of the next buffer as it
+ * takes to finish the record, and the rest of that buffer is pending until
+ * carry's been read.  So only records that cross from one buffer to the next
+ * ever get copied.
+ */
+static char fillFromRing()
+{
+    size_t leftLen = dataLen - pos;
+
+    if (leftLen > 0) {
+        // Has to be saved before the buffer it's in gets reused.
+        if (leftLen > carryCap) {
+            size_t newCap = (carryCap == 0) ? READ_CHUNK_SIZE : carryCap;
+            while (newCap < leftLen) {
+                newCap *= 2;
+            }
+            char *newCarry = malloc(sizeof(char) * newCap);
+            if (newCarry == NULL) {
+                return CSVH_READER__OUT_OF_MEMORY;
+            }
+            memcpy(newCarry, data + pos, leftLen);
+            free(carry);
+            carry = newCarry;
+            carryCap = newCap;
+        } else {
+            memmove(carry, data + pos, leftLen);
+        }
+    }
+    if (leftLen > 0 || data == carry) {
+        data = carry;
+    }
+    dataOffset += pos;
+    dataLen = leftLen;
+    scanPos -= pos;
+    pos = 0;
+
+    const char *next;
+    size_t nextLen;
+    long long nextOffset;
+
+    if (pending != NULL) {
+        next = pending;
+        nextLen = pendingLen;
+        nextOffset = pendingOffset;
+        pending = NULL;
+    } else {
+        char rc = csvh_aio_next(&next, &nextLen, &nextOffset);
+        if (rc == CSVH_AIO__OUT_OF_MEMORY) {
+            return CSVH_READER__OUT_OF_MEMORY;
+        }
+        if (rc != CSVH_AIO__OK) {
+            return CSVH_READER__IO_ERROR;
+        }
+        if (nextLen == 0) {
+            atEof = 1;
+            return CSVH_READER__OK;
+        }
+    }
+
+    if (leftLen == 0) {
+        // Nothing to put back together, so no copying.
+        data = (char *) next;
+        dataLen = nextLen;
+        dataOffset = nextOffset;
+        scanPos = 0;
+        return CSVH_READER__OK;
+    }
+
+    // Everything up to pos has been scanned, so the state of quotes there is
+    // known, and the record's end can be found in the next buffer.
+    long end = findEndInBlock(next, nextLen, scanInQuote);
+    size_t take = (end == -1) ? nextLen : (size_t) end + 1;
+
+    if (leftLen + take > carryCap) {
+        size_t newCap = carryCap * 2;
+        while (newCap < leftLen + take) {
+            newCap *= 2;
+        }
+        char *newCarry = realloc(carry, sizeof(char) * newCap);
+        if (newCarry == NULL) {
+            return CSVH_READER__OUT_OF_MEMORY;
+        }
+        carry = newCarry;
+        carryCap = newCap;
+        data = carry;
+    }
+
+    memcpy(carry + leftLen, next, take);
+    dataLen = leftLen + take;
+
+    if (take < nextLen) {
+        pending = next + take;
+        pendingLen = nextLen - take;
+        pendingOffset = nextOffset + take;
+    }
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Find the first line break in a block that isn't inside quotes, given
+ * whether the block starts inside quotes.  Returns its index, or -1 if there
+ * isn't one.
+ *
+ * @param   block
+ * @param   len
+ * @param   inQuote
+ */
+static long findEndInBlock(const char *block, size_t len, char inQuote)
+{
+    const char *from = block;
+    const char *end = block + len;
+
+    while (from < end) {
+        const char *nl = memchr(from, '\n', end - from);
+        const char *stop = (nl == NULL) ? end : nl;
+
+        for (const char *q = from; quoting && (q = memchr(q, '"', stop - q)) != NULL; q++) {
+            inQuote = !inQuote;
+        }
+
+        if (nl == NULL) {
+            return -1;
+        }
+        if (!inQuote) {
+            return nl - block;
+        }
+
+        from = nl + 1;
+    }
+
+    return -1;
+}
+
+/**
+ * Sleep until the followed file changes.  Returns "done" if it got deleted,
+ * since nothing else is going to get added to it after that.
+ */
+static char waitForAppend()
+{
+#ifdef __linux__
+    // Whatever's been printed so far should show up before sitting here for
+    // who knows how long.
+    fflush(stdout);
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(watchFd, events, sizeof(events));
+
+    if (len <= 0) {
+        return CSVH_READER__IO_ERROR;
+    }
+
+    const struct inotify_event *event;
+    struct stat st;
+    for (char *ptr = events; ptr < events + len; ptr += sizeof(struct inotify_event) + event->len) {
+        event = (const struct inotify_event *)ptr;
+        if (event->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+            return CSVH_READER__DONE;
+        }
+        if ((event->mask & IN_ATTRIB) && fstat(inFd, &st) == 0 && st.st_nlink == 0) {
+            // Since it's still open here, deleting it only shows up as a
+            // change to its link count.
+            return CSVH_READER__DONE;
+        }
+    }
+
+    return CSVH_READER__OK;
+#else
+    return CSVH_READER__DONE;
+#endif
+}
+
+/**
+ * Find the line break that ends the record starting at pos, and return its
+ * index in data.  Returns -1 if data runs out first.  A line break only ends
+ * the record if it's not inside quotes, which is the same as saying there's
+ * been an even number of quotes since the start of the record.  (Without
+ * quoting, that's just the first one.)
+ */
+static long findRecordEnd()
+{
+    // No need to look past the longest a record can be.  (Otherwise one stray
+    // quote in a mapped file would mean scanning everything after it.)
+    size_t limit = (dataLen - pos > maxRecordSize) ? pos + maxRecordSize + 1 : dataLen;
+
+    while (scanPos < limit) {
+        const char *nl = memchr(data + scanPos, '\n', limit - scanPos);
+        const char *stop = (nl == NULL) ? data + limit : nl;
+
+        for (
+            const char *q = data + scanPos;
+            quoting && (q = memchr(q, '"', stop - q)) != NULL;
+            q++
+        ) {
+            scanInQuote = !scanInQuote;
+        }
+
+        if (nl == NULL) {
+            scanPos = limit;
+            break;
+        }
+
+        scanPos = nl - data + 1;
+
+        if (!scanInQuote) {
+            return nl - data;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Give up on the record starting at pos, and move on to just after the first
+ * line break after its start, whether that's inside quotes or not, since the
+ * quotes are probably what's wrong.
+ *
+ * Everything after that gets scanned again, but that's never more than the
+ * longest a record can be, and it can't happen again for a while: the next
+ * record can only go bad the same way if there's no closing quote for it
+ * within that distance either.
+ */
+static char resync()
+{
+    badRecordOffset = dataOffset + pos;
+
+    const char *nl;
+    char rc;
+
+    while ((nl = memchr(data + pos, '\n', dataLen - pos)) == NULL) {
+        // One line longer than a record can be, so none of it's worth
+        // keeping.
+        pos = dataLen;
+        scanPos = pos;
+        if (atEof) {
+            break;
+        }
+        if ((rc = fillBuffer()) != CSVH_READER__OK) {
+            return rc;
+        }
+    }
+
+    if (nl != NULL) {
+        pos = nl - data + 1;
+        scanPos = pos;
+    }
+    scanInQuote = 0;
+
+    return CSVH_READER__BAD_RECORD;
+}
+
+/**
+ * Set the record that gets passed back out, and remember where it was.
+ *
+ * @param   record
+ * @param   recordLen
+ * @param   start       Index in data of start of record.
+ * @param   end         Index in data of line break (or end of data).
+ * @param   terminated  Record ended in a line break.
+ */
+static void setRecord(const char **record, size_t *recordLen, size_t start, size_t end, char terminated)
+{
+    recordOffset = dataOffset + start;
+    recordEnd = dataOffset + end + (terminated ? 1 : 0);
+    recordTerminated = terminated;
+
+    if (terminated && end > start && data[end - 1] == '\r') {
+        // Because DOS line endings.
+        end--;
+    }
+
+    *record = data + start;
+    *recordLen = end - start;
+}
+
+/**
+ * Write all of a buffer, however many calls it takes.
+ *
+ * @param   outFd
+ * @param   buff
+ * @param   len
+ */
+static char writeAll(int outFd, const char *buff, size_t len)
+{
+    while (len > 0) {
+        ssize_t res = write(outFd, buff, len);
+        if (res <= 0) {
+            return CSVH_READER__IO_ERROR;
+        }
+        buff += res;
+        len -= res;
+    }
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Scan a block of the input backwards, counting records, as part of finding
+ * the last n of them.  Returns true (and sets start to its offset) once the
+ * start of the nth record from the end is found.  The counts and quote state
+ * carry over to the next block (i.e., the one before this one).
+ *
+ * @param   block
+ * @param   len
+ * @param   blockOffset     Offset of block in the input.
+ * @param   n
+ * @param   found
+ * @param   inQuote
+ * @param   start
+ */
+static char scanTailBlock(const char *block, size_t len, long long blockOffset, int n, int *found, char *inQuote, long long *start)
+{
+    for (size_t i = len; i > 0; i--) {
+        char c = block[i - 1];
+        if (c == '"' && quoting) {
+            *inQuote = !*inQuote;
+        } else if (c == '\n' && !*inQuote) {
+            if (*found == n) {
+                *start = blockOffset + i;
+                return 1;
+            }
+            (*found)++;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Read the rest of the input, keeping the last n records in the tail ring.
+ *
+ * @param   n
+ * @param   found
+ */
+static char fillTailRing(int n, int *found)
+{
+    *found = 0;
+    if (n <= 0) {
+        n = 0;
+    }
+
+    char **ring = malloc(sizeof(char *) * (n + 1)); // +1 so never zero.
+    tailLens = malloc(sizeof(size_t) * (n + 1));
+    tailOffsets = malloc(sizeof(long long) * (n + 1));
+    tailEnds = malloc(sizeof(long long) * (n + 1));
+    if (ring == NULL || tailLens == NULL || tailOffsets == NULL || tailEnds == NULL) {
+        free(ring);
+        return CSVH_READER__OUT_OF_MEMORY;
+    }
+
+    const char *record;
+    size_t recordLen;
+    char rc;
+    int next = 0; // Slot the next record goes in.
+    int count = 0;
+
+    while ((rc = csvh_reader_next_record(&record, &recordLen)) == CSVH_READER__OK) {
+        if (n == 0) {
+            continue;
+        }
+
+        if (count == n) {
+            free(ring[next]);
+        } else {
+            count++;
+        }
+
+        if ((ring[next] = malloc(sizeof(char) * (recordLen + 1))) == NULL) {
+            return CSVH_READER__OUT_OF_MEMORY;
+        }
+        memcpy(ring[next], record, recordLen);
+        tailLens[next] = recordLen;
+        tailOffsets[next] = recordOffset;
+        tailEnds[next] = recordEnd;
+
+        next = (next + 1) % n;
+    }
+
+    if (rc != CSVH_READER__DONE) {
+        return rc;
+    }
+
+    // Unroll it so that the oldest is first, to make handing them out easy.
+    char **ordered = malloc(sizeof(char *) * (n + 1));
+    size_t *orderedLens = malloc(sizeof(size_t) * (n + 1));
+    long long *orderedOffsets = malloc(sizeof(long long) * (n + 1));
+    long long *orderedEnds = malloc(sizeof(long long) * (n + 1));
+    if (ordered == NULL || orderedLens == NULL || orderedOffsets == NULL || orderedEnds == NULL) {
+        return CSVH_READER__OUT_OF_MEMORY;
+    }
+
+    int first = (count == n) ? next : 0;
+    for (int i = 0; i < count; i++) {
+        int from = (first + i) % (n == 0 ? 1 : n);
+        ordered[i] = ring[from];
+        orderedLens[i] = tailLens[from];
+        orderedOffsets[i] = tailOffsets[from];
+        orderedEnds[i] = tailEnds[from];
+    }
+
+    free(ring);
+    free(tailLens);
+    free(tailOffsets);
+    free(tailEnds);
+    tailRing = ordered;
+    tailLens = orderedLens;
+    tailOffsets = orderedOffsets;
+    tailEnds = orderedEnds;
+    tailCount = count;
+    tailInd = 0;
+    *found = count;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Hand out the next record from the tail ring.
+ *
+ * @param   record
+ * @param   recordLen
+ */
+static char nextTailRecord(const char **record, size_t *recordLen)
+{
+    if (tailInd == tailCount) {
+        return CSVH_READER__DONE;
+    }
+
+    *record = tailRing[tailInd];
+    *recordLen = tailLens[tailInd];
+    recordOffset = tailOffsets[tailInd];
+    recordEnd = tailEnds[tailInd];
+    recordTerminated = (recordEnd - recordOffset > (long long)*recordLen);
+    tailInd++;
+
+    return CSVH_READER__OK;
+}
@@ -0,0 +1,59 @@
+#ifndef csvh_reader_h
+#define csvh_reader_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_READER__OK                 0
+#define CSVH_READER__DONE               1
+#define CSVH_READER__OUT_OF_MEMORY      2
+#define CSVH_READER__IO_ERROR           3
+#define CSVH_READER__NOT_OPEN           4
+#define CSVH_READER__BAD_RECORD         5
+
+#define CSVH_READER__DEFAULT_MAX_RECORD 67108864
+
+char csvh_reader_set_follow(char followIn);
+
+char csvh_reader_set_mapping(char mapFilesIn);
+
+char csvh_reader_set_quoting(char quotingIn);
+
+char csvh_reader_set_max_record(size_t maxSize);
+
+char csvh_reader_open(int fd);
+
+char csvh_reader_next_record(const char **record, size_t *recordLen);
+
+long long csvh_reader_bad_record_offset();
+
+char csvh_reader_skip_records(int n, int *skipped);
+
+char csvh_reader_seek_tail(int n, int *found);
+
+long long csvh_reader_position();
+
+char csvh_reader_rewind(long long offset);
+
+char csvh_reader_take_rest(const char **view, size_t *len);
+
+long long csvh_reader_record_offset();
+
+long long csvh_reader_record_end();
+
+char csvh_reader_record_terminated();
+
+char csvh_reader_is_file();
+
+char csvh_reader_is_mapped();
+
+char csvh_reader_is_following();
+
+char csvh_reader_view(long long offset, size_t len, const char **view);
+
+char csvh_reader_copy_range(long long start, long long len, int outFd);
+
+char csvh_reader_close();
+
+#endif
@@ -0,0 +1,484 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csvh-sample.h"
+
+// This is a helper module for csv-handler.c.
+
+// Picks a random handful of records out of the input, without keeping the
+// whole input around.
+
+// For input that has to be read straight through (pipes, mostly), it's a
+// reservoir: the first n records go straight in, and after that, record
+// number i replaces a random one with probability n / i.  Every record ends
+// up with the same chance of being picked, without knowing how many there
+// are ahead of time.
+
+// For mapped files, there's no need to read everything.  It jumps to random
+// spots in the file and takes the first record that starts after each one.
+// The hard part is finding where that is, since a line break might be inside
+// quotes, and there's no way to know without reading from the beginning.  So
+// it guesses both ways (see findRecordStart).  Records that come after long
+// records are a little more likely to get picked this way, but for the usual
+// file, where the lines are all about the same length, it's close enough.
+// (Without quoting, there's nothing to guess: a record is just a line.)
+
+/**
+ * How far past a random spot to look for the start of a record before giving
+ * up on it.
+ */
+#define RESYNC_WINDOW 1048576
+
+/**
+ * How many more lines to look through, once the only thing left to rule out
+ * is the spot being inside quotes, before deciding it isn't.  (A quoted value
+ * going on for this many lines without a single quote in them is pretty
+ * unlikely.)
+ */
+#define RESYNC_CONFIRM_LINES 16
+
+/**
+ * How much of the start of the file to use to guess how long records are.
+ */
+#define ESTIMATE_BYTES 65536
+
+/**
+ * Jumping around only makes sense if the file has at least this many times
+ * more records than are wanted.  Otherwise, the same records keep getting
+ * picked, and reading straight through is cheap anyway.
+ */
+#define MIN_RECORDS_FACTOR 4
+
+/**
+ * Most jumps to make, per record wanted.
+ */
+#define MAX_TRIES_FACTOR 16
+
+/**
+ * A record that got picked.
+ */
+struct pick {
+    char *record;
+    size_t len;
+    long long order; // Where it was in the input, to put them back in order.
+};
+
+// Forward declarations for static functions.
+
+static char setPick(struct pick *dest, const char *record, size_t recordLen, long long order);
+
+static const char *findRecordStart(const char *data, const char *end, const char *from, char delim, char quoted);
+
+static const char *findRecordEnd(const char *start, const char *end, char quoted);
+
+static uint64_t nextRandom();
+
+static uint64_t randomBelow(uint64_t bound);
+
+static int comparePicks(const void *a, const void *b);
+
+// END forward declarations.
+
+/**
+ * Records picked so far.
+ */
+static struct pick *picks = NULL;
+static int pickCount = 0;
+static int wanted = 0;
+
+/**
+ * Records seen so far, for the reservoir.
+ */
+static long long seen = 0;
+
+/**
+ * Next pick to hand out.
+ */
+static int servedInd = 0;
+
+/**
+ * Random number generator state (xorshift64*).
+ */
+static uint64_t rngState = 0;
+
+/**
+ * Initialize.
+ *
+ * @param   n       Number of records to pick.
+ * @param   seed    0 to pick one from the time.
+ */
+char csvh_sample_init(int n, unsigned long long seed)
+{
+    wanted = (n < 0) ? 0 : n;
+    pickCount = 0;
+    seen = 0;
+    servedInd = 0;
+
+    if (seed == 0) {
+        seed = ((uint64_t) time(NULL) << 20) ^ (uint64_t) getpid();
+    }
+    // Mix it up a little, so that seeds that are close together don't give
+    // runs that are close together.  (This is splitmix64's finalizer.)
+    seed += 0x9e3779b97f4a7c15ULL;
+    seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+    seed ^= seed >> 31;
+    rngState = (seed == 0) ? 1 : seed;
+
+    picks = calloc((wanted == 0) ? 1 : wanted, sizeof(struct pick));
+    if (picks == NULL) {
+        return CSVH_SAMPLE__OUT_OF_MEMORY;
+    }
+
+    return CSVH_SAMPLE__OK;
+}
+
+/**
+ * Add a record to the reservoir.  The record gets copied if it's picked.
+ *
+ * @param   record
+ * @param   recordLen
+ */
+char csvh_sample_add(const char *record, size_t recordLen)
+{
+    long long order = seen++;
+
+    if (pickCount < wanted) {
+        if (setPick(picks + pickCount, record, recordLen, order) != CSVH_SAMPLE__OK) {
+            return CSVH_SAMPLE__OUT_OF_MEMORY;
+        }
+        pickCount++;
+        return CSVH_SAMPLE__OK;
+    }
+
+    uint64_t ind = randomBelow((uint64_t) seen);
+    if (ind < (uint64_t) wanted) {
+        return setPick(picks + ind, record, recordLen, order);
+    }
+
+    return CSVH_SAMPLE__OK;
+}
+
+/**
+ * Pick records out of a mapped file by jumping to random spots in it, instead
+ * of reading all of it.  Returns CSVH_SAMPLE__TOO_SMALL (without picking
+ * anything) if there don't look to be enough records to bother, in which case
+ * it's up to the caller to go through them with csvh_sample_add instead.
+ *
+ * @param   data    Starting at the first record to pick from.
+ * @param   len
+ * @param   delim
+ * @param   quoted  Whether the data has quoting.
+ */
+char csvh_sample_seek(const char *data, size_t len, char delim, char quoted)
+{
+    if (wanted == 0) {
+        return CSVH_SAMPLE__OK;
+    }
+
+    // Guess how many records there are from the start of the file.  Quoted
+    // line breaks throw it off a little, but it only needs to be close.
+    size_t scanned = (len < ESTIMATE_BYTES) ? len : ESTIMATE_BYTES;
+    const char *nl = data;
+    long long lines = 0;
+    while ((nl = memchr(nl, '\n', data + scanned - nl)) != NULL) {
+        lines++;
+        nl++;
+    }
+    if (lines == 0 || (long long) (len / (scanned / lines)) < (long long) wanted * MIN_RECORDS_FACTOR) {
+        return CSVH_SAMPLE__TOO_SMALL;
+    }
+
+    const char *end = data + len;
+    long long tries = (long long) wanted * MAX_TRIES_FACTOR;
+
+    while (pickCount < wanted && tries > 0) {
+        // Jump around until there's enough, then drop any record that got
+        // picked twice and go again for the ones that are missing.
+        for (; pickCount < wanted && tries > 0; tries--) {
+            const char *from = data + randomBelow(len);
+            // The first record doesn't have anything before it to land in.
+            const char *start = (from == data) ? data : findRecordStart(data, end, from, delim, quoted);
+            if (start == NULL || start >= end) {
+                continue;
+            }
+
+            const char *recordEnd = findRecordEnd(start, end, quoted);
+            size_t recordLen = recordEnd - start;
+            if (recordLen > 0 && start[recordLen - 1] == '\r') {
+                // Because DOS line endings.
+                recordLen--;
+            }
+
+            if (setPick(picks + pickCount, start, recordLen, start - data) != CSVH_SAMPLE__OK) {
+                return CSVH_SAMPLE__OUT_OF_MEMORY;
+            }
+            pickCount++;
+        }
+
+        qsort(picks, pickCount, sizeof(struct pick), comparePicks);
+
+        int kept = 0;
+        for (int i = 0; i < pickCount; i++) {
+            if (kept > 0 && picks[kept - 1].order == picks[i].order) {
+                free(picks[i].record);
+                picks[i].record = NULL;
+                continue;
+            }
+            picks[kept++] = picks[i];
+        }
+        for (int i = kept; i < pickCount; i++) {
+            picks[i].record = NULL;
+        }
+        pickCount = kept;
+    }
+
+    return CSVH_SAMPLE__OK;
+}
+
+/**
+ * Done adding.  Put the picks back in the order they were in the input.
+ */
+char csvh_sample_finish()
+{
+    qsort(picks, pickCount, sizeof(struct pick), comparePicks);
+    servedInd = 0;
+
+    return CSVH_SAMPLE__OK;
+}
+
+/**
+ * Get the next picked record.  It belongs to this module, and stays good
+ * until csvh_sample_close.
+ *
+ * @param   record
+ * @param   recordLen
+ */
+char csvh_sample_next(const char **record, size_t *recordLen)
+{
+    if (servedInd >= pickCount) {
+        return CSVH_SAMPLE__DONE;
+    }
+
+    *record = picks[servedInd].record;
+    *recordLen = picks[servedInd].len;
+    servedInd++;
+
+    return CSVH_SAMPLE__OK;
+}
+
+/**
+ * Close out everything.
+ */
+char csvh_sample_close()
+{
+    for (int i = 0; picks != NULL && i < pickCount; i++) {
+        free(picks[i].record);
+    }
+    free(picks);
+    picks = NULL;
+    pickCount = 0;
+    wanted = 0;
+    seen = 0;
+    servedInd = 0;
+
+    return CSVH_SAMPLE__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Copy a record into a pick, replacing whatever was there.
+ *
+ * @param   dest
+ * @param   record
+ * @param   recordLen
+ * @param   order
+ */
+static char setPick(struct pick *dest, const char *record, size_t recordLen, long long order)
+{
+    char *copy = malloc(sizeof(char) * (recordLen + 1));
+    if (copy == NULL) {
+        return CSVH_SAMPLE__OUT_OF_MEMORY;
+    }
+    memcpy(copy, record, recordLen);
+    copy[recordLen] = '\0';
+
+    free(dest->record);
+    dest->record = copy;
+    dest->len = recordLen;
+    dest->order = order;
+
+    return CSVH_SAMPLE__OK;
+}
+
+/**
+ * Find the start of the first record after a random spot in the data, or NULL
+ * if there isn't one.
+ *
+ * There's no telling whether the spot is inside quotes, so this goes forward
+ * with two guesses at once: that it's outside of quotes, and that it's
+ * inside.  Each one flips at every quote, and each one keeps the first line
+ * break it thinks is outside of quotes.  A guess is ruled out by a quote that
+ * can't be where it is if the guess is right: a quote that opens a value has
+ * to come right after a delimiter or a line break, and one that closes it has
+ * to come right before one (or before another quote, which makes it an
+ * escaped quote).  Whichever guess is left standing wins.  If neither gets
+ * ruled out for a while, it's almost certainly outside of quotes.
+ *
+ * Without quoting, it's just the next line.
+ *
+ * @param   data    Start of the data, for looking behind.
+ * @param   end
+ * @param   from
+ * @param   delim
+ * @param   quoted
+ */
+static const char *findRecordStart(const char *data, const char *end, const char *from, char delim, char quoted)
+{
+    char inQuote[2] = {0, 1};
+    char alive[2] = {1, 1};
+    char skipNext[2] = {0, 0};
+    const char *found[2] = {NULL, NULL};
+    int linesAfter = 0;
+
+    const char *limit = !quoted ? from : (end - from > RESYNC_WINDOW) ? from + RESYNC_WINDOW : end;
+
+    for (const char *c = from; c < limit; c++) {
+        for (int h = 0; h < 2; h++) {
+            if (!alive[h]) {
+                continue;
+            }
+            if (skipNext[h]) {
+                skipNext[h] = 0;
+                continue;
+            }
+
+            if (*c == '"') {
+                if (inQuote[h]) {
+                    char next = (c + 1 < end) ? c[1] : '\n';
+                    if (next == '"') {
+                        skipNext[h] = 1;
+                    } else if (next == delim || next == '\n' || next == '\r') {
+                        inQuote[h] = 0;
+                    } else {
+                        alive[h] = 0;
+                    }
+                } else {
+                    char prev = (c > data) ? c[-1] : '\n';
+                    if (prev == delim || prev == '\n') {
+                        inQuote[h] = 1;
+                    } else {
+                        alive[h] = 0;
+                    }
+                }
+            } else if (*c == '\n' && !inQuote[h]) {
+                if (found[h] == NULL) {
+                    found[h] = c + 1;
+                } else if (h == 0) {
+                    linesAfter++;
+                }
+            }
+        }
+
+        if (!alive[0] && !alive[1]) {
+            // Not proper CSV around here, so just go with the next line.
+            break;
+        }
+        if (!alive[1] && found[0] != NULL) {
+            return found[0];
+        }
+        if (!alive[0] && found[1] != NULL) {
+            return found[1];
+        }
+        if (found[0] != NULL && linesAfter >= RESYNC_CONFIRM_LINES) {
+            return found[0];
+        }
+    }
+
+    if (alive[0] && found[0] != NULL) {
+        return found[0];
+    }
+    if (alive[1] && found[1] != NULL) {
+        return found[1];
+    }
+
+    const char *nl = memchr(from, '\n', end - from);
+    return (nl == NULL) ? NULL : nl + 1;
+}
+
+/**
+ * Find the end of the record starting at start (the line break after it, or
+ * the end of the data).
+ *
+ * @param   start
+ * @param   end
+ * @param   quoted
+ */
+static const char *findRecordEnd(const char *start, const char *end, char quoted)
+{
+    if (!quoted) {
+        const char *nl = memchr(start, '\n', end - start);
+        return (nl == NULL) ? end : nl;
+    }
+
+    char inQuote = 0;
+
+    for (const char *c = start; c < end; c++) {
+        if (*c == '"') {
+            inQuote = !inQuote;
+        } else if (*c == '\n' && !inQuote) {
+            return c;
+        }
+    }
+
+    return end;
+}
+
+/**
+ * Get the next random number.
+ */
+static uint64_t nextRandom()
+{
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+
+    return rngState * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * Get a random number from 0 up to (but not including) bound, without
+ * favoring the small ones.
+ *
+ * @param   bound
+ */
+static uint64_t randomBelow(uint64_t bound)
+{
+    uint64_t threshold = -bound % bound;
+    uint64_t r;
+
+    do {
+        r = nextRandom();
+    } while (r < threshold);
+
+    return r % bound;
+}
+
+/**
+ * Compare picks by where they were in the input, for qsort.
+ *
+ * @param   a
+ * @param   b
+ */
+static int comparePicks(const void *a, const void *b)
+{
+    long long orderA = ((const struct pick *) a)->order;
+    long long orderB = ((const struct pick *) b)->order;
+
+    return (orderA > orderB) - (orderA < orderB);
+}
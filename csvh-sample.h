@@ -0,0 +1,25 @@
+#ifndef csvh_sample_h
+#define csvh_sample_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_SAMPLE__OK                 0
+#define CSVH_SAMPLE__DONE               1
+#define CSVH_SAMPLE__OUT_OF_MEMORY      2
+#define CSVH_SAMPLE__TOO_SMALL          3
+
+char csvh_sample_init(int n, unsigned long long seed);
+
+char csvh_sample_add(const char *record, size_t recordLen);
+
+char csvh_sample_seek(const char *data, size_t len, char delim, char quoted);
+
+char csvh_sample_finish();
+
+char csvh_sample_next(const char **record, size_t *recordLen);
+
+char csvh_sample_close();
+
+#endif
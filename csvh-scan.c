@@ -0,0 +1,358 @@
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "csvh-scan.h"
+
+// Helper module for byte scanning.  Nothing in here knows anything about CSV;
+// it's just the loops that are hot enough to be worth vectorizing.
+
+// Forward declarations for static functions.
+
+static const char *findMemchr(const char *hay, size_t hayLen, const char *needle, size_t needleLen);
+
+// END forward declarations.
+
+/**
+ * Find the first occurrence of needle in hay.  Returns NULL if there isn't one.
+ *
+ * With SSE2 this compares the first and last byte of the needle against 16
+ * positions at a time and only runs memcmp on the positions where both match,
+ * which is what makes it fast on data where the needle is rare.  Otherwise,
+ * it's memchr for the first byte and memcmp for the rest.
+ *
+ * @param   hay
+ * @param   hayLen
+ * @param   needle
+ * @param   needleLen
+ */
+const char *csvh_scan_find(const char *hay, size_t hayLen, const char *needle, size_t needleLen)
+{
+    if (needleLen == 0) {
+        return hay;
+    }
+
+    if (needleLen > hayLen) {
+        return NULL;
+    }
+
+    if (needleLen == 1) {
+        return memchr(hay, needle[0], hayLen);
+    }
+
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needleLen - 1]);
+    size_t i = 0;
+
+    // Last position where a whole 16-byte block of candidates can be checked
+    // without reading past the end of hay.
+    for (; i + needleLen - 1 + 16 <= hayLen; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i *)(hay + i + needleLen - 1));
+
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_and_si128(
+                _mm_cmpeq_epi8(blockFirst, first),
+                _mm_cmpeq_epi8(blockLast, last)
+            )
+        );
+
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, needleLen - 2) == 0) {
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    // Whatever's left over is shorter than a block.
+    return findMemchr(hay + i, hayLen - i, needle, needleLen);
+#else
+    return findMemchr(hay, hayLen, needle, needleLen);
+#endif
+}
+
+/**
+ * Find where the bytes pick up after the count-th separator that isn't
+ * between quote bytes.  (Quotes just flip between inside and outside, so a
+ * doubled-up quote works out the same.)  Returns NULL if there aren't that
+ * many separators.
+ *
+ * @param   bytes
+ * @param   len
+ * @param   sep
+ * @param   quote
+ * @param   count
+ */
+const char *csvh_scan_skip_unquoted(const char *bytes, size_t len, char sep, char quote, int count)
+{
+    char inQuote = 0;
+
+    return csvh_scan_skip_unquoted_from(bytes, len, sep, quote, &count, &inQuote);
+}
+
+/**
+ * Same as csvh_scan_skip_unquoted, but for going through something a piece at
+ * a time: count gets the separators found taken off of it, and inQuote says
+ * whether the bytes start inside quotes, and gets set to whether they end
+ * inside them.  Returns NULL if count didn't get down to 0, in which case the
+ * next piece can pick up where this one left off.
+ *
+ * With SSE2 this looks at 16 bytes at a time, and a block without any quotes
+ * in it just gets its separators counted, so skipping a lot of short fields
+ * (or lines) costs next to nothing.
+ *
+ * @param   bytes
+ * @param   len
+ * @param   sep
+ * @param   quote
+ * @param   count
+ * @param   inQuote
+ */
+const char *csvh_scan_skip_unquoted_from(const char *bytes, size_t len, char sep, char quote, int *count, char *inQuote)
+{
+    if (*count <= 0) {
+        return bytes;
+    }
+
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i sepVec = _mm_set1_epi8(sep);
+    const __m128i quoteVec = _mm_set1_epi8(quote);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(bytes + i));
+        unsigned int quotes = _mm_movemask_epi8(_mm_cmpeq_epi8(block, quoteVec));
+        unsigned int seps = _mm_movemask_epi8(_mm_cmpeq_epi8(block, sepVec));
+
+        if (quotes == 0) {
+            if (*inQuote) {
+                continue;
+            }
+            int found = __builtin_popcount(seps);
+            if (found < *count) {
+                *count -= found;
+                continue;
+            }
+            // It's in this block, so drop the ones before it.
+            for (; *count > 1; (*count)--) {
+                seps &= seps - 1;
+            }
+            *count = 0;
+            return bytes + i + __builtin_ctz(seps) + 1;
+        }
+
+        // Go through the quotes and separators in order.
+        for (unsigned int both = quotes | seps; both != 0; both &= both - 1) {
+            int bit = __builtin_ctz(both);
+            if (quotes & (1u << bit)) {
+                *inQuote = !*inQuote;
+            } else if (!*inQuote && --(*count) == 0) {
+                return bytes + i + bit + 1;
+            }
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (bytes[i] == quote) {
+            *inQuote = !*inQuote;
+        } else if (bytes[i] == sep && !*inQuote && --(*count) == 0) {
+            return bytes + i + 1;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Same as csvh_scan_skip_unquoted, but for bytes without any quoting, so
+ * every separator counts.
+ *
+ * @param   bytes
+ * @param   len
+ * @param   sep
+ * @param   count
+ */
+const char *csvh_scan_skip(const char *bytes, size_t len, char sep, int count)
+{
+    return csvh_scan_skip_from(bytes, len, sep, &count);
+}
+
+/**
+ * Same as csvh_scan_skip_unquoted_from, but for bytes without any quoting, so
+ * there's no quote state to carry over, just the count.
+ *
+ * With SSE2, it's the same as a block without quotes there: the separators
+ * in each 16 bytes just get counted, until the block with the one that's
+ * wanted.
+ *
+ * @param   bytes
+ * @param   len
+ * @param   sep
+ * @param   count
+ */
+const char *csvh_scan_skip_from(const char *bytes, size_t len, char sep, int *count)
+{
+    if (*count <= 0) {
+        return bytes;
+    }
+
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i sepVec = _mm_set1_epi8(sep);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(bytes + i));
+        unsigned int seps = _mm_movemask_epi8(_mm_cmpeq_epi8(block, sepVec));
+
+        int found = __builtin_popcount(seps);
+        if (found < *count) {
+            *count -= found;
+            continue;
+        }
+        for (; *count > 1; (*count)--) {
+            seps &= seps - 1;
+        }
+        *count = 0;
+        return bytes + i + __builtin_ctz(seps) + 1;
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (bytes[i] == sep && --(*count) == 0) {
+            return bytes + i + 1;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Get how many bytes at the start are plain ASCII (i.e., the high bit isn't
+ * set).  Returns len if they all are.
+ *
+ * With SSE2, the high bits of 16 bytes come out of a single instruction, so
+ * this is about as cheap as it gets.
+ *
+ * @param   bytes
+ * @param   len
+ */
+size_t csvh_scan_ascii_prefix(const char *bytes, size_t len)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        unsigned int high = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(bytes + i)));
+        if (high != 0) {
+            return i + __builtin_ctz(high);
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        if ((unsigned char) bytes[i] >= 0x80) {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+
+/**
+ * Get how many bytes at the start are none of the passed special bytes (at
+ * most 4 of them), and, if controls is set, aren't control characters
+ * (i.e., below a space) either.  Returns len if none are.  This is what
+ * escaping uses to find how much it can just copy.
+ *
+ * With SSE2, each block of 16 bytes is compared against every special byte
+ * at once, and a block without any of them costs a few instructions.
+ *
+ * @param   bytes
+ * @param   len
+ * @param   specials
+ * @param   specialCount
+ * @param   controls
+ */
+size_t csvh_scan_plain_prefix(const char *bytes, size_t len, const char *specials, int specialCount, char controls)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128i specialVecs[4];
+    for (int j = 0; j < specialCount && j < 4; j++) {
+        specialVecs[j] = _mm_set1_epi8(specials[j]);
+    }
+    const __m128i lastControl = _mm_set1_epi8(0x1f);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(bytes + i));
+        __m128i hits = _mm_setzero_si128();
+
+        for (int j = 0; j < specialCount && j < 4; j++) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, specialVecs[j]));
+        }
+        if (controls) {
+            // Unsigned, a byte is at most 0x1f exactly when the larger of it
+            // and 0x1f is 0x1f.
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(_mm_max_epu8(block, lastControl), lastControl));
+        }
+
+        unsigned int mask = _mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (controls && (unsigned char) bytes[i] < 0x20) {
+            return i;
+        }
+        for (int j = 0; j < specialCount && j < 4; j++) {
+            if (bytes[i] == specials[j]) {
+                return i;
+            }
+        }
+    }
+
+    return len;
+}
+
+// Static functions below this line.
+
+/**
+ * Find needle by looking for its first byte with memchr and checking the rest
+ * with memcmp.  Used for the tail end of the SIMD search and for everything
+ * when SIMD isn't available.  Needs no setup, which matters since the tail is
+ * all there is for short lines, and this runs once per line.
+ *
+ * @param   hay
+ * @param   hayLen
+ * @param   needle
+ * @param   needleLen
+ */
+static const char *findMemchr(const char *hay, size_t hayLen, const char *needle, size_t needleLen)
+{
+    if (needleLen > hayLen) {
+        return NULL;
+    }
+
+    const char *end = hay + hayLen - needleLen + 1; // Last place it could start, plus one.
+
+    for (const char *at = hay; at < end && (at = memchr(at, needle[0], end - at)) != NULL; at++) {
+        if (memcmp(at + 1, needle + 1, needleLen - 1) == 0) {
+            return at;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef csvh_scan_h
+#define csvh_scan_h
+
+#include <stddef.h>
+
+// Byte-scanning primitives shared by the csv-handler modules.  These use SSE2
+// where the compiler offers it and fall back to plain loops elsewhere.
+
+const char *csvh_scan_find(const char *hay, size_t hayLen, const char *needle, size_t needleLen);
+
+const char *csvh_scan_skip_unquoted(const char *bytes, size_t len, char sep, char quote, int count);
+
+const char *csvh_scan_skip_unquoted_from(const char *bytes, size_t len, char sep, char quote, int *count, char *inQuote);
+
+const char *csvh_scan_skip(const char *bytes, size_t len, char sep, int count);
+
+const char *csvh_scan_skip_from(const char *bytes, size_t len, char sep, int *count);
+
+size_t csvh_scan_ascii_prefix(const char *bytes, size_t len);
+
+size_t csvh_scan_plain_prefix(const char *bytes, size_t len, const char *specials, int specialCount, char controls);
+
+#endif
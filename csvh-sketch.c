@@ -0,0 +1,518 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "csvh-sketch.h"
+
+// This is a helper module for csv-handler.c.
+
+// Answers questions about a column that would normally need every different
+// value kept in memory, in a fixed amount of memory instead, at the cost of
+// the answers being estimates.
+
+// Distinct counts use HyperLogLog: each value's hash picks a register and the
+// register keeps the most leading zeros seen in the rest of the hash.  Lots of
+// different values means somebody's going to get a lot of zeros.  It's 16K
+// one-byte registers no matter how big the input is, and the estimate is
+// usually within a percent or two.
+
+// Top values use Space-Saving: keep counters for a fixed number of values.  A
+// value that doesn't have one takes over the counter with the smallest count,
+// and starts from that count (which is remembered as its error, since it might
+// not have been seen that many times).  Anything that really is common ends
+// up with a counter, and its count is never under the real one by more than
+// the error.
+
+/**
+ * Bits of the hash that pick the HyperLogLog register.
+ */
+#define HLL_PRECISION 14
+
+/**
+ * Counters to keep for each value asked for, for top values.  More counters
+ * means better counts for the ones near the bottom of the list.
+ */
+#define TOP_K_FACTOR 10
+
+/**
+ * Fewest and most counters to keep, for top values.
+ */
+#define TOP_K_MIN_COUNTERS 1000
+#define TOP_K_MAX_COUNTERS 100000
+
+/**
+ * A value being counted, for top values.  The counters are kept as a heap with
+ * the smallest count on top, so the one to take over is always right there.
+ */
+struct counter {
+    char *value;
+    size_t len;
+    uint64_t hash;
+    long long count;
+    long long error;
+    size_t slot; // Where it is in the hash table.
+};
+
+// Forward declarations for static functions.
+
+static void addDistinct(uint64_t hash);
+
+static char addTopK(const char *value, size_t len, uint64_t hash);
+
+static void removeSlot(size_t slot);
+
+static size_t findSlot(const char *value, size_t len, uint64_t hash);
+
+static void siftDown(int ind);
+
+static void siftUp(int ind);
+
+static void swapCounters(int a, int b);
+
+static int compareServed(const void *a, const void *b);
+
+static uint64_t hashValue(const char *value, size_t len);
+
+// END forward declarations.
+
+/**
+ * HyperLogLog registers.  NULL if not counting distinct values.
+ */
+static uint8_t *registers = NULL;
+
+/**
+ * Number of top values to hand out.  0 if not finding top values.
+ */
+static int topK = 0;
+
+/**
+ * Counters, as a heap, and how many there's room for.
+ */
+static struct counter *heap = NULL;
+static int heapCount = 0;
+static int capacity = 0;
+
+/**
+ * Hash table from value to where its counter is in the heap (-1 for empty).
+ * Always has a power of two slots.
+ */
+static int *slots = NULL;
+static size_t slotCount = 0;
+
+/**
+ * Counters in the order they get handed out, and the next one.
+ */
+static struct counter **served = NULL;
+static int servedCount = 0;
+static int servedInd = 0;
+
+/**
+ * Start counting distinct values.
+ */
+char csvh_sketch_init_distinct()
+{
+    registers = calloc((size_t) 1 << HLL_PRECISION, sizeof(uint8_t));
+    if (registers == NULL) {
+        return CSVH_SKETCH__OUT_OF_MEMORY;
+    }
+
+    return CSVH_SKETCH__OK;
+}
+
+/**
+ * Start finding the k most common values.
+ *
+ * @param   k
+ */
+char csvh_sketch_init_top_k(int k)
+{
+    topK = (k < 1) ? 1 : k;
+
+    if (topK > TOP_K_MAX_COUNTERS / TOP_K_FACTOR) {
+        capacity = TOP_K_MAX_COUNTERS;
+    } else if (topK * TOP_K_FACTOR < TOP_K_MIN_COUNTERS) {
+        capacity = TOP_K_MIN_COUNTERS;
+    } else {
+        capacity = topK * TOP_K_FACTOR;
+    }
+    if (topK > capacity) {
+        topK = capacity;
+    }
+
+    // At most half full.
+    for (slotCount = 1; slotCount < (size_t) capacity * 2; slotCount *= 2) {}
+
+    heap = malloc(sizeof(struct counter) * capacity);
+    slots = malloc(sizeof(int) * slotCount);
+    if (heap == NULL || slots == NULL) {
+        return CSVH_SKETCH__OUT_OF_MEMORY;
+    }
+    memset(slots, -1, sizeof(int) * slotCount);
+
+    return CSVH_SKETCH__OK;
+}
+
+/**
+ * Count a value.
+ *
+ * @param   value
+ * @param   len
+ */
+char csvh_sketch_add(const char *value, size_t len)
+{
+    uint64_t hash = hashValue(value, len);
+
+    if (registers != NULL) {
+        addDistinct(hash);
+    }
+
+    if (heap != NULL) {
+        return addTopK(value, len, hash);
+    }
+
+    return CSVH_SKETCH__OK;
+}
+
+/**
+ * Get the estimated number of distinct values.
+ */
+long long csvh_sketch_distinct_estimate()
+{
+    if (registers == NULL) {
+        return 0;
+    }
+
+    double m = (double) ((size_t) 1 << HLL_PRECISION);
+    double sum = 0;
+    int zeros = 0;
+
+    for (size_t i = 0; i < ((size_t) 1 << HLL_PRECISION); i++) {
+        sum += ldexp(1.0, -registers[i]);
+        zeros += (registers[i] == 0);
+    }
+
+    double estimate = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+
+    if (estimate <= 2.5 * m && zeros > 0) {
+        // Not many values, so most registers are still empty, and counting
+        // those is more accurate.
+        estimate = m * log(m / zeros);
+    }
+
+    return llround(estimate);
+}
+
+/**
+ * Done counting.  Get the top values ready to hand out.
+ */
+char csvh_sketch_finish()
+{
+    if (heap == NULL) {
+        return CSVH_SKETCH__OK;
+    }
+
+    served = malloc(sizeof(struct counter *) * (heapCount + 1));
+    if (served == NULL) {
+        return CSVH_SKETCH__OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; i < heapCount; i++) {
+        served[i] = heap + i;
+    }
+    qsort(served, heapCount, sizeof(struct counter *), compareServed);
+
+    servedCount = (heapCount < topK) ? heapCount : topK;
+    servedInd = 0;
+
+    return CSVH_SKETCH__OK;
+}
+
+/**
+ * Get the next top value, most common first.  The count can be more than the
+ * real count, but by no more than the error.  The value is good until close.
+ *
+ * @param   value
+ * @param   count
+ * @param   error
+ */
+char csvh_sketch_next(const char **value, long long *count, long long *error)
+{
+    if (servedInd >= servedCount) {
+        return CSVH_SKETCH__DONE;
+    }
+
+    struct counter *c = served[servedInd++];
+    *value = c->value;
+    *count = c->count;
+    *error = c->error;
+
+    return CSVH_SKETCH__OK;
+}
+
+/**
+ * Close out everything.
+ */
+char csvh_sketch_close()
+{
+    free(registers);
+    registers = NULL;
+
+    for (int i = 0; i < heapCount; i++) {
+        free(heap[i].value);
+    }
+    free(heap);
+    heap = NULL;
+    heapCount = 0;
+    capacity = 0;
+    topK = 0;
+
+    free(slots);
+    slots = NULL;
+    slotCount = 0;
+
+    free(served);
+    served = NULL;
+    servedCount = 0;
+    servedInd = 0;
+
+    return CSVH_SKETCH__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Count a value towards the distinct count.
+ *
+ * @param   hash
+ */
+static void addDistinct(uint64_t hash)
+{
+    size_t ind = hash >> (64 - HLL_PRECISION);
+
+    // The rest of the bits, with a 1 at the end so there's always one to find.
+    uint64_t rest = (hash << HLL_PRECISION) | ((uint64_t) 1 << (HLL_PRECISION - 1));
+    uint8_t rank = __builtin_clzll(rest) + 1;
+
+    if (rank > registers[ind]) {
+        registers[ind] = rank;
+    }
+}
+
+/**
+ * Count a value towards the top values.
+ *
+ * @param   value
+ * @param   len
+ * @param   hash
+ */
+static char addTopK(const char *value, size_t len, uint64_t hash)
+{
+    size_t slot = findSlot(value, len, hash);
+
+    if (slots[slot] != -1) {
+        int ind = slots[slot];
+        heap[ind].count++;
+        siftDown(ind);
+        return CSVH_SKETCH__OK;
+    }
+
+    char *copy = malloc(sizeof(char) * (len + 1));
+    if (copy == NULL) {
+        return CSVH_SKETCH__OUT_OF_MEMORY;
+    }
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+
+    if (heapCount < capacity) {
+        struct counter *c = heap + heapCount;
+        c->value = copy;
+        c->len = len;
+        c->hash = hash;
+        c->count = 1;
+        c->error = 0;
+        c->slot = slot;
+        slots[slot] = heapCount;
+        siftUp(heapCount++);
+        return CSVH_SKETCH__OK;
+    }
+
+    // Full, so take over the counter with the smallest count.
+    struct counter *c = heap;
+    removeSlot(c->slot);
+    free(c->value);
+
+    c->value = copy;
+    c->len = len;
+    c->hash = hash;
+    c->error = c->count;
+    c->count++;
+
+    // Removing the old value may have moved things around.
+    c->slot = findSlot(value, len, hash);
+    slots[c->slot] = 0;
+
+    siftDown(0);
+
+    return CSVH_SKETCH__OK;
+}
+
+/**
+ * Empty a hash table slot, and move up anything after it that was pushed past
+ * its spot, so that lookups still find it.
+ *
+ * @param   slot
+ */
+static void removeSlot(size_t slot)
+{
+    size_t mask = slotCount - 1;
+    size_t hole = slot;
+    size_t next = slot;
+
+    slots[hole] = -1;
+
+    while (1) {
+        next = (next + 1) & mask;
+        if (slots[next] == -1) {
+            return;
+        }
+
+        size_t home = heap[slots[next]].hash & mask;
+
+        // Can it move back to the hole without going before its home?
+        char canMove = (hole <= next)
+            ? (home <= hole || home > next)
+            : (home <= hole && home > next);
+
+        if (canMove) {
+            slots[hole] = slots[next];
+            heap[slots[hole]].slot = hole;
+            slots[next] = -1;
+            hole = next;
+        }
+    }
+}
+
+/**
+ * Find the hash table slot of a value, or the empty slot where it would go.
+ *
+ * @param   value
+ * @param   len
+ * @param   hash
+ */
+static size_t findSlot(const char *value, size_t len, uint64_t hash)
+{
+    size_t mask = slotCount - 1;
+    size_t slot = hash & mask;
+
+    while (slots[slot] != -1) {
+        struct counter *c = heap + slots[slot];
+        if (c->hash == hash && c->len == len && memcmp(c->value, value, len) == 0) {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+/**
+ * Move a counter down the heap until it's in the right place.
+ *
+ * @param   ind
+ */
+static void siftDown(int ind)
+{
+    while (1) {
+        int smallest = ind;
+        int left = ind * 2 + 1;
+        int right = left + 1;
+
+        if (left < heapCount && heap[left].count < heap[smallest].count) {
+            smallest = left;
+        }
+        if (right < heapCount && heap[right].count < heap[smallest].count) {
+            smallest = right;
+        }
+        if (smallest == ind) {
+            return;
+        }
+
+        swapCounters(ind, smallest);
+        ind = smallest;
+    }
+}
+
+/**
+ * Move a counter up the heap until it's in the right place.
+ *
+ * @param   ind
+ */
+static void siftUp(int ind)
+{
+    while (ind > 0 && heap[(ind - 1) / 2].count > heap[ind].count) {
+        swapCounters(ind, (ind - 1) / 2);
+        ind = (ind - 1) / 2;
+    }
+}
+
+/**
+ * Swap two counters in the heap, keeping the hash table pointing at them.
+ *
+ * @param   a
+ * @param   b
+ */
+static void swapCounters(int a, int b)
+{
+    struct counter temp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = temp;
+
+    slots[heap[a].slot] = a;
+    slots[heap[b].slot] = b;
+}
+
+/**
+ * Compare counters for handing out: highest count first, then by value, for
+ * qsort.
+ *
+ * @param   a
+ * @param   b
+ */
+static int compareServed(const void *a, const void *b)
+{
+    const struct counter *ca = *(struct counter * const *) a;
+    const struct counter *cb = *(struct counter * const *) b;
+
+    if (ca->count != cb->count) {
+        return (ca->count < cb->count) ? 1 : -1;
+    }
+
+    return strcmp(ca->value, cb->value);
+}
+
+/**
+ * FNV-1a hash of a value, with the bits mixed up some more at the end, since
+ * HyperLogLog needs every bit to be as good as every other.
+ *
+ * @param   value
+ * @param   len
+ */
+static uint64_t hashValue(const char *value, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) value[i];
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
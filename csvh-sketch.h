@@ -0,0 +1,26 @@
+#ifndef csvh_sketch_h
+#define csvh_sketch_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_SKETCH__OK                 0
+#define CSVH_SKETCH__DONE               1
+#define CSVH_SKETCH__OUT_OF_MEMORY      2
+
+char csvh_sketch_init_distinct();
+
+char csvh_sketch_init_top_k(int k);
+
+char csvh_sketch_add(const char *value, size_t len);
+
+long long csvh_sketch_distinct_estimate();
+
+char csvh_sketch_finish();
+
+char csvh_sketch_next(const char **value, long long *count, long long *error);
+
+char csvh_sketch_close();
+
+#endif
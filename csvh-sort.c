@@ -0,0 +1,574 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "csvh-sort.h"
+
+// This is a helper module for csv-handler.c.
+
+// Sorts records by a key.  Everything gets added, then finished, then read
+// back out in order.  Entries are kept in memory until they go over the memory
+// budget, at which point they're sorted and spilled to a temp file as a
+// "run".  When finished, if anything was spilled, the runs get merged back
+// together as they're read out.
+
+// Records can be passed in either as bytes (which get copied) or as just an
+// offset into the input (which is all that's kept), for when the input is
+// mapped and the caller can get the bytes back out whenever it wants.
+
+/**
+ * Size of each block of memory holding keys and records.
+ */
+#define ARENA_BLOCK_SIZE 1048576
+
+/**
+ * A single record to be sorted.
+ */
+struct sortEntry {
+    double num; // Key as number, if sorting numerically.
+    char *key; // Key as bytes, if not sorting numerically.
+    size_t keyLen;
+    char *record; // NULL if only keeping the offset.
+    size_t recordLen;
+    long long offset;
+    int lineNum;
+};
+
+/**
+ * A run that's been spilled to a temp file, and the entry from it that's
+ * currently up for merging.
+ */
+struct sortRun {
+    FILE *file;
+    struct sortEntry cur;
+    size_t keyCap;
+    size_t recordCap;
+};
+
+// Forward declarations for static functions.
+
+static int compareEntries(const struct sortEntry *a, const struct sortEntry *b);
+
+static int compareEntriesQsort(const void *a, const void *b);
+
+static char *arenaCopy(const char *src, size_t len);
+
+static void arenaReset();
+
+static char spillRun();
+
+static char readRunEntry(struct sortRun *run);
+
+static void heapDown(int ind);
+
+static int compareHeap(int a, int b);
+
+// END forward declarations.
+
+/**
+ * Sort by number, as opposed to bytes.
+ */
+static char numeric = 0;
+
+/**
+ * Sort in descending order.
+ */
+static char descending = 0;
+
+/**
+ * How many bytes of entries to hold in memory before spilling a run.
+ */
+static size_t memBudget = 0;
+
+/**
+ * Bytes currently used by entries in memory.
+ */
+static size_t memUsed = 0;
+
+/**
+ * Entries held in memory.
+ */
+static struct sortEntry *entries = NULL;
+static size_t entryCount = 0;
+static size_t entryCap = 0;
+
+/**
+ * Blocks of memory holding keys and records of the entries in memory.  The
+ * last one is the one being filled.
+ */
+static char **arenaBlocks = NULL;
+static int arenaBlockCount = 0;
+static size_t arenaBlockUsed = 0;
+
+/**
+ * Runs spilled to temp files.
+ */
+static struct sortRun *runs = NULL;
+static int runCount = 0;
+
+/**
+ * Heap of indexes into runs, with the run whose current entry comes first on
+ * top.
+ */
+static int *heap = NULL;
+static int heapCount = 0;
+
+/**
+ * Run that the last entry handed out came from, which needs to move on to its
+ * next entry before the next one is handed out.  -1 if none.
+ */
+static int lastRun = -1;
+
+/**
+ * Index of next entry to hand out, when everything fit in memory.
+ */
+static size_t serveInd = 0;
+
+/**
+ * Initialize.
+ *
+ * @param   numericIn
+ * @param   descendingIn
+ * @param   memBudgetIn     In bytes.
+ */
+char csvh_sort_init(char numericIn, char descendingIn, size_t memBudgetIn)
+{
+    numeric = numericIn;
+    descending = descendingIn;
+    memBudget = memBudgetIn;
+
+    return CSVH_SORT__OK;
+}
+
+/**
+ * Add a record.  If record is NULL, only the offset is kept, and that's all
+ * that will come back out.
+ *
+ * @param   key
+ * @param   keyLen
+ * @param   lineNum
+ * @param   record
+ * @param   recordLen
+ * @param   offset
+ */
+char csvh_sort_add(const char *key, size_t keyLen, int lineNum, const char *record, size_t recordLen, long long offset)
+{
+    if (entryCount == entryCap) {
+        size_t newCap = (entryCap == 0) ? 1024 : entryCap * 2;
+        struct sortEntry *newEntries = realloc(entries, sizeof(struct sortEntry) * newCap);
+        if (newEntries == NULL) {
+            return CSVH_SORT__OUT_OF_MEMORY;
+        }
+        entries = newEntries;
+        entryCap = newCap;
+    }
+
+    struct sortEntry *entry = &entries[entryCount];
+
+    entry->lineNum = lineNum;
+    entry->offset = offset;
+    entry->recordLen = recordLen;
+    entry->record = NULL;
+    entry->key = NULL;
+    entry->keyLen = 0;
+    entry->num = NAN;
+
+    if (numeric) {
+        // Need it null-terminated for strtod.  Anything too long for this
+        // isn't a sensible number anyway.
+        char numStr[64];
+        size_t numLen = (keyLen < sizeof(numStr) - 1) ? keyLen : sizeof(numStr) - 1;
+        memcpy(numStr, key, numLen);
+        numStr[numLen] = '\0';
+
+        char *eptr;
+        double num = strtod(numStr, &eptr);
+        if (eptr != numStr) {
+            // Otherwise, it's not a number and stays NaN, which sorts last.
+            entry->num = num;
+        }
+    } else {
+        if ((entry->key = arenaCopy(key, keyLen)) == NULL) {
+            return CSVH_SORT__OUT_OF_MEMORY;
+        }
+        entry->keyLen = keyLen;
+    }
+
+    if (record != NULL && (entry->record = arenaCopy(record, recordLen)) == NULL) {
+        return CSVH_SORT__OUT_OF_MEMORY;
+    }
+
+    entryCount++;
+    memUsed += sizeof(struct sortEntry) + entry->keyLen + (record != NULL ? recordLen : 0);
+
+    if (memUsed > memBudget) {
+        return spillRun();
+    }
+
+    return CSVH_SORT__OK;
+}
+
+/**
+ * Done adding records, so get ready to read them back out.
+ */
+char csvh_sort_finish()
+{
+    if (runCount == 0) {
+        // Everything fit in memory, so just sort it and be done.
+        qsort(entries, entryCount, sizeof(struct sortEntry), compareEntriesQsort);
+        serveInd = 0;
+        return CSVH_SORT__OK;
+    }
+
+    char rc;
+    if (entryCount > 0 && (rc = spillRun()) != CSVH_SORT__OK) {
+        return rc;
+    }
+
+    heap = malloc(sizeof(int) * runCount);
+    if (heap == NULL) {
+        return CSVH_SORT__OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; i < runCount; i++) {
+        rewind(runs[i].file);
+        if ((rc = readRunEntry(&runs[i])) == CSVH_SORT__OK) {
+            heap[heapCount++] = i;
+        } else if (rc != CSVH_SORT__DONE) {
+            return rc;
+        }
+    }
+
+    for (int i = heapCount / 2 - 1; i >= 0; i--) {
+        heapDown(i);
+    }
+
+    return CSVH_SORT__OK;
+}
+
+/**
+ * Get next record in sorted order.  If it was added with only an offset,
+ * record will be NULL.  Good until the next call.
+ *
+ * @param   record
+ * @param   recordLen
+ * @param   offset
+ * @param   lineNum
+ */
+char csvh_sort_next(const char **record, size_t *recordLen, long long *offset, int *lineNum)
+{
+    struct sortEntry *entry;
+
+    if (runCount == 0) {
+        if (serveInd == entryCount) {
+            return CSVH_SORT__DONE;
+        }
+        entry = &entries[serveInd++];
+    } else {
+        if (lastRun != -1) {
+            // Move the run that was used last time on to its next entry.
+            char rc = readRunEntry(&runs[lastRun]);
+            if (rc == CSVH_SORT__DONE) {
+                heap[0] = heap[--heapCount];
+            } else if (rc != CSVH_SORT__OK) {
+                return rc;
+            }
+            heapDown(0);
+            lastRun = -1;
+        }
+
+        if (heapCount == 0) {
+            return CSVH_SORT__DONE;
+        }
+
+        lastRun = heap[0];
+        entry = &runs[lastRun].cur;
+    }
+
+    *record = entry->record;
+    *recordLen = entry->recordLen;
+    *offset = entry->offset;
+    *lineNum = entry->lineNum;
+
+    return CSVH_SORT__OK;
+}
+
+/**
+ * Close out everything.
+ */
+char csvh_sort_close()
+{
+    arenaReset();
+    free(arenaBlocks);
+    arenaBlocks = NULL;
+
+    free(entries);
+    entries = NULL;
+    entryCount = 0;
+    entryCap = 0;
+
+    for (int i = 0; i < runCount; i++) {
+        fclose(runs[i].file); // Temp files go away on their own.
+        free(runs[i].cur.key);
+        free(runs[i].cur.record);
+    }
+    free(runs);
+    runs = NULL;
+    runCount = 0;
+
+    free(heap);
+    heap = NULL;
+    heapCount = 0;
+    lastRun = -1;
+
+    return CSVH_SORT__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Compare two entries.  Non-numbers sort after numbers either way, and ties go
+ * to whichever came first in the input, so the sort is stable.
+ *
+ * @param   a
+ * @param   b
+ */
+static int compareEntries(const struct sortEntry *a, const struct sortEntry *b)
+{
+    int res = 0;
+
+    if (numeric) {
+        char aNan = isnan(a->num);
+        char bNan = isnan(b->num);
+        if (aNan || bNan) {
+            res = aNan - bNan;
+            if (res != 0) {
+                return res;
+            }
+        } else {
+            res = (a->num > b->num) - (a->num < b->num);
+        }
+    } else {
+        size_t minLen = (a->keyLen < b->keyLen) ? a->keyLen : b->keyLen;
+        res = memcmp(a->key, b->key, minLen);
+        if (res == 0) {
+            res = (a->keyLen > b->keyLen) - (a->keyLen < b->keyLen);
+        }
+    }
+
+    if (res != 0) {
+        return descending ? -res : res;
+    }
+
+    return (a->lineNum > b->lineNum) - (a->lineNum < b->lineNum);
+}
+
+/**
+ * Wrapper for compareEntries to pass to qsort.
+ *
+ * @param   a
+ * @param   b
+ */
+static int compareEntriesQsort(const void *a, const void *b)
+{
+    return compareEntries(a, b);
+}
+
+/**
+ * Copy bytes into the arena.
+ *
+ * @param   src
+ * @param   len
+ */
+static char *arenaCopy(const char *src, size_t len)
+{
+    if (arenaBlockCount == 0 || arenaBlockUsed + len > ARENA_BLOCK_SIZE) {
+        // Need a new block.  Anything bigger than a block gets a block all
+        // to itself.
+        size_t blockSize = (len > ARENA_BLOCK_SIZE) ? len : ARENA_BLOCK_SIZE;
+        char **newBlocks = realloc(arenaBlocks, sizeof(char *) * (arenaBlockCount + 1));
+        if (newBlocks == NULL) {
+            return NULL;
+        }
+        arenaBlocks = newBlocks;
+
+        if ((arenaBlocks[arenaBlockCount] = malloc(sizeof(char) * blockSize)) == NULL) {
+            return NULL;
+        }
+        arenaBlockCount++;
+        arenaBlockUsed = 0;
+    }
+
+    char *dest = arenaBlocks[arenaBlockCount - 1] + arenaBlockUsed;
+    memcpy(dest, src, len);
+    arenaBlockUsed += len;
+
+    if (len > ARENA_BLOCK_SIZE) {
+        // Don't try to put anything else in an oversized block.
+        arenaBlockUsed = ARENA_BLOCK_SIZE;
+    }
+
+    return dest;
+}
+
+/**
+ * Free everything in the arena.
+ */
+static void arenaReset()
+{
+    for (int i = 0; i < arenaBlockCount; i++) {
+        free(arenaBlocks[i]);
+    }
+    arenaBlockCount = 0;
+    arenaBlockUsed = 0;
+}
+
+/**
+ * Sort the entries in memory and write them out to a new run.
+ */
+static char spillRun()
+{
+    struct sortRun *newRuns = realloc(runs, sizeof(struct sortRun) * (runCount + 1));
+    if (newRuns == NULL) {
+        return CSVH_SORT__OUT_OF_MEMORY;
+    }
+    runs = newRuns;
+
+    struct sortRun *run = &runs[runCount];
+    memset(run, 0, sizeof(struct sortRun));
+
+    if ((run->file = tmpfile()) == NULL) {
+        return CSVH_SORT__IO_ERROR;
+    }
+    runCount++;
+
+    qsort(entries, entryCount, sizeof(struct sortEntry), compareEntriesQsort);
+
+    for (size_t i = 0; i < entryCount; i++) {
+        struct sortEntry *entry = &entries[i];
+        char hasRecord = (entry->record != NULL);
+
+        if (
+            fwrite(&entry->num, sizeof(double), 1, run->file) != 1
+            || fwrite(&entry->keyLen, sizeof(size_t), 1, run->file) != 1
+            || fwrite(&entry->recordLen, sizeof(size_t), 1, run->file) != 1
+            || fwrite(&entry->offset, sizeof(long long), 1, run->file) != 1
+            || fwrite(&entry->lineNum, sizeof(int), 1, run->file) != 1
+            || fwrite(&hasRecord, sizeof(char), 1, run->file) != 1
+            || fwrite(entry->key, sizeof(char), entry->keyLen, run->file) != entry->keyLen
+            || (hasRecord && fwrite(entry->record, sizeof(char), entry->recordLen, run->file) != entry->recordLen)
+        ) {
+            return CSVH_SORT__IO_ERROR;
+        }
+    }
+
+    entryCount = 0;
+    memUsed = 0;
+    arenaReset();
+
+    return CSVH_SORT__OK;
+}
+
+/**
+ * Read the next entry of a run into its current entry.
+ *
+ * @param   run
+ */
+static char readRunEntry(struct sortRun *run)
+{
+    struct sortEntry *entry = &run->cur;
+    char hasRecord;
+
+    if (fread(&entry->num, sizeof(double), 1, run->file) != 1) {
+        return feof(run->file) ? CSVH_SORT__DONE : CSVH_SORT__IO_ERROR;
+    }
+
+    if (
+        fread(&entry->keyLen, sizeof(size_t), 1, run->file) != 1
+        || fread(&entry->recordLen, sizeof(size_t), 1, run->file) != 1
+        || fread(&entry->offset, sizeof(long long), 1, run->file) != 1
+        || fread(&entry->lineNum, sizeof(int), 1, run->file) != 1
+        || fread(&hasRecord, sizeof(char), 1, run->file) != 1
+    ) {
+        return CSVH_SORT__IO_ERROR;
+    }
+
+    if (entry->keyLen > run->keyCap) {
+        char *newKey = realloc(entry->key, sizeof(char) * entry->keyLen);
+        if (newKey == NULL) {
+            return CSVH_SORT__OUT_OF_MEMORY;
+        }
+        entry->key = newKey;
+        run->keyCap = entry->keyLen;
+    }
+
+    if (fread(entry->key, sizeof(char), entry->keyLen, run->file) != entry->keyLen) {
+        return CSVH_SORT__IO_ERROR;
+    }
+
+    if (!hasRecord) {
+        // Keep the buffer around for later, but don't hand it out.
+        free(entry->record);
+        entry->record = NULL;
+        run->recordCap = 0;
+        return CSVH_SORT__OK;
+    }
+
+    if (entry->recordLen > run->recordCap || entry->record == NULL) {
+        char *newRecord = realloc(entry->record, sizeof(char) * (entry->recordLen + 1));
+        if (newRecord == NULL) {
+            return CSVH_SORT__OUT_OF_MEMORY;
+        }
+        entry->record = newRecord;
+        run->recordCap = entry->recordLen;
+    }
+
+    if (fread(entry->record, sizeof(char), entry->recordLen, run->file) != entry->recordLen) {
+        return CSVH_SORT__IO_ERROR;
+    }
+
+    return CSVH_SORT__OK;
+}
+
+/**
+ * Move the run at the passed heap position down until the heap is in order
+ * again.
+ *
+ * @param   ind
+ */
+static void heapDown(int ind)
+{
+    while (1) {
+        int smallest = ind;
+        int left = 2 * ind + 1;
+        int right = left + 1;
+
+        if (left < heapCount && compareHeap(left, smallest) < 0) {
+            smallest = left;
+        }
+        if (right < heapCount && compareHeap(right, smallest) < 0) {
+            smallest = right;
+        }
+        if (smallest == ind) {
+            return;
+        }
+
+        int dum = heap[ind];
+        heap[ind] = heap[smallest];
+        heap[smallest] = dum;
+        ind = smallest;
+    }
+}
+
+/**
+ * Compare the current entries of the runs at two heap positions.
+ *
+ * @param   a
+ * @param   b
+ */
+static int compareHeap(int a, int b)
+{
+    return compareEntries(&runs[heap[a]].cur, &runs[heap[b]].cur);
+}
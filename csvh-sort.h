@@ -0,0 +1,23 @@
+#ifndef csvh_sort_h
+#define csvh_sort_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_SORT__OK                   0
+#define CSVH_SORT__DONE                 1
+#define CSVH_SORT__OUT_OF_MEMORY        2
+#define CSVH_SORT__IO_ERROR             3
+
+char csvh_sort_init(char numericIn, char descendingIn, size_t memBudgetIn);
+
+char csvh_sort_add(const char *key, size_t keyLen, int lineNum, const char *record, size_t recordLen, long long offset);
+
+char csvh_sort_finish();
+
+char csvh_sort_next(const char **record, size_t *recordLen, long long *offset, int *lineNum);
+
+char csvh_sort_close();
+
+#endif
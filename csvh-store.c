@@ -0,0 +1,464 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "csvh-dict.h"
+
+#include "csvh-store.h"
+
+// This is a helper module for csv-handler.c.
+
+// Holds rows in memory, for output that needs everything at once (i.e.,
+// transposed).  It's kept by column.  Every column starts out dictionary
+// encoded (see csvh-dict.c): each row has a code instead of a string, and the
+// codes are as small as they can be (8 bits for up to 256 different values,
+// then 16, then 32).  If a column turns out to have too many different values
+// for that to be worth it (like IDs or names), it gets switched over to just
+// keeping the strings.
+
+/**
+ * Size of each block of memory holding strings of plain columns.  Anything
+ * bigger gets its own block.
+ */
+#define ARENA_BLOCK_SIZE 1048576
+
+/**
+ * A single column.  Either dict is set and codes has a code for every row, or
+ * dict is NULL and values has a string for every row.  Strings go by their
+ * null terminator, unless one of them has a null in it, and then lens gets
+ * made, with the length of every one.
+ */
+struct storeColumn {
+    struct csvhDict *dict;
+    void *codes;
+    char codeWidth; // In bytes.
+    const char **values;
+    size_t *lens;
+};
+
+// Forward declarations for static functions.
+
+static char addValue(struct storeColumn *col, const char *value, size_t len);
+
+static char setPlainValue(struct storeColumn *col, int row, const char *value, size_t len);
+
+static char widenCodes(struct storeColumn *col, char newWidth);
+
+static char makePlain(struct storeColumn *col);
+
+static int getCode(struct storeColumn *col, int row);
+
+static char growRows();
+
+static char growColumns(int newCount);
+
+static char *arenaCopy(const char *src, size_t len);
+
+// END forward declarations.
+
+/**
+ * Columns.
+ */
+static struct storeColumn *columns = NULL;
+static int columnCount = 0;
+
+/**
+ * Number of fields each row has.
+ */
+static int *fieldCounts = NULL;
+
+/**
+ * Rows so far, and how many there's room for in every column.
+ */
+static int rowCount = 0;
+static int rowCap = 0;
+
+/**
+ * Blocks of memory holding strings of plain columns.
+ */
+static char **arenaBlocks = NULL;
+static int arenaBlockCount = 0;
+static size_t arenaBlockUsed = 0;
+
+/**
+ * Add a row, as a NULL-terminated array of strings, which get copied, and
+ * their lengths.
+ *
+ * @param   fields
+ * @param   lens
+ */
+char csvh_store_add_row(char **fields, size_t *lens)
+{
+    int fieldCount = 0;
+    for (; fields[fieldCount] != NULL; fieldCount++) {}
+
+    if (rowCount == rowCap && growRows() != CSVH_STORE__OK) {
+        return CSVH_STORE__OUT_OF_MEMORY;
+    }
+
+    if (fieldCount > columnCount && growColumns(fieldCount) != CSVH_STORE__OK) {
+        return CSVH_STORE__OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; i < columnCount; i++) {
+        // Columns that the row doesn't have still get a placeholder, so that
+        // every column has something for every row.
+        if (
+            addValue(
+                columns + i,
+                (i < fieldCount) ? fields[i] : "",
+                (i < fieldCount) ? lens[i] : 0
+            ) != CSVH_STORE__OK
+        ) {
+            return CSVH_STORE__OUT_OF_MEMORY;
+        }
+    }
+
+    fieldCounts[rowCount++] = fieldCount;
+
+    return CSVH_STORE__OK;
+}
+
+/**
+ * Get the number of rows.
+ */
+int csvh_store_row_count()
+{
+    return rowCount;
+}
+
+/**
+ * Get a value, and its length, if len isn't NULL.  Returns NULL if the row
+ * doesn't have that column.
+ *
+ * @param   row
+ * @param   col
+ * @param   len
+ */
+const char *csvh_store_get(int row, int col, size_t *len)
+{
+    if (row < 0 || row >= rowCount || col < 0 || col >= fieldCounts[row]) {
+        return NULL;
+    }
+
+    if (columns[col].dict != NULL) {
+        return csvh_dict_value(columns[col].dict, getCode(columns + col, row), len);
+    }
+
+    const char *value = columns[col].values[row];
+    if (len != NULL) {
+        *len = (columns[col].lens == NULL) ? strlen(value) : columns[col].lens[row];
+    }
+
+    return value;
+}
+
+/**
+ * Close out everything.
+ */
+char csvh_store_close()
+{
+    for (int i = 0; i < columnCount; i++) {
+        csvh_dict_free(columns[i].dict);
+        free(columns[i].codes);
+        free(columns[i].values);
+        free(columns[i].lens);
+    }
+    free(columns);
+    columns = NULL;
+    columnCount = 0;
+
+    free(fieldCounts);
+    fieldCounts = NULL;
+    rowCount = 0;
+    rowCap = 0;
+
+    for (int i = 0; i < arenaBlockCount; i++) {
+        free(arenaBlocks[i]);
+    }
+    free(arenaBlocks);
+    arenaBlocks = NULL;
+    arenaBlockCount = 0;
+    arenaBlockUsed = 0;
+
+    return CSVH_STORE__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Add the value for the next row (rowCount) to a column.
+ *
+ * @param   col
+ * @param   value
+ * @param   len
+ */
+static char addValue(struct storeColumn *col, const char *value, size_t len)
+{
+    if (col->dict == NULL) {
+        return setPlainValue(col, rowCount, value, len);
+    }
+
+    int code = csvh_dict_intern(col->dict, value, len);
+    if (code == -1) {
+        return CSVH_STORE__OUT_OF_MEMORY;
+    }
+
+    if (code > UINT16_MAX && col->codeWidth < 4) {
+        if (widenCodes(col, 4) != CSVH_STORE__OK) {
+            return CSVH_STORE__OUT_OF_MEMORY;
+        }
+    } else if (code > UINT8_MAX && col->codeWidth < 2) {
+        if (widenCodes(col, 2) != CSVH_STORE__OK) {
+            return CSVH_STORE__OUT_OF_MEMORY;
+        }
+    }
+
+    switch (col->codeWidth) {
+        case 1:
+            ((uint8_t *) col->codes)[rowCount] = code;
+            break;
+        case 2:
+            ((uint16_t *) col->codes)[rowCount] = code;
+            break;
+        default:
+            ((uint32_t *) col->codes)[rowCount] = code;
+            break;
+    }
+
+    if (!csvh_dict_is_low_cardinality(col->dict, rowCount + 1)) {
+        // Not worth it for this column.
+        return makePlain(col);
+    }
+
+    return CSVH_STORE__OK;
+}
+
+/**
+ * Make the codes of a column wider.
+ *
+ * @param   col
+ * @param   newWidth
+ */
+static char widenCodes(struct storeColumn *col, char newWidth)
+{
+    void *newCodes = malloc(newWidth * (size_t) rowCap);
+    if (newCodes == NULL) {
+        return CSVH_STORE__OUT_OF_MEMORY;
+    }
+
+    // Only up to rowCount, since the current row hasn't been set yet.
+    for (int i = 0; i < rowCount; i++) {
+        int code = getCode(col, i);
+        if (newWidth == 2) {
+            ((uint16_t *) newCodes)[i] = code;
+        } else {
+            ((uint32_t *) newCodes)[i] = code;
+        }
+    }
+
+    free(col->codes);
+    col->codes = newCodes;
+    col->codeWidth = newWidth;
+
+    return CSVH_STORE__OK;
+}
+
+/**
+ * Switch a column from codes to plain strings, including the current row.
+ *
+ * @param   col
+ */
+static char makePlain(struct storeColumn *col)
+{
+    col->values = malloc(sizeof(char *) * rowCap);
+    if (col->values == NULL) {
+        return CSVH_STORE__OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; i <= rowCount; i++) {
+        size_t len;
+        const char *value = csvh_dict_value(col->dict, getCode(col, i), &len);
+        if (setPlainValue(col, i, value, len) != CSVH_STORE__OK) {
+            return CSVH_STORE__OUT_OF_MEMORY;
+        }
+    }
+
+    csvh_dict_free(col->dict);
+    col->dict = NULL;
+    free(col->codes);
+    col->codes = NULL;
+
+    return CSVH_STORE__OK;
+}
+
+/**
+ * Copy a value into a row of a plain column.  The first one with a null in it
+ * is when the column starts keeping lengths.
+ *
+ * @param   col
+ * @param   row
+ * @param   value
+ * @param   len
+ */
+static char setPlainValue(struct storeColumn *col, int row, const char *value, size_t len)
+{
+    if ((col->values[row] = arenaCopy(value, len)) == NULL) {
+        return CSVH_STORE__OUT_OF_MEMORY;
+    }
+
+    if (col->lens == NULL && memchr(value, '\0', len) != NULL) {
+        if ((col->lens = malloc(sizeof(size_t) * rowCap)) == NULL) {
+            return CSVH_STORE__OUT_OF_MEMORY;
+        }
+        for (int i = 0; i < row; i++) {
+            col->lens[i] = strlen(col->values[i]);
+        }
+    }
+
+    if (col->lens != NULL) {
+        col->lens[row] = len;
+    }
+
+    return CSVH_STORE__OK;
+}
+
+/**
+ * Get the code of a row in a column.
+ *
+ * @param   col
+ * @param   row
+ */
+static int getCode(struct storeColumn *col, int row)
+{
+    switch (col->codeWidth) {
+        case 1:
+            return ((uint8_t *) col->codes)[row];
+        case 2:
+            return ((uint16_t *) col->codes)[row];
+    }
+
+    return ((uint32_t *) col->codes)[row];
+}
+
+/**
+ * Make room for more rows in every column.
+ */
+static char growRows()
+{
+    int newCap = (rowCap == 0) ? 1024 : rowCap * 2;
+
+    int *newCounts = realloc(fieldCounts, sizeof(int) * newCap);
+    if (newCounts == NULL) {
+        return CSVH_STORE__OUT_OF_MEMORY;
+    }
+    fieldCounts = newCounts;
+
+    for (int i = 0; i < columnCount; i++) {
+        if (columns[i].dict == NULL) {
+            const char **newValues = realloc(columns[i].values, sizeof(char *) * newCap);
+            if (newValues == NULL) {
+                return CSVH_STORE__OUT_OF_MEMORY;
+            }
+            columns[i].values = newValues;
+            if (columns[i].lens != NULL) {
+                size_t *newLens = realloc(columns[i].lens, sizeof(size_t) * newCap);
+                if (newLens == NULL) {
+                    return CSVH_STORE__OUT_OF_MEMORY;
+                }
+                columns[i].lens = newLens;
+            }
+        } else {
+            void *newCodes = realloc(columns[i].codes, columns[i].codeWidth * (size_t) newCap);
+            if (newCodes == NULL) {
+                return CSVH_STORE__OUT_OF_MEMORY;
+            }
+            columns[i].codes = newCodes;
+        }
+    }
+
+    rowCap = newCap;
+
+    return CSVH_STORE__OK;
+}
+
+/**
+ * Add columns, when a row comes along with more fields than any before it.
+ * Rows before it get empty strings in the new columns (not that anybody will
+ * ask for them).
+ *
+ * @param   newCount
+ */
+static char growColumns(int newCount)
+{
+    struct storeColumn *newColumns = realloc(columns, sizeof(struct storeColumn) * newCount);
+    if (newColumns == NULL) {
+        return CSVH_STORE__OUT_OF_MEMORY;
+    }
+    columns = newColumns;
+
+    for (; columnCount < newCount; columnCount++) {
+        struct storeColumn *col = columns + columnCount;
+        col->values = NULL;
+        col->lens = NULL;
+        col->codeWidth = 1;
+        col->dict = csvh_dict_new();
+        col->codes = calloc(rowCap, 1); // Code 0 is the empty string.
+        if (
+            col->dict == NULL
+            || col->codes == NULL
+            || csvh_dict_intern(col->dict, "", 0) != 0
+        ) {
+            columnCount++; // So that it gets freed.
+            return CSVH_STORE__OUT_OF_MEMORY;
+        }
+    }
+
+    return CSVH_STORE__OK;
+}
+
+/**
+ * Copy a string into the arena, with a null terminator after it.
+ *
+ * @param   src
+ * @param   len
+ */
+static char *arenaCopy(const char *src, size_t len)
+{
+    size_t need = len + 1;
+
+    if (need > ARENA_BLOCK_SIZE || arenaBlockCount == 0 || arenaBlockUsed + need > ARENA_BLOCK_SIZE) {
+        char **newBlocks = realloc(arenaBlocks, sizeof(char *) * (arenaBlockCount + 1));
+        if (newBlocks == NULL) {
+            return NULL;
+        }
+        arenaBlocks = newBlocks;
+
+        size_t blockSize = (need > ARENA_BLOCK_SIZE) ? need : ARENA_BLOCK_SIZE;
+        char *block = malloc(blockSize);
+        if (block == NULL) {
+            return NULL;
+        }
+
+        if (need > ARENA_BLOCK_SIZE && arenaBlockCount > 0) {
+            // Big one gets its own block, but keep filling the one before it.
+            arenaBlocks[arenaBlockCount] = arenaBlocks[arenaBlockCount - 1];
+            arenaBlocks[arenaBlockCount - 1] = block;
+            arenaBlockCount++;
+            memcpy(block, src, len);
+            block[len] = '\0';
+            return block;
+        }
+
+        arenaBlocks[arenaBlockCount++] = block;
+        arenaBlockUsed = 0;
+    }
+
+    char *dest = arenaBlocks[arenaBlockCount - 1] + arenaBlockUsed;
+    memcpy(dest, src, len);
+    dest[len] = '\0';
+    arenaBlockUsed += need;
+
+    return dest;
+}
@@ -0,0 +1,19 @@
+#ifndef csvh_store_h
+#define csvh_store_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_STORE__OK                  0
+#define CSVH_STORE__OUT_OF_MEMORY       1
+
+char csvh_store_add_row(char **fields, size_t *lens);
+
+int csvh_store_row_count();
+
+const char *csvh_store_get(int row, int col, size_t *len);
+
+char csvh_store_close();
+
+#endif
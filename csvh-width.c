@@ -0,0 +1,232 @@
+#include <stddef.h>
+
+#include "csvh-scan.h"
+#include "csvh-width.h"
+
+// This is a helper module for csv-handler.c.
+
+// Works out how many terminal columns text takes up, so that boxed output
+// lines up when there's more than ASCII in it.  A byte isn't a column: a
+// character can be up to four bytes, Chinese, Japanese and Korean characters
+// (and most emoji) take up two columns, and accents that get put on top of the
+// character before them take up none.
+//
+// This doesn't try to be everything wcwidth() is, since that depends on the
+// locale and the terminal anyway.  The tables are the ranges that come up in
+// real data.  Bytes that aren't valid UTF-8 count as one column each, since
+// that's about what a terminal shows for them.
+
+/**
+ * A range of code points, first to last.
+ */
+struct range {
+    unsigned int first;
+    unsigned int last;
+};
+
+/**
+ * Code points that don't take up a column of their own (combining marks,
+ * zero-width spaces and joiners, variation selectors, skin tones).  Sorted,
+ * for searching.
+ */
+static const struct range zeroWidth[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF},
+    {0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A},
+    {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4},
+    {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A},
+    {0x0E47, 0x0E4E}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F},
+    {0x202A, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0x302A, 0x302D},
+    {0x3099, 0x309A}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF},
+    {0x1F3FB, 0x1F3FF}, {0xE0000, 0xE007F}, {0xE0100, 0xE01EF},
+};
+
+/**
+ * Code points that take up two columns (East Asian wide and full-width
+ * characters, and emoji).  Sorted, for searching.
+ */
+static const struct range doubleWidth[] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+    {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+    {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+    {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+    {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+    {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+    {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x303E},
+    {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+    {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19},
+    {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4},
+    {0x17000, 0x18CFF}, {0x1B000, 0x1B2FF}, {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF},
+    {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F251}, {0x1F300, 0x1F64F},
+    {0x1F680, 0x1F6FF}, {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F9FF}, {0x1FA70, 0x1FAFF},
+    {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
+
+// Forward declarations for static functions.
+
+static size_t decode(const unsigned char *bytes, size_t len, unsigned int *codePoint);
+
+static int codePointWidth(unsigned int codePoint);
+
+static char inRanges(unsigned int codePoint, const struct range *ranges, int count);
+
+// END forward declarations.
+
+/**
+ * Get how many bytes at the start of str fit in maxCols columns, without
+ * cutting a character in half.  cols gets how many columns those bytes
+ * actually take up, which can be one short of maxCols if the next character
+ * is a wide one.  Anything that takes up no columns right after the last
+ * character that fits (i.e., an accent on it) stays with it.
+ *
+ * Plain ASCII is one column per byte, so it gets checked for first, all at
+ * once (see csvh-scan.c), and most of the time that's all there is to it.
+ *
+ * @param   str
+ * @param   len
+ * @param   maxCols
+ * @param   cols
+ */
+size_t csvh_width_fit(const char *str, size_t len, int maxCols, int *cols)
+{
+    if (maxCols < 0) {
+        maxCols = 0;
+    }
+
+    // A byte past the last one that fits can't be part of a character that
+    // fits, but it can be an accent on it, so look at one more than that.
+    size_t firstLook = (len < (size_t) maxCols) ? len : (size_t) maxCols;
+    size_t ascii = csvh_scan_ascii_prefix(str, firstLook);
+    if (ascii == firstLook && (firstLook == len || (unsigned char) str[firstLook] < 0x80)) {
+        *cols = (int) firstLook;
+        return firstLook;
+    }
+
+    size_t i = ascii;
+    int used = (int) ascii;
+
+    while (i < len) {
+        unsigned int codePoint;
+        size_t charLen = decode((const unsigned char *) str + i, len - i, &codePoint);
+        int charCols = (charLen == 0) ? 1 : codePointWidth(codePoint);
+
+        if (used + charCols > maxCols) {
+            break;
+        }
+
+        used += charCols;
+        i += (charLen == 0) ? 1 : charLen;
+    }
+
+    *cols = used;
+
+    return i;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Decode the UTF-8 character at the start of bytes.  Returns how many bytes it
+ * is, or 0 if it isn't valid (cut off, overlong, a surrogate, or too big).
+ *
+ * @param   bytes
+ * @param   len
+ * @param   codePoint
+ */
+static size_t decode(const unsigned char *bytes, size_t len, unsigned int *codePoint)
+{
+    unsigned char lead = bytes[0];
+    size_t charLen;
+    unsigned int min;
+
+    if (lead < 0x80) {
+        *codePoint = lead;
+        return 1;
+    } else if (lead >= 0xC2 && lead <= 0xDF) {
+        charLen = 2;
+        *codePoint = lead & 0x1F;
+        min = 0x80;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        charLen = 3;
+        *codePoint = lead & 0x0F;
+        min = 0x800;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        charLen = 4;
+        *codePoint = lead & 0x07;
+        min = 0x10000;
+    } else {
+        return 0;
+    }
+
+    if (charLen > len) {
+        return 0;
+    }
+
+    for (size_t i = 1; i < charLen; i++) {
+        if ((bytes[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+        *codePoint = (*codePoint << 6) | (bytes[i] & 0x3F);
+    }
+
+    if (
+        *codePoint < min
+        || *codePoint > 0x10FFFF
+        || (*codePoint >= 0xD800 && *codePoint <= 0xDFFF)
+    ) {
+        return 0;
+    }
+
+    return charLen;
+}
+
+/**
+ * Get how many columns a code point takes up.
+ *
+ * @param   codePoint
+ */
+static int codePointWidth(unsigned int codePoint)
+{
+    if (codePoint < 0x300) {
+        // Nothing down here is anything but one column.
+        return 1;
+    }
+
+    // Zero-width first, since skin tones are in the middle of the emoji.
+    if (inRanges(codePoint, zeroWidth, sizeof(zeroWidth) / sizeof(zeroWidth[0]))) {
+        return 0;
+    }
+    if (inRanges(codePoint, doubleWidth, sizeof(doubleWidth) / sizeof(doubleWidth[0]))) {
+        return 2;
+    }
+
+    return 1;
+}
+
+/**
+ * Determine if a code point is in any of a sorted list of ranges.
+ *
+ * @param   codePoint
+ * @param   ranges
+ * @param   count
+ */
+static char inRanges(unsigned int codePoint, const struct range *ranges, int count)
+{
+    int low = 0;
+    int high = count - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (codePoint < ranges[mid].first) {
+            high = mid - 1;
+        } else if (codePoint > ranges[mid].last) {
+            low = mid + 1;
+        } else {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef csvh_width_h
+#define csvh_width_h
+
+#include <stddef.h>
+
+// Display widths of UTF-8 text, in terminal columns.
+
+size_t csvh_width_fit(const char *str, size_t len, int maxCols, int *cols);
+
+#endif
@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "csv-handler.h"
 
@@ -16,6 +18,16 @@ int argcG;
 
 char **argvG;
 
+/**
+ * Output waiting to be written, for the formats that build it up themselves
+ * instead of going through printf.  It gets written out in one go whenever
+ * there's at least OUT_FLUSH_SIZE of it, and the buffer gets reused.
+ */
+char *outBuff = NULL;
+size_t outLen = 0;
+size_t outCap = 0;
+#define OUT_FLUSH_SIZE 65536
+
 // START forward declarations for helper functions.
 
 char normalPrint();
@@ -26,14 +38,34 @@ char verticalPrint();
 
 char rawPrint();
 
+char rawPassThroughPrint();
+
+char jsonPrint();
+
+char tsvPrint();
+
+char bufferedLinePrint(char (*appendLine)(char **, size_t *, size_t *), char includeCurrent);
+
 void printError(char rc);
 
+void printBadRecords();
+
 char printHeaders();
 
 char *getPassedOption(char in, char pos);
 
 char isFlagSet(char in);
 
+char *getPassedLongOption(char *name, char pos);
+
+char isLongFlagSet(char *name);
+
+char **getPassedLongOptionList(char *name, int *count);
+
+char appendOutput(const char *str, size_t len);
+
+char flushOutput();
+
 // END forward declarations for helper functions.
 
 int main(int argc, char **argv)
@@ -52,13 +84,68 @@ int main(int argc, char **argv)
     if (isFlagSet('d')) {
         csv_handler_set_delim(getPassedOption('d', 1)[0]);
     }
+    if (isFlagSet('q')) {
+        // Double quotes are the default, so "none" is the only other thing
+        // that means anything.
+        char *quote = getPassedOption('q', 1);
+        if (strcmp(quote, "none") != 0 && strcmp(quote, "\"") != 0) {
+            printError(CSV_HANDLER__INVALID_INPUT);
+            return CSV_HANDLER__INVALID_INPUT;
+        }
+        csv_handler_set_quoting(quote[0] == '"');
+    }
+
+    // Before anything's read, since reading ahead in the files uses them.
+    if (isLongFlagSet("threads")) {
+        csv_handler_set_threads(atoi(getPassedLongOption("threads", 1)));
+    }
+
+    if (isLongFlagSet("files")) {
+        int fileCount = 0;
+        char **files = getPassedLongOptionList("files", &fileCount);
+        RETURN_ERR_IF_APP(
+            csv_handler_set_files(files, fileCount)
+        )
+        if (isLongFlagSet("file-lines")) {
+            csv_handler_set_lines_per_file();
+        }
+    }
+
+    if (isLongFlagSet("follow")) {
+        if (getPassedOption('o', 1)[0] == 't' || isFlagSet('S') || isLongFlagSet("files")) {
+            // These need the whole file before they can print anything.  (And
+            // files after the first would never get a turn.)
+            printError(CSV_HANDLER__INVALID_INPUT);
+            return CSV_HANDLER__INVALID_INPUT;
+        }
+        RETURN_ERR_IF_APP(csv_handler_set_follow())
+    }
+
+    if (isLongFlagSet("no-mmap")) {
+        RETURN_ERR_IF_APP(csv_handler_set_no_mapping())
+    }
+
+    if (isLongFlagSet("max-record") || isLongFlagSet("bad-records")) {
+        char *policy = getPassedLongOption("bad-records", 1);
+        if (isLongFlagSet("bad-records") && strcmp(policy, "skip") != 0 && strcmp(policy, "stop") != 0) {
+            printError(CSV_HANDLER__INVALID_INPUT);
+            return CSV_HANDLER__INVALID_INPUT;
+        }
+        size_t maxRecord = 0; // Default.
+        if (isLongFlagSet("max-record")) {
+            // In MB, but it can be a fraction of one.
+            maxRecord = atof(getPassedLongOption("max-record", 1)) * 1024 * 1024;
+        }
+        RETURN_ERR_IF_APP(csv_handler_set_bad_records(maxRecord, strcmp(policy, "stop") == 0))
+    }
+
+    if (isLongFlagSet("cache")) {
+        RETURN_ERR_IF_APP(csv_handler_set_cache())
+    }
 
     if (isFlagSet('k')) {
         // I know this letter sucks, but 's' is already used.
-        int skipLines = atoi(getPassedOption('k', 1));
-        for (int i = 0; i < skipLines; i++) {
-            csv_handler_skip_next_line();
-        }
+        csv_handler_skip_lines(atoi(getPassedOption('k', 1)));
     }
 
     if ((rc = csv_handler_read_next_line()) != CSV_HANDLER__OK) {
@@ -71,18 +158,22 @@ int main(int argc, char **argv)
     }
     RETURN_ERR_IF_APP(csv_handler_set_headers_from_line())
 
+    if (csv_handler_duplicate_header() != NULL) {
+        // Not an error, but anything picked by this name might not be the
+        // column that was meant.  Stderr so it doesn't end up in the output.
+        fprintf(
+            stderr,
+            "Warning: Header \"%s\" shows up more than once.  Using the first one.\n",
+            csv_handler_duplicate_header()
+        );
+    }
+
     // If applicable, print headers and exit.
     if (isFlagSet('h')) {
         RETURN_ERR_IF_APP(printHeaders())
         return 0;
     }
 
-    if (isFlagSet('f')) {
-        RETURN_ERR_IF_APP(
-            csv_handler_set_selected_fields(getPassedOption('f', 1))
-        )
-    }
-
     // Set restrictions.
     switch (getPassedOption('r', 1)[0]) {
         case 'l':
@@ -108,11 +199,112 @@ int main(int argc, char **argv)
                 )
             )
             break;
+        case 'c':
+            RETURN_ERR_IF_APP(
+                csv_handler_restrict_by_contains(
+                    getPassedOption('r', 2),
+                    getPassedOption('r', 3)
+                )
+            )
+            break;
+        case 'x':
+            RETURN_ERR_IF_APP(
+                csv_handler_restrict_by_regex(
+                    getPassedOption('r', 2),
+                    getPassedOption('r', 3)
+                )
+            )
+            break;
         // No default.  That just means no restrictions.
     }
 
+    if (isFlagSet('g')) {
+        // The column to add up is optional, so make sure the next thing isn't
+        // another option.
+        char *sumHeader = getPassedOption('g', 2);
+        if (sumHeader != NULL && sumHeader[0] == '-') {
+            sumHeader = NULL;
+        }
+        size_t groupMem = 256; // Megabytes.
+        if (isLongFlagSet("group-mem")) {
+            groupMem = atol(getPassedLongOption("group-mem", 1));
+        }
+        RETURN_ERR_IF_APP(
+            csv_handler_group_by(getPassedOption('g', 1), sumHeader, groupMem * 1024 * 1024)
+        )
+    }
+
+    if (isLongFlagSet("distinct")) {
+        RETURN_ERR_IF_APP(
+            csv_handler_distinct(getPassedLongOption("distinct", 1))
+        )
+    }
+
+    if (isLongFlagSet("topk")) {
+        RETURN_ERR_IF_APP(
+            csv_handler_top_k(
+                getPassedLongOption("topk", 1),
+                atoi(getPassedLongOption("topk", 2))
+            )
+        )
+    }
+
+    if (isFlagSet('p')) {
+        RETURN_ERR_IF_APP(csv_handler_profile())
+    }
+
+    // Fields are picked after grouping, since grouping changes the headers.
+    if (isFlagSet('f')) {
+        RETURN_ERR_IF_APP(
+            csv_handler_set_selected_fields(getPassedOption('f', 1))
+        )
+    }
+
+    if (isLongFlagSet("cols")) {
+        RETURN_ERR_IF_APP(
+            csv_handler_set_column_window(getPassedLongOption("cols", 1))
+        )
+    }
+
+    if (isLongFlagSet("tail")) {
+        RETURN_ERR_IF_APP(
+            csv_handler_set_tail(atoi(getPassedLongOption("tail", 1)))
+        )
+    }
+
+    // After the tail, so that it's a sample of the tail.
+    if (isLongFlagSet("sample")) {
+        unsigned long long seed = 0; // Different every time.
+        if (isLongFlagSet("seed")) {
+            seed = strtoull(getPassedLongOption("seed", 1), NULL, 10);
+        }
+        RETURN_ERR_IF_APP(
+            csv_handler_sample(atoi(getPassedLongOption("sample", 1)), seed)
+        )
+    }
+
+    if (isLongFlagSet("limit")) {
+        csv_handler_set_limit(atoi(getPassedLongOption("limit", 1)));
+    }
+
+    if (isFlagSet('S')) {
+        size_t sortMem = 256; // Megabytes.
+        if (isLongFlagSet("sort-mem")) {
+            sortMem = atol(getPassedLongOption("sort-mem", 1));
+        }
+        RETURN_ERR_IF_APP(
+            csv_handler_set_sort(getPassedOption('S', 1), sortMem * 1024 * 1024)
+        )
+    }
+
     // START Normal format.
-    switch (getPassedOption('o', 1)[0]) {
+    char outputType = getPassedOption('o', 1)[0];
+    if (outputType == '\0' && isFlagSet('p')) {
+        // Profiles read better one column at a time.
+        outputType = 'v';
+    }
+
+    switch (outputType) {
         case 't':
             rc = transposedPrint();
             break;
@@ -122,11 +314,21 @@ int main(int argc, char **argv)
         case 'r':
             rc = rawPrint();
             break;
+        case 'j':
+            rc = jsonPrint();
+            break;
+        case 'T':
+            rc = tsvPrint();
+            break;
         default:
             rc = normalPrint();
             break;
     }
 
+    if (rc != CSV_HANDLER__BAD_RECORD) {
+        // Otherwise, it stopped at the first one instead of skipping it.
+        printBadRecords();
+    }
     csv_handler_close();
 
     return rc;
@@ -174,18 +376,22 @@ char normalPrint() {
         printf("%s\n", outputLine);
     }
 
-    if (rc != CSV_HANDLER__DONE) {
-        printError(rc);
-        return rc;
+    if (rc == CSV_HANDLER__DONE) {
+        printf("%s", borderPadd);
+        printf("%s\n", borderLine);
     }
 
-    printf("%s", borderPadd);
-    printf("%s\n", borderLine);
-
     free(outputLine);
     free(borderLine);
     free(borderPadd);
 
+    if (rc != CSV_HANDLER__DONE) {
+        // Like with a bad file partway through.
+        csv_handler_close();
+        printError(rc);
+        return rc;
+    }
+
     return 0;
 }
 
@@ -230,34 +436,64 @@ char transposedPrint()
  */
 char verticalPrint()
 {
-    char *outputLine = NULL;
+    char *lineNum = NULL;
     char *borderLine = NULL;
     char rc = 0;
     char showLineNums = !isFlagSet('s');
 
     RETURN_ERR_IF_APP(csv_handler_vertical_border_line(&borderLine))
+    size_t borderLen = strlen(borderLine);
 
     while ((rc = csv_handler_read_next_line()) == CSV_HANDLER__OK) {
         if (showLineNums) {
-            RETURN_ERR_IF_APP(csv_handler_output_line_number(&outputLine))
-            printf("%s Line %s %s\n", borderLine, outputLine, borderLine);
+            if ((rc = csv_handler_output_line_number(&lineNum)) != CSV_HANDLER__OK) {
+                break;
+            }
+            rc = appendOutput(borderLine, borderLen)
+                || appendOutput(" Line ", 6)
+                || appendOutput(lineNum, strlen(lineNum))
+                || appendOutput(" ", 1)
+                || appendOutput(borderLine, borderLen)
+                || appendOutput("\n", 1);
         } else {
-            printf("%s%s\n", borderLine,borderLine);
+            rc = appendOutput(borderLine, borderLen)
+                || appendOutput(borderLine, borderLen)
+                || appendOutput("\n", 1);
+        }
+        if (rc) {
+            rc = CSV_HANDLER__OUT_OF_MEMORY;
+            break;
         }
 
-        RETURN_ERR_IF_APP(csv_handler_output_vertical_entry(&outputLine));
-        printf("%s\n", outputLine);
-    }
+        // Goes straight into the output, instead of being copied there.
+        if ((rc = csv_handler_append_vertical_entry(&outBuff, &outLen, &outCap)) != CSV_HANDLER__OK) {
+            break;
+        }
+        if ((rc = appendOutput("\n", 1)) != CSV_HANDLER__OK) {
+            break;
+        }
 
-    if (rc != CSV_HANDLER__DONE) {
-        return rc;
+        if (outLen >= OUT_FLUSH_SIZE) {
+            flushOutput();
+        }
     }
 
+    flushOutput();
+    free(outBuff);
+    outBuff = NULL;
+    outCap = 0;
+
     //printf("%s\n", borderLine); // I think I like it better without the final line.
 
-    free(outputLine);
+    free(lineNum);
     free(borderLine);
 
+    if (rc != CSV_HANDLER__DONE) {
+        csv_handler_close();
+        printError(rc);
+        return rc;
+    }
+
     return 0;
 }
 
@@ -266,24 +502,101 @@ char verticalPrint()
  */
 char rawPrint()
 {
-    char *outputLine = NULL;
+    if (csv_handler_can_pass_through()) {
+        return rawPassThroughPrint();
+    }
+
+    // Starts with the line that's already been read (the headers).  Goes by
+    // length, so nulls in the values come through.
+    return bufferedLinePrint(csv_handler_append_raw_line, 1);
+}
+
+/**
+ * Print raw formatting when every line is output exactly as it was input.
+ */
+char rawPassThroughPrint()
+{
+    const char *record = NULL;
+    size_t recordLen = 0;
     char rc = 0;
 
-    RETURN_ERR_IF_APP(csv_handler_raw_line(&outputLine))
-    printf("%s\n", outputLine);
-    // This is necessary because already read first line!  So can't call
-    // csv_handler_read_next_line again until this one is printed.
+    RETURN_ERR_IF_APP(csv_handler_raw_record(&record, &recordLen))
+    fwrite(record, sizeof(char), recordLen, stdout);
+    putchar('\n');
 
-    while ((rc = csv_handler_read_next_line()) == CSV_HANDLER__OK) {
-        csv_handler_raw_line(&outputLine);
-        printf("%s\n", outputLine);
+    if (csv_handler_can_copy_ranges()) {
+        // Everything else goes straight to the fd, so get what's been printed
+        // so far out of the way first.
+        fflush(stdout);
+        rc = csv_handler_raw_copy_ranges(STDOUT_FILENO);
+    } else {
+        while ((rc = csv_handler_read_next_line()) == CSV_HANDLER__OK) {
+            csv_handler_raw_record(&record, &recordLen);
+            fwrite(record, sizeof(char), recordLen, stdout);
+            putchar('\n');
+        }
     }
 
     if (rc != CSV_HANDLER__DONE) {
+        printError(rc);
         return rc;
     }
 
-    free(outputLine);
+    return 0;
+}
+
+/**
+ * Print JSON Lines, one object per line.  The headers are the keys, so the
+ * header line itself doesn't get printed.
+ */
+char jsonPrint()
+{
+    return bufferedLinePrint(csv_handler_append_json_line, 0);
+}
+
+/**
+ * Print TSV, starting with the headers.
+ */
+char tsvPrint()
+{
+    return bufferedLinePrint(csv_handler_append_tsv_line, 1);
+}
+
+/**
+ * Print every line the way appendLine writes it, one per line, straight into
+ * the output buffer.  The current line (i.e., the headers) only gets printed
+ * if includeCurrent is set.
+ *
+ * @param   appendLine
+ * @param   includeCurrent
+ */
+char bufferedLinePrint(char (*appendLine)(char **, size_t *, size_t *), char includeCurrent)
+{
+    char rc = includeCurrent ? CSV_HANDLER__OK : csv_handler_read_next_line();
+
+    for (; rc == CSV_HANDLER__OK; rc = csv_handler_read_next_line()) {
+        if ((rc = appendLine(&outBuff, &outLen, &outCap)) != CSV_HANDLER__OK) {
+            break;
+        }
+        if ((rc = appendOutput("\n", 1)) != CSV_HANDLER__OK) {
+            break;
+        }
+
+        if (outLen >= OUT_FLUSH_SIZE) {
+            flushOutput();
+        }
+    }
+
+    flushOutput();
+    free(outBuff);
+    outBuff = NULL;
+    outCap = 0;
+
+    if (rc != CSV_HANDLER__DONE) {
+        csv_handler_close();
+        printError(rc);
+        return rc;
+    }
 
     return 0;
 }
@@ -302,7 +615,11 @@ void printError(char rc)
     // module itself.
     switch (rc) {
         case CSV_HANDLER__FILE_NOT_FOUND:
-            printf("Error: File not found.");
+            if (csv_handler_current_file()[0] != '\0') {
+                printf("Error: File not found: %s", csv_handler_current_file());
+            } else {
+                printf("Error: File not found.");
+            }
             break;
         case CSV_HANDLER__DONE:
             printf("Interal error: Done.");
@@ -327,6 +644,33 @@ void printError(char rc)
         case CSV_HANDLER__HEADER_NOT_FOUND:
             printf("Error: A specified header in passed parameters does not exist.");
             break;
+        case CSV_HANDLER__HEADER_MISMATCH:
+            printf(
+                "Error: Headers in %s don't match the first file's.",
+                csv_handler_current_file()
+            );
+            break;
+        case CSV_HANDLER__BAD_RECORD: {
+            long long offset;
+            int lineNum;
+            char *file;
+            if (csv_handler_bad_record(0, &offset, &lineNum, &file) == CSV_HANDLER__OK) {
+                printf("Error: Malformed line %d (at byte %lld", lineNum, offset);
+                if (file != NULL) {
+                    printf(" of %s", file);
+                }
+                printf("): unclosed quote, or longer than --max-record.");
+            } else {
+                printf("Error: Malformed line.");
+            }
+            break;
+        }
+        case CSV_HANDLER__UNSUPPORTED:
+            printf("Error: Not supported on this platform.");
+            break;
+        case CSV_HANDLER__INVALID_SORT_TYPE:
+            printf("Error: Invalid sort type (can be :n, :s, :asc, or :desc).");
+            break;
         case CSV_HANDLER__UNKNOWN_ERROR:
             printf("Unknown error!");
             break;
@@ -334,6 +678,40 @@ void printError(char rc)
     printf("\n");
 }
 
+/**
+ * Tell about any malformed lines that got skipped.  This goes to stderr, since
+ * stdout is the output, which might be going into something else.
+ */
+void printBadRecords()
+{
+    int count = csv_handler_bad_record_count();
+    if (count == 0) {
+        return;
+    }
+
+    fflush(stdout);
+    fprintf(
+        stderr,
+        "Warning: Skipped %d malformed line%s (unclosed quote, or longer than --max-record):\n",
+        count,
+        (count == 1) ? "" : "s"
+    );
+
+    long long offset;
+    int lineNum;
+    char *file;
+    for (int i = 0; csv_handler_bad_record(i, &offset, &lineNum, &file) == CSV_HANDLER__OK; i++) {
+        fprintf(stderr, "    Line %d, at byte %lld", lineNum, offset);
+        if (file != NULL) {
+            fprintf(stderr, " of %s", file);
+        }
+        fprintf(stderr, "\n");
+    }
+    if (count > CSV_HANDLER__BAD_RECORDS_KEPT) {
+        fprintf(stderr, "    And %d more.\n", count - CSV_HANDLER__BAD_RECORDS_KEPT);
+    }
+}
+
 /**
  * Print the headers.
  */
@@ -393,3 +771,111 @@ char isFlagSet(char in)
 
     return 0;
 }
+
+/**
+ * Get an option that was passed from the command line with a long name, like
+ * "--name".  Return "" if DNE.
+ *
+ * @param   name
+ * @param   pos
+ */
+char *getPassedLongOption(char *name, char pos)
+{
+    for (int i = 1; i < argcG - pos; i++) {
+        if (argvG[i][0] == '-' && argvG[i][1] == '-' && strcmp(argvG[i] + 2, name) == 0) {
+            return argvG[i + pos];
+        }
+    }
+
+    return "";
+}
+
+/**
+ * Determine if a flag with a long name is set.
+ *
+ * @param   name
+ */
+char isLongFlagSet(char *name)
+{
+    for (int i = 1; i < argcG; i++) {
+        if (argvG[i][0] == '-' && argvG[i][1] == '-' && strcmp(argvG[i] + 2, name) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Get every argument after an option with a long name, up to the next option
+ * (i.e., a list of files).  NULL if the option isn't there.
+ *
+ * @param   name
+ * @param   count
+ */
+char **getPassedLongOptionList(char *name, int *count)
+{
+    for (int i = 1; i < argcG; i++) {
+        if (argvG[i][0] == '-' && argvG[i][1] == '-' && strcmp(argvG[i] + 2, name) == 0) {
+            *count = 0;
+            while (i + 1 + *count < argcG && argvG[i + 1 + *count][0] != '-') {
+                (*count)++;
+            }
+            return argvG + i + 1;
+        }
+    }
+
+    *count = 0;
+    return NULL;
+}
+
+/**
+ * Add to the output waiting to be written.
+ *
+ * @param   str
+ * @param   len
+ */
+char appendOutput(const char *str, size_t len)
+{
+    if (outLen + len + 1 > outCap) {
+        size_t newCap = (outCap == 0) ? OUT_FLUSH_SIZE * 2 : outCap * 2;
+        if (newCap < outLen + len + 1) {
+            newCap = outLen + len + 1;
+        }
+        char *newBuff = realloc(outBuff, sizeof(char) * newCap);
+        if (newBuff == NULL) {
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        }
+        outBuff = newBuff;
+        outCap = newCap;
+    }
+
+    memcpy(outBuff + outLen, str, len);
+    outLen += len;
+    outBuff[outLen] = '\0';
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Write out everything that's waiting to be.  Anything printf'd before it
+ * goes first.
+ */
+char flushOutput()
+{
+    fflush(stdout);
+
+    size_t written = 0;
+    while (written < outLen) {
+        ssize_t result = write(STDOUT_FILENO, outBuff + written, outLen - written);
+        if (result < 0) {
+            // Probably a closed pipe, so nobody's reading anymore anyway.
+            break;
+        }
+        written += result;
+    }
+
+    outLen = 0;
+
+    return 0;
+}